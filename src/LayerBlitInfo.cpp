@@ -1,12 +1,30 @@
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
 #include "AttributeSet.hpp"
 #include "DisplayDevice.hpp"
 #include "LayerBlitInfo.hpp"
 
+namespace 
+{
+	//grows the area to cover the given vertices. Positions are drawn
+	//as signed shorts.
+	void add_vertices_to_area(const std::vector<tile_corner>& v, int* x1, int* y1, int* x2, int* y2)
+	{
+		for(const tile_corner& c : v) {
+			const int x = static_cast<int16_t>(c.vertex.x);
+			const int y = static_cast<int16_t>(c.vertex.y);
+			*x1 = std::min(*x1, x);
+			*y1 = std::min(*y1, y);
+			*x2 = std::max(*x2, x);
+			*y2 = std::max(*y2, y);
+		}
+	}
+}
+
 LayerBlitInfo::LayerBlitInfo()
-	: KRE::SceneObject("layer_blit_info"),
-	  xbase_(0),
-	  ybase_(0),
-	  initialised_(false)
+	: KRE::SceneObject("layer_blit_info")
 {
 	using namespace KRE;
 
@@ -30,6 +48,17 @@ LayerBlitInfo::LayerBlitInfo()
 
 void LayerBlitInfo::setVertices(std::vector<tile_corner>* op, std::vector<tile_corner>* tr)
 {
+	int x1 = std::numeric_limits<int>::max(), y1 = std::numeric_limits<int>::max();
+	int x2 = std::numeric_limits<int>::min(), y2 = std::numeric_limits<int>::min();
+	if(op != nullptr) {
+		add_vertices_to_area(*op, &x1, &y1, &x2, &y2);
+	}
+	if(tr != nullptr) {
+		add_vertices_to_area(*tr, &x1, &y1, &x2, &y2);
+	}
+
+	area_ = x1 <= x2 ? rect::from_coordinates(x1, y1, x2, y2) : rect();
+
 	//LOG_DEBUG("Adding " << op->size() << " opaque vertices");
 	if(op != nullptr) {
 		getAttributeSet()[0]->setCount(op->size());
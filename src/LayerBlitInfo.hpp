@@ -29,23 +29,21 @@
 
 #include "draw_tile.hpp"
 
+//The vertices for the tiles of one chunk of a tile layer. Levels split
+//each layer into fixed-size chunks so that only the chunks on screen are
+//drawn, and only the chunks containing changed tiles are rebuilt.
 class LayerBlitInfo : public KRE::SceneObject
 {
 public:
 	LayerBlitInfo();
-	bool isInitialised() const { return initialised_; }
-	int xbase() const { return xbase_; }
-	int ybase() const { return ybase_; }
-	void setXbase(int xb) { xbase_ = xb; }
-	void setYbase(int yb) { ybase_ = yb; }
-	void setBase(int xb, int yb) { xbase_ = xb; ybase_ = yb; initialised_ = true; }
+
+	//the area covered by the vertices, in the layer's coordinates.
+	const rect& area() const { return area_; }
 
 	void setVertices(std::vector<tile_corner>* op, std::vector<tile_corner>* tr);
 private:
-	int xbase_;
-	int ybase_;
-	bool initialised_;
+	rect area_;
 
 	std::shared_ptr<KRE::Attribute<tile_corner>> opaques_;
 	std::shared_ptr<KRE::Attribute<tile_corner>> transparent_;
-};
\ No newline at end of file
+};
@@ -129,9 +129,11 @@ void report_assert_msg(const std::string& m)
 }
 
 namespace {
-	int silence_on_assert = 0;
-	int throw_validation_failure = 0;
-	int throw_fatal = 0;
+	//per thread, so a recover scope on a worker thread doesn't change how
+	//asserts on the main thread behave.
+	THREAD_LOCAL int silence_on_assert = 0;
+	THREAD_LOCAL int throw_validation_failure = 0;
+	THREAD_LOCAL int throw_fatal = 0;
 }
 
 validation_failure_exception::validation_failure_exception(const std::string& m)
@@ -21,10 +21,13 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <functional>
-#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "background_task_pool.hpp"
@@ -34,67 +37,254 @@ namespace background_task_pool
 {
 	namespace 
 	{
-		int next_task_id = 0;
+		const int NumPriorities = 2;
+
+		enum TASK_STATE { TASK_QUEUED, TASK_RUNNING, TASK_DONE, TASK_CANCELLED };
 
 		struct task 
 		{
+			task(int task_id, std::function<void()> j, std::function<void()> c)
+			  : id(task_id), job(j), on_complete(c), state(TASK_QUEUED), discard_result(false)
+			{}
+			int id;
 			std::function<void()> job, on_complete;
+			std::atomic<int> state;
+
+			//only touched by the main thread.
+			bool discard_result;
+		};
+
+		typedef std::shared_ptr<task> task_ptr;
+
+		//Each worker owns a deque per priority. The owner takes jobs from
+		//the front, so jobs run in the order they were submitted, while idle
+		//workers steal from the back of other workers' deques.
+		struct worker 
+		{
+			worker() : index(0) {}
+			int index;
+			threading::mutex mutex;
+			std::deque<task_ptr> queues[NumPriorities];
 			std::shared_ptr<threading::thread> thread;
 		};
 
+		std::vector<std::shared_ptr<worker> > workers;
+		int next_worker = 0;
+
+		//number of jobs sitting in worker deques. Workers only go to sleep
+		//when this is zero.
+		std::atomic<int> num_queued(0);
+		bool shutting_down = false;
+
+		threading::mutex& get_sleep_mutex()
+		{
+			static threading::mutex res;
+			return res;
+		}
+
+		threading::condition& get_work_available()
+		{
+			static threading::condition res;
+			return res;
+		}
+
 		const threading::mutex& get_completed_tasks_mutex()
 		{
 			static std::shared_ptr<threading::mutex> res = std::make_shared<threading::mutex>();
 			return *res;
 		}
 
-		std::vector<int> completed_tasks;
+		std::vector<task_ptr> completed_tasks;
 
-		std::map<int, task> task_map;
+		//tasks which have been submitted but not yet had their
+		//on_complete delivered. Only accessed from the main thread.
+		int next_task_id = 0;
+		std::unordered_map<int, task_ptr> pending_tasks;
+
+		task_ptr pop_task(worker& w, int priority, bool steal)
+		{
+			threading::lock lck(w.mutex);
+			std::deque<task_ptr>& q = w.queues[priority];
+			if(q.empty()) {
+				return task_ptr();
+			}
+
+			task_ptr result;
+			if(steal) {
+				result = q.back();
+				q.pop_back();
+			} else {
+				result = q.front();
+				q.pop_front();
+			}
 
-		void run_task(std::function<void()> job, int task_id)
+			--num_queued;
+			return result;
+		}
+
+		task_ptr find_task(worker& self)
 		{
-			job();
+			for(int priority = 0; priority != NumPriorities; ++priority) {
+				task_ptr t = pop_task(self, priority, false);
+				if(t) {
+					return t;
+				}
+
+				for(int n = 1; n < static_cast<int>(workers.size()); ++n) {
+					worker& victim = *workers[(self.index + n)%workers.size()];
+					t = pop_task(victim, priority, true);
+					if(t) {
+						return t;
+					}
+				}
+			}
+
+			return task_ptr();
+		}
+
+		void run_task(const task_ptr& t)
+		{
+			int expected = TASK_QUEUED;
+			if(!t->state.compare_exchange_strong(expected, TASK_RUNNING)) {
+				//cancelled before we got to it.
+				return;
+			}
+
+			t->job();
+			t->state = TASK_DONE;
+
 			threading::lock lck(get_completed_tasks_mutex());
-			completed_tasks.push_back(task_id);
+			completed_tasks.push_back(t);
+		}
+
+		void worker_thread_fn(worker* self)
+		{
+			for(;;) {
+				task_ptr t = find_task(*self);
+				if(t) {
+					run_task(t);
+					continue;
+				}
+
+				threading::lock lck(get_sleep_mutex());
+				while(num_queued == 0 && !shutting_down) {
+					get_work_available().wait(get_sleep_mutex());
+				}
+
+				if(num_queued == 0 && shutting_down) {
+					return;
+				}
+			}
+		}
+
+		void start_workers()
+		{
+			if(workers.empty() == false) {
+				return;
+			}
+
+			//keep at least two workers so a job which blocks for a long
+			//time (e.g. waiting on a child process) can't stall the pool.
+			const int nworkers = std::max(2, SDL_GetCPUCount());
+			for(int n = 0; n != nworkers; ++n) {
+				workers.push_back(std::make_shared<worker>());
+				workers.back()->index = n;
+			}
+
+			for(auto& w : workers) {
+				w->thread = std::make_shared<threading::thread>("background_task", std::bind(worker_thread_fn, w.get()));
+			}
+		}
+
+		void stop_workers()
+		{
+			{
+				threading::lock lck(get_sleep_mutex());
+				shutting_down = true;
+				get_work_available().notify_all();
+			}
+
+			for(auto& w : workers) {
+				w->thread->join();
+			}
+
+			workers.clear();
+			shutting_down = false;
 		}
 	}
 
 	manager::manager()
 	{
 		get_completed_tasks_mutex();
+		start_workers();
 	}
 
 	manager::~manager()
 	{
-		while(task_map.empty() == false) {
+		while(pending_tasks.empty() == false) {
 			pump();
 		}
+
+		stop_workers();
+	}
+
+	int submit(std::function<void()> job, std::function<void()> on_complete, TASK_PRIORITY priority)
+	{
+		start_workers();
+
+		const int id = next_task_id++;
+		task_ptr t = std::make_shared<task>(id, job, on_complete);
+		pending_tasks[id] = t;
+
+		worker& w = *workers[next_worker++%workers.size()];
+		{
+			threading::lock lck(w.mutex);
+			w.queues[static_cast<int>(priority)].push_back(t);
+			++num_queued;
+		}
+
+		threading::lock lck(get_sleep_mutex());
+		get_work_available().notify_one();
+		return id;
+	}
+
+	bool cancel(int task_id)
+	{
+		auto itor = pending_tasks.find(task_id);
+		if(itor == pending_tasks.end()) {
+			return false;
+		}
+
+		task_ptr t = itor->second;
+		int expected = TASK_QUEUED;
+		if(t->state.compare_exchange_strong(expected, TASK_CANCELLED)) {
+			//the worker which picks it up will discard it.
+			pending_tasks.erase(itor);
+			return true;
+		}
+
+		t->discard_result = true;
+		return false;
 	}
 
-	void submit(std::function<void()> job, std::function<void()> on_complete)
+	int num_workers()
 	{
-        std::string task_name = "background_task";
-        std::function<void()> f = std::bind(run_task, job, next_task_id);
-        task t = {
-            job,
-            on_complete,
-            std::make_shared<threading::thread>(task_name, f) };
-		task_map[next_task_id] = t;
-		++next_task_id;
+		return static_cast<int>(workers.size());
 	}
 
 	void pump()
 	{
-		std::vector<int> completed;
+		std::vector<task_ptr> completed;
 		{
 			threading::lock lck(get_completed_tasks_mutex());
 			completed.swap(completed_tasks);
 		}
 
-		for(int t : completed) {
-			task_map[t].on_complete();
-			task_map.erase(t);
+		for(const task_ptr& t : completed) {
+			pending_tasks.erase(t->id);
+			if(!t->discard_result) {
+				t->on_complete();
+			}
 		}
 	}
 
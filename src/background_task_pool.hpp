@@ -25,9 +25,15 @@
 
 #include <functional>
 
+//A fixed-size pool of worker threads which runs jobs in the background.
+//submit(), cancel() and pump() must all be called from the main thread;
+//on_complete handlers are run from inside pump().
 namespace background_task_pool
 {
-	struct manager 
+	//Workers always run all NEEDED_NOW jobs before any PREFETCH job.
+	enum class TASK_PRIORITY { NEEDED_NOW, PREFETCH };
+
+	struct manager
 	{
 		manager();
 		~manager();
@@ -35,5 +41,14 @@ namespace background_task_pool
 
 	void pump();
 
-	void submit(std::function<void()> job, std::function<void()> on_complete);
+	//returns an id which may be passed to cancel().
+	int submit(std::function<void()> job, std::function<void()> on_complete, TASK_PRIORITY priority=TASK_PRIORITY::NEEDED_NOW);
+
+	//cancels a task. Returns true if the job was prevented from running.
+	//If the job has already started it will run to completion, but its
+	//on_complete handler will not be called.
+	bool cancel(int task_id);
+
+	//the number of worker threads in the pool.
+	int num_workers();
 }
@@ -29,6 +29,8 @@
 #include "object_events.hpp"
 #include "rectangle_rotator.hpp"
 #include "solid_map.hpp"
+#include "spatial_grid.hpp"
+#include "unit_test.hpp"
 
 namespace 
 {
@@ -43,6 +45,47 @@ namespace
 
 		return ypos + delta_y;
 	}
+
+	//gets a rect which contains every area in which the entity could
+	//register a user collision. Rotated areas use the rect which contains
+	//the area at any rotation, so this is never smaller than the bounding
+	//rects entity_user_collision() tests against.
+	rect get_user_collision_bounding_rect(const Entity& e)
+	{
+		const Frame& f = e.getCurrentFrame();
+		const bool rotated = e.currentRotation() != 0;
+
+		bool found = false;
+		int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+		for(const auto& area : f.getCollisionAreas()) {
+			rect r = e.calculateCollisionRect(f, area);
+			if(r.w() <= 0 || r.h() <= 0) {
+				continue;
+			}
+
+			if(rotated) {
+				const int center_x = r.x() + r.w()/2;
+				const int center_y = r.y() + r.h()/2;
+				const int dim = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(r.w()*r.w() + r.h()*r.h()))));
+				r = rect(center_x - dim/2 - 1, center_y - dim/2 - 1, dim+2, dim+2);
+			}
+
+			if(!found) {
+				x1 = r.x();
+				y1 = r.y();
+				x2 = r.x2();
+				y2 = r.y2();
+				found = true;
+			} else {
+				x1 = std::min(x1, r.x());
+				y1 = std::min(y1, r.y());
+				x2 = std::max(x2, r.x2());
+				y2 = std::max(y2, r.y2());
+			}
+		}
+
+		return rect(x1, y1, x2 - x1, y2 - y1);
+	}
 }
 
 void CollisionInfo::readSurfInfo()
@@ -81,7 +124,8 @@ std::vector<EntityPtr> get_potentially_standable_objects_in_area(const Level& lv
 {
 	std::vector<EntityPtr> result;
 
-	const std::vector<EntityPtr>& chars = lvl.get_solid_chars();
+	std::vector<EntityPtr> chars;
+	lvl.get_solid_chars_in_rect(area, chars);
 
 	for(const EntityPtr& obj : chars) {
 		if(obj.get() == &e) {
@@ -193,7 +237,8 @@ bool entity_collides(Level& lvl, const Entity& e, MOVE_DIRECTION dir, CollisionI
 		return true;
 	}
 
-	const std::vector<EntityPtr>& solid_chars = lvl.get_solid_chars();
+	std::vector<EntityPtr> solid_chars;
+	lvl.get_solid_chars_in_rect(e.solidRect(), solid_chars);
 	for(std::vector<EntityPtr>::const_iterator obj = solid_chars.begin(); obj != solid_chars.end(); ++obj) {
 		if(obj->get() != &e && entity_collides_with_entity(e, **obj, info)) {
 			if(info) {
@@ -502,6 +547,51 @@ bool place_entity_in_level_with_large_displacement(Level& lvl, Entity& e)
 	return true;
 }
 
+namespace
+{
+	//true if a pixel of a collision area counts towards a collision, the
+	//same as testing it with Frame::isAlpha().
+	bool is_opaque(const Frame::CollisionMask* mask, const Frame::CollisionArea& area, int x, int y)
+	{
+		return area.no_alpha_check || (mask != nullptr && mask->test(x, y));
+	}
+
+	//true if some point in [x1, x2] x [y1, y2] is opaque in both masks.
+	//With a stride of 2 only points an even distance from (x1, y1) along
+	//both axes are looked at. ax, ay and bx, by are the positions of the
+	//masks; a null mask counts as fully opaque.
+	bool collision_masks_overlap(const Frame::CollisionMask* a, int ax, int ay,
+	                             const Frame::CollisionMask* b, int bx, int by,
+	                             int x1, int y1, int x2, int y2, int stride)
+	{
+		ASSERT_LOG(stride == 1 || stride == 2, "Unsupported collision stride: " << stride);
+		const uint64_t Pixels = stride == 2 ? 0x5555555555555555ULL : ~uint64_t(0);
+		for(int y = y1; y <= y2; y += stride) {
+			for(int x = x1; x <= x2; x += 64) {
+				uint64_t bits = Pixels;
+				const int npixels = x2 - x + 1;
+				if(npixels < 64) {
+					bits &= (uint64_t(1) << npixels) - 1;
+				}
+
+				if(a != nullptr) {
+					bits &= a->getBits(x - ax, y - ay);
+				}
+
+				if(b != nullptr) {
+					bits &= b->getBits(x - bx, y - by);
+				}
+
+				if(bits != 0) {
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+}
+
 int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas_colliding, int buf_size)
 {
 	const Frame& fa = a.getCurrentFrame();
@@ -517,8 +607,8 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 		return 0;
 	}
 
-	const int time_a = a.getTimeInFrame();
-	const int time_b = b.getTimeInFrame();
+	const Frame::CollisionMask* mask_a = fa.getCollisionMask(a.getTimeInFrame(), a.isFacingRight());
+	const Frame::CollisionMask* mask_b = fb.getCollisionMask(b.getTimeInFrame(), b.isFacingRight());
 
 	int result = 0;
 
@@ -557,13 +647,10 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 				if(rects_intersect(bounding_a, bounding_b)) {
 					const int Stride = 2;
 
-
 					const float radians_to_degrees = 57.29577951308232087f;
 
 					const float rot_a = rotate_a/radians_to_degrees;
 					const float rot_b = rotate_b/radians_to_degrees;
-					const float cos_a = cos(rot_a);
-					const float sin_a = sin(rot_a);
 
 					const float a_center_x = rect_a.x() + float(rect_a.w())*0.5f;
 					const float a_center_y = rect_a.y() + float(rect_a.h())*0.5f;
@@ -571,33 +658,42 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 					const float b_center_x = rect_b.x() + float(rect_b.w())*0.5f;
 					const float b_center_y = rect_b.y() + float(rect_b.h())*0.5f;
 
+					//rotating around a's center and then back around b's
+					//center is a single affine transform, so work it out
+					//once rather than calling sin/cos for every point.
+					const float cos_a = cos(rot_a), sin_a = sin(rot_a);
+					const float cos_b = cos(-rot_b), sin_b = sin(-rot_b);
+					const float m00 = cos_b*cos_a - sin_b*sin_a;
+					const float m01 = -cos_b*sin_a - sin_b*cos_a;
+					const float m10 = sin_b*cos_a + cos_b*sin_a;
+					const float m11 = cos_b*cos_a - sin_b*sin_a;
+					const float dx = a_center_x - b_center_x;
+					const float dy = a_center_y - b_center_y;
+
 					//there might be a collision. Do a rigorous check.
 					for(int xpos = 1; xpos < rect_a.w() && !found; xpos += Stride) {
 						for(int ypos = 1; ypos < rect_a.h(); ypos += Stride) {
-							if(area_a.no_alpha_check == false && fa.isAlpha(xpos, ypos, time_a, a.isFacingRight())) {
+							if(!is_opaque(mask_a, area_a, xpos, ypos)) {
 								continue;
 							}
 
-							float a_x = static_cast<float>(rect_a.x() + xpos);
-							float a_y = static_cast<float>(rect_a.y() + ypos);
+							const float a_x = static_cast<float>(rect_a.x() + xpos) - a_center_x;
+							const float a_y = static_cast<float>(rect_a.y() + ypos) - a_center_y;
 
-							geometry::Point<float> p = rotate_point_around_origin_with_offset(a_x, a_y, rot_a, a_center_x, a_center_y, false);
+							const float p_x = m00*a_x + m01*a_y + cos_b*dx - sin_b*dy + b_center_x;
+							const float p_y = m10*a_x + m11*a_y + sin_b*dx + cos_b*dy + b_center_y;
 
-							p = rotate_point_around_origin_with_offset(p.x, p.y, -rot_b, b_center_x, b_center_y, false);
-
-							int b_x = static_cast<int>(p.x) - rect_b.x();
-							int b_y = static_cast<int>(p.y) - rect_b.y();
+							const int b_x = static_cast<int>(p_x) - rect_b.x();
+							const int b_y = static_cast<int>(p_y) - rect_b.y();
 
 							if(b_x < 0 || b_y < 0 || b_x >= rect_b.w() || b_y >= rect_b.h()) {
 								continue;
 							}
 
-							if(area_b.no_alpha_check == false && fb.isAlpha(b_x, b_y, time_b, b.isFacingRight())) {
+							if(!is_opaque(mask_b, area_b, b_x, b_y)) {
 								continue;
 							}
 
-							fprintf(stderr, "COLLIDE: %d, %d / %d, %d\n", b_x, b_y, rect_b.w(), rect_b.h());
-
 							found = true;
 							break;
 						}
@@ -612,14 +708,10 @@ int entity_user_collision(const Entity& a, const Entity& b, CollisionPair* areas
 				//enough accuracy and is 4x faster.
 				const int Stride = 2;
 				const rect intersection = intersection_rect(rect_a, rect_b);
-				for(int y = intersection.y(); y <= intersection.y2() && !found; y += Stride) {
-					for(int x = intersection.x(); x <= intersection.x2(); x += Stride) {
-						if((area_a.no_alpha_check || !fa.isAlpha(x - a.x(), y - a.y(), time_a, a.isFacingRight())) &&
-						   (area_b.no_alpha_check || !fb.isAlpha(x - b.x(), y - b.y(), time_b, b.isFacingRight()))) {
-							found = true;
-							break;
-						}
-					}
+				if((area_a.no_alpha_check || mask_a != nullptr) && (area_b.no_alpha_check || mask_b != nullptr)) {
+					found = collision_masks_overlap(area_a.no_alpha_check ? nullptr : mask_a, a.x(), a.y(),
+					                                area_b.no_alpha_check ? nullptr : mask_b, b.x(), b.y(),
+					                                intersection.x(), intersection.y(), intersection.x2(), intersection.y2(), Stride);
 				}
 			}
 
@@ -690,20 +782,15 @@ bool entity_user_collision_specific_areas(const Entity& a, const std::string& ar
 		return false;
 	}
 
-	const int time_a = a.getTimeInFrame();
-	const int time_b = b.getTimeInFrame();
-
-	const rect intersection = intersection_rect(rect_a, rect_b);
-	for(int y = intersection.y(); y <= intersection.y2(); ++y) {
-		for(int x = intersection.x(); x <= intersection.x2(); ++x) {
-			if(!fa.isAlpha(x - a.x(), y - a.y(), time_a, a.isFacingRight()) &&
-			   !fb.isAlpha(x - b.x(), y - b.y(), time_b, b.isFacingRight())) {
-				return true;
-			}
-		}
+	const Frame::CollisionMask* mask_a = fa.getCollisionMask(a.getTimeInFrame(), a.isFacingRight());
+	const Frame::CollisionMask* mask_b = fb.getCollisionMask(b.getTimeInFrame(), b.isFacingRight());
+	if(mask_a == nullptr || mask_b == nullptr) {
+		return false;
 	}
 
-	return false;
+	const rect intersection = intersection_rect(rect_a, rect_b);
+	return collision_masks_overlap(mask_a, a.x(), a.y(), mask_b, b.x(), b.y(),
+	                               intersection.x(), intersection.y(), intersection.x2(), intersection.y2(), 1);
 }
 
 namespace {
@@ -756,11 +843,23 @@ void detect_user_collisions(Level& lvl)
 {
 	std::vector<EntityPtr> chars;
 	chars.reserve(lvl.get_active_chars().size());
+
+	SpatialGrid<const Entity*>& grid = lvl.user_collision_grid();
+	grid.beginUpdate();
 	for(const EntityPtr& a : lvl.get_active_chars()) {
 		if(a->getWeakCollideDimensions() != 0 && a->getCurrentFrame().getCollisionAreas().empty() == false) {
+			grid.update(a.get(), get_user_collision_bounding_rect(*a), static_cast<int>(chars.size()));
 			chars.push_back(a);
 		}
 	}
+	grid.endUpdate();
+
+	//only pairs whose collision areas overlap can possibly collide. Sort
+	//them so collisions are reported in the same order as if we had
+	//tested every pair.
+	std::vector<std::pair<int,int> > candidates;
+	grid.getIntersectingPairs(candidates);
+	std::sort(candidates.begin(), candidates.end());
 
 	typedef std::pair<EntityPtr, const std::string*> collision_key;
 	std::map<collision_key, std::vector<collision_key> > collision_info;
@@ -769,30 +868,28 @@ void detect_user_collisions(Level& lvl)
 
 	const int MaxCollisions = 16;
 	CollisionPair collision_buf[MaxCollisions];
-	for(std::vector<EntityPtr>::const_iterator i = chars.begin(); i != chars.end(); ++i) {
-		for(std::vector<EntityPtr>::const_iterator j = i + 1; j != chars.end(); ++j) {
-			const EntityPtr& a = *i;
-			const EntityPtr& b = *j;
-			if(a == b ||
-			   ((a->getWeakCollideDimensions()&b->getCollideDimensions()) == 0 &&
-			   (a->getCollideDimensions()&b->getWeakCollideDimensions()) == 0)) {
-				//the objects do not share a dimension, and so can't collide.
-				continue;
-			}
+	for(const std::pair<int,int>& candidate : candidates) {
+		const EntityPtr& a = chars[candidate.first];
+		const EntityPtr& b = chars[candidate.second];
+		if(a == b ||
+		   ((a->getWeakCollideDimensions()&b->getCollideDimensions()) == 0 &&
+		   (a->getCollideDimensions()&b->getWeakCollideDimensions()) == 0)) {
+			//the objects do not share a dimension, and so can't collide.
+			continue;
+		}
 
-			int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
-			if(ncollisions > MaxCollisions) {
-				ncollisions = MaxCollisions;
-			}
+		int ncollisions = entity_user_collision(*a, *b, collision_buf, MaxCollisions);
+		if(ncollisions > MaxCollisions) {
+			ncollisions = MaxCollisions;
+		}
 
-			for(int n = 0; n != ncollisions; ++n) {
-				{
-					collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
-				}
+		for(int n = 0; n != ncollisions; ++n) {
+			{
+				collision_info[collision_key(a, collision_buf[n].first)].push_back(collision_key(b, collision_buf[n].second));
+			}
 
-				{
-					collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
-				}
+			{
+				collision_info[collision_key(b, collision_buf[n].second)].push_back(collision_key(a, collision_buf[n].first));
 			}
 		}
 	}
@@ -836,7 +933,8 @@ bool is_flightpath_clear(const Level& lvl, const Entity& e, const rect& area)
 		return false;
 	}
 
-	const std::vector<EntityPtr>& v = lvl.get_solid_chars();
+	std::vector<EntityPtr> v;
+	lvl.get_solid_chars_in_rect(area, v);
 	for(std::vector<EntityPtr>::const_iterator obj = v.begin();
 	    obj != v.end(); ++obj) {
 		if(obj->get() == &e) {
@@ -850,3 +948,211 @@ bool is_flightpath_clear(const Level& lvl, const Entity& e, const rect& area)
 
 	return true;
 }
+
+namespace
+{
+	//a field of bullet-sized objects scattered over a large level, each
+	//of which moves a little every cycle.
+	std::vector<rect> generate_collision_test_rects(int count, int level_size)
+	{
+		std::vector<rect> result;
+		result.reserve(count);
+		for(int n = 0; n != count; ++n) {
+			const int w = 8 + rand()%48;
+			const int h = 8 + rand()%48;
+			result.push_back(rect(rand()%level_size - level_size/2, rand()%level_size - level_size/2, w, h));
+		}
+
+		return result;
+	}
+
+	void move_collision_test_rects(std::vector<rect>& rects)
+	{
+		for(rect& r : rects) {
+			r = rect(r.x() + rand()%17 - 8, r.y() + rand()%17 - 8, r.w(), r.h());
+		}
+	}
+
+	void get_intersecting_pairs_all_pairs(const std::vector<rect>& rects, std::vector<std::pair<int,int> >& result)
+	{
+		for(int i = 0; i < static_cast<int>(rects.size()); ++i) {
+			for(int j = i+1; j < static_cast<int>(rects.size()); ++j) {
+				if(rects_intersect(rects[i], rects[j])) {
+					result.push_back(std::pair<int,int>(i, j));
+				}
+			}
+		}
+	}
+
+	void update_collision_test_grid(SpatialGrid<int>& grid, const std::vector<rect>& rects)
+	{
+		grid.beginUpdate();
+		for(int n = 0; n != static_cast<int>(rects.size()); ++n) {
+			grid.update(n, rects[n], n);
+		}
+		grid.endUpdate();
+	}
+}
+
+UNIT_TEST(user_collision_grid_matches_all_pairs)
+{
+	SpatialGrid<int> grid(64, 16);
+	std::vector<rect> rects = generate_collision_test_rects(300, 2000);
+
+	//a few objects which cover much of the level exercise the path for
+	//items too big to put in cells.
+	rects.push_back(rect(-900, -900, 1800, 40));
+	rects.push_back(rect(-200, -1000, 30, 2000));
+
+	for(int cycle = 0; cycle != 10; ++cycle) {
+		update_collision_test_grid(grid, rects);
+		CHECK_EQ(grid.size(), rects.size());
+
+		std::vector<std::pair<int,int> > expected, actual;
+		get_intersecting_pairs_all_pairs(rects, expected);
+		grid.getIntersectingPairs(actual);
+		std::sort(actual.begin(), actual.end());
+		CHECK_EQ(expected.size(), actual.size());
+		CHECK(expected == actual, "grid and all-pairs collision candidates differ");
+
+		const rect query(-100, -100, 300, 300);
+		std::vector<int> expected_hits, actual_hits;
+		for(int n = 0; n != static_cast<int>(rects.size()); ++n) {
+			if(rects_intersect(rects[n], query)) {
+				expected_hits.push_back(n);
+			}
+		}
+		grid.getIntersecting(query, actual_hits);
+		std::sort(actual_hits.begin(), actual_hits.end());
+		CHECK(expected_hits == actual_hits, "grid and linear rect query differ");
+
+		move_collision_test_rects(rects);
+	}
+
+	//objects no longer updated are dropped from the grid.
+	grid.beginUpdate();
+	grid.update(0, rects[0], 0);
+	grid.endUpdate();
+	CHECK_EQ(grid.size(), 1);
+}
+
+BENCHMARK(user_collision_candidates_all_pairs)
+{
+	std::vector<rect> rects = generate_collision_test_rects(400, 4000);
+	std::vector<std::pair<int,int> > pairs;
+	BENCHMARK_LOOP {
+		move_collision_test_rects(rects);
+		pairs.clear();
+		get_intersecting_pairs_all_pairs(rects, pairs);
+	}
+}
+
+BENCHMARK(user_collision_candidates_grid)
+{
+	std::vector<rect> rects = generate_collision_test_rects(400, 4000);
+	SpatialGrid<int> grid;
+	std::vector<std::pair<int,int> > pairs;
+	BENCHMARK_LOOP {
+		move_collision_test_rects(rects);
+		update_collision_test_grid(grid, rects);
+		pairs.clear();
+		grid.getIntersectingPairs(pairs);
+		std::sort(pairs.begin(), pairs.end());
+	}
+}
+
+namespace
+{
+	//a roughly elliptical sprite filling a w x h frame.
+	Frame::CollisionMask generate_ellipse_mask(int w, int h)
+	{
+		Frame::CollisionMask mask(w, h);
+		for(int y = 0; y != h; ++y) {
+			for(int x = 0; x != w; ++x) {
+				const float dx = (x + 0.5f)/w - 0.5f;
+				const float dy = (y + 0.5f)/h - 0.5f;
+				if(dx*dx + dy*dy <= 0.25f) {
+					mask.set(x, y);
+				}
+			}
+		}
+		return mask;
+	}
+
+	bool collision_masks_overlap_per_pixel(const Frame::CollisionMask& a, int ax, int ay,
+	                                       const Frame::CollisionMask& b, int bx, int by,
+	                                       int x1, int y1, int x2, int y2, int stride)
+	{
+		for(int y = y1; y <= y2; y += stride) {
+			for(int x = x1; x <= x2; x += stride) {
+				if(a.test(x - ax, y - ay) && b.test(x - bx, y - by)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool collision_masks_overlap_at(const Frame::CollisionMask& a, int ax, int ay,
+	                                const Frame::CollisionMask& b, int bx, int by, int stride, bool per_pixel)
+	{
+		const rect ra(ax, ay, a.width(), a.height());
+		const rect rb(bx, by, b.width(), b.height());
+		if(!rects_intersect(ra, rb)) {
+			return false;
+		}
+
+		const rect area = intersection_rect(ra, rb);
+		if(per_pixel) {
+			return collision_masks_overlap_per_pixel(a, ax, ay, b, bx, by, area.x(), area.y(), area.x2(), area.y2(), stride);
+		}
+
+		return collision_masks_overlap(&a, ax, ay, &b, bx, by, area.x(), area.y(), area.x2(), area.y2(), stride);
+	}
+}
+
+UNIT_TEST(collision_masks_overlap_matches_per_pixel)
+{
+	const Frame::CollisionMask bullet = generate_ellipse_mask(9, 7);
+	const Frame::CollisionMask enemy = generate_ellipse_mask(150, 48);
+
+	CHECK_EQ(enemy.getBits(-64, 24), uint64_t(0));
+	CHECK_EQ(enemy.getBits(0, -1), uint64_t(0));
+	CHECK_EQ((enemy.getBits(-1, 24) >> 1) & 1, static_cast<uint64_t>(enemy.test(0, 24)));
+	CHECK_EQ((enemy.getBits(70, 24) >> 3) & 1, static_cast<uint64_t>(enemy.test(73, 24)));
+
+	int hits = 0;
+	for(int y = -12; y < 60; ++y) {
+		for(int x = -12; x < 165; x += 3) {
+			for(int stride = 1; stride <= 2; ++stride) {
+				const bool expected = collision_masks_overlap_at(bullet, x, y, enemy, 0, 0, stride, true);
+				CHECK_EQ(collision_masks_overlap_at(bullet, x, y, enemy, 0, 0, stride, false), expected);
+				CHECK_EQ(collision_masks_overlap_at(enemy, 0, 0, bullet, x, y, stride, false), expected);
+				hits += expected ? 1 : 0;
+			}
+		}
+	}
+	CHECK_GT(hits, 0);
+}
+
+BENCHMARK(user_collision_masks_per_pixel)
+{
+	const Frame::CollisionMask bullet = generate_ellipse_mask(12, 12);
+	const Frame::CollisionMask enemy = generate_ellipse_mask(64, 64);
+	int n = 0;
+	BENCHMARK_LOOP {
+		collision_masks_overlap_at(bullet, n%80 - 8, (n/80)%80 - 8, enemy, 0, 0, 2, true);
+		++n;
+	}
+}
+
+BENCHMARK(user_collision_masks_packed)
+{
+	const Frame::CollisionMask bullet = generate_ellipse_mask(12, 12);
+	const Frame::CollisionMask enemy = generate_ellipse_mask(64, 64);
+	int n = 0;
+	BENCHMARK_LOOP {
+		collision_masks_overlap_at(bullet, n%80 - 8, (n/80)%80 - 8, enemy, 0, 0, 2, false);
+		++n;
+	}
+}
@@ -59,6 +59,7 @@
 #include "formula_callable_visitor.hpp"
 #include "formula_object.hpp"
 #include "formula_profiler.hpp"
+#include "formula_vm.hpp"
 #include "geometry_callable.hpp"
 #include "graphical_font.hpp"
 #include "json_parser.hpp"
@@ -116,6 +117,7 @@ namespace
 	}
 
 	PREF_BOOL(draw_objects_on_even_pixel_boundaries, true, "If true will only draw objects on 2-pixel boundaries");
+	PREF_BOOL(auto_batch_objects, true, "If true, consecutive objects in a layer which share a texture and shader are drawn with a single draw call");
 
 	PREF_STRING(play_sound_function, "", "");
 }
@@ -1297,6 +1299,21 @@ struct BatchDrawInfo {
 //this will be flushed when the CustomObjectDrawZOrderManager
 //is destroyed.
 std::map<std::string, BatchDrawInfo > g_batch_draw_objects;
+
+//Plain sprites merged automatically while a CustomObjectDrawZOrderManager
+//is active. Flushed whenever an object that can't join it is drawn, so
+//the draw order is unchanged.
+Frame::AutoBatch g_auto_batch;
+
+//Objects drawn from inside another object's draw() (attached objects,
+//drivers, etc) are drawn straight away, since the enclosing object draws
+//its own parts without flushing the batch.
+int g_object_draw_depth = 0;
+
+struct ObjectDrawDepthScope {
+	ObjectDrawDepthScope() { ++g_object_draw_depth; }
+	~ObjectDrawDepthScope() { --g_object_draw_depth; }
+};
 }
 
 CustomObjectDrawZOrderManager::CustomObjectDrawZOrderManager() : disabled_(g_draw_zorder_manager_active)
@@ -1310,6 +1327,8 @@ CustomObjectDrawZOrderManager::~CustomObjectDrawZOrderManager()
 		return;
 	}
 
+	g_auto_batch.flush();
+
 	for(const auto& p : g_batch_draw_objects) {
 		p.second.objects.front()->draw(p.second.xx, p.second.yy);
 	}
@@ -1323,8 +1342,68 @@ CustomObjectDrawZOrderManager::~CustomObjectDrawZOrderManager()
 
 extern int g_camera_extend_x, g_camera_extend_y;
 
+bool CustomObject::isAutoBatchable() const
+{
+	if(!g_auto_batch_objects || !g_draw_zorder_manager_active || g_object_draw_depth > 0 || Level::current().in_editor()) {
+		return false;
+	}
+
+	if(type_->drawBatchID().empty() == false || type_->isHiddenInGame() || type_->isShadow()) {
+		return false;
+	}
+
+	if(shader_ || driver_ || clip_area_ || use_absolute_screen_coordinates_ ||
+	   custom_draw_xy_.empty() == false || custom_draw_.get() != nullptr ||
+	   draw_scale_ || draw_area_.get() || getRotateZ().as_float32() != 0.0f) {
+		return false;
+	}
+
+	if(draw_color_ && !draw_color_->fits_in_color()) {
+		return false;
+	}
+
+	if(blur_objects_.empty() == false || effects_shaders_.empty() == false ||
+	   draw_primitives_.empty() == false || widgets_.empty() == false ||
+	   particle_systems_.empty() == false || particles_ != nullptr ||
+	   text_ || document_ || attachedObjects().empty() == false) {
+		return false;
+	}
+
+	if(preferences::show_debug_hitboxes() || Level::current().debug_properties().empty() == false) {
+		return false;
+	}
+
+	return frame_->canAutoBatch();
+}
+
 void CustomObject::draw(int xx, int yy) const
 {
+	if(frame_ != nullptr && isAutoBatchable()) {
+		std::unique_ptr<KRE::ColorScope> color_scope;
+		if(draw_color_) {
+			color_scope.reset(new KRE::ColorScope(draw_color_->toColor()));
+		}
+
+		int draw_x = x();
+		int draw_y = y();
+
+		if(g_draw_objects_on_even_pixel_boundaries) {
+			draw_x -= draw_x%2;
+			draw_y -= draw_y%2;
+		}
+
+		//an unclipped object drawn normally would end any clip scope left
+		//over from the previous object.
+		g_clip_stencil_scope.reset();
+		g_clip_stencil_rect.reset();
+
+		g_auto_batch.add(*frame_, draw_x, draw_y, isFacingRight(), isUpsideDown(), time_in_frame_);
+		return;
+	}
+
+	g_auto_batch.flush();
+	const ObjectDrawDepthScope depth_scope;
+
 	for(auto b : blur_objects_) {
 		const_cast<BlurObject*>(b.get())->draw(xx, yy);
 	}
@@ -6412,3 +6491,46 @@ BENCHMARK_ARG(custom_object_handle_event, const std::string& object_event)
 BENCHMARK_ARG_CALL(custom_object_handle_event, ant_non_exist, "ant_black:blahblah");
 
 BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_handle_event);
+
+//runs all of an object type's event handlers, to measure how real FFL
+//performs in the VM. Reports the time and the VM's own stack allocations
+//per formula run.
+BENCHMARK_ARG(custom_object_event_handlers, const std::string& obj_type)
+{
+	static Level* lvl = new Level("titlescreen.cfg");
+	lvl->setAsCurrentLevel();
+	static std::map<std::string, CustomObject*> objects;
+	CustomObject*& obj = objects[obj_type];
+	if(obj == nullptr) {
+		obj = new CustomObject(obj_type, 0, 0, false);
+		obj->setLevel(*lvl);
+	}
+
+	std::vector<int> events;
+	const CustomObjectType::event_handler_map& handlers = obj->getType()->getEventHandlers();
+	for(int n = 0; n != static_cast<int>(handlers.size()); ++n) {
+		if(handlers[n]) {
+			events.push_back(n);
+		}
+	}
+
+	const int iterations = benchmark_iterations;
+	const formula_vm::ExecutionStats before = formula_vm::getExecutionStats();
+	profile::timer timer;
+
+	BENCHMARK_LOOP {
+		for(int event : events) {
+			obj->handleEvent(event);
+		}
+	}
+
+	const double ns = timer.get_time()*1000.0;
+	const formula_vm::ExecutionStats after = formula_vm::getExecutionStats();
+	const uint64_t nformulas = after.executions - before.executions;
+	if(iterations > 1 && nformulas > 0) {
+		const uint64_t allocations = (after.context_allocations - before.context_allocations) + (after.stack_reallocations - before.stack_reallocations);
+		LOG_INFO(obj_type << ": " << events.size() << " event handlers, " << (nformulas/iterations) << " VM formulas/iteration, " << static_cast<int64_t>(ns/nformulas) << "ns/formula, " << (static_cast<double>(allocations)/nformulas) << " VM allocations/formula");
+	}
+}
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(custom_object_event_handlers);
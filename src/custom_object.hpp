@@ -344,6 +344,10 @@ protected:
 	void surrenderReferences(GarbageCollector* collector) override;
 
 private:
+	//true if draw() only has to blit the current frame, so the sprite can
+	//be merged into a batch with its neighbours.
+	bool isAutoBatchable() const;
+
 	void initProperties(bool defer=false);
 	void initProperty(const CustomObjectType::PropertyEntry& e);
 	CustomObject& operator=(const CustomObject& o);
@@ -735,7 +735,7 @@ namespace
 					node = node.add_attr(variant("music"), variant(sound::current_music()));
 				}
 
-				sys::write_file(preferences::save_file_path(), node.write_json());
+				sys::write_file(preferences::save_file_path(), Level::writeSaveDocument(node));
 			}
 		}
 	};
@@ -2491,7 +2491,7 @@ RETURN_TYPE("bool")
 
 			std::vector<int> layers;
 			layers.push_back(zorder);
-			Level::current().start_rebuild_tiles_in_background(layers);
+			Level::current().start_rebuild_tiles_rect_in_background(layers, rect::from_coordinates(r[0], r[1], r[2], r[3]));
 		}));
 	FUNCTION_ARGS_DEF
 		ARG_TYPE("int")
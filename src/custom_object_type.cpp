@@ -22,9 +22,12 @@
 */
 
 #include <cassert>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "code_editor_dialog.hpp"
 #include "collision_utils.hpp"
 #include "custom_object.hpp"
@@ -37,6 +40,7 @@
 #include "formula.hpp"
 #include "formula_constants.hpp"
 #include "formula_function_registry.hpp"
+#include "formula_garbage_collector.hpp"
 #include "formula_profiler.hpp"
 #include "json_parser.hpp"
 #include "level.hpp"
@@ -113,6 +117,22 @@ namespace
 		module::get_unique_filenames_under_dir("data/object_prototypes", &::prototype_file_paths());
 	}
 
+	//how long each type took to load in preloadAllObjects(). Parse time
+	//covers reading and parsing on the workers, merge time merging in its
+	//prototypes there, and compile time excludes any other types loaded
+	//while compiling it.
+	struct PreloadTiming
+	{
+		PreloadTiming() : parse_ms(0.0), merge_ms(0.0), compile_ms(0.0)
+		{}
+		double parse_ms, merge_ms, compile_ms;
+	};
+
+	std::map<std::string, PreloadTiming>* g_preload_timings = nullptr;
+
+	//time spent compiling types nested inside the one being timed.
+	double g_preload_nested_ms = 0.0;
+
 	typedef std::map<std::string, ConstCustomObjectTypePtr> object_map;
 
 	object_map& cache() 
@@ -736,33 +756,47 @@ void CustomObjectType::ReloadFilePaths()
 }
 
 
-//function which finds if a node has a prototype, and if so, applies the
-//prototype to the node.
-variant CustomObjectType::mergePrototype(variant node, std::vector<std::string>* proto_paths)
+namespace
 {
-	if(!node.has_key("prototype")) {
-		return node;
-	}
+	//applies the prototypes of a node, getting each prototype's document
+	//and path from load_prototype().
+	variant merge_prototypes(variant node, std::vector<std::string>* proto_paths, const std::function<variant(const std::string&, std::string*)>& load_prototype)
+	{
+		if(!node.has_key("prototype")) {
+			return node;
+		}
 
-	std::vector<std::string> protos = node["prototype"].as_list_string();
-	if(protos.size() > 1) {
-		LOG_WARN("Multiple inheritance of objects is deprecated: " << node["prototype"].debug_location());
+		std::vector<std::string> protos = node["prototype"].as_list_string();
+		if(protos.size() > 1) {
+			LOG_WARN("Multiple inheritance of objects is deprecated: " << node["prototype"].debug_location());
+		}
+
+		for(const std::string& proto : protos) {
+			//look up the object's prototype and merge it in
+			std::string path;
+			variant prototype_node = load_prototype(proto, &path);
+			ASSERT_LOG(prototype_node["id"].as_string() == proto, "PROTOTYPE NODE FOR " << proto << " DOES NOT SPECIFY AN ACCURATE id FIELD");
+			if(proto_paths) {
+				proto_paths->push_back(path);
+			}
+			prototype_node = merge_prototypes(prototype_node, proto_paths, load_prototype);
+			node = merge_into_prototype(prototype_node, node);
+		}
+		return node;
 	}
+}
 
-	for(const std::string& proto : protos) {
-		//look up the object's prototype and merge it in
+//function which finds if a node has a prototype, and if so, applies the
+//prototype to the node.
+variant CustomObjectType::mergePrototype(variant node, std::vector<std::string>* proto_paths)
+{
+	return merge_prototypes(node, proto_paths, [](const std::string& proto, std::string* path) {
 		std::map<std::string, std::string>::const_iterator path_itor = module::find(::prototype_file_paths(), proto + ".cfg");
 		ASSERT_LOG(path_itor != ::prototype_file_paths().end(), "Could not find file for prototype '" << proto << "'");
 
-		variant prototype_node = json::parse_from_file(path_itor->second);
-		ASSERT_LOG(prototype_node["id"].as_string() == proto, "PROTOTYPE NODE FOR " << proto << " DOES NOT SPECIFY AN ACCURATE id FIELD");
-		if(proto_paths) {
-			proto_paths->push_back(path_itor->second);
-		}
-		prototype_node = mergePrototype(prototype_node, proto_paths);
-		node = merge_into_prototype(prototype_node, node);
-	}
-	return node;
+		*path = path_itor->second;
+		return json::parse_from_file(path_itor->second);
+	});
 }
 
 const std::string* CustomObjectType::getObjectPath(const std::string& id)
@@ -779,6 +813,12 @@ const std::string* CustomObjectType::getObjectPath(const std::string& id)
 	return &itor->second;
 }
 
+bool CustomObjectType::isLoaded(const std::string& id)
+{
+	std::string::const_iterator dot_itor = std::find(id.begin(), id.end(), '.');
+	return cache().count(module::get_id(std::string(id.begin(), dot_itor))) != 0;
+}
+
 ConstCustomObjectTypePtr CustomObjectType::get(const std::string& id)
 {
 	std::string::const_iterator dot_itor = std::find(id.begin(), id.end(), '.');
@@ -796,6 +836,10 @@ ConstCustomObjectTypePtr CustomObjectType::get(const std::string& id)
 		return itor->second;
 	}
 
+	profile::timer compile_timer;
+	const double outer_nested_ms = g_preload_nested_ms;
+	g_preload_nested_ms = 0.0;
+
 	ConstCustomObjectTypePtr result(create(id));
 	cache()[module::get_id(id)] = result;
 
@@ -803,6 +847,13 @@ ConstCustomObjectTypePtr CustomObjectType::get(const std::string& id)
 	//when an object starts its variation.
 	result->loadVariations();
 
+	//the timer counts microseconds.
+	const double elapsed_ms = compile_timer.get_time()/1000.0;
+	if(g_preload_timings != nullptr) {
+		(*g_preload_timings)[module::get_id(id)].compile_ms += elapsed_ms - g_preload_nested_ms;
+	}
+	g_preload_nested_ms = outer_nested_ms + elapsed_ms;
+
 	for(auto s : result->preloadObjects()) {
 		get(s);
 	}
@@ -836,6 +887,16 @@ CustomObjectTypePtr CustomObjectType::create(const std::string& id)
 namespace 
 {
 	std::map<std::string, std::vector<std::string> > object_prototype_paths;
+
+	//object nodes already merged with their prototypes by
+	//preloadAllObjects(), waiting to be compiled.
+	struct MergedObjectNode
+	{
+		variant node;
+		std::vector<std::string> proto_paths;
+	};
+
+	std::map<std::string, MergedObjectNode> g_merged_object_nodes;
 }
 
 CustomObjectTypePtr CustomObjectType::recreate(const std::string& id,
@@ -858,7 +919,15 @@ CustomObjectTypePtr CustomObjectType::recreate(const std::string& id,
 
 	try {
 		std::vector<std::string> proto_paths;
-		variant node = mergePrototype(json::parse_from_file(path_itor->second), &proto_paths);
+		variant node;
+		auto merged = g_merged_object_nodes.find(id);
+		if(merged != g_merged_object_nodes.end() && old_type == nullptr) {
+			node = merged->second.node;
+			proto_paths.swap(merged->second.proto_paths);
+			g_merged_object_nodes.erase(merged);
+		} else {
+			node = mergePrototype(json::parse_from_file(path_itor->second), &proto_paths);
+		}
 
 		ASSERT_LOG(node["id"].as_string() == module::get_id(id), "IN " << path_itor->second << " OBJECT ID DOES NOT MATCH FILENAME");
 		
@@ -1028,6 +1097,342 @@ std::vector<ConstCustomObjectTypePtr> CustomObjectType::getAll()
 	return res;
 }
 
+namespace
+{
+	//a slice of the object or prototype files read and parsed by one
+	//background task.
+	struct ObjectParseJob
+	{
+		//the names the files are known by, their paths as given to
+		//json::parse_from_file() and the files to read.
+		std::vector<std::string> ids, paths, files;
+		std::vector<json::PrefetchedDocument> docs;
+		std::vector<bool> parsed;
+		std::vector<double> parse_ms;
+
+		void run() {
+			docs.resize(files.size());
+			parsed.resize(files.size(), false);
+			parse_ms.resize(files.size());
+			for(size_t n = 0; n != files.size(); ++n) {
+				profile::timer parse_timer;
+				std::string contents;
+				try {
+					contents = sys::read_file(files[n]);
+				} catch(...) {
+					//it will be read again when it's used.
+				}
+
+				if(contents.empty() == false) {
+					parsed[n] = json::parse_in_worker(paths[n], contents, json::JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &docs[n]);
+				}
+				parse_ms[n] = parse_timer.get_time()/1000.0;
+			}
+		}
+	};
+
+	typedef std::shared_ptr<ObjectParseJob> ObjectParseJobPtr;
+
+	//parsed prototype documents and their paths, by the name objects use
+	//for them.
+	typedef std::map<std::string, std::pair<std::string, variant> > PrototypeDocuments;
+
+	struct PrototypeNotParsed {};
+
+	//a slice of the object documents merged with their prototypes by one
+	//background task. The parsed documents are shared by all the jobs and
+	//only read by them, since reference counts aren't thread safe: each job
+	//merges its own copies of them.
+	struct ObjectMergeJob
+	{
+		std::vector<std::string> ids;
+		std::vector<variant> docs;
+		std::shared_ptr<const PrototypeDocuments> prototypes;
+		std::vector<MergedObjectNode> nodes;
+		std::vector<bool> merged;
+		std::vector<double> merge_ms;
+
+		void run() {
+			nodes.resize(docs.size());
+			merged.resize(docs.size(), false);
+			merge_ms.resize(docs.size());
+
+			const VariantWorkerThreadScope worker_scope;
+			const GarbageCollectorUntrackedScope untracked_scope;
+
+			//copies of the prototypes used so far, made as they're needed.
+			PrototypeDocuments copies;
+			for(size_t n = 0; n != docs.size(); ++n) {
+				profile::timer merge_timer;
+				try {
+					assert_recover_scope recover_scope(SilenceAsserts);
+					nodes[n].node = merge_prototypes(docs[n].deep_copy_document(), &nodes[n].proto_paths, [this, &copies](const std::string& proto, std::string* path) {
+						PrototypeDocuments::const_iterator itor = copies.find(proto);
+						if(itor == copies.end()) {
+							PrototypeDocuments::const_iterator shared = prototypes->find(proto);
+							if(shared == prototypes->end()) {
+								throw PrototypeNotParsed();
+							}
+
+							itor = copies.insert(std::make_pair(proto, std::make_pair(shared->second.first, shared->second.second.deep_copy_document()))).first;
+						}
+
+						*path = itor->second.first;
+						return itor->second.second;
+					});
+					merged[n] = true;
+				} catch(validation_failure_exception&) {
+					//merged again on the main thread, which reports the error.
+					nodes[n] = MergedObjectNode();
+				} catch(PrototypeNotParsed&) {
+					nodes[n] = MergedObjectNode();
+				}
+				merge_ms[n] = merge_timer.get_time()/1000.0;
+			}
+		}
+	};
+
+	typedef std::shared_ptr<ObjectMergeJob> ObjectMergeJobPtr;
+
+	//runs the jobs on the background task pool and waits for all of them.
+	//Returns how long that took, in milliseconds.
+	template<typename JobPtr>
+	double run_preload_jobs(const std::vector<JobPtr>& jobs)
+	{
+		profile::timer wall_timer;
+
+		//shared with the on_complete handlers, which may still run after
+		//we're gone if another handler throws.
+		std::shared_ptr<int> remaining = std::make_shared<int>(0);
+		for(const JobPtr& job : jobs) {
+			++*remaining;
+			background_task_pool::submit([job]() { job->run(); }, [remaining]() {
+				--*remaining;
+			});
+		}
+
+		while(*remaining > 0) {
+			background_task_pool::pump();
+			if(*remaining > 0) {
+				profile::delay(1);
+			}
+		}
+
+		return wall_timer.get_time()/1000.0;
+	}
+
+	//hands the merged nodes and parsed documents to recreate() and
+	//json::parse_from_file() while types are compiled, and makes sure no
+	//leftovers are seen by later loads.
+	struct PreloadedDocumentsScope
+	{
+		std::vector<std::string> paths;
+
+		~PreloadedDocumentsScope() {
+			g_merged_object_nodes.clear();
+			for(const std::string& path : paths) {
+				json::discard_prefetched_document(path);
+			}
+		}
+	};
+
+	struct PreloadTimingScope
+	{
+		explicit PreloadTimingScope(std::map<std::string, PreloadTiming>* timings) {
+			g_preload_timings = timings;
+		}
+
+		~PreloadTimingScope() {
+			g_preload_timings = nullptr;
+		}
+	};
+}
+
+void CustomObjectType::preloadAllObjects(bool report)
+{
+	profile::timer total_timer;
+
+	std::vector<std::string> ids;
+	for(const std::string& id : getAllIds()) {
+		if(!isLoaded(id)) {
+			ids.push_back(id);
+		}
+	}
+
+	if(ids.empty()) {
+		return;
+	}
+
+	//first every object file and the prototype files they may use are
+	//parsed, split over a few jobs per worker to keep them balanced.
+	const int njobs = std::min(static_cast<int>(ids.size()), std::max(1, background_task_pool::num_workers())*4);
+	std::vector<ObjectParseJobPtr> parse_jobs, proto_jobs;
+	for(int n = 0; n != njobs; ++n) {
+		parse_jobs.push_back(std::make_shared<ObjectParseJob>());
+		proto_jobs.push_back(std::make_shared<ObjectParseJob>());
+	}
+
+	std::set<std::string> object_paths;
+	for(size_t n = 0; n != ids.size(); ++n) {
+		const std::string* path = getObjectPath(ids[n] + ".cfg");
+		if(path == nullptr) {
+			continue;
+		}
+
+		ObjectParseJob& job = *parse_jobs[n%njobs];
+		job.ids.push_back(ids[n]);
+		job.paths.push_back(*path);
+		job.files.push_back(module::map_file(*path));
+		object_paths.insert(*path);
+	}
+
+	//objects may also be used as prototypes, and aren't parsed twice.
+	std::map<std::string, std::string> prototype_paths;
+	std::set<std::string> proto_paths_queued;
+	for(const auto& p : ::prototype_file_paths()) {
+		const std::string& fname = p.first;
+		if(fname.size() < 4 || std::string(fname.end()-4, fname.end()) != ".cfg") {
+			continue;
+		}
+
+		std::map<std::string, std::string>::const_iterator path_itor = module::find(::prototype_file_paths(), fname);
+		if(path_itor == ::prototype_file_paths().end()) {
+			continue;
+		}
+
+		const std::string& path = path_itor->second;
+		prototype_paths[std::string(fname.begin(), fname.end()-4)] = path;
+		if(object_paths.count(path) == 0 && proto_paths_queued.insert(path).second) {
+			ObjectParseJob& job = *proto_jobs[proto_paths_queued.size()%njobs];
+			job.ids.push_back(std::string(fname.begin(), fname.end()-4));
+			job.paths.push_back(path);
+			job.files.push_back(module::map_file(path));
+		}
+	}
+
+	std::vector<ObjectParseJobPtr> all_parse_jobs = parse_jobs;
+	all_parse_jobs.insert(all_parse_jobs.end(), proto_jobs.begin(), proto_jobs.end());
+	const double parse_wall_ms = run_preload_jobs(all_parse_jobs);
+
+	std::map<std::string, variant> docs_by_path;
+	for(const ObjectParseJobPtr& job : all_parse_jobs) {
+		for(size_t n = 0; n != job->paths.size(); ++n) {
+			if(job->parsed[n]) {
+				docs_by_path[job->paths[n]] = job->docs[n].doc;
+			}
+		}
+	}
+
+	//then the objects are merged with their prototypes. Anything which
+	//wasn't parsed or fails to merge is left to the main thread.
+	std::shared_ptr<PrototypeDocuments> prototypes = std::make_shared<PrototypeDocuments>();
+	for(const auto& p : prototype_paths) {
+		auto doc = docs_by_path.find(p.second);
+		if(doc != docs_by_path.end()) {
+			(*prototypes)[p.first] = std::make_pair(p.second, doc->second);
+		}
+	}
+
+	std::vector<ObjectMergeJobPtr> merge_jobs;
+	for(const ObjectParseJobPtr& parse_job : parse_jobs) {
+		ObjectMergeJobPtr job = std::make_shared<ObjectMergeJob>();
+		job->prototypes = prototypes;
+		for(size_t n = 0; n != parse_job->ids.size(); ++n) {
+			if(parse_job->parsed[n]) {
+				job->ids.push_back(parse_job->ids[n]);
+				job->docs.push_back(parse_job->docs[n].doc);
+			}
+		}
+
+		merge_jobs.push_back(job);
+	}
+
+	docs_by_path.clear();
+	const double merge_wall_ms = run_preload_jobs(merge_jobs);
+
+	//the workers are done with the parsed documents, so they can be handed
+	//to json::parse_from_file() for anything compiled from them directly.
+	PreloadedDocumentsScope preloaded_documents;
+	for(const ObjectParseJobPtr& job : all_parse_jobs) {
+		for(size_t n = 0; n != job->paths.size(); ++n) {
+			if(job->parsed[n]) {
+				json::set_prefetched_document(job->paths[n], job->docs[n]);
+				preloaded_documents.paths.push_back(job->paths[n]);
+			}
+		}
+	}
+
+	//time spent by each worker adds up across them, and compared to the
+	//phase's wall time shows how well it ran in parallel.
+	double worker_ms = 0.0;
+	std::map<std::string, PreloadTiming> timings;
+	for(const ObjectParseJobPtr& job : all_parse_jobs) {
+		for(size_t n = 0; n != job->ids.size(); ++n) {
+			worker_ms += job->parse_ms[n];
+		}
+	}
+
+	for(const ObjectParseJobPtr& job : parse_jobs) {
+		for(size_t n = 0; n != job->ids.size(); ++n) {
+			timings[module::get_id(job->ids[n])].parse_ms += job->parse_ms[n];
+		}
+	}
+
+	for(const ObjectMergeJobPtr& job : merge_jobs) {
+		for(size_t n = 0; n != job->ids.size(); ++n) {
+			worker_ms += job->merge_ms[n];
+			timings[module::get_id(job->ids[n])].merge_ms += job->merge_ms[n];
+			if(job->merged[n]) {
+				g_merged_object_nodes[job->ids[n]] = job->nodes[n];
+			}
+		}
+	}
+
+	//the types are then compiled and published on the main thread in one
+	//pass, since FFL and the garbage collector aren't thread safe. Types
+	//which were already pulled in by another one are just skipped.
+	profile::timer compile_timer;
+	{
+		const PreloadTimingScope timing_scope(report ? &timings : nullptr);
+		for(const std::string& id : ids) {
+			if(!isLoaded(id)) {
+				get(id);
+			}
+		}
+	}
+	const double compile_wall_ms = compile_timer.get_time()/1000.0;
+
+	if(!report) {
+		return;
+	}
+
+	std::vector<std::pair<std::string, PreloadTiming> > sorted_timings(timings.begin(), timings.end());
+	std::sort(sorted_timings.begin(), sorted_timings.end(), [](const std::pair<std::string, PreloadTiming>& a, const std::pair<std::string, PreloadTiming>& b) {
+		return a.second.compile_ms > b.second.compile_ms;
+	});
+
+	double total_parse_ms = 0.0, total_merge_ms = 0.0, total_compile_ms = 0.0;
+	for(const auto& t : sorted_timings) {
+		total_parse_ms += t.second.parse_ms;
+		total_merge_ms += t.second.merge_ms;
+		total_compile_ms += t.second.compile_ms;
+	}
+
+	std::ostringstream ss;
+	ss << std::fixed << std::setprecision(2);
+	const double parallel_wall_ms = parse_wall_ms + merge_wall_ms;
+	ss << "Preloaded " << sorted_timings.size() << " object types in " << total_timer.get_time()/1000.0 << "ms using "
+	   << background_task_pool::num_workers() << " worker threads (compile " << total_compile_ms << "ms, parse " << total_parse_ms << "ms, merge " << total_merge_ms << "ms)\n";
+	ss << "Parsing took " << parse_wall_ms << "ms and merging " << merge_wall_ms << "ms on the workers, for " << worker_ms
+	   << "ms of work: a speedup of " << (parallel_wall_ms > 0.0 ? worker_ms/parallel_wall_ms : 1.0) << "x. Compiling took "
+	   << compile_wall_ms << "ms on the main thread\n";
+	ss << std::setw(12) << "compile ms" << std::setw(12) << "parse ms" << std::setw(12) << "merge ms" << "  type\n";
+	for(const auto& t : sorted_timings) {
+		ss << std::setw(12) << t.second.compile_ms << std::setw(12) << t.second.parse_ms << std::setw(12) << t.second.merge_ms << "  " << t.first << "\n";
+	}
+	LOG_INFO(ss.str());
+}
+
 #ifndef NO_EDITOR
 namespace 
 {
@@ -2058,5 +2463,6 @@ UTILITY(object_definition)
 
 UTILITY(test_all_objects)
 {
+	CustomObjectType::preloadAllObjects();
 	CustomObjectType::getAll();
 }
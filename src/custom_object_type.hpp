@@ -69,6 +69,9 @@ public:
 	static variant mergePrototype(variant node, std::vector<std::string>* proto_paths=nullptr);
 	static const std::string* getObjectPath(const std::string& id);
 	static ConstCustomObjectTypePtr get(const std::string& id);
+
+	//true if get() can return the type without loading it.
+	static bool isLoaded(const std::string& id);
 	static ConstCustomObjectTypePtr getOrDie(const std::string& id);
 	static CustomObjectTypePtr create(const std::string& id);
 	static void invalidateObject(const std::string& id);
@@ -76,6 +79,12 @@ public:
 	static std::vector<ConstCustomObjectTypePtr> getAll();
 	static std::vector<std::string> getAllIds();
 
+	//loads every object type which isn't loaded yet. Object and prototype
+	//files are parsed, and objects merged with their prototypes, on the
+	//background task pool; the types are then compiled on the main thread.
+	//If report is true a per-type breakdown of the time taken is logged.
+	static void preloadAllObjects(bool report=false);
+
 	static int getObjectTypeIndex(const std::string& id);
 
 	//a function which returns all objects that have an editor category
@@ -126,6 +135,7 @@ public:
 	const game_logic::ConstFormulaPtr& nextAnimationFormula() const { return next_animation_formula_; }
 
 	game_logic::ConstFormulaPtr getEventHandler(int event) const;
+	const event_handler_map& getEventHandlers() const { return event_handlers_; }
 	int parallaxScaleMillisX() const {
 		if(parallax_scale_millis_.get() == nullptr){
 			return 1000;
@@ -28,9 +28,11 @@
 #include "json_parser.hpp"
 #include "preferences.hpp"
 #include "unit_test.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 
 PREF_STRING(db_json_file, "", "The file to output database content to when using a file to simulate a database");
+PREF_BOOL(db_binary_file, false, "Write the file used to simulate a database in binary rather than as JSON");
 PREF_STRING(db_key_prefix, "", "Prefix to put before all requests for keys.");
 
 BEGIN_DEFINE_CALLABLE_NOBASE(DbClient)
@@ -98,7 +100,13 @@ namespace
 			if(db_client_cache.count(fname)) {
 				doc_ = db_client_cache[fname];
 			} else if(sys::file_exists(fname_)) {
-				doc_ = json::parse(sys::read_file(fname_), json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+				const std::string contents = sys::read_file(fname_);
+				if(variant_binary::is_binary_document(contents.c_str(), contents.size())) {
+					const bool valid = variant_binary::read(contents.c_str(), contents.size(), &doc_);
+					ASSERT_LOG(valid, "Invalid binary database file: " << fname_);
+				} else {
+					doc_ = json::parse(contents, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
+				}
 			}
 			
 			if(!doc_.is_map()) {
@@ -114,7 +122,7 @@ namespace
 
 		bool process(int timeout_us) override {
 			if(dirty_) {
-				sys::write_file(fname_, doc_.write_json());
+				sys::write_file(fname_, variant_binary::write_document(doc_, g_db_binary_file));
 				dirty_ = false;
 			}
 			return false;
@@ -593,6 +593,7 @@ variant performance_data::getValue(const std::string& key) const
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(draw_calls);
 #undef PERF_ATTR
 
 	return variant();
@@ -609,6 +610,7 @@ void performance_data::getInputs(std::vector<game_logic::FormulaInput>* inputs)
 	PERF_ATTR(flip);
 	PERF_ATTR(cycle);
 	PERF_ATTR(nevents);
+	PERF_ATTR(draw_calls);
 #undef PERF_ATTR
 }
 
@@ -629,7 +631,7 @@ void draw_fps(const Level& lvl, const performance_data& data)
 	}
 
 	std::ostringstream s;
-	s << data.fps << "/" << data.cycles_per_second << "fps; max: " << data.max_frame_time << "ms; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events";
+	s << data.fps << "/" << data.cycles_per_second << "fps; max: " << data.max_frame_time << "ms; " << (data.draw/10) << "% draw; " << (data.flip/10) << "% flip; " << (data.process/10) << "% process; " << (data.delay/10) << "% idle; " << lvl.num_active_chars() << " objects; " << data.nevents << " events; " << data.draw_calls << " draw calls";
 
 	std::ostringstream nets;
 
@@ -91,13 +91,16 @@ struct performance_data {
 	int cycle;
 	int nevents;
 
+	//number of draw calls issued while rendering the last frame.
+	int draw_calls;
+
 	std::string profiling_info;
 
 	performance_data(int max_frame_time_, int fps_, int cycles_per_second_, int delay_, int draw_, int process_, int flip_, int cycle_, int nevents_, const std::string& profiling_info_)
 	  : max_frame_time(max_frame_time_),
 	    fps(fps_), cycles_per_second(cycles_per_second_), delay(delay_),
 	    draw(draw_), process(process_), flip(flip_), cycle(cycle_),
-		nevents(nevents_), profiling_info(profiling_info_)
+		nevents(nevents_), draw_calls(0), profiling_info(profiling_info_)
 	{}
 
 	variant getValue(const std::string& key) const;
@@ -3103,8 +3103,9 @@ void editor::add_tile_rect(int zorder, const std::string& tile_id, int x1, int y
 
 		std::vector<int> layers;
 		layers.push_back(zorder);
-		undo.push_back(std::bind(&Level::start_rebuild_tiles_in_background, lvl.get(), layers));
-		redo.push_back(std::bind(&Level::start_rebuild_tiles_in_background, lvl.get(), layers));
+		const rect area = rect::from_coordinates(x1, y1, x2, y2);
+		undo.push_back([=](){ lvl->start_rebuild_tiles_rect_in_background(layers, area); });
+		redo.push_back([=](){ lvl->start_rebuild_tiles_rect_in_background(layers, area); });
 	}
 
 	executeCommand(
@@ -3165,8 +3166,9 @@ void editor::remove_tile_rect(int x1, int y1, int x2, int y2)
 
 		redo.push_back([=](){ lvl->clear_tile_rect(x1, y1, x2, y2); });
 
-		undo.push_back(std::bind(&Level::start_rebuild_tiles_in_background, lvl.get(), layers));
-		redo.push_back(std::bind(&Level::start_rebuild_tiles_in_background, lvl.get(), layers));
+		const rect area = rect::from_coordinates(x1, y1, x2, y2);
+		undo.push_back([=](){ lvl->start_rebuild_tiles_rect_in_background(layers, area); });
+		redo.push_back([=](){ lvl->start_rebuild_tiles_rect_in_background(layers, area); });
 	}
 
 	executeCommand(std::bind(execute_functions, redo), std::bind(execute_functions, undo));
@@ -32,6 +32,7 @@
 #include "playable_custom_object.hpp"
 #include "preferences.hpp"
 #include "rectangle_rotator.hpp"
+#include "solid_entity_index.hpp"
 #include "solid_map.hpp"
 #include "variant_utils.hpp"
 
@@ -302,6 +303,11 @@ void Entity::calculateSolidRect()
 	} else {
 		platform_rect_ = rect();
 	}
+
+	if(spatial_index_link_.index && !spatial_index_link_.moved) {
+		spatial_index_link_.moved = true;
+		spatial_index_link_.index->entityMoved(this);
+	}
 }
 
 rect Entity::getBodyRect() const
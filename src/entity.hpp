@@ -46,6 +46,7 @@
 class character;
 class Frame;
 class Level;
+class SolidEntityIndex;
 class pc_character;
 class PlayerInfo;
 
@@ -433,6 +434,20 @@ private:
 
 	bool true_z_;
 	double tx_, ty_, tz_;
+
+	//the solid object index of the level this entity is in, which is
+	//told whenever the solid or platform rect changes. It is deliberately
+	//not copied along with the entity.
+	struct SpatialIndexLink {
+		SpatialIndexLink() : index(nullptr), moved(false) {}
+		SpatialIndexLink(const SpatialIndexLink&) : index(nullptr), moved(false) {}
+		SpatialIndexLink& operator=(const SpatialIndexLink&) { return *this; }
+		SolidEntityIndex* index;
+		bool moved;
+	};
+
+	SpatialIndexLink spatial_index_link_;
+	friend class SolidEntityIndex;
 };
 
 bool zorder_compare(const EntityPtr& e1, const EntityPtr& e2);	
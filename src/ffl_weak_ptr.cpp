@@ -94,6 +94,7 @@ void weak_ptr_base::release(reference_counted_object* obj)
 
 	if(obj->weak_) {
 		obj->weak_->release_internal();
+		obj->weak_ = nullptr;
 	}
 }
 
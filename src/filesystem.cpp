@@ -25,6 +25,8 @@
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <ctime>
+#include <set>
 #include <boost/algorithm/string.hpp>
 
 #ifdef __APPLE__
@@ -54,6 +56,7 @@
 #include "unit_test.hpp"
 
 #ifdef __linux__
+#include <errno.h>
 #include <sys/inotify.h>
 #include <sys/select.h>
 #endif
@@ -206,6 +209,21 @@ namespace sys
 		}
 	}
 
+	void touch_file(const std::string& fname)
+	{
+		last_write_time(path(fname), time(nullptr));
+	}
+
+	long long file_size(const std::string& fname)
+	{
+		path p(fname);
+		if(is_regular_file(p)) {
+			return static_cast<long long>(boost::filesystem::file_size(p));
+		} else {
+			return 0;
+		}
+	}
+
 	void move_file(const std::string& from, const std::string& to)
 	{
 		return rename(path(from), path(to));
@@ -328,93 +346,204 @@ namespace sys
 		return instance;
 	}
 
-	std::vector<std::function<void()> > file_mod_notification_queue;
+	//files which have been modified but whose handlers haven't been called
+	//yet, mapped to the time of the last event seen for them. Several events
+	//for the same file are coalesced into one call of its handlers.
+	std::map<std::string, int> file_mod_notification_queue;
 
 	threading::mutex& get_mod_queue_mutex() {
 		static threading::mutex instance;
 		return instance;
 	}
 
+	//a file must go this long without being modified again before we call
+	//its handlers, so a burst of writes only causes one reload.
+	const int FileModSettleTimeMs = 100;
+
+	void queue_file_modifications(const std::vector<std::string>& paths)
+	{
+		if(paths.empty()) {
+			return;
+		}
+
+		const int now = profile::get_tick_time();
+
+		threading::lock lck(get_mod_queue_mutex());
+		for(const std::string& path : paths) {
+			file_mod_notification_queue[path] = now;
+		}
+	}
+
+#ifdef __linux__
+	//a pipe which is written to in order to wake up the worker thread when
+	//there are new files to listen on or when it should exit.
+	int file_mod_wake_fds[2] = { -1, -1 };
+
+	void wake_file_mod_worker()
+	{
+		if(file_mod_wake_fds[1] != -1) {
+			const char c = 0;
+			if(write(file_mod_wake_fds[1], &c, 1) != 1) {
+				LOG_WARN("COULD NOT WAKE FILE NOTIFY THREAD");
+			}
+		}
+	}
+#endif
+
 	void file_mod_worker_thread_fn()
 	{
 #ifdef __linux__
 		const int inotify_fd = inotify_init();
-		std::map<int, std::string> fd_to_path;
+		if(inotify_fd < 0) {
+			LOG_ERROR("COULD NOT INITIALIZE INOTIFY");
+			return;
+		}
+
+		//we watch the directories files are in rather than the files
+		//themselves. This needs far fewer watches and keeps working when an
+		//editor saves by writing a new file and renaming it over the old one.
+		//
+		//Files are identified by the directory prefix of the path they were
+		//registered with. Different prefixes may name the same directory, in
+		//which case inotify gives them the same watch descriptor.
+		std::map<std::string, int> prefix_to_wd;
+		std::map<int, std::vector<std::string> > wd_to_prefixes;
+		std::set<std::string> files;
+
+		//inotify events are variable length, so read as many as will fit.
+		std::vector<char> buf(64*1024);
 		fd_set read_set;
+#else
+		std::map<std::string, int64_t> mod_times;
 #endif
 
-		std::map<std::string, int64_t> mod_times;
 		for(;;) {
-			file_mod_handler_map m;
 			std::vector<std::string> new_files;
 
 			{
 				threading::lock lck(get_mod_map_mutex());
-				m = get_mod_map();
-				new_files = new_files_listening;
-				new_files_listening.clear();
-			}
+				if(get_mod_map().empty()) {
+					break;
+				}
 
-			if(m.empty()) {
-				break;
+				new_files.swap(new_files_listening);
 			}
 
 #ifdef __linux__
-			for(int n = 0; n != new_files.size(); ++n) {
-				const int fd = inotify_add_watch(inotify_fd, new_files[n].c_str(), IN_CLOSE_WRITE);
-				if(fd > 0) {
-					fd_to_path[fd] = new_files[n];
+			for(const std::string& fname : new_files) {
+				const std::string::size_type slash = fname.rfind('/');
+				const std::string prefix = slash == std::string::npos ? "" : fname.substr(0, slash+1);
+				files.insert(fname);
+
+				if(prefix_to_wd.count(prefix)) {
+					continue;
+				}
+
+				const std::string dir = prefix.empty() ? "." : (prefix.size() == 1 ? prefix : prefix.substr(0, prefix.size()-1));
+				const int wd = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO);
+				if(wd >= 0) {
+					prefix_to_wd[prefix] = wd;
+					wd_to_prefixes[wd].push_back(prefix);
 				} else {
-					LOG_WARN("COULD NOT LISTEN ON FILE " << new_files[n]);
+					LOG_WARN("COULD NOT LISTEN ON DIRECTORY " << dir << " FOR FILE " << fname);
 				}
 			}
 
 			FD_ZERO(&read_set);
 			FD_SET(inotify_fd, &read_set);
-			timeval tv = {1, 0};
-			const int select_res = select(inotify_fd+1, &read_set, nullptr, nullptr, &tv);
-			if(select_res > 0) {
-				inotify_event ev;
-				const int nbytes = read(inotify_fd, &ev, sizeof(ev));
-				if(nbytes == sizeof(ev)) {
-
-					const std::string path = fd_to_path[ev.wd];
-					LOG_INFO("LINUX FILE MOD: " << path);
-					if(ev.mask&IN_IGNORED) {
-						fd_to_path.erase(ev.wd);
-						const int fd = inotify_add_watch(inotify_fd, path.c_str(), IN_MODIFY);
-						if(fd > 0) {
-							fd_to_path[fd] = path;
+			FD_SET(file_mod_wake_fds[0], &read_set);
+			const int select_res = select(std::max(inotify_fd, file_mod_wake_fds[0])+1, &read_set, nullptr, nullptr, nullptr);
+			if(select_res < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+
+				LOG_ERROR("SELECT FAILURE IN FILE NOTIFY");
+				break;
+			}
+
+			if(FD_ISSET(file_mod_wake_fds[0], &read_set)) {
+				char wake_buf[64];
+				if(read(file_mod_wake_fds[0], wake_buf, sizeof(wake_buf)) <= 0) {
+					LOG_ERROR("READ FAILURE ON FILE NOTIFY WAKE PIPE");
+				}
+			}
+
+			if(FD_ISSET(inotify_fd, &read_set)) {
+				const ssize_t nbytes = read(inotify_fd, &buf[0], buf.size());
+				if(nbytes <= 0) {
+					LOG_ERROR("READ FAILURE IN FILE NOTIFY");
+					continue;
+				}
+
+				std::vector<std::string> modified;
+				for(ssize_t pos = 0; pos < nbytes; ) {
+					const inotify_event* ev = reinterpret_cast<const inotify_event*>(&buf[pos]);
+					pos += sizeof(inotify_event) + ev->len;
+
+					if(ev->mask&IN_Q_OVERFLOW) {
+						//events were dropped so we can't tell what changed.
+						LOG_WARN("FILE NOTIFY QUEUE OVERFLOW");
+						modified.assign(files.begin(), files.end());
+						continue;
+					}
+
+					auto itor = wd_to_prefixes.find(ev->wd);
+					if(itor == wd_to_prefixes.end()) {
+						continue;
+					}
+
+					if(ev->mask&IN_IGNORED) {
+						//the directory went away. Forget about it so that
+						//it's watched again if a file in it is registered.
+						for(const std::string& prefix : itor->second) {
+							prefix_to_wd.erase(prefix);
 						}
+
+						wd_to_prefixes.erase(itor);
+						continue;
 					}
-					std::vector<std::function<void()> >& handlers = m[path];
-					LOG_INFO("FILE HANDLERS: " << handlers.size());
 
-					threading::lock lck(get_mod_queue_mutex());
-					file_mod_notification_queue.insert(file_mod_notification_queue.end(), handlers.begin(), handlers.end());
-				} else {
-					LOG_ERROR("READ FAILURE IN FILE NOTIFY");
+					if(ev->len == 0) {
+						continue;
+					}
+
+					for(const std::string& prefix : itor->second) {
+						const std::string path = prefix + ev->name;
+						if(files.count(path)) {
+							LOG_INFO("LINUX FILE MOD: " << path);
+							modified.push_back(path);
+						}
+					}
 				}
+
+				queue_file_modifications(modified);
 			}
 
 #else
-			for(file_mod_handler_map::iterator i = m.begin(); i != m.end(); ++i) {
-				std::map<std::string, int64_t>::iterator mod_itor = mod_times.find(i->first);
-				const int64_t mod_time = file_mod_time(i->first);
-				if(mod_itor == mod_times.end()) {
-					mod_times[i->first] = mod_time;
-				} else if(mod_time != mod_itor->second) {
-					LOG_INFO("MODIFY: " << mod_itor->first);
-					mod_itor->second = mod_time;
-
-					threading::lock lck(get_mod_queue_mutex());
-					file_mod_notification_queue.insert(file_mod_notification_queue.end(), i->second.begin(), i->second.end());
+			for(const std::string& fname : new_files) {
+				mod_times[fname] = file_mod_time(fname);
+			}
+
+			std::vector<std::string> modified;
+			for(auto& p : mod_times) {
+				const int64_t mod_time = file_mod_time(p.first);
+				if(mod_time != p.second) {
+					LOG_INFO("MODIFY: " << p.first);
+					p.second = mod_time;
+					modified.push_back(p.first);
 				}
 			}
 
+			queue_file_modifications(modified);
+
 			profile::delay(100);
 #endif
 		}
+
+#ifdef __linux__
+		close(inotify_fd);
+#endif
 	}
 
 	threading::thread* file_mod_worker_thread = nullptr;
@@ -432,8 +561,21 @@ namespace sys
 			get_mod_map().clear();
 		}
 
+#ifdef __linux__
+		wake_file_mod_worker();
+#endif
+
 		delete file_mod_worker_thread;
 		file_mod_worker_thread = nullptr;
+
+#ifdef __linux__
+		for(int& fd : file_mod_wake_fds) {
+			if(fd != -1) {
+				close(fd);
+				fd = -1;
+			}
+		}
+#endif
 	}
 
 	std::string get_user_data_dir()
@@ -476,7 +618,18 @@ namespace sys
 		}
 
 		if(file_mod_worker_thread == nullptr) {
+#ifdef __linux__
+			if(file_mod_wake_fds[0] == -1 && pipe(file_mod_wake_fds) != 0) {
+				LOG_ERROR("COULD NOT CREATE FILE NOTIFY WAKE PIPE");
+				file_mod_wake_fds[0] = file_mod_wake_fds[1] = -1;
+				return handle;
+			}
+#endif
 			file_mod_worker_thread = new threading::thread("file_change_notify", file_mod_worker_thread_fn);
+		} else {
+#ifdef __linux__
+			wake_file_mod_worker();
+#endif
 		}
 
 		return handle;
@@ -504,10 +657,35 @@ namespace sys
 			return;
 		}
 
-		std::vector<std::function<void()> > v;
+		std::vector<std::string> paths;
 		{
+			const int now = profile::get_tick_time();
+
 			threading::lock lck(get_mod_queue_mutex());
-			v.swap(file_mod_notification_queue);
+			for(auto i = file_mod_notification_queue.begin(); i != file_mod_notification_queue.end(); ) {
+				if(now - i->second >= FileModSettleTimeMs) {
+					paths.push_back(i->first);
+					i = file_mod_notification_queue.erase(i);
+				} else {
+					++i;
+				}
+			}
+		}
+
+		if(paths.empty()) {
+			return;
+		}
+
+		std::vector<std::function<void()> > v;
+		{
+			threading::lock lck(get_mod_map_mutex());
+			for(const std::string& path : paths) {
+				auto itor = get_mod_map().find(path);
+				if(itor != get_mod_map().end()) {
+					LOG_INFO("FILE HANDLERS FOR " << path << ": " << itor->second.size());
+					v.insert(v.end(), itor->second.begin(), itor->second.end());
+				}
+			}
 		}
 
 		for(std::function<void()> f : v) {
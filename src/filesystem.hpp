@@ -67,6 +67,12 @@ namespace sys
 
 	long long file_mod_time(const std::string& fname);
 
+	//sets the modification time of an existing file to now.
+	void touch_file(const std::string& fname);
+
+	//size in bytes of a regular file, or 0 if it isn't one.
+	long long file_size(const std::string& fname);
+
 	void move_file(const std::string& from, const std::string& to);
 	void remove_file(const std::string& fname);
 	void copy_file(const std::string& from, const std::string& to);
@@ -2425,10 +2425,33 @@ namespace {
 			void emitVM(formula_vm::VirtualMachine& vm) const override {
 				left_->emitVM(vm);
 				right_->emitVM(vm);
-				vm.addInstruction(op_);
+				vm.addInstruction(getVMOp());
 			}
 	
 		private:
+			//the VM instruction for this operator, using the integer
+			//version when both operands are known to be ints.
+			OP getVMOp() const {
+				variant_type_ptr left_type = left_->queryVariantType();
+				variant_type_ptr right_type = right_->queryVariantType();
+				if(!left_type || !right_type || !left_type->is_type(variant::VARIANT_TYPE_INT) || !right_type->is_type(variant::VARIANT_TYPE_INT)) {
+					return op_;
+				}
+
+				switch(op_) {
+				case OP_ADD: return OP_INT_ADD;
+				case OP_SUB: return OP_INT_SUB;
+				case OP_MUL: return OP_INT_MUL;
+				case OP_LT: return OP_INT_LT;
+				case OP_GT: return OP_INT_GT;
+				case OP_LTE: return OP_INT_LTE;
+				case OP_GTE: return OP_INT_GTE;
+				case OP_EQ: return OP_INT_EQ;
+				case OP_NEQ: return OP_INT_NEQ;
+				default: return op_;
+				}
+			}
+
 			variant execute(const FormulaCallable& variables) const override {
 				const variant left = left_->evaluate(variables);
 				variant right = right_->evaluate(variables);
@@ -2746,9 +2769,7 @@ namespace {
 
 				if(left_->canCreateVM() && right_->canCreateVM()) {
 					formula_vm::VirtualMachine vm;
-					left_->emitVM(vm);
-					right_->emitVM(vm);
-					vm.addInstruction(op_);
+					emitVM(vm);
 					return ExpressionPtr(new VMExpression(vm, queryVariantType(), *this));
 				}
 
@@ -5419,6 +5440,30 @@ UNIT_TEST(short_circuit) {
 	f.execute(*callable);
 }
 
+UNIT_TEST(formula_vm_fused_ops) {
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	callable->add("x", variant(0));
+	callable->add("d", variant(decimal::from_string("2.5")));
+
+	//the add must not be fused with the else branch, since the other
+	//branch jumps to it.
+	Formula f(variant("2 + if(x, 1, 5)"));
+	CHECK_EQ(f.execute(*callable), variant(7));
+	callable->add("x", variant(1));
+	CHECK_EQ(f.execute(*callable), variant(3));
+
+	CHECK_EQ(Formula(variant("d < 3")).execute(*callable), variant::from_bool(true));
+	CHECK_EQ(Formula(variant("d + 1")).execute(*callable), variant(decimal::from_string("3.5")));
+
+	Formula typed(variant("def f(int a, int b) -> int if(a < b, a*b + 1, a - b); [f(x, 4), f(5, x), f(x+7, x-3)]"));
+	std::vector<variant> expected;
+	expected.push_back(variant(5));
+	expected.push_back(variant(4));
+	expected.push_back(variant(10));
+	CHECK_EQ(typed.execute(*callable), variant(&expected));
+}
+
 UNIT_TEST(formula_decimal) {
 	CHECK_EQ(Formula(variant("0.0005")).execute().string_cast(), "0.0005");
     CHECK_EQ(Formula(variant("0.005")).execute().string_cast(), "0.005");
@@ -5574,6 +5619,16 @@ BENCHMARK(formula_map_bench) {
 	}
 }
 
+//a map literal, which is built by OP_MAP each time it's evaluated.
+BENCHMARK(formula_map_literal_bench) {
+	Formula f(variant("{x: input, y: input + 1, w: input*2, h: input*3, name: 'rect', visible: true}"));
+	static MapFormulaCallable* callable = new MapFormulaCallable;
+	callable->add("input", variant(5));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
 BENCHMARK(formula_recurse_sort) {
 	Formula f(variant("def my_qsort(items) if(size(items) <= 1, items,"
 					  " my_qsort(filter(items, i, i < items[0])) +"
@@ -5635,6 +5690,15 @@ BENCHMARK(formula_add) {
 	}
 }
 
+BENCHMARK(formula_int_ops) {
+	Formula f(variant("map(range(input), if(value < 500, value*value + 5, value - 1))"));
+	static MapFormulaCallable* callable = new MapFormulaCallable;
+	callable->add("input", variant(1000));
+	BENCHMARK_LOOP {
+		f.execute(*callable);
+	}
+}
+
 COMMAND_LINE_UTILITY(test_multithread_variants) {
 	std::vector<variant> lists;
 
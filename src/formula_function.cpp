@@ -970,13 +970,11 @@ namespace game_logic
 
 			for(int n = 0; n+1 < static_cast<int>(NUM_ARGS); n += 2) {
 				args()[n]->emitVM(vm);
-				const int jump_source = vm.addJumpSource(OP_JMP_UNLESS);
-				vm.addInstruction(OP_POP);
+				const int jump_source = vm.addJumpSource(OP_POP_JMP_UNLESS);
 				args()[n+1]->emitVM(vm);
 				jump_to_end_sources.push_back(vm.addJumpSource(OP_JMP));
 
 				vm.jumpToEnd(jump_source);
-				vm.addInstruction(OP_POP);
 			}
 
 			if(NUM_ARGS%2 == 1) {
@@ -5755,8 +5753,8 @@ std::map<std::string, variant>& get_doc_cache(bool prefs_dir) {
 			//CustomObject::run_garbage_collection();
 			int gens = gens_;
 			bool mandatory = mandatory_;
+			//a level runner destroys the garbage a little each frame.
 			addAsynchronousWorkItem([=]() { runGarbageCollection(gens, mandatory); });
-			addAsynchronousWorkItem([=]() { reapGarbageCollection(); });
 		}
 	};
 
@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <map>
 #include <mutex>
+#include <sstream>
 #include <thread>
 
 #include <vector>
@@ -31,6 +32,9 @@ namespace {
 	int g_threads;
 	SDL_mutex* g_gc_mutex;
 
+	//number of GarbageCollectorUntrackedScope objects on this thread.
+	THREAD_LOCAL int g_untracked_scopes;
+
 	struct LockGC {
 		LockGC() {
 			if(g_gc_mutex) {
@@ -90,8 +94,23 @@ GarbageCollectible* GarbageCollectible::debugGetObject(void* ptr)
 	return NULL;
 }
 
+GarbageCollectorUntrackedScope::GarbageCollectorUntrackedScope()
+{
+	++g_untracked_scopes;
+}
+
+GarbageCollectorUntrackedScope::~GarbageCollectorUntrackedScope()
+{
+	--g_untracked_scopes;
+}
+
 GarbageCollectible::GarbageCollectible() : reference_counted_object(), prev_(nullptr), tenure_(0)
 {
+	if(g_untracked_scopes) {
+		next_ = this;
+		return;
+	}
+
 	LockGC lock;
 	next_ = g_head;
 	insertAtHead();
@@ -99,6 +118,11 @@ GarbageCollectible::GarbageCollectible() : reference_counted_object(), prev_(nul
 
 GarbageCollectible::GarbageCollectible(const GarbageCollectible& o) : reference_counted_object(o), prev_(nullptr), tenure_(0)
 {
+	if(g_untracked_scopes) {
+		next_ = this;
+		return;
+	}
+
 	LockGC lock;
 	next_ = g_head;
 	insertAtHead();
@@ -223,36 +247,73 @@ namespace {
 	};
 }
 
+namespace {
+	const int NumPauseBuckets = 9;
+
+	//indexed by GARBAGE_COLLECTION_PAUSE.
+	int g_pause_histograms[2][NumPauseBuckets];
+
+	void recordPause(GARBAGE_COLLECTION_PAUSE pause, double us)
+	{
+		int bucket = 0;
+		for(double limit = 1000.0; bucket < NumPauseBuckets-1 && us >= limit; limit *= 2.0) {
+			++bucket;
+		}
+
+		g_pause_histograms[pause][bucket]++;
+	}
+}
+
 class GarbageCollectorImpl : public GarbageCollector
 {
 public:
-	GarbageCollectorImpl(int num_gens=-1) : gens_(num_gens)
+	GarbageCollectorImpl(int num_gens=-1) : gens_(num_gens), next_reap_(0)
 	{}
 
 	void surrenderVariant(const variant* v, const char* description) override;
 	void surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollectible>* ptr, const char* description) override;
 
 	void collect();
-	void reap();
+
+	//destroys collected objects. Returns false if it ran out of time
+	//before destroying all of them; a negative time means no limit.
+	bool reap(int max_time_us=-1);
 	void debugOutputCollected();
 
 private:
 	void accumulateAll();
 	void performCollection();
 
-	void destroyReferences(GarbageCollectible* item);
-	void restoreReferences(GarbageCollectible* item);
+	//index of the object in items_, or -1 if it isn't being collected.
+	int findItem(const void* p) const;
+
+	void destroyReferences(int index);
+	void restoreReferences(int index);
 
 	std::vector<variant*> variants_;
 	std::vector<PointerPair> pointers_;
 
-	std::map<GarbageCollectible*, ObjectRecord> records_;
+	//records_[n] describes the references surrendered by items_[n].
+	std::vector<ObjectRecord> records_;
 
 	std::vector<GarbageCollectible*> items_, saved_;
 
 	int gens_;
+
+	//items_ before this index have already been destroyed by reap().
+	size_t next_reap_;
 };
 
+int GarbageCollectorImpl::findItem(const void* p) const
+{
+	auto itor = std::lower_bound(items_.begin(), items_.end(), p);
+	if(itor == items_.end() || *itor != p) {
+		return -1;
+	}
+
+	return static_cast<int>(itor - items_.begin());
+}
+
 void GarbageCollectorImpl::surrenderVariant(const variant* v, const char* description)
 {
 	switch(v->type_ ) {
@@ -262,7 +323,7 @@ void GarbageCollectorImpl::surrenderVariant(const variant* v, const char* descri
 	case variant::VARIANT_TYPE_FUNCTION:
 	case variant::VARIANT_TYPE_GENERIC_FUNCTION:
 	case variant::VARIANT_TYPE_MULTI_FUNCTION:
-		if(std::binary_search(items_.begin(), items_.end(), v->get_addr()) == false) {
+		if(findItem(v->get_addr()) == -1) {
 			break;
 		}
 
@@ -280,7 +341,7 @@ void GarbageCollectorImpl::surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollect
 		return;
 	}
 
-	if(std::binary_search(items_.begin(), items_.end(), ptr->get()) == false) {
+	if(findItem(ptr->get()) == -1) {
 		return;
 	}
 
@@ -289,11 +350,9 @@ void GarbageCollectorImpl::surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollect
 	ptr->reset();
 }
 
-void GarbageCollectorImpl::destroyReferences(GarbageCollectible* item)
+void GarbageCollectorImpl::destroyReferences(int index)
 {
-	auto itor = records_.find(item);
-	ASSERT_LOG(itor != records_.end(), "Could not find item in GC");
-	const ObjectRecord& record = itor->second;
+	const ObjectRecord& record = records_[index];
 	for(int n = record.begin_variant; n != record.end_variant; ++n) {
 		variants_[n]->increment_refcount();
 		*variants_[n] = variant();
@@ -301,11 +360,9 @@ void GarbageCollectorImpl::destroyReferences(GarbageCollectible* item)
 }
 
 
-void GarbageCollectorImpl::restoreReferences(GarbageCollectible* item)
+void GarbageCollectorImpl::restoreReferences(int index)
 {
-	auto itor = records_.find(item);
-	ASSERT_LOG(itor != records_.end(), "Could not find item in GC");
-	const ObjectRecord& record = itor->second;
+	const ObjectRecord& record = records_[index];
 	for(int n = record.begin_variant; n != record.end_variant; ++n) {
 		variants_[n]->increment_refcount();
 	}
@@ -325,7 +382,18 @@ void GarbageCollectorImpl::collect()
 	accumulateAll();
 	performCollection();
 
-	LOG_DEBUG("Garbage collection complete in " << static_cast<int>(timer.get_time()) << "us. Collected " << items_.size() << " objects. " << saved_.size() << " objects remaining; variants: " << variants_.size() << "; pointers: " << pointers_.size());
+	//objects which survived get their references back straight away;
+	//only destroying the garbage can be spread out by reap().
+	for(auto item : saved_) {
+		item->dec_reference();
+	}
+
+	saved_.clear();
+
+	const double us = timer.get_time();
+	recordPause(GC_PAUSE_COLLECT, us);
+
+	LOG_DEBUG("Garbage collection complete in " << static_cast<int>(us) << "us. Collected " << items_.size() << " objects; variants: " << variants_.size() << "; pointers: " << pointers_.size());
 }
 
 void GarbageCollectorImpl::accumulateAll()
@@ -349,12 +417,13 @@ void GarbageCollectorImpl::accumulateAll()
 
 	pointers_.reserve(items_.size()*2);
 	variants_.reserve(items_.size()*2);
+	records_.resize(items_.size());
 
-	for(GarbageCollectible* p : items_) {
-		ObjectRecord& record = records_[p];
+	for(size_t n = 0; n != items_.size(); ++n) {
+		ObjectRecord& record = records_[n];
 		record.begin_variant = variants_.size();
 		record.begin_pointer = pointers_.size();
-		p->surrenderReferences(this);
+		items_[n]->surrenderReferences(this);
 		record.end_variant = variants_.size();
 		record.end_pointer = pointers_.size();
 	}
@@ -362,46 +431,83 @@ void GarbageCollectorImpl::accumulateAll()
 
 void GarbageCollectorImpl::performCollection()
 {
-	int nlast = -1;
-	while(nlast != items_.size()) {
-		nlast = items_.size();
+	//an object is alive if something outside of the collection still
+	//references it, i.e. it has references other than our own. Giving a
+	//live object its references back may in turn make the objects it
+	//refers to alive, so propagate through a worklist until nothing else
+	//comes alive.
+	std::vector<char> alive(items_.size(), 0);
+	std::vector<int> worklist;
+	for(size_t n = 0; n != items_.size(); ++n) {
+		if(items_[n]->refcount() > 1) {
+			alive[n] = 1;
+			worklist.push_back(static_cast<int>(n));
+		}
+	}
 
-		int save_count = 0;
-		for(GarbageCollectible*& item : items_) {
-			if(item->refcount() == 1) {
-				continue;
-			}
+	while(worklist.empty() == false) {
+		const int index = worklist.back();
+		worklist.pop_back();
 
-			++save_count;
+		restoreReferences(index);
 
-			restoreReferences(item);
-			saved_.push_back(item);
-			item->tenure_++;
-			item = nullptr;
+		const ObjectRecord& record = records_[index];
+		for(int n = record.begin_variant; n != record.end_variant; ++n) {
+			const int target = findItem(variants_[n]->get_addr());
+			if(target != -1 && !alive[target] && items_[target]->refcount() > 1) {
+				alive[target] = 1;
+				worklist.push_back(target);
+			}
 		}
 
-		items_.erase(std::remove(items_.begin(), items_.end(), nullptr), items_.end());
+		for(int n = record.begin_pointer; n != record.end_pointer; ++n) {
+			const int target = findItem(pointers_[n].points_to);
+			if(target != -1 && !alive[target] && items_[target]->refcount() > 1) {
+				alive[target] = 1;
+				worklist.push_back(target);
+			}
+		}
 	}
 
-	for(auto item : items_) {
-		destroyReferences(item);
+	std::vector<GarbageCollectible*> garbage;
+	for(size_t n = 0; n != items_.size(); ++n) {
+		if(alive[n]) {
+			saved_.push_back(items_[n]);
+			items_[n]->tenure_++;
+		} else {
+			//garbage may be destroyed over several frames, so make sure
+			//nothing can reach it through a weak pointer in the meantime.
+			weak_ptr_base::release(items_[n]);
+			destroyReferences(static_cast<int>(n));
+			garbage.push_back(items_[n]);
+		}
 	}
+
+	items_.swap(garbage);
 }
 
-void GarbageCollectorImpl::reap()
+bool GarbageCollectorImpl::reap(int max_time_us)
 {
 	LockGC lock;
+	if(next_reap_ == items_.size()) {
+		return true;
+	}
+
 	profile::timer timer;
 
-	for(auto item : saved_) {
-		item->dec_reference();
-	}
+	while(next_reap_ != items_.size()) {
+		items_[next_reap_++]->dec_reference();
 
-	for(auto item : items_) {
-		item->dec_reference();
+		if(max_time_us >= 0 && (next_reap_%16) == 0 && timer.get_time() >= max_time_us) {
+			break;
+		}
 	}
 
-	LOG_DEBUG("Garbage collection reap in " << static_cast<int>(timer.get_time()) << "us.");
+	const double us = timer.get_time();
+	recordPause(GC_PAUSE_REAP, us);
+
+	LOG_DEBUG("Garbage collection reap in " << static_cast<int>(us) << "us. " << (items_.size() - next_reap_) << " objects left to reap.");
+	return next_reap_ == items_.size();
 }
 
 void GarbageCollectorImpl::debugOutputCollected()
@@ -762,6 +868,28 @@ void GarbageCollectorAnalyzer::run(const char* fname)
 
 namespace {
 	std::vector<std::shared_ptr<GarbageCollectorImpl>> g_reapable_gc;
+
+	//number of GarbageCollectionIncrementalReapScope objects.
+	int g_incremental_reap_scopes;
+
+	//must be called with the global GC mutex held.
+	void reapPendingGarbage(int max_time_us)
+	{
+		profile::timer timer;
+		while(g_reapable_gc.empty() == false) {
+			int remaining_us = -1;
+			if(max_time_us >= 0) {
+				remaining_us = std::max(0, max_time_us - static_cast<int>(timer.get_time()));
+			}
+
+			formula_profiler::Instrument instrument("GC");
+			if(g_reapable_gc.front()->reap(remaining_us) == false) {
+				return;
+			}
+
+			g_reapable_gc.erase(g_reapable_gc.begin());
+		}
+	}
 }
 
 void runGarbageCollection(int num_gens, bool mandatory)
@@ -774,23 +902,70 @@ void runGarbageCollection(int num_gens, bool mandatory)
 
 	std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex(), std::adopt_lock_t());
 	
-	reapGarbageCollection();
+	reapPendingGarbage(-1);
 
 	formula_profiler::Instrument instrument("GC");
 	std::shared_ptr<GarbageCollectorImpl> gc(new GarbageCollectorImpl(num_gens));
 	gc->collect();
-	gc->reap();
-//	g_reapable_gc.push_back(gc);
+	g_reapable_gc.push_back(gc);
+
+	//nothing will pump the reaper, so finish the job now.
+	if(g_incremental_reap_scopes == 0) {
+		reapPendingGarbage(-1);
+	}
+}
+
+GarbageCollectionIncrementalReapScope::GarbageCollectionIncrementalReapScope()
+{
+	++g_incremental_reap_scopes;
+}
+
+GarbageCollectionIncrementalReapScope::~GarbageCollectionIncrementalReapScope()
+{
+	--g_incremental_reap_scopes;
 }
 
-void reapGarbageCollection()
+void reapGarbageCollection(int max_time_us)
 {
-	for(auto gc : g_reapable_gc) {
-		formula_profiler::Instrument instrument("GC");
-		gc->reap();
+	if(g_reapable_gc.empty()) {
+		return;
+	}
+
+	if(max_time_us < 0) {
+		GarbageCollector::getGlobalMutex().lock();
+	} else if(GarbageCollector::getGlobalMutex().try_lock() == false) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex(), std::adopt_lock_t());
+	reapPendingGarbage(max_time_us);
+}
+
+std::vector<int> getGarbageCollectionPauseHistogram(GARBAGE_COLLECTION_PAUSE pause)
+{
+	return std::vector<int>(g_pause_histograms[pause], g_pause_histograms[pause] + NumPauseBuckets);
+}
+
+std::string getGarbageCollectionPauseSummary()
+{
+	std::ostringstream s;
+	const char* names[] = { "GC COLLECT PAUSES:", "GC REAP PAUSES:" };
+	for(int pause = 0; pause != 2; ++pause) {
+		s << names[pause];
+		for(int n = 0; n != NumPauseBuckets; ++n) {
+			if(n == NumPauseBuckets-1) {
+				s << " >=" << (1 << (n-1)) << "ms: ";
+			} else {
+				s << " <" << (1 << n) << "ms: ";
+			}
+
+			s << g_pause_histograms[pause][n];
+		}
+
+		s << "\n";
 	}
 
-	g_reapable_gc.clear();
+	return s.str();
 }
 
 void runGarbageCollectionDebug(const char* fname)
@@ -45,6 +45,17 @@ private:
 	int tenure_;
 };
 
+//while one exists, the collectibles the current thread creates aren't
+//tracked by the garbage collector, which can then run while the thread
+//works on them. Only for building acyclic data, such as parsed
+//documents, which reference counting alone frees.
+class GarbageCollectorUntrackedScope
+{
+public:
+	GarbageCollectorUntrackedScope();
+	~GarbageCollectorUntrackedScope();
+};
+
 class GarbageCollector
 {
 public:
@@ -62,6 +73,30 @@ private:
 	virtual void surrenderPtrInternal(ffl::IntrusivePtr<GarbageCollectible>* ptr, const char* description) = 0;
 };
 
+//while one exists, a frame loop calls reapGarbageCollection() with a time
+//limit each frame, so garbage found by runGarbageCollection() is left for
+//it to destroy a little at a time. Only for use on the main thread.
+class GarbageCollectionIncrementalReapScope
+{
+public:
+	GarbageCollectionIncrementalReapScope();
+	~GarbageCollectionIncrementalReapScope();
+};
+
+//collects garbage objects. If a GarbageCollectionIncrementalReapScope
+//exists, destroying them is left to reapGarbageCollection(). Otherwise,
+//such as on the headless and TBS servers, they're destroyed before this
+//returns.
 void runGarbageCollection(int num_gens=-1, bool mandatory=true);
-void reapGarbageCollection();
+
+//destroys objects found by earlier collections, stopping once max_time_us
+//microseconds have passed. A negative time means destroy all of them.
+void reapGarbageCollection(int max_time_us=-1);
+
+enum GARBAGE_COLLECTION_PAUSE { GC_PAUSE_COLLECT, GC_PAUSE_REAP };
+
+//counts of pauses of each length. The first bucket counts pauses under
+//1ms, bucket n pauses under 2^n ms, and the last bucket everything longer.
+std::vector<int> getGarbageCollectionPauseHistogram(GARBAGE_COLLECTION_PAUSE pause);
+std::string getGarbageCollectionPauseSummary();
 void runGarbageCollectionDebug(const char* fname);
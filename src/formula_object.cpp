@@ -42,6 +42,7 @@
 #include "json_parser.hpp"
 #include "module.hpp"
 #include "preferences.hpp"
+#include "preprocessor.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
 #include "uuid.hpp"
@@ -70,6 +71,46 @@ game_logic::FunctionSymbolTable* getClassFunctionSymbolTable()
 	return nullptr;
 }
 
+//source of FormulaObject generations. Every write takes a fresh value so
+//two objects can only share a generation by being copies of each other.
+unsigned long long g_formula_object_generation = 0;
+
+//true if every list and map reachable from a without going through another
+//object still has the generation of its counterpart in b. Objects are
+//compared separately, so references to them are not followed.
+bool containers_unmodified(const variant& a, const variant& b)
+{
+	if(a.is_list() != b.is_list() || a.is_map() != b.is_map()) {
+		return false;
+	}
+
+	if(a.is_list()) {
+		if(a.container_generation() != b.container_generation() || a.num_elements() != b.num_elements()) {
+			return false;
+		}
+
+		for(int n = 0; n != a.num_elements(); ++n) {
+			if(!containers_unmodified(a[n], b[n])) {
+				return false;
+			}
+		}
+	} else if(a.is_map()) {
+		if(a.container_generation() != b.container_generation() || a.num_elements() != b.num_elements()) {
+			return false;
+		}
+
+		for(auto i = a.as_map().begin(), j = b.as_map().begin(); i != a.as_map().end(); ++i, ++j) {
+			//object keys are ordered by address, so the two maps might
+			//not line up.
+			if(i->first.is_callable() || !containers_unmodified(i->first, j->first) || !containers_unmodified(i->second, j->second)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
 }
 
 namespace game_logic
@@ -1187,8 +1228,6 @@ std::map<std::string, std::string>& class_path_map()
 
 variant FormulaObject::generateDiff(variant before, variant b)
 {
-	variant a = deepClone(before);
-
 	std::vector<ffl::IntrusivePtr<FormulaObject> > objects;
 
 	std::map<boost::uuids::uuid, FormulaObject*> src, dst;
@@ -1199,7 +1238,7 @@ variant FormulaObject::generateDiff(variant before, variant b)
 			objects.push_back(obj);
 		}});
 
-	visitVariants(a, [&src,&objects](variant v) {
+	visitVariants(before, [&src,&objects](variant v) {
 		FormulaObject* obj = v.try_convert<FormulaObject>();
 		if(obj) {
 			src[obj->uuid()] = obj;
@@ -1217,35 +1256,56 @@ variant FormulaObject::generateDiff(variant before, variant b)
 
 	std::vector<variant> deltas;
 
-	std::set<FormulaObject*> seen;
 	for(auto i = src.begin(); i != src.end(); ++i) {
-		variant v(i->second);
-		mapObjectIntoDifferentTree(v, mapping, seen);
 		auto j = dst.find(i->first);
-		if(j != dst.end() && i->second->variables_ != j->second->variables_) {
-			std::map<variant, variant> node_delta;
-			node_delta[variant("_uuid")] = variant(write_uuid(i->second->uuid()));
-			if(i->second->variables_.size() < j->second->variables_.size()) {
-				i->second->variables_.resize(j->second->variables_.size());
+		if(j == dst.end()) {
+			continue;
+		}
+
+		if(i->second->generation_ == j->second->generation_ && i->second->variables_.size() == j->second->variables_.size()) {
+			//neither object has been written to since they were cloned
+			//from the same source. Lists and maps can still be changed
+			//in place, so they must be unmodified too.
+			bool unmodified = true;
+			for(int n = 0; n != i->second->variables_.size() && unmodified; ++n) {
+				unmodified = containers_unmodified(i->second->variables_[n], j->second->variables_[n]);
 			}
 
-			if(j->second->variables_.size() < i->second->variables_.size()) {
-				j->second->variables_.resize(i->second->variables_.size());
+			if(unmodified) {
+				continue;
 			}
+		}
 
-			for(int n = 0; n != j->second->variables_.size(); ++n) {
-				if(i->second->variables_[n] != j->second->variables_[n]) {
-					for(const PropertyEntry& e : i->second->class_->slots()) {
-						if(e.variable_slot == n) {
-							node_delta[e.name_variant] = j->second->variables_[n];
-							break;
-						}
+		//rather than cloning the whole of the before tree, copy just the
+		//variables of objects that may have changed and remap them.
+		std::vector<variant> before_vars = i->second->variables_;
+		for(variant& v : before_vars) {
+			mapReferencesIntoDifferentTree(v, mapping);
+		}
+
+		const std::vector<variant>& after_vars = j->second->variables_;
+		if(before_vars == after_vars) {
+			continue;
+		}
+
+		std::map<variant, variant> node_delta;
+		node_delta[variant("_uuid")] = variant(write_uuid(i->second->uuid()));
+		const int nvars = static_cast<int>(std::max(before_vars.size(), after_vars.size()));
+		before_vars.resize(nvars);
+
+		for(int n = 0; n != nvars; ++n) {
+			const variant after = n < static_cast<int>(after_vars.size()) ? after_vars[n] : variant();
+			if(before_vars[n] != after) {
+				for(const PropertyEntry& e : i->second->class_->slots()) {
+					if(e.variable_slot == n) {
+						node_delta[e.name_variant] = after;
+						break;
 					}
 				}
 			}
-
-			deltas.push_back(variant(&node_delta));
 		}
+
+		deltas.push_back(variant(&node_delta));
 	}
 
 	std::vector<variant> new_objects;
@@ -1314,6 +1374,8 @@ void FormulaObject::applyDiff(variant delta)
 
 			obj_itor->second->variables_[obj_itor->second->class_->slots()[prop_itor->second].variable_slot] = p.second;
 		}
+
+		obj_itor->second->markModified();
 	}
 }
 
@@ -1361,6 +1423,35 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		}
 	}
 
+	void FormulaObject::mapReferencesIntoDifferentTree(variant& v, const std::map<FormulaObject*, FormulaObject*>& mapping)
+	{
+		if(v.try_convert<FormulaObject>()) {
+			auto itor = mapping.find(v.try_convert<FormulaObject>());
+			if(itor != mapping.end()) {
+				v = variant(itor->second);
+			}
+		} else if(v.is_list()) {
+			std::vector<variant> result;
+			for(const variant& item : v.as_list()) {
+				result.push_back(item);
+				mapReferencesIntoDifferentTree(result.back(), mapping);
+			}
+
+			v = variant(&result);
+		} else if(v.is_map()) {
+			std::map<variant, variant> result;
+			for(const variant_pair& item : v.as_map()) {
+				variant key = item.first;
+				variant value = item.second;
+				mapReferencesIntoDifferentTree(key, mapping);
+				mapReferencesIntoDifferentTree(value, mapping);
+				result[key] = value;
+			}
+
+			v = variant(&result);
+		}
+	}
+
 	variant FormulaObject::deepClone(variant v)
 	{
 		std::map<FormulaObject*,FormulaObject*> mapping;
@@ -1394,14 +1485,18 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 				items.push_back(deepClone(v[n], mapping));
 			}
 
-			return variant(&items);
+			variant result(&items);
+			result.copy_container_generation(v);
+			return result;
 		} else if(v.is_map()) {
 			std::map<variant, variant> m;
 			for(const variant::map_pair& p : v.as_map()) {
 				m[deepClone(p.first, mapping)] = deepClone(p.second, mapping);
 			}
 
-			return variant(&m);
+			variant result(&m);
+			result.copy_container_generation(v);
+			return result;
 		} else {
 			return v;
 		}
@@ -1470,6 +1565,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 
 	FormulaObject::FormulaObject(const std::string& type, variant args)
 	  : new_in_update_(true), orphaned_(false),
+		generation_(++g_formula_object_generation),
 		class_(get_class(type)), private_data_(-1)
 	{
 		ASSERT_LOG(class_->is_library_only() == false || args.is_null(), "Creating instance of library class is illegal: " << type);
@@ -1562,6 +1658,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 
 	FormulaObject::FormulaObject(variant data)
 	  : WmlSerializableFormulaCallable(data["_uuid"].is_string() ? read_uuid(data["_uuid"].as_string()) : generate_uuid()), new_in_update_(true), orphaned_(false),
+		generation_(++g_formula_object_generation),
 		class_(get_class(data["@class"].as_string())), private_data_(-1)
 	{
 		if(class_->getBuiltinCtor()) {
@@ -1608,7 +1705,15 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 					property_overrides_.resize(itor->second+1);
 				}
 
-				property_overrides_[itor->second] = FormulaPtr(new Formula(p.second, getClassFunctionSymbolTable()));
+				variant formula_str = p.second;
+				static const std::string StrWithDebug = "@str_with_debug ";
+				if(formula_str.is_string() && formula_str.as_string().compare(0, StrWithDebug.size(), StrWithDebug) == 0) {
+					//documents which haven't been through the preprocessor,
+					//such as binary ones, still have the form we wrote.
+					formula_str = preprocess_string_value(formula_str.as_string());
+				}
+
+				property_overrides_[itor->second] = FormulaPtr(new Formula(formula_str, getClassFunctionSymbolTable()));
 			}
 		}
 
@@ -1620,6 +1725,11 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 	FormulaObject::~FormulaObject()
 	{}
 
+	void FormulaObject::markModified()
+	{
+		generation_ = ++g_formula_object_generation;
+	}
+
 	ffl::IntrusivePtr<FormulaObject> FormulaObject::clone() const
 	{
 		ffl::IntrusivePtr<FormulaObject> result(new FormulaObject(*this));
@@ -1795,6 +1905,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 	{
 		if(private_data_ != -1 && key == "_data") {
 			variables_[private_data_] = value;
+			markModified();
 			return;
 		}
 
@@ -1821,6 +1932,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 			case FIELD_PRIVATE:
 				ASSERT_NE(private_data_, -1);
 				variables_[private_data_] = value;
+				markModified();
 				return;
 			default:
 				ASSERT_LOG(false, "TRIED TO SET ILLEGAL KEY IN CLASS: " << BaseFields[slot]);
@@ -1852,6 +1964,7 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 			executeCommand(entry.setter->execute(*this));
 		} else if(entry.variable_slot != -1) {
 			variables_[entry.variable_slot] = value;
+			markModified();
 		} else {
 			ASSERT_LOG(false, "ILLEGAL WRITE PROPERTY ACCESS OF NON-WRITABLE VARIABLE " << entry.name << " IN CLASS " << class_->name());
 		}
@@ -2158,7 +2271,6 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 		return FormulaCallablePtr(get_library_object()->queryValue(id).mutable_callable());
 	}
 
-#if defined(USE_LUA)
 	formula_class_unit_test_helper::formula_class_unit_test_helper()
 	{
 		ASSERT_LOG(unit_test_class_node_map.size() == 0, "Tried to construct multiple helpers?");
@@ -2170,6 +2282,28 @@ void FormulaObject::mapObjectIntoDifferentTree(variant& v, const std::map<Formul
 	void formula_class_unit_test_helper::add_class_defn(const std::string & name, const variant & node) {
 		unit_test_class_node_map[name] = node;
 	}
-#endif
 
 }
+
+UNIT_TEST(formula_object_diff_sees_map_mutation) {
+	using namespace game_logic;
+
+	formula_class_unit_test_helper helper;
+	helper.add_class_defn("diff_test", Formula(variant("\
+{\
+	properties: {\
+		m : { type: \"map\", default: { key: 1 } },\
+	},\
+}")).execute());
+
+	variant obj = Formula(variant("construct(\"diff_test\")")).execute();
+	variant before = FormulaObject::deepClone(obj);
+
+	//the same in-place write set(obj.m.key, 2) makes, which doesn't
+	//touch the object itself.
+	obj.as_callable()->queryValue("m").add_attr_mutation(variant("key"), variant(2));
+
+	variant diff = FormulaObject::generateDiff(before, obj);
+	before.try_convert<FormulaObject>()->applyDiff(diff);
+	CHECK_EQ(before.as_callable()->queryValue("m")[variant("key")], variant(2));
+}
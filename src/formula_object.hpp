@@ -55,6 +55,10 @@ namespace game_logic
 		static void visitVariantObjects(const variant& v, const std::function<void (FormulaObject*)>& fn);
 		static void mapObjectIntoDifferentTree(variant& v, const std::map<FormulaObject*, FormulaObject*>& mapping, std::set<FormulaObject*>& seen);
 
+		//like mapObjectIntoDifferentTree() but only remaps references held
+		//directly in v, without descending into the objects it refers to.
+		static void mapReferencesIntoDifferentTree(variant& v, const std::map<FormulaObject*, FormulaObject*>& mapping);
+
 		void update(FormulaObject& updated);
 
 		static variant deepClone(variant v);
@@ -63,9 +67,18 @@ namespace game_logic
 		static void deepDestroy(variant v);
 		static void deepDestroy(variant v, std::set<FormulaObject*>& seen);
 		
+		//objects in a and b with the same uuid and the same generation are
+		//known to be unchanged and are not compared.
 		static variant generateDiff(variant a, variant b);
+
+		//patches this object tree in place.
 		void applyDiff(variant delta);
 
+		//a value which changes every time one of this object's variables
+		//is written. Copies and clones share the generation of their source
+		//until they are written to.
+		unsigned long long generation() const { return generation_; }
+
 
 		static void reloadClasses();
 		static void loadAllClasses();
@@ -113,6 +126,8 @@ namespace game_logic
 
 		void getInputs(std::vector<FormulaInput>* inputs) const override;
 
+		void markModified();
+
 		bool new_in_update_;
 		bool orphaned_;
 
@@ -123,6 +138,8 @@ namespace game_logic
 
 		std::vector<variant> variables_;
 
+		unsigned long long generation_;
+
 		ffl::IntrusivePtr<const FormulaClass> class_;
 
 		// for lua integration
@@ -147,7 +164,6 @@ namespace game_logic
 	bool can_load_library_instance(const std::string& id);
 	FormulaCallablePtr get_library_instance(const std::string& id);
 
-#if defined(USE_LUA)
 	class formula_class_unit_test_helper {
 	public:
 		formula_class_unit_test_helper();
@@ -155,5 +171,4 @@ namespace game_logic
 		void add_class_defn(const std::string & name, const variant & node);
 		//friend void TEST_lua_in_ffl_objects();
 	};
-#endif
 }
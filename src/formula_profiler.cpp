@@ -48,6 +48,7 @@
 #include "custom_object_type.hpp"
 #include "filesystem.hpp"
 #include "formatter.hpp"
+#include "formula_garbage_collector.hpp"
 #include "formula_profiler.hpp"
 #include "formula_function.hpp"
 #include "formula_function_registry.hpp"
@@ -1361,6 +1362,7 @@ namespace formula_profiler
 			std::ostringstream s;
 			s << "TOTAL SAMPLES: " << total_samples << "\n";
 			s << (100*empty_samples)/total_samples << "% (" << empty_samples << ") CORE ENGINE (non-FFL processing)\n";
+			s << getGarbageCollectionPauseSummary();
 
 			for(int n = 0; n != sorted_samples.size(); ++n) {
 				s << (100*sorted_samples[n].first)/total_samples << "% (" << sorted_samples[n].first << ") " << sorted_samples[n].second << "\n";
@@ -1571,6 +1573,19 @@ namespace formula_profiler
 		}
 
 		return variant(&result);
+
+	DEFINE_FIELD(gc_pauses, "{string -> [int]}")
+		std::map<variant,variant> m;
+		for(GARBAGE_COLLECTION_PAUSE pause : { GC_PAUSE_COLLECT, GC_PAUSE_REAP }) {
+			std::vector<variant> buckets;
+			for(int count : getGarbageCollectionPauseHistogram(pause)) {
+				buckets.push_back(variant(count));
+			}
+
+			m[variant(pause == GC_PAUSE_COLLECT ? "collect" : "reap")] = variant(&buckets);
+		}
+
+		return variant(&m);
 	END_DEFINE_CALLABLE(ProfilerInterface)
 
 	const std::string FunctionModule = "core";
@@ -1,3 +1,4 @@
+#include <iterator>
 #include <limits>
 #include <sstream>
 #include <vector>
@@ -41,16 +42,133 @@ static bool incrementVec(std::vector<int>& v, const std::vector<int>& max_values
 	return false;
 }
 
+VirtualMachine::InstructionType g_arg_instructions[] = { OP_LOOKUP, OP_JMP_IF, OP_JMP, OP_JMP_UNLESS, OP_POP_JMP_IF, OP_POP_JMP_UNLESS, OP_CALL, OP_CALL_BUILTIN, OP_CALL_BUILTIN_DYNAMIC, OP_ALGO_MAP, OP_ALGO_FILTER, OP_ALGO_FIND, OP_ALGO_COMPREHENSION, OP_UNDER, OP_PUSH_INT, OP_LOOKUP_SYMBOL_STACK, OP_WHERE, OP_INLINE_FUNCTION, OP_CONSTANT,
+	OP_ADD_INT_CONST, OP_LT_INT_CONST, OP_GT_INT_CONST, OP_LTE_INT_CONST, OP_GTE_INT_CONST, OP_EQ_INT_CONST, OP_NEQ_INT_CONST,
+	OP_INDEX_CONSTANT, OP_INDEX_STR_CONSTANT,
+	OP_INT_LT_POP_JMP_UNLESS, OP_INT_GT_POP_JMP_UNLESS, OP_INT_LTE_POP_JMP_UNLESS, OP_INT_GTE_POP_JMP_UNLESS, OP_INT_EQ_POP_JMP_UNLESS, OP_INT_NEQ_POP_JMP_UNLESS };
+
+bool isInstructionWithArg(VirtualMachine::InstructionType i) {
+	for(auto in : g_arg_instructions) {
+		if(in == i) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
-variant VirtualMachine::execute(const FormulaCallable& variables) const
-{
+//instructions whose argument is an index into the VM's constants.
+bool isConstantInstruction(VirtualMachine::InstructionType i) {
+	return i == OP_CONSTANT || i == OP_INDEX_CONSTANT || i == OP_INDEX_STR_CONSTANT;
+}
+
+//the comparison done by an op, counting from OP_INT_LT, OP_LT_INT_CONST
+//or OP_INT_LT_POP_JMP_UNLESS, which all list comparisons in the same order.
+template<typename T>
+bool compareValues(int cmp, const T& a, const T& b) {
+	switch(cmp) {
+	case 0: return a < b;
+	case 1: return a > b;
+	case 2: return a <= b;
+	case 3: return a >= b;
+	case 4: return a == b;
+	default: return a != b;
+	}
+}
+
+bool compareOperands(int cmp, const variant& a, const variant& b) {
+	if(a.is_int() && b.is_int()) {
+		return compareValues(cmp, a.as_int(), b.as_int());
+	}
+
+	return compareValues(cmp, a, b);
+}
+
+}
+
+namespace {
+//the stacks a formula runs on. They are kept for reuse once the formula
+//finishes, so that running a formula normally doesn't allocate.
+struct ExecutionContext {
 	std::vector<FormulaCallablePtr> variables_stack;
 	std::vector<variant> stack;
 	std::vector<variant> symbol_stack;
-	stack.reserve(8);
-	executeInternal(variables, variables_stack, stack, symbol_stack, &instructions_[0], &instructions_[0] + instructions_.size());
-	return stack.back();
+};
+
+//contexts not currently in use on this thread. Formulas may call functions
+//which run other formulas, so every execute() takes its own context.
+THREAD_LOCAL std::vector<ExecutionContext*>* g_free_contexts;
+
+//contexts whose stacks grew beyond this are freed rather than kept.
+const size_t MaxPooledStackSize = 1024;
+
+THREAD_LOCAL uint64_t g_executions, g_context_allocations, g_stack_reallocations;
+
+class ExecutionContextScope {
+public:
+	ExecutionContextScope() {
+		if(g_free_contexts == nullptr) {
+			g_free_contexts = new std::vector<ExecutionContext*>;
+		}
+
+		++g_executions;
+		if(g_free_contexts->empty()) {
+			++g_context_allocations;
+			ctx_ = new ExecutionContext;
+			ctx_->stack.reserve(8);
+		} else {
+			ctx_ = g_free_contexts->back();
+			g_free_contexts->pop_back();
+		}
+
+		stack_capacity_ = ctx_->stack.capacity();
+	}
+
+	~ExecutionContextScope() {
+		if(ctx_->stack.capacity() != stack_capacity_) {
+			++g_stack_reallocations;
+		}
+
+		ctx_->variables_stack.clear();
+		ctx_->stack.clear();
+		ctx_->symbol_stack.clear();
+
+		if(ctx_->stack.capacity() > MaxPooledStackSize || ctx_->symbol_stack.capacity() > MaxPooledStackSize) {
+			delete ctx_;
+		} else {
+			g_free_contexts->push_back(ctx_);
+		}
+	}
+
+	ExecutionContext& get() { return *ctx_; }
+private:
+	ExecutionContextScope(const ExecutionContextScope&);
+	void operator=(const ExecutionContextScope&);
+
+	ExecutionContext* ctx_;
+	size_t stack_capacity_;
+};
+}
+
+ExecutionStats getExecutionStats()
+{
+	ExecutionStats result;
+	result.executions = g_executions;
+	result.context_allocations = g_context_allocations;
+	result.stack_reallocations = g_stack_reallocations;
+	return result;
+}
+
+VirtualMachine::VirtualMachine() : last_op_(-1), jump_target_(-1)
+{
+}
+
+variant VirtualMachine::execute(const FormulaCallable& variables) const
+{
+	ExecutionContextScope scope;
+	ExecutionContext& ctx = scope.get();
+	executeInternal(variables, ctx.variables_stack, ctx.stack, ctx.symbol_stack, &instructions_[0], &instructions_[0] + instructions_.size());
+	return std::move(ctx.stack.back());
 }
 
 void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vector<FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2) const
@@ -92,7 +210,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 			if(left.as_bool() == false) {
 				stack.pop_back();
 			} else {
-				left = right;
+				left = std::move(right);
 				stack.pop_back();
 			}
 			break;
@@ -103,7 +221,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 			if(left.as_bool()) {
 				stack.pop_back();
 			} else {
-				left = right;
+				left = std::move(right);
 				stack.pop_back();
 			}
 			break;
@@ -215,6 +333,93 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 			break;
 		}
 
+		case OP_INT_ADD: {
+			variant& left = stack[stack.size()-2];
+			variant& right = stack[stack.size()-1];
+			if(left.is_int() && right.is_int()) {
+				left = variant(left.as_int() + right.as_int());
+			} else {
+				left = left + right;
+			}
+			stack.pop_back();
+			break;
+		}
+		case OP_INT_SUB: {
+			variant& left = stack[stack.size()-2];
+			variant& right = stack[stack.size()-1];
+			if(left.is_int() && right.is_int()) {
+				left = variant(left.as_int() - right.as_int());
+			} else {
+				left = left - right;
+			}
+			stack.pop_back();
+			break;
+		}
+		case OP_INT_MUL: {
+			variant& left = stack[stack.size()-2];
+			variant& right = stack[stack.size()-1];
+			if(left.is_int() && right.is_int()) {
+				left = variant(left.as_int() * right.as_int());
+			} else {
+				left = left * right;
+			}
+			stack.pop_back();
+			break;
+		}
+		case OP_INT_LT:
+		case OP_INT_GT:
+		case OP_INT_LTE:
+		case OP_INT_GTE:
+		case OP_INT_EQ:
+		case OP_INT_NEQ: {
+			variant& left = stack[stack.size()-2];
+			variant& right = stack[stack.size()-1];
+			left = variant::from_bool(compareOperands(*p - OP_INT_LT, left, right));
+			stack.pop_back();
+			break;
+		}
+
+		case OP_ADD_INT_CONST: {
+			++p;
+			variant& left = stack.back();
+			if(left.is_int()) {
+				left = variant(left.as_int() + *p);
+			} else {
+				left = left + variant(static_cast<int>(*p));
+			}
+			break;
+		}
+		case OP_LT_INT_CONST:
+		case OP_GT_INT_CONST:
+		case OP_LTE_INT_CONST:
+		case OP_GTE_INT_CONST:
+		case OP_EQ_INT_CONST:
+		case OP_NEQ_INT_CONST: {
+			const int cmp = *p - OP_LT_INT_CONST;
+			++p;
+			variant& left = stack.back();
+			if(left.is_int()) {
+				left = variant::from_bool(compareValues(cmp, left.as_int(), static_cast<int>(*p)));
+			} else {
+				left = variant::from_bool(compareValues(cmp, left, variant(static_cast<int>(*p))));
+			}
+			break;
+		}
+
+		case OP_INDEX_CONSTANT: {
+			++p;
+			variant& left = stack.back();
+			variant result = left[constants_[*p]];
+			left = result;
+			break;
+		}
+
+		case OP_INDEX_STR_CONSTANT: {
+			++p;
+			indexStr(stack.back(), constants_[*p], p, stack);
+			break;
+		}
+
 		case OP_UNARY_NOT: {
 			stack.back() = stack.back().as_bool() ? variant::from_bool(false) : variant::from_bool(true);
 			break;
@@ -290,24 +495,7 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 		}
 
 		case OP_INDEX_STR: {
-			variant& left = stack[stack.size()-2];
-			variant& right = stack[stack.size()-1];
-
-			if(left.is_callable()) {
-				variant result = left.as_callable()->queryValue(right.as_string());
-				left = result;
-			} else if(left.is_list() || left.is_map()) {
-				variant result = left[right];
-				left = result;
-			} else if(left.is_string()) {
-				const std::string& s = left.as_string();
-				unsigned int index = right.as_int();
-				ASSERT_LOG(index < s.length(), "index outside bounds: " << s << "[" << index << "]'\n'"  << debugPinpointLocation(p, stack));
-				left = variant(s.substr(index, 1));
-
-			} else {
-				ASSERT_LOG(false, "Illegal lookup in bytecode: " << left.to_debug_string() << " indexed by " << right.to_debug_string() << " expected map or object");
-			}
+			indexStr(stack[stack.size()-2], stack[stack.size()-1], p, stack);
 			stack.pop_back();
 			break;
 		}
@@ -332,10 +520,10 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 				stack.clear();
 				stack.push_back(v);
 			} else {
-				std::vector<variant> items(stack.end() - nitems, stack.end());
+				std::vector<variant> items(std::make_move_iterator(stack.end() - nitems), std::make_move_iterator(stack.end()));
 				variant v(&items);
 				stack.erase(stack.end() - nitems, stack.end());
-				stack.push_back(v);
+				stack.push_back(std::move(v));
 			}
 			break;
 		}
@@ -346,14 +534,12 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 
 			std::map<variant,variant> res;
 			for(size_t n = stack.size() - nitems; n+1 < stack.size(); n += 2) {
-				variant key = stack[n];
-				variant value = stack[n+1];
-				res[key] = value;
+				res[std::move(stack[n])] = std::move(stack[n+1]);
 			}
 
 			variant result(&res);
 			stack.resize(stack.size() - nitems);
-			stack.push_back(result);
+			stack.push_back(std::move(result));
 			break;
 		}
 
@@ -936,6 +1122,21 @@ void VirtualMachine::executeInternal(const FormulaCallable& variables, std::vect
 			break;
 		}
 
+		case OP_INT_LT_POP_JMP_UNLESS:
+		case OP_INT_GT_POP_JMP_UNLESS:
+		case OP_INT_LTE_POP_JMP_UNLESS:
+		case OP_INT_GTE_POP_JMP_UNLESS:
+		case OP_INT_EQ_POP_JMP_UNLESS:
+		case OP_INT_NEQ_POP_JMP_UNLESS: {
+			if(compareOperands(*p - OP_INT_LT_POP_JMP_UNLESS, stack[stack.size()-2], stack[stack.size()-1])) {
+				++p;
+			} else {
+				p += *(p+1);
+			}
+			stack.resize(stack.size()-2);
+			break;
+		}
+
 		case OP_LAMBDA_WITH_CLOSURE: {
 			const FormulaCallable& vars = variables_stack.empty() ? variables : *variables_stack.back();
 			stack.back() = stack.back().change_function_callable(vars);
@@ -1001,13 +1202,65 @@ void VirtualMachine::replaceInstructions(Iterator i1, Iterator i2, const std::ve
 
 	instructions_.erase(instructions_.begin() + i1.get_index(), instructions_.begin() + i2.get_index());
 	instructions_.insert(instructions_.begin() + i1.get_index(), new_instructions.begin(), new_instructions.end());
+	last_op_ = -1;
 }
 
 void VirtualMachine::addInstruction(OP op)
 {
+	if(fuseInstruction(op)) {
+		return;
+	}
+
+	last_op_ = static_cast<int>(instructions_.size());
 	instructions_.push_back(op);
 }
 
+bool VirtualMachine::canFuseWithLastInstruction() const
+{
+	if(last_op_ < 0 || jump_target_ == static_cast<int>(instructions_.size())) {
+		return false;
+	}
+
+	//make sure nothing but the instruction's own argument follows it.
+	return last_op_ + (isInstructionWithArg(instructions_[last_op_]) ? 2 : 1) == static_cast<int>(instructions_.size());
+}
+
+bool VirtualMachine::fuseInstruction(OP op)
+{
+	if(!canFuseWithLastInstruction()) {
+		return false;
+	}
+
+	const InstructionType prev = instructions_[last_op_];
+
+	if(prev == OP_CONSTANT && (op == OP_INDEX || op == OP_INDEX_STR)) {
+		instructions_[last_op_] = op == OP_INDEX ? OP_INDEX_CONSTANT : OP_INDEX_STR_CONSTANT;
+		return true;
+	}
+
+	if(prev != OP_PUSH_INT && prev != OP_PUSH_0 && prev != OP_PUSH_1) {
+		return false;
+	}
+
+	OP fused;
+	switch(op) {
+	case OP_ADD: case OP_INT_ADD: fused = OP_ADD_INT_CONST; break;
+	case OP_LT: case OP_INT_LT: fused = OP_LT_INT_CONST; break;
+	case OP_GT: case OP_INT_GT: fused = OP_GT_INT_CONST; break;
+	case OP_LTE: case OP_INT_LTE: fused = OP_LTE_INT_CONST; break;
+	case OP_GTE: case OP_INT_GTE: fused = OP_GTE_INT_CONST; break;
+	case OP_EQ: case OP_INT_EQ: fused = OP_EQ_INT_CONST; break;
+	case OP_NEQ: case OP_INT_NEQ: fused = OP_NEQ_INT_CONST; break;
+	default: return false;
+	}
+
+	const InstructionType value = prev == OP_PUSH_INT ? instructions_[last_op_+1] : (prev == OP_PUSH_1 ? 1 : 0);
+	instructions_.resize(last_op_);
+	instructions_.push_back(fused);
+	instructions_.push_back(value);
+	return true;
+}
+
 void VirtualMachine::addConstant(const variant& v)
 {
 	instructions_.push_back(static_cast<InstructionType>(constants_.size()));
@@ -1056,6 +1309,13 @@ void VirtualMachine::addLoadConstantInstruction(const variant& v)
 
 int VirtualMachine::addJumpSource(InstructionType i)
 {
+	if(i == OP_POP_JMP_UNLESS && canFuseWithLastInstruction() && instructions_[last_op_] >= OP_INT_LT && instructions_[last_op_] <= OP_INT_NEQ) {
+		instructions_[last_op_] = OP_INT_LT_POP_JMP_UNLESS + (instructions_[last_op_] - OP_INT_LT);
+		addInt(0);
+		return static_cast<int>(instructions_.size())-1;
+	}
+
+	last_op_ = static_cast<int>(instructions_.size());
 	instructions_.push_back(i);
 	addInt(0);
 	return static_cast<int>(instructions_.size())-1;
@@ -1064,6 +1324,7 @@ int VirtualMachine::addJumpSource(InstructionType i)
 void VirtualMachine::jumpToEnd(int source)
 {
 	instructions_[source] = static_cast<InstructionType>(instructions_.size()) - source;
+	jump_target_ = static_cast<int>(instructions_.size());
 }
 
 int VirtualMachine::getPosition() const
@@ -1074,14 +1335,11 @@ int VirtualMachine::getPosition() const
 void VirtualMachine::addJumpToPosition(InstructionType i, int pos)
 {
 	const int value = pos - getPosition() - 1;
+	last_op_ = static_cast<int>(instructions_.size());
 	instructions_.push_back(i);
 	addInt(value);
 }
 
-namespace {
-	VirtualMachine::InstructionType g_arg_instructions[] = { OP_LOOKUP, OP_JMP_IF, OP_JMP, OP_JMP_UNLESS, OP_POP_JMP_IF, OP_POP_JMP_UNLESS, OP_CALL, OP_CALL_BUILTIN, OP_CALL_BUILTIN_DYNAMIC, OP_ALGO_MAP, OP_ALGO_FILTER, OP_ALGO_FIND, OP_ALGO_COMPREHENSION, OP_UNDER, OP_PUSH_INT, OP_LOOKUP_SYMBOL_STACK, OP_WHERE, OP_INLINE_FUNCTION, OP_CONSTANT };
-}
-
 void VirtualMachine::append(const VirtualMachine& other)
 {
 	for(DebugInfo d : other.debug_info_) {
@@ -1108,7 +1366,7 @@ void VirtualMachine::append(const VirtualMachine& other)
 
 	for(size_t i = 0; i < other.instructions_.size(); ++i) {
 		instructions_.push_back(other.instructions_[i]);
-		if(instructions_.back() == OP_CONSTANT) {
+		if(isConstantInstruction(instructions_.back())) {
 			++i;
 
 			auto mapping = map_constants.find(static_cast<int>(other.instructions_[i]));
@@ -1117,24 +1375,14 @@ void VirtualMachine::append(const VirtualMachine& other)
 			} else {
 				instructions_.push_back(constants_.size() + other.instructions_[i]);
 			}
-		} else {
-		
-			bool need_skip = false;
-			for(auto in : g_arg_instructions) {
-				if(in == instructions_.back()) {
-					need_skip = true;
-					break;
-				}
-			}
-
-			if(need_skip) {
-				++i;
-				instructions_.push_back(other.instructions_[i]);
-			}
+		} else if(isInstructionWithArg(instructions_.back())) {
+			++i;
+			instructions_.push_back(other.instructions_[i]);
 		}
 	}
 
 	constants_.insert(constants_.end(), other_constants.begin(), other_constants.end());
+	last_op_ = -1;
 }
 
 void VirtualMachine::append(Iterator i1, Iterator i2, const VirtualMachine& other)
@@ -1243,6 +1491,17 @@ const char* getOpName(VirtualMachine::InstructionType op) {
 		  
 		  
 		  DEF_OP(OP_POW) DEF_OP(OP_DICE)
+
+		  DEF_OP(OP_INT_ADD) DEF_OP(OP_INT_SUB) DEF_OP(OP_INT_MUL)
+		  DEF_OP(OP_INT_LT) DEF_OP(OP_INT_GT) DEF_OP(OP_INT_LTE) DEF_OP(OP_INT_GTE) DEF_OP(OP_INT_EQ) DEF_OP(OP_INT_NEQ)
+
+		  DEF_OP(OP_ADD_INT_CONST)
+		  DEF_OP(OP_LT_INT_CONST) DEF_OP(OP_GT_INT_CONST) DEF_OP(OP_LTE_INT_CONST) DEF_OP(OP_GTE_INT_CONST) DEF_OP(OP_EQ_INT_CONST) DEF_OP(OP_NEQ_INT_CONST)
+
+		  DEF_OP(OP_INDEX_CONSTANT) DEF_OP(OP_INDEX_STR_CONSTANT)
+
+		  DEF_OP(OP_INT_LT_POP_JMP_UNLESS) DEF_OP(OP_INT_GT_POP_JMP_UNLESS) DEF_OP(OP_INT_LTE_POP_JMP_UNLESS)
+		  DEF_OP(OP_INT_GTE_POP_JMP_UNLESS) DEF_OP(OP_INT_EQ_POP_JMP_UNLESS) DEF_OP(OP_INT_NEQ_POP_JMP_UNLESS)
 		  default:
 		  	return "UNKNOWN";
 	}
@@ -1347,6 +1606,14 @@ std::string VirtualMachine::debugOutput(const VirtualMachine::InstructionType* i
 			s << ": OP_LOOKUP_SYMBOL_STACK ";
 			++n;
 			s << static_cast<int>(instructions_[n]) << "\n";
+		} else if(op >= OP_INT_LT_POP_JMP_UNLESS && op <= OP_INT_NEQ_POP_JMP_UNLESS) {
+			s << ": " << getOpName(op) << " ";
+			++n;
+			s << instructions_[n] << " ( -> " << (n + static_cast<int>(instructions_[n])) << ")\n";
+		} else if(op > OP_DICE && isInstructionWithArg(op)) {
+			s << ": " << getOpName(op) << " ";
+			++n;
+			s << static_cast<int>(instructions_[n]) << "\n";
 		} else {
 			s << ": " << getOpName(op) << "\n";
 		}
@@ -1397,6 +1664,24 @@ std::string VirtualMachine::debugPinpointLocation(const InstructionType* p, cons
 	return stream.str();
 }
 
+void VirtualMachine::indexStr(variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const
+{
+	if(left.is_callable()) {
+		variant result = left.as_callable()->queryValue(right.as_string());
+		left = result;
+	} else if(left.is_list() || left.is_map()) {
+		variant result = left[right];
+		left = result;
+	} else if(left.is_string()) {
+		const std::string& s = left.as_string();
+		unsigned int index = right.as_int();
+		ASSERT_LOG(index < s.length(), "index outside bounds: " << s << "[" << index << "]'\n'"  << debugPinpointLocation(p, stack));
+		left = variant(s.substr(index, 1));
+	} else {
+		ASSERT_LOG(false, "Illegal lookup in bytecode: " << left.to_debug_string() << " indexed by " << right.to_debug_string() << " expected map or object");
+	}
+}
+
 VirtualMachine::InstructionType VirtualMachine::Iterator::get() const
 {
 	return vm_->instructions_[index_];
@@ -1404,14 +1689,7 @@ VirtualMachine::InstructionType VirtualMachine::Iterator::get() const
 
 bool VirtualMachine::Iterator::has_arg() const
 {
-	auto cur = get();
-	for(auto in : g_arg_instructions) {
-		if(cur == in) {
-			return true;
-		}
-	}
-
-	return false;
+	return isInstructionWithArg(get());
 }
 
 VirtualMachine::InstructionType VirtualMachine::Iterator::arg() const
@@ -1445,7 +1723,7 @@ bool VirtualMachine::isInstructionLoop(InstructionType i)
 
 bool VirtualMachine::isInstructionJump(InstructionType i)
 {
-	return isInstructionLoop(i) || (i >= OP_JMP_IF && i <= OP_JMP);
+	return isInstructionLoop(i) || (i >= OP_JMP_IF && i <= OP_JMP) || (i >= OP_INT_LT_POP_JMP_UNLESS && i <= OP_INT_NEQ_POP_JMP_UNLESS);
 }
 
 UNIT_TEST(formula_vm) {
@@ -1459,6 +1737,61 @@ UNIT_TEST(formula_vm) {
 		vm.addConstant(variant(8));
 		vm.addInstruction(OP_ADD);
 		CHECK_EQ(vm.execute(*callable), variant(13));
+
+		//running again reuses the stacks from the first run.
+		const ExecutionStats before = getExecutionStats();
+		CHECK_EQ(vm.execute(*callable), variant(13));
+		const ExecutionStats after = getExecutionStats();
+		CHECK_EQ(after.executions, before.executions + 1);
+		CHECK_EQ(after.context_allocations, before.context_allocations);
+	}
+
+	{
+		//a push of a small int followed by a compare is fused, and falls
+		//back to a generic compare for a non-int operand.
+		VirtualMachine vm;
+		vm.addLoadConstantInstruction(variant(decimal::from_string("2.5")));
+		vm.addLoadConstantInstruction(variant(3));
+		vm.addInstruction(OP_INT_LT);
+		auto i = vm.begin_itor();
+		i.next();
+		CHECK_EQ(i.get(), OP_LT_INT_CONST);
+		CHECK_EQ(vm.execute(*callable), variant::from_bool(true));
+	}
+
+	{
+		//an int compare followed by a conditional jump is fused.
+		VirtualMachine vm;
+		vm.addLoadConstantInstruction(variant(100000));
+		vm.addLoadConstantInstruction(variant(200000));
+		vm.addInstruction(OP_INT_GT);
+		const int jump_source = vm.addJumpSource(OP_POP_JMP_UNLESS);
+		vm.addLoadConstantInstruction(variant("greater"));
+		const int jump_end = vm.addJumpSource(OP_JMP);
+		vm.jumpToEnd(jump_source);
+		vm.addLoadConstantInstruction(variant("not greater"));
+		vm.jumpToEnd(jump_end);
+
+		auto i = vm.begin_itor();
+		i.next();
+		i.next();
+		CHECK_EQ(i.get(), OP_INT_GT_POP_JMP_UNLESS);
+		CHECK_EQ(vm.execute(*callable), variant("not greater"));
+	}
+}
+
+BENCHMARK(formula_vm_execute)
+{
+	MapFormulaCallable* callable = new MapFormulaCallable;
+	variant ref(callable);
+	VirtualMachine vm;
+	vm.addInstruction(OP_CONSTANT);
+	vm.addConstant(variant(5));
+	vm.addInstruction(OP_CONSTANT);
+	vm.addConstant(variant(8));
+	vm.addInstruction(OP_ADD);
+	BENCHMARK_LOOP {
+		vm.execute(*callable);
 	}
 }
 
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "formula_callable.hpp"
@@ -275,9 +276,58 @@ enum OP {
 		  
 		  OP_POW='^', OP_DICE='d',
 
+		  //Integer versions of binary operators, emitted when the compiler
+		  //has proven both operands are ints. If an operand turns out not
+		  //to be an int they behave exactly like the generic operator.
+		  // POP: 2
+		  // PUSH: 1
+		  // ARGS: NONE
+		  OP_INT_ADD, OP_INT_SUB, OP_INT_MUL,
+		  OP_INT_LT, OP_INT_GT, OP_INT_LTE, OP_INT_GTE, OP_INT_EQ, OP_INT_NEQ,
+
+		  //Superinstructions for a binary operator whose right operand is
+		  //an integer given as the argument. Fused by addInstruction() from
+		  //OP_PUSH_INT, OP_PUSH_0 or OP_PUSH_1 followed by the operator.
+		  // POP: 1
+		  // PUSH: 1
+		  // ARGS: 1
+		  OP_ADD_INT_CONST,
+		  OP_LT_INT_CONST, OP_GT_INT_CONST, OP_LTE_INT_CONST, OP_GTE_INT_CONST, OP_EQ_INT_CONST, OP_NEQ_INT_CONST,
+
+		  //OP_CONSTANT followed by OP_INDEX or OP_INDEX_STR. Indexes the
+		  //top item on the stack by the constant given as the argument.
+		  // POP: 1
+		  // PUSH: 1
+		  // ARGS: 1
+		  OP_INDEX_CONSTANT, OP_INDEX_STR_CONSTANT,
+
+		  //An integer comparison followed by OP_POP_JMP_UNLESS. Pops both
+		  //operands and jumps n spaces forward unless the comparison holds.
+		  // POP: 2
+		  // PUSH: 0
+		  // ARGS: 1
+		  OP_INT_LT_POP_JMP_UNLESS, OP_INT_GT_POP_JMP_UNLESS, OP_INT_LTE_POP_JMP_UNLESS,
+		  OP_INT_GTE_POP_JMP_UNLESS, OP_INT_EQ_POP_JMP_UNLESS, OP_INT_NEQ_POP_JMP_UNLESS,
+
 		  };
 
 
+//counts kept by the VM for the calling thread since it started.
+struct ExecutionStats
+{
+	ExecutionStats() : executions(0), context_allocations(0), stack_reallocations(0)
+	{}
+
+	//number of times a formula was run.
+	uint64_t executions;
+
+	//number of times a run had to allocate new stacks, and number of
+	//times a run's value stack had to grow.
+	uint64_t context_allocations, stack_reallocations;
+};
+
+ExecutionStats getExecutionStats();
+
 class VirtualMachine
 {
 public:
@@ -285,6 +335,8 @@ public:
 	typedef unsigned short UnsignedInstructionType;
 	typedef int ExtInstructionType;
 
+	VirtualMachine();
+
 	static bool isInstructionLoop(InstructionType instruction);
 	static bool isInstructionJump(InstructionType instruction);
 
@@ -345,6 +397,16 @@ public:
 private:
 	void executeInternal(const game_logic::FormulaCallable& variables, std::vector<game_logic::FormulaCallablePtr>& variables_stack, std::vector<variant>& stack, std::vector<variant>& symbol_stack, const InstructionType* p, const InstructionType* p2) const;
 	std::string debugPinpointLocation(const InstructionType* p, const std::vector<variant>& stack) const;
+
+	//the lookup done by OP_INDEX_STR and OP_INDEX_STR_CONSTANT, which
+	//replaces left with left[right].
+	void indexStr(variant& left, const variant& right, const InstructionType* p, const std::vector<variant>& stack) const;
+
+	//tries to fuse op with the instruction before it into a
+	//superinstruction. Returns false if op must be added on its own.
+	bool fuseInstruction(OP op);
+	bool canFuseWithLastInstruction() const;
+
 	std::vector<InstructionType> instructions_;
 	std::vector<variant> constants_;
 
@@ -355,6 +417,14 @@ private:
 
 	std::vector<DebugInfo> debug_info_;
 	variant parent_formula_;
+
+	//position of the last instruction added with addInstruction() or
+	//addJumpSource(), or -1 if instructions have been spliced in since.
+	int last_op_;
+
+	//the most recent position made into a jump target by jumpToEnd().
+	//Nothing may be fused across it.
+	int jump_target_;
 };
 
 }
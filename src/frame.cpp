@@ -28,7 +28,9 @@
 
 #include <boost/lexical_cast.hpp>
 
+#include "ColorScope.hpp"
 #include "DisplayDevice.hpp"
+#include "ModelMatrixScope.hpp"
 #include "TextureUtils.hpp"
 #include "WindowManager.hpp"
 
@@ -351,6 +353,8 @@ Frame::Frame(variant node)
 		buildAlpha();
 	}
 
+	buildCollisionMasks();
+
 	for(const variant_pair& value : node.as_map()) {
 		static const std::string PivotPrefix = "pivot_";
 		const std::string& attr = value.first.as_string();
@@ -668,6 +672,76 @@ void Frame::buildAlpha()
 	}
 }
 
+Frame::CollisionMask::CollisionMask(int width, int height)
+	: width_(std::max(width, 0)), height_(std::max(height, 0)), words_per_row_((width_ + 63)/64),
+	  bits_(words_per_row_*height_, 0)
+{
+}
+
+void Frame::CollisionMask::set(int x, int y)
+{
+	ASSERT_LOG(x >= 0 && y >= 0 && x < width_ && y < height_, "Collision mask pixel out of range: " << x << ", " << y);
+	bits_[y*words_per_row_ + x/64] |= uint64_t(1) << (x%64);
+}
+
+uint64_t Frame::CollisionMask::getBits(int x, int y) const
+{
+	if(y < 0 || y >= height_) {
+		return 0;
+	}
+
+	const int index = x >= 0 ? x/64 : -((-x + 63)/64);
+	const int shift = x - index*64;
+	if(shift == 0) {
+		return getWord(y, index);
+	}
+
+	return (getWord(y, index) >> shift) | (getWord(y, index+1) << (64 - shift));
+}
+
+void Frame::buildCollisionMasks()
+{
+	collision_masks_.clear();
+	if(alpha_.empty() || collision_areas_.empty()) {
+		return;
+	}
+
+	//the same lookup getAlphaItor() does, done once per pixel up front.
+	const int w = width();
+	const int h = height();
+	collision_masks_.reserve(nframes_*2);
+	for(int n = 0; n < nframes_; ++n) {
+		for(int face_right = 0; face_right != 2; ++face_right) {
+			CollisionMask mask(w, h);
+			for(int y = 0; y != h; ++y) {
+				const int src_y = static_cast<int>(y / scale_);
+				for(int x = 0; x != w; ++x) {
+					const int src_x = static_cast<int>((face_right ? x : w - x - 1) / scale_);
+					if(src_x >= img_rect_.w() || src_y >= img_rect_.h()) {
+						continue;
+					}
+
+					if(!alpha_[src_y*img_rect_.w()*nframes_ + n*img_rect_.w() + src_x]) {
+						mask.set(x, y);
+					}
+				}
+			}
+
+			collision_masks_.emplace_back(mask);
+		}
+	}
+}
+
+const Frame::CollisionMask* Frame::getCollisionMask(int time, bool face_right) const
+{
+	if(collision_masks_.empty()) {
+		return nullptr;
+	}
+
+	const int nframe = std::max(0, std::min(frameNumber(time), nframes_ - 1));
+	return &collision_masks_[nframe*2 + (face_right ? 1 : 0)];
+}
+
 bool Frame::isAlpha(int x, int y, int time, bool face_right) const
 {
 	std::vector<bool>::const_iterator itor = getAlphaItor(x, y, time, face_right);
@@ -883,6 +957,102 @@ void Frame::drawBatch(graphics::AnuraShaderPtr shader, const BatchDrawItem* i1,
 	wnd->render(&frame->blit_target_);
 }
 
+bool Frame::canAutoBatch() const
+{
+	return blit_target_.getTexture() != nullptr &&
+	       !blit_target_.isBlendModeSet() &&
+	       !blit_target_.isBlendEquationSet() &&
+	       !blit_target_.isColorSet() &&
+	       !blit_target_.hasClipSettings() &&
+	       !blit_target_.getCamera() &&
+	       !blit_target_.getRenderTarget();
+}
+
+Frame::AutoBatch::AutoBatch()
+{
+}
+
+void Frame::AutoBatch::add(const Frame& frame, int x, int y, bool face_right, bool upside_down, int time)
+{
+	const KRE::TexturePtr& tex = frame.blit_target_.getTexture();
+	const KRE::ShaderProgramPtr& shader = frame.blit_target_.getShader();
+	const KRE::Color& color = KRE::ColorScope::getCurrentColor();
+	if(!vertices_.empty() && (tex != texture_ || shader != shader_ || !(color == color_))) {
+		flush();
+	}
+
+	texture_ = tex;
+	shader_ = shader;
+	color_ = color;
+
+	const rect old_src_rect = tex->getSourceRect();
+
+	const FrameInfo* info = nullptr;
+	frame.getRectInTexture(time, info);
+
+	tex->setSourceRect(0, old_src_rect);
+
+	//this matches the geometry Frame::draw() builds: the blittable is
+	//centred on an integer position with a float half-size offset.
+	x += static_cast<int>((face_right ? info->x_adjust : info->x2_adjust) * frame.scale_);
+	y += static_cast<int>(info->y_adjust * frame.scale_);
+	const int w = static_cast<int>(info->area.w() * frame.scale_);
+	const int h = static_cast<int>(info->area.h() * frame.scale_);
+
+	const float cx = static_cast<float>(x + w/2) - w/2.0f;
+	const float cy = static_cast<float>(y + h/2) - h/2.0f;
+
+	const float vx1 = face_right ? cx : cx + w;
+	const float vx2 = face_right ? cx + w : cx;
+	const float vy1 = upside_down ? cy + h : cy;
+	const float vy2 = upside_down ? cy : cy + h;
+
+	const glm::mat4& model = KRE::get_global_model_matrix();
+	auto transform = [&model](float vx, float vy) {
+		const glm::vec4 v = model * glm::vec4(vx, vy, 0.0f, 1.0f);
+		return glm::vec2(v.x, v.y);
+	};
+
+	const glm::vec2 p1 = transform(vx1, vy1);
+	const glm::vec2 p2 = transform(vx2, vy1);
+	const glm::vec2 p3 = transform(vx1, vy2);
+	const glm::vec2 p4 = transform(vx2, vy2);
+
+	const rectf& r = info->draw_rect;
+	vertices_.emplace_back(p1, glm::vec2(r.x1(), r.y1()));
+	vertices_.emplace_back(p2, glm::vec2(r.x2(), r.y1()));
+	vertices_.emplace_back(p3, glm::vec2(r.x1(), r.y2()));
+	vertices_.emplace_back(p3, glm::vec2(r.x1(), r.y2()));
+	vertices_.emplace_back(p2, glm::vec2(r.x2(), r.y1()));
+	vertices_.emplace_back(p4, glm::vec2(r.x2(), r.y2()));
+}
+
+void Frame::AutoBatch::flush()
+{
+	if(vertices_.empty()) {
+		return;
+	}
+
+	if(!blit_) {
+		blit_.reset(new KRE::Blittable);
+		blit_->setDrawMode(KRE::DrawMode::TRIANGLES);
+		//the vertices have already been through the model matrix.
+		blit_->useGlobalModelMatrix(true);
+	}
+
+	blit_->setTexture(texture_);
+	blit_->setShader(shader_);
+
+	KRE::ColorScope color_scope(color_);
+	auto wnd = KRE::WindowManager::getMainWindow();
+	blit_->update(&vertices_);
+	wnd->render(blit_.get());
+
+	vertices_.clear();
+	texture_.reset();
+	shader_.reset();
+}
+
 void Frame::drawCustom(graphics::AnuraShaderPtr shader, int x, int y, const std::vector<CustomPoint>& points, const rect* area, bool face_right, bool upside_down, int time, float rotation) const
 {
 	KRE::Blittable blit;
@@ -23,6 +23,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -74,6 +76,36 @@ public:
 	std::vector<bool>::const_iterator getAlphaItor(int x, int y, int time, bool face_right) const;
 	const std::vector<bool>& getAlphaBuf() const { return alpha_; }
 
+	//A bit per pixel, set where the pixel is opaque, packed into rows of
+	//64-bit words so that overlaps can be tested a row at a time. Uses the
+	//same coordinates as isAlpha().
+	class CollisionMask
+	{
+	public:
+		CollisionMask(int width, int height);
+		int width() const { return width_; }
+		int height() const { return height_; }
+		void set(int x, int y);
+		bool test(int x, int y) const {
+			return x >= 0 && y >= 0 && x < width_ && y < height_ && ((bits_[y*words_per_row_ + x/64] >> (x%64)) & 1) != 0;
+		}
+
+		//the 64 pixels on row y starting at x, with pixel x in the lowest
+		//bit. Pixels outside the mask are clear.
+		uint64_t getBits(int x, int y) const;
+	private:
+		uint64_t getWord(int y, int index) const {
+			return index >= 0 && index < words_per_row_ ? bits_[y*words_per_row_ + index] : 0;
+		}
+
+		int width_, height_, words_per_row_;
+		std::vector<uint64_t> bits_;
+	};
+
+	//the opaque pixels at the given time, or nullptr if the frame has no
+	//alpha information. Only built for frames with collision areas.
+	const CollisionMask* getCollisionMask(int time, bool face_right) const;
+
 	void draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right=true, bool upside_down=false, int time=0, float rotate=0) const;
 	void draw(graphics::AnuraShaderPtr shader, int x, int y, bool face_right, bool upside_down, int time, float rotate, float scale) const;
 	void draw(graphics::AnuraShaderPtr shader, int x, int y, const rect& area, bool face_right=true, bool upside_down=false, int time=0, float rotate=0) const;
@@ -99,6 +131,32 @@ public:
 
 	static void drawBatch(graphics::AnuraShaderPtr shader, const BatchDrawItem* i1, const BatchDrawItem* i2);
 
+	//true if the frame has no blend mode, color or render state of its own,
+	//so it can be drawn through an AutoBatch.
+	bool canAutoBatch() const;
+
+	//Collects unrotated, unscaled sprites which share a texture, shader and
+	//color and draws them with a single draw call. Vertices are transformed
+	//by the model matrix when they're added so sprites drawn under different
+	//model matrices can still share a batch.
+	class AutoBatch {
+	public:
+		AutoBatch();
+
+		//queues the sprite that draw(nullptr, x, y, face_right, upside_down, time)
+		//would draw, flushing first if it can't join the current batch.
+		void add(const Frame& frame, int x, int y, bool face_right, bool upside_down, int time);
+		void flush();
+
+		bool empty() const { return vertices_.empty(); }
+	private:
+		KRE::TexturePtr texture_;
+		KRE::ShaderProgramPtr shader_;
+		KRE::Color color_;
+		std::vector<KRE::vertex_texcoord> vertices_;
+		std::unique_ptr<KRE::Blittable> blit_;
+	};
+
 	void setImageAsSolid();
 	ConstSolidInfoPtr solid() const { return solid_; }
 	ConstSolidInfoPtr platform() const { return platform_; }
@@ -213,7 +271,11 @@ private:
 
 	void buildAlphaFromFrameInfo();
 	void buildAlpha();
+	void buildCollisionMasks();
 	std::vector<bool> alpha_;
+
+	//indexed by frame number*2 + face_right.
+	std::vector<CollisionMask> collision_masks_;
 	bool allow_wrapping_;
 	bool force_no_alpha_;
 
@@ -22,6 +22,15 @@
 */
 
 #include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "asserts.hpp"
 #include "code_editor_dialog.hpp"
@@ -31,6 +40,7 @@
 #include "formula_callable.hpp"
 #include "formula_constants.hpp"
 #include "formula_function.hpp"
+#include "formula_garbage_collector.hpp"
 #include "formula_object.hpp"
 #include "json_parser.hpp"
 #include "json_tokenizer.hpp"
@@ -40,9 +50,13 @@
 #include "preprocessor.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
+PREF_BOOL(json_disk_cache, true, "Cache parsed documents on disk so unchanged files don't have to be parsed again");
+PREF_INT(json_disk_cache_size_mb, 64, "Size the on-disk parse cache is pruned back to, least recently used entries first");
+
 namespace game_logic 
 {
 	void remove_formula_function_cached_doc(const std::string& name);
@@ -263,11 +277,38 @@ namespace json
 		};
 
 		std::set<std::string> filename_registry;
+		std::mutex filename_registry_mutex;
+
+		const std::string* register_filename(const std::string& fname)
+		{
+			std::lock_guard<std::mutex> lock(filename_registry_mutex);
+			return &*filename_registry.insert(fname).first;
+		}
+
+		//thrown when parsing on a worker thread reaches something only
+		//the main thread can do.
+		struct WorkerParseUnsupported {};
+
+		//counts preprocessor directives seen whose results depend on
+		//something other than the text of the document, such as @include
+		//or @eval. Documents which use them can't be cached on disk.
+		int g_num_environment_directives = 0;
+
+		bool is_environment_directive(const std::string& s)
+		{
+			return s.size() > 1 && s[0] == '@' && s[1] != '@' &&
+			       s != "@base" && s != "@derive" && s != "@merge" &&
+			       s != "@call" && s != "@flatten";
+		}
 
+		//in_worker means we're on a worker thread, where the preprocessor
+		//can't run since its directives may run FFL. Any string it would
+		//act on throws WorkerParseUnsupported instead.
 		variant parse_internal(const std::string& doc, const std::string& fname,
 							   JSON_PARSE_OPTIONS options,
 							   std::map<std::string, JsonMacroPtr>* macros,
-							   const game_logic::FormulaCallable* callable)
+							   const game_logic::FormulaCallable* callable,
+							   bool in_worker=false)
 		{
 			std::map<std::string, JsonMacroPtr> macros_buf;
 			if(!macros) {
@@ -276,10 +317,8 @@ namespace json
 
 			bool use_preprocessor = options == JSON_PARSE_OPTIONS::USE_PREPROCESSOR;
 
-			std::set<std::string>::const_iterator filename_itor = filename_registry.insert(fname).first;
-
 			variant::debug_info debug_info;
-			debug_info.filename = &*filename_itor;
+			debug_info.filename = register_filename(fname);
 			debug_info.line = 1;
 			debug_info.column = 1;
 
@@ -363,7 +402,7 @@ namespace json
 						} else if(begin_macro) {
 							(*macros)[name.as_string()].reset(new JsonMacro(std::string(begin_macro, t.end), *macros));
 							use_preprocessor = true;
-						} else if(use_preprocessor && v.is_map() && game_logic::WmlSerializableFormulaCallable::deserializeObj(v, &v)) {
+						} else if(use_preprocessor && !in_worker && v.is_map() && game_logic::WmlSerializableFormulaCallable::deserializeObj(v, &v)) {
 							stack.back().add(name, v);
 						} else {
 							stack.back().add(name, v);
@@ -427,13 +466,25 @@ namespace json
 				
 						bool is_macro = false;
 						bool is_flatten = false;
-						if(use_preprocessor) {
+						if(use_preprocessor && in_worker) {
+							//serialized objects are also marked by keys
+							//starting with '@', so are caught here too.
+							if(!s.empty() && s[0] == '@') {
+								throw WorkerParseUnsupported();
+							}
+
+							v = variant(s);
+						} else if(use_preprocessor) {
 							const std::string Macro = "@macro ";
 							if(stack.back().type == VAL_TYPE::OBJ && s.size() > Macro.size() && std::equal(Macro.begin(), Macro.end(), s.begin())) {
 								s.erase(s.begin(), s.begin() + Macro.size());
 								is_macro = true;
 							}
 
+							if(is_environment_directive(s)) {
+								++g_num_environment_directives;
+							}
+
 							try {
 								v = preprocess_string_value(s, callable);
 
@@ -575,12 +626,222 @@ namespace json
 		return parse_internal(doc, "", options, nullptr, nullptr);
 	}
 
+	namespace
+	{
+		typedef std::pair<std::string, JSON_PARSE_OPTIONS> CacheKey;
+
+		//the on-disk cache is keyed on the hash of the document's contents,
+		//so an entry can never be stale; editing a file just means a
+		//different entry is used. The filename is part of the key too since
+		//it's recorded in the document's debug info.
+		std::string get_disk_cache_dir()
+		{
+			return std::string(preferences::user_data_path()) + "/parse_cache/";
+		}
+
+		std::string get_disk_cache_path(const std::string& fname, const CacheKey& key)
+		{
+			return get_disk_cache_dir() + md5::sum(key.first + ":" + fname) + (key.second == JSON_PARSE_OPTIONS::USE_PREPROCESSOR ? "-p" : "-n") + ".fbv";
+		}
+
+		//Since every edit to a file makes a new entry, the cache is pruned
+		//back to json_disk_cache_size_mb the first time each process writes
+		//to it, deleting the least recently used entries. Reading an entry
+		//updates its modification time, so it's ordered by last use. Temporary
+		//files left behind by a process which died mid-write are removed
+		//once they're an hour old.
+		void prune_disk_cache()
+		{
+			const std::string dir = get_disk_cache_dir();
+			std::vector<std::string> files;
+			sys::get_files_in_dir(dir, &files);
+
+			const long long now = static_cast<long long>(time(nullptr));
+
+			std::vector<std::pair<long long, std::string> > entries;
+			long long total_size = 0;
+			for(const std::string& f : files) {
+				const std::string path = dir + f;
+				const long long mod_time = sys::file_mod_time(path);
+				try {
+					if(f.size() > 4 && std::equal(f.end()-4, f.end(), ".tmp")) {
+						if(now - mod_time > 60*60) {
+							sys::remove_file(path);
+						}
+					} else if(f.size() > 4 && std::equal(f.end()-4, f.end(), ".fbv")) {
+						entries.push_back(std::make_pair(mod_time, path));
+						total_size += sys::file_size(path);
+					}
+				} catch(std::exception&) {
+				}
+			}
+
+			const long long max_size = static_cast<long long>(g_json_disk_cache_size_mb)*1024*1024;
+			if(total_size <= max_size) {
+				return;
+			}
+
+			std::sort(entries.begin(), entries.end());
+			int nremoved = 0;
+			for(const auto& entry : entries) {
+				if(total_size <= max_size) {
+					break;
+				}
+
+				try {
+					const long long size = sys::file_size(entry.second);
+					sys::remove_file(entry.second);
+					total_size -= size;
+					++nremoved;
+				} catch(std::exception&) {
+				}
+			}
+
+			LOG_INFO("Pruned " << nremoved << " entries from the parse cache");
+		}
+
+		//a name for a temporary file that no other thread or process
+		//is writing.
+		std::string get_disk_cache_tmp_path(const std::string& path)
+		{
+			static std::atomic<int> counter(0);
+#if defined(_MSC_VER)
+			const int pid = static_cast<int>(_getpid());
+#else
+			const int pid = static_cast<int>(getpid());
+#endif
+			return formatter() << path << "." << pid << "." << ++counter << ".tmp";
+		}
+
+		bool read_disk_cache(const std::string& fname, const CacheKey& key, variant* result)
+		{
+			if(!g_json_disk_cache) {
+				return false;
+			}
+
+			const std::string path = get_disk_cache_path(fname, key);
+			if(!sys::file_exists(path)) {
+				return false;
+			}
+
+			const std::string data = sys::read_file(path);
+			if(variant_binary::read(data.c_str(), data.size(), result, register_filename)) {
+				try {
+					sys::touch_file(path);
+				} catch(std::exception&) {
+				}
+				return true;
+			}
+
+			LOG_WARN("Discarding invalid parse cache entry: " << path);
+			try {
+				sys::remove_file(path);
+			} catch(std::exception&) {
+			}
+
+			return false;
+		}
+
+		void write_disk_cache(const std::string& fname, const CacheKey& key, const variant& doc)
+		{
+			if(!g_json_disk_cache) {
+				return;
+			}
+
+			std::string data;
+			if(!variant_binary::write(doc, &data, variant_binary::WRITE_DEBUG_INFO|variant_binary::REJECT_OBJECTS)) {
+				//the document contains objects, which we don't cache since
+				//only references to them would be written.
+				return;
+			}
+
+			static std::once_flag pruned;
+			std::call_once(pruned, prune_disk_cache);
+
+			//write to a temporary file and move it into place, so another
+			//process never sees a partially written entry.
+			const std::string path = get_disk_cache_path(fname, key);
+			const std::string tmp_path = get_disk_cache_tmp_path(path);
+			try {
+				sys::write_file(tmp_path, data);
+				sys::move_file(tmp_path, path);
+			} catch(std::exception& e) {
+				LOG_WARN("Could not write parse cache entry " << path << ": " << e.what());
+				try {
+					sys::remove_file(tmp_path);
+				} catch(std::exception&) {
+				}
+			}
+		}
+	}
+
+	namespace
+	{
+		//documents parsed ahead of time, each of which is used once.
+		std::map<std::string, PrefetchedDocument> prefetched_documents;
+	}
+
+	bool parse_in_worker(const std::string& fname, const std::string& data, JSON_PARSE_OPTIONS options, PrefetchedDocument* result)
+	{
+		result->hash = md5::sum(data);
+		result->options = options;
+		result->doc = variant();
+
+		if(data.empty()) {
+			return false;
+		}
+
+		//binary documents may refer to objects, which only the main
+		//thread can resolve.
+		if(variant_binary::is_binary_document(data.c_str(), data.size())) {
+			return false;
+		}
+
+		//the document is built untracked by the garbage collector, so it
+		//can run meanwhile. Documents don't have cycles to collect.
+		const GarbageCollectorUntrackedScope untracked_scope;
+
+		//documents which aren't files aren't worth caching on disk.
+		const CacheKey key(result->hash, options);
+		if(!fname.empty() && read_disk_cache(fname, key, &result->doc)) {
+			return true;
+		}
+
+		try {
+			const VariantWorkerThreadScope worker_scope;
+			assert_recover_scope recover_scope(SilenceAsserts);
+			result->doc = parse_internal(data, fname, options, nullptr, nullptr, true);
+		} catch(WorkerParseUnsupported&) {
+			return false;
+		} catch(ParseError&) {
+			//reported when the main thread parses it.
+			return false;
+		} catch(validation_failure_exception&) {
+			return false;
+		}
+
+		if(!fname.empty()) {
+			write_disk_cache(fname, key, result->doc);
+		}
+
+		return true;
+	}
+
+	void set_prefetched_document(const std::string& path, const PrefetchedDocument& doc)
+	{
+		prefetched_documents[path] = doc;
+	}
+
+	void discard_prefetched_document(const std::string& path)
+	{
+		prefetched_documents.erase(path);
+	}
+
 	variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options)
 	{
 		try {
 			std::string data = get_file_contents(fname);
 
-			typedef std::pair<std::string, JSON_PARSE_OPTIONS> CacheKey;
 			static std::map<CacheKey, variant> cache;
 
 			CacheKey key(md5::sum(data), options);
@@ -595,7 +856,44 @@ namespace json
 				throw ParseError(formatter() << "Could not find file " << fname);
 			}
 
+			for(std::map<CacheKey, variant>::iterator i = cache.begin(); i != cache.end(); ) {
+				if(i->second.refcount() == 1) {
+					cache.erase(i++);
+				} else {
+					++i;
+				}
+			}
+
+			auto prefetched = prefetched_documents.find(fname);
+			if(prefetched != prefetched_documents.end()) {
+				const PrefetchedDocument doc = prefetched->second;
+				prefetched_documents.erase(prefetched);
+
+				//the file may have changed since it was read.
+				if(doc.hash == key.first && doc.options == options) {
+					cache[key] = doc.doc;
+					return doc.doc;
+				}
+			}
+
 			variant result;
+			if(variant_binary::is_binary_document(data.c_str(), data.size())) {
+				//binary documents, such as binary save games, are read
+				//as-is and are never preprocessed.
+				if(!variant_binary::read(data.c_str(), data.size(), &result)) {
+					throw ParseError("Invalid binary document");
+				}
+
+				cache[key] = result;
+				return result;
+			}
+
+			if(read_disk_cache(fname, key, &result)) {
+				cache[key] = result;
+				return result;
+			}
+
+			const int num_environment_directives = g_num_environment_directives;
 		
 			try {
 				result = parse_internal(data, fname, options, nullptr, nullptr);
@@ -617,12 +915,8 @@ namespace json
 				return parse_from_file(fname, options);
 			}
 
-			for(std::map<CacheKey, variant>::iterator i = cache.begin(); i != cache.end(); ) {
-				if(i->second.refcount() == 1) {
-					cache.erase(i++);
-				} else {
-					++i;
-				}
+			if(num_environment_directives == g_num_environment_directives) {
+				write_disk_cache(fname, key, result);
 			}
 
 			cache[key] = result;
@@ -720,4 +1014,91 @@ namespace json
 		CHECK_EQ(v["b"]["a"], variant(4));
 		CHECK_EQ(v["b"]["z"], variant(5));
 	}
+
+	UNIT_TEST(json_disk_cache_rejects_objects)
+	{
+		game_logic::formula_class_unit_test_helper helper;
+		helper.add_class_defn("disk_cache_test", parse("{properties: {x: {type: \"int\", default: 1}}}"));
+
+		const std::string contents = "{obj: {\"@class\": \"disk_cache_test\"}}";
+		const variant doc = parse(contents);
+		CHECK(doc["obj"].is_callable(), "object not constructed");
+
+		const bool disk_cache = g_json_disk_cache;
+		g_json_disk_cache = true;
+
+		const std::string fname = "__json_disk_cache_objects_test__.cfg";
+		const CacheKey key(md5::sum(contents), JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
+		write_disk_cache(fname, key, doc);
+
+		variant result;
+		const bool cached = read_disk_cache(fname, key, &result);
+		g_json_disk_cache = disk_cache;
+
+		const std::string path = get_disk_cache_path(fname, key);
+		if(sys::file_exists(path)) {
+			sys::remove_file(path);
+		}
+
+		//the objects can't be written, so the document may only be
+		//cached if it reads back the same.
+		CHECK(!cached || result == doc, "document with objects cached incompletely");
+	}
+
+	UNIT_TEST(json_parse_in_worker)
+	{
+		PrefetchedDocument doc;
+		CHECK(parse_in_worker("", "{a: [1, \"x\"], b: {c: true}}", JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &doc), "plain document not parsed");
+		CHECK_EQ(doc.doc, parse("{a: [1, \"x\"], b: {c: true}}"));
+
+		//anything the preprocessor acts on is left to the main thread.
+		CHECK(!parse_in_worker("", "{a: \"@eval 4\"}", JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &doc), "directive parsed in worker");
+		CHECK(parse_in_worker("", "{a: \"@eval 4\"}", JSON_PARSE_OPTIONS::NO_PREPROCESSOR, &doc), "document without preprocessor not parsed");
+	}
+
+	namespace
+	{
+		//removes a file written by a test, along with any document left
+		//prefetched for it, and restores the disk cache setting, even if
+		//a check fails.
+		struct TestFileScope
+		{
+			explicit TestFileScope(const std::string& path) : path_(path), disk_cache_(g_json_disk_cache)
+			{}
+
+			~TestFileScope() {
+				g_json_disk_cache = disk_cache_;
+				discard_prefetched_document(path_);
+				try {
+					if(sys::file_exists(path_)) {
+						sys::remove_file(path_);
+					}
+				} catch(std::exception&) {
+				}
+			}
+
+			std::string path_;
+			bool disk_cache_;
+		};
+	}
+
+	UNIT_TEST(json_prefetched_document)
+	{
+		const std::string path = std::string(preferences::user_data_path()) + "/__json_prefetched_document_test__.cfg";
+		const TestFileScope scope(path);
+		g_json_disk_cache = false;
+
+		sys::write_file(path, "{a: 1}");
+
+		//a document parsed from old contents isn't used.
+		PrefetchedDocument doc;
+		parse_in_worker(path, "{a: 2}", JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &doc);
+		set_prefetched_document(path, doc);
+		CHECK_EQ(parse_from_file(path)["a"], variant(1));
+
+		sys::write_file(path, "{a: 3}");
+		parse_in_worker(path, "{a: 3}", JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &doc);
+		set_prefetched_document(path, doc);
+		CHECK_EQ(parse_from_file(path).get_addr(), doc.doc.get_addr());
+	}
 }
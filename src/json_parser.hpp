@@ -32,6 +32,29 @@ namespace json
 	std::string get_file_contents(const std::string& path);
 
 	enum class JSON_PARSE_OPTIONS { NO_PREPROCESSOR, USE_PREPROCESSOR };
+
+	//a document parsed ahead of time from contents with the given md5 hash.
+	struct PrefetchedDocument
+	{
+		std::string hash;
+		JSON_PARSE_OPTIONS options;
+		variant doc;
+	};
+
+	//parses a file's contents on a worker thread, using the on-disk cache.
+	//Returns false if the document needs the main thread, which is the
+	//case for binary documents and whenever the preprocessor would act on
+	//it, since its directives may run FFL. The document isn't tracked by
+	//the garbage collector, so no lock is needed while it's built, but
+	//only one thread at a time may use it.
+	bool parse_in_worker(const std::string& fname, const std::string& data, JSON_PARSE_OPTIONS options, PrefetchedDocument* result);
+
+	//supplies a document parsed by parse_in_worker(). The next
+	//parse_from_file() of the path uses it if the file still has the
+	//contents it was parsed from. Main thread only.
+	void set_prefetched_document(const std::string& path, const PrefetchedDocument& doc);
+	void discard_prefetched_document(const std::string& path);
+
 	variant parse(const std::string& doc, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
 	variant parse_from_file(const std::string& fname, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
 	variant parse_from_file_or_die(const std::string& fname, JSON_PARSE_OPTIONS options=JSON_PARSE_OPTIONS::USE_PREPROCESSOR);
@@ -193,6 +193,12 @@ namespace KRE
 
 		static bool checkForFeature(DisplayDeviceCapabilties cap);
 
+		// Number of draw calls issued since the last reset, used to report
+		// how well sprites are being batched each frame.
+		static void recordDrawCall();
+		static int getDrawCallCount();
+		static void resetDrawCallCount();
+
 		static void registerFactoryFunction(const std::string& type, std::function<DisplayDevicePtr(WindowPtr)>);
 	private:
 		std::weak_ptr<Window> parent_;
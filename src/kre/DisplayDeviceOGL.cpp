@@ -457,6 +457,7 @@ namespace KRE
 					}
 				}
 			}
+			recordDrawCall();
 
 			shader->cleanUpAfterDraw();
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -24,6 +24,7 @@
 #include <GL/glew.h>
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <math.h>
 
@@ -40,6 +41,7 @@
 #include "WindowManager.hpp"
 
 #include "asserts.hpp"
+#include "background_task_pool.hpp"
 #include "collision_utils.hpp"
 #include "controls.hpp"
 #include "draw_scene.hpp"
@@ -47,6 +49,7 @@
 #include "entity.hpp"
 #include "filesystem.hpp"
 #include "formatter.hpp"
+#include "formula_garbage_collector.hpp"
 #include "formula_profiler.hpp"
 #include "json_parser.hpp"
 #include "hex.hpp"
@@ -73,6 +76,7 @@
 #include "thread.hpp"
 #include "tile_map.hpp"
 #include "unit_test.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -806,6 +810,7 @@ void Level::load_character(variant c)
 	}
 
 	solid_chars_.clear();
+	solid_chars_index_.invalidate();
 }
 
 PREF_BOOL(respect_difficulty, false, "");
@@ -897,6 +902,12 @@ void Level::finishLoading()
 
 			boost::uuids::uuid obj_uuid;
 
+			if(obj_node.is_map()) {
+				//documents which weren't run through the preprocessor, such
+				//as binary saves, have serializable objects as maps too.
+				game_logic::WmlSerializableFormulaCallable::deserializeObj(obj_node, &obj_node);
+			}
+
 			if(obj_node.is_map()) {
 
 				EntityPtr e(Entity::build(obj_node));
@@ -956,13 +967,19 @@ void Level::finishLoading()
 
 	controls::new_level(cycle_, players_.empty() ? 1 : static_cast<int>(players_.size()), multiplayer::slot());
 
-	//start loading FML for previous and next level
+	//start warming up the levels the player can leave to.
 	if(!previous_level().empty()) {
-		preload_level_wml(previous_level());
+		preload_level(previous_level());
 	}
 
 	if(!next_level().empty()) {
-		preload_level_wml(next_level());
+		preload_level(next_level());
+	}
+
+	for(const portal& p : portals_) {
+		if(!p.level_dest.empty() && !p.saved_game) {
+			preload_level(p.level_dest);
+		}
 	}
 
 	if(!sub_levels.empty()) {
@@ -1058,12 +1075,45 @@ namespace
 	//the level we're currently building tiles for.
 	const Level* level_building = nullptr;
 
+	struct TileInRect {
+		explicit TileInRect(const rect& r) : rect_(r)
+		{}
+
+		bool operator()(const LevelTile& t) const {
+			return pointInRect(point(t.x, t.y), rect_);
+		}
+
+		rect rect_;
+	};
+
+	//a rebuild which has been handed to a worker. The worker only touches
+	//the job, so it stays valid even if the level goes away first.
+	struct TileRebuildJob
+	{
+		TileRebuildJob() : whole_map(true), done(false)
+		{}
+
+		std::map<int, TileMap> tile_maps;
+
+		//the layers to rebuild, or all of them if empty.
+		std::vector<int> layers;
+
+		//if whole_map is false, only tiles inside area are rebuilt.
+		bool whole_map;
+		rect area;
+
+		//where the worker will store the new tiles.
+		std::vector<LevelTile> tiles;
+
+		std::atomic<bool> done;
+	};
+
 	struct level_tile_rebuild_info 
 	{
 		level_tile_rebuild_info() : tile_rebuild_in_progress(false),
 									tile_rebuild_queued(false),
-									rebuild_tile_thread(nullptr),
-									tile_rebuild_complete(false)
+									rebuild_whole_map(false),
+									rebuild_area_valid(false)
 		{}
 
 		//record whether we are currently rebuilding tiles, and if we have had
@@ -1071,51 +1121,73 @@ namespace
 		bool tile_rebuild_in_progress;
 		bool tile_rebuild_queued;
 
-		threading::thread* rebuild_tile_thread;
-
 		//an unsynchronized buffer only accessed by the main thread with layers
 		//that will be rebuilt.
 		std::vector<int> rebuild_tile_layers_buffer;
 
-		//buffer accessed by the worker thread which contains layers that will
-		//be rebuilt.
-		std::vector<int> rebuild_tile_layers_worker_buffer;
-
-		//a locked flag which is polled to see if tile rebuilding has been completed.
-		bool tile_rebuild_complete;
-
-		threading::mutex tile_rebuild_complete_mutex;
+		//the area the queued requests cover. A request without an area
+		//sets rebuild_whole_map, which wins over any area.
+		bool rebuild_whole_map;
+		bool rebuild_area_valid;
+		rect rebuild_area;
 
-		//the tiles where the thread will store the new tiles.
-		std::vector<LevelTile> task_tiles;
+		//the job currently in flight, if any.
+		std::shared_ptr<TileRebuildJob> job;
 	};
 
 	std::map<const Level*, level_tile_rebuild_info> tile_rebuild_map;
 
-	void build_tiles_thread_function(level_tile_rebuild_info* info, std::map<int, TileMap> tile_maps, threading::mutex& sync) {
-		std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex());
+	void build_tiles_job(std::shared_ptr<TileRebuildJob> job) {
+		for(auto& i : job->tile_maps) {
+			if(job->whole_map) {
+				i.second.buildTiles(&job->tiles);
+				continue;
+			}
 
-		info->task_tiles.clear();
+			//patterns anchored outside of the area can still reach into
+			//it, so build a margin around it and keep only what's inside.
+			const int border = i.second.getPatternRadius()*TileSize;
+			const rect build_area(job->area.x() - border, job->area.y() - border, job->area.w() + border*2, job->area.h() + border*2);
 
-		if(info->rebuild_tile_layers_worker_buffer.empty()) {
-			for(auto& i : tile_maps) {
-				i.second.buildTiles(&info->task_tiles);
-			}
-		} else {
-			for(int layer : info->rebuild_tile_layers_worker_buffer) {
-				auto itor = tile_maps.find(layer);
-				if(itor != tile_maps.end()) {
-					itor->second.buildTiles(&info->task_tiles);
-				}
-			}
+			std::vector<LevelTile> tiles;
+			i.second.buildTiles(&tiles, &build_area);
+			std::copy_if(tiles.begin(), tiles.end(), std::back_inserter(job->tiles), TileInRect(job->area));
 		}
 
-		threading::lock l(info->tile_rebuild_complete_mutex);
-		info->tile_rebuild_complete = true;
+		job->done = true;
+	}
+
+	int tile_floor(int n)
+	{
+		return n >= 0 ? n/TileSize : -((-n + TileSize - 1)/TileSize);
 	}
 }
 
 void Level::start_rebuild_tiles_in_background(const std::vector<int>& layers)
+{
+	queue_tile_rebuild(layers, nullptr);
+}
+
+void Level::start_rebuild_tiles_rect_in_background(const std::vector<int>& layers, const rect& area)
+{
+	//a change to a tile can alter the tiles chosen for any tile within
+	//pattern range of it.
+	int radius = 1;
+	for(auto& i : tile_maps_) {
+		if(layers.empty() || std::count(layers.begin(), layers.end(), i.first)) {
+			radius = std::max(radius, i.second.getPatternRadius());
+		}
+	}
+
+	const rect r = rect::from_coordinates(
+	  (tile_floor(area.x()) - radius)*TileSize,
+	  (tile_floor(area.y()) - radius)*TileSize,
+	  (tile_floor(area.x2()) + radius)*TileSize,
+	  (tile_floor(area.y2()) + radius)*TileSize);
+	queue_tile_rebuild(layers, &r);
+}
+
+void Level::queue_tile_rebuild(const std::vector<int>& layers, const rect* area)
 {
 	level_tile_rebuild_info& info = tile_rebuild_map[this];
 
@@ -1129,26 +1201,52 @@ void Level::start_rebuild_tiles_in_background(const std::vector<int>& layers)
 		info.rebuild_tile_layers_buffer.clear();
 	}
 
+	if(area == nullptr) {
+		info.rebuild_whole_map = true;
+	} else if(info.rebuild_area_valid) {
+		info.rebuild_area = rect::from_coordinates(
+		  std::min(info.rebuild_area.x(), area->x()),
+		  std::min(info.rebuild_area.y(), area->y()),
+		  std::max(info.rebuild_area.x2(), area->x2()) - 1,
+		  std::max(info.rebuild_area.y2(), area->y2()) - 1);
+	} else {
+		info.rebuild_area = *area;
+		info.rebuild_area_valid = true;
+	}
+
 	if(info.tile_rebuild_in_progress) {
 		info.tile_rebuild_queued = true;
 		return;
 	}
 
 	info.tile_rebuild_in_progress = true;
-	info.tile_rebuild_complete = false;
 
-	info.rebuild_tile_layers_worker_buffer = info.rebuild_tile_layers_buffer;
-	info.rebuild_tile_layers_buffer.clear();
+	std::shared_ptr<TileRebuildJob> job(new TileRebuildJob);
+	job->layers.swap(info.rebuild_tile_layers_buffer);
+	job->whole_map = info.rebuild_whole_map || !info.rebuild_area_valid;
+	job->area = info.rebuild_area;
+
+	info.rebuild_whole_map = false;
+	info.rebuild_area_valid = false;
+
+	//only the layers being rebuilt go to the worker.
+	for(auto& i : tile_maps_) {
+		if(job->layers.empty() || std::binary_search(job->layers.begin(), job->layers.end(), i.first)) {
+			TileMap& m = job->tile_maps[i.first];
+			m = i.second;
 
-	std::map<int, TileMap> worker_tile_maps = tile_maps_;
-	for(auto& i : worker_tile_maps) {
-		//make the tile maps safe to go into a worker thread.
-		i.second.prepareForCopyToWorkerThread();
+			//make the tile map safe to go into a worker thread.
+			m.prepareForCopyToWorkerThread();
+		}
 	}
 
-	static threading::mutex* sync = new threading::mutex;
+	info.job = job;
 
-	info.rebuild_tile_thread = new threading::thread("rebuild_tiles", std::bind(build_tiles_thread_function, &info, worker_tile_maps, *sync), threading::THREAD_ALLOCATES_COLLECTIBLE_OBJECTS);
+	//tile filters create collectible objects on the worker.
+	GarbageCollectible::incrementWorkerThreads();
+	background_task_pool::submit(std::bind(build_tiles_job, job), []() {
+		GarbageCollectible::decrementWorkerThreads();
+	});
 }
 
 void Level::freeze_rebuild_tiles_in_background()
@@ -1160,14 +1258,15 @@ void Level::freeze_rebuild_tiles_in_background()
 void Level::unfreeze_rebuild_tiles_in_background()
 {
 	level_tile_rebuild_info& info = tile_rebuild_map[this];
-	if(info.rebuild_tile_thread != nullptr) {
-		//a thread is actually in flight calculating tiles, so any requests
+	if(info.job) {
+		//a job is actually in flight calculating tiles, so any requests
 		//would have been queued up anyway.
 		return;
 	}
 
 	info.tile_rebuild_in_progress = false;
-	start_rebuild_tiles_in_background(info.rebuild_tile_layers_buffer);
+	const std::vector<int> layers = info.rebuild_tile_layers_buffer;
+	queue_tile_rebuild(layers, info.rebuild_area_valid && !info.rebuild_whole_map ? &info.rebuild_area : nullptr);
 }
 
 namespace 
@@ -1231,48 +1330,51 @@ bool Level::complete_rebuild_tiles_in_background()
 		return true;
 	}
 
-	{
-		threading::lock l(info.tile_rebuild_complete_mutex);
-		if(!info.tile_rebuild_complete) {
-			return false;
-		}
+	if(!info.job || !info.job->done) {
+		return false;
 	}
 
 	const int begin_time = profile::get_tick_time();
 
-//	ASSERT_LOG(rebuild_tile_thread, "REBUILD TILE THREAD IS nullptr");
-	delete info.rebuild_tile_thread;
-	info.rebuild_tile_thread = nullptr;
+	std::shared_ptr<TileRebuildJob> job = info.job;
+	info.job.reset();
 
 	TileBackupScope backup(tiles_);
 
-	if(info.rebuild_tile_layers_worker_buffer.empty()) {
+	if(job->whole_map && job->layers.empty()) {
 		tiles_.clear();
-	} else {
-		for(int layer : info.rebuild_tile_layers_worker_buffer) {
+	} else if(job->whole_map) {
+		for(int layer : job->layers) {
 			using namespace std::placeholders;
 			tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), std::bind(level_tile_from_layer, std::placeholders::_1, layer)), tiles_.end());
 		}
+	} else {
+		const TileInRect in_area(job->area);
+		tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), [&](const LevelTile& t) {
+			return in_area(t) && (job->layers.empty() || std::binary_search(job->layers.begin(), job->layers.end(), t.layer_from));
+		}), tiles_.end());
 	}
 
-	tiles_.insert(tiles_.end(), info.task_tiles.begin(), info.task_tiles.end());
-	info.task_tiles.clear();
-
-	LOG_INFO("COMPLETE TILE REBUILD: " << (profile::get_tick_time() - begin_time));
+	tiles_.insert(tiles_.end(), job->tiles.begin(), job->tiles.end());
 
-	info.rebuild_tile_layers_worker_buffer.clear();
+	LOG_INFO("COMPLETE TILE REBUILD: " << (profile::get_tick_time() - begin_time) << " tiles: " << job->tiles.size());
 
 	info.tile_rebuild_in_progress = false;
 
 	++g_tile_rebuild_state_id;
 
-	complete_tiles_refresh();
+	if(job->whole_map) {
+		complete_tiles_refresh();
+	} else {
+		complete_tiles_refresh_rect(job->area);
+	}
 
 	backup.cancel();
 
 	if(info.tile_rebuild_queued) {
 		info.tile_rebuild_queued = false;
-		start_rebuild_tiles_in_background(info.rebuild_tile_layers_buffer);
+		const std::vector<int> layers = info.rebuild_tile_layers_buffer;
+		queue_tile_rebuild(layers, info.rebuild_area_valid && !info.rebuild_whole_map ? &info.rebuild_area : nullptr);
 	}
 
 	return true;
@@ -1342,18 +1444,34 @@ void Level::flip_variations(int xtile, int ytile, int delta)
 	rebuild_tiles_rect(rect(xtile*TileSize, ytile*TileSize, TileSize, TileSize));
 }
 
-namespace 
+void Level::complete_tiles_refresh_rect(const rect& r)
 {
-	struct TileInRect {
-		explicit TileInRect(const rect& r) : rect_(r)
-		{}
+	for(int x = r.x(); x <= r.x2(); x += TileSize) {
+		for(int y = r.y(); y <= r.y2(); y += TileSize) {
+			tile_pos pos(tile_floor(x), tile_floor(y));
+			solid_.erase(pos);
+			standable_.erase(pos);
+		}
+	}
 
-		bool operator()(const LevelTile& t) const {
-			return pointInRect(point(t.x, t.y), rect_);
+	//tiles from outside the area may be large enough to reach into it, so
+	//put back the solids of everything which overlaps it.
+	for(const LevelTile& t : tiles_) {
+		if(rects_intersect(rect(t.x, t.y, t.object->width(), t.object->height()), r)) {
+			add_tile_solid(t);
+			layers_.insert(t.zorder);
 		}
+	}
 
-		rect rect_;
-	};
+	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
+		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
+	}
+	prepare_tiles_for_drawing(&r);
+
+	const std::vector<EntityPtr> chars = chars_;
+	for(const EntityPtr& e : chars) {
+		e->handleEvent("level_tiles_refreshed");
+	}
 }
 
 void Level::rebuild_tiles_rect(const rect& r)
@@ -1386,7 +1504,7 @@ void Level::rebuild_tiles_rect(const rect& r)
 	if(std::adjacent_find(tiles_.rbegin(), tiles_.rend(), level_tile_zorder_pos_comparer()) != tiles_.rend()) {
 		std::sort(tiles_.begin(), tiles_.end(), level_tile_zorder_pos_comparer());
 	}
-	prepare_tiles_for_drawing();
+	prepare_tiles_for_drawing(&r);
 }
 
 std::string Level::package() const
@@ -1776,6 +1894,13 @@ variant Level::write() const
 	return result;
 }
 
+PREF_BOOL(binary_level_saves, false, "Write saved games in binary rather than as FSON");
+
+std::string Level::writeSaveDocument(const variant& doc)
+{
+	return variant_binary::write_document(doc, g_binary_level_saves);
+}
+
 point Level::get_dest_from_str(const std::string& key) const
 {
 	int ypos = 0;
@@ -1879,9 +2004,15 @@ void Level::draw_layer(int layer, int x, int y, int w, int h) const
 
 	draw_layer_solid(layer, x, y, w, h);
 	
-	auto& blit_cache_info = *layer_itor->second;
+	//x and y have been moved into the layer's coordinates above, so the
+	//chunks can be culled against them directly.
+	const rect viewport(x, y, w, h);
 	KRE::ModelManager2D model_matrix_scope(position.x, position.y);
-	KRE::WindowManager::getMainWindow()->render(&blit_cache_info);
+	for(auto& chunk : layer_itor->second) {
+		if(rects_intersect(chunk.second->area(), viewport)) {
+			KRE::WindowManager::getMainWindow()->render(chunk.second.get());
+		}
+	}
 }
 
 void Level::draw_layer_solid(int layer, int x, int y, int w, int h) const
@@ -1912,45 +2043,56 @@ void Level::draw_layer_solid(int layer, int x, int y, int w, int h) const
 	}
 }
 
-void Level::prepare_tiles_for_drawing()
+namespace 
 {
-	auto main_wnd = KRE::WindowManager::getMainWindow();
-	LevelObject::setCurrentPalette(palettes_used_);
-
-	solid_color_rects_.clear();
-	blit_cache_.clear();
+	//width and height of the chunks tile layers are split into, in tiles.
+	const int TileChunkSize = 16;
 
-	for(int n = 0; n != tiles_.size(); ++n) {
-		if(!is_arcade_level() && tiles_[n].object->getSolidColor()) {
-			continue;
-		}
+	int tile_chunk_index(int pos)
+	{
+		const int size = TileChunkSize*TileSize;
+		return pos >= 0 ? pos/size : -((-pos + size - 1)/size);
+	}
 
-		//in the editor we want to draw the whole level, so don't exclude
-		//things outside the level bounds.
-		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
-			continue;
-		}
+	//chunks are keyed by row then column.
+	std::pair<int,int> tile_chunk_key(const LevelTile& t)
+	{
+		return std::pair<int,int>(tile_chunk_index(t.y), tile_chunk_index(t.x));
+	}
+}
 
-		std::shared_ptr<LayerBlitInfo>& blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
-		if(blit_cache_info_ptr == nullptr) {
-			blit_cache_info_ptr = std::make_shared<LayerBlitInfo>();
-		}
+void Level::prepare_tiles_for_drawing(const rect* changed_area)
+{
+	auto main_wnd = KRE::WindowManager::getMainWindow();
+	LevelObject::setCurrentPalette(palettes_used_);
 
-		if(!blit_cache_info_ptr->isInitialised()) {
-			//LOG_DEBUG("zorder: " << tiles_[n].zorder << ", set texture with id: "<< tiles_[n].object->texture()->id());
-			blit_cache_info_ptr->setTexture(tiles_[n].object->texture());
-			blit_cache_info_ptr->setBase(tiles_[n].x, tiles_[n].y);
-		}
+	solid_color_rects_.clear();
 
-		if(tiles_[n].x < blit_cache_info_ptr->xbase()) {
-			blit_cache_info_ptr->setXbase(tiles_[n].x);
-		}
-		if(tiles_[n].y < blit_cache_info_ptr->ybase()) {
-			blit_cache_info_ptr->setYbase(tiles_[n].y);
+	//the chunks which will be rebuilt. Tiles belong to the chunk their
+	//position is in.
+	int row1 = std::numeric_limits<int>::min(), row2 = std::numeric_limits<int>::max();
+	int col1 = std::numeric_limits<int>::min(), col2 = std::numeric_limits<int>::max();
+	if(changed_area != nullptr) {
+		row1 = tile_chunk_index(changed_area->y());
+		row2 = tile_chunk_index(changed_area->y2());
+		col1 = tile_chunk_index(changed_area->x());
+		col2 = tile_chunk_index(changed_area->x2());
+
+		for(auto& layer : blit_cache_) {
+			for(auto i = layer.second.begin(); i != layer.second.end(); ) {
+				if(i->first.first >= row1 && i->first.first <= row2 && i->first.second >= col1 && i->first.second <= col2) {
+					layer.second.erase(i++);
+				} else {
+					++i;
+				}
+			}
 		}
+	} else {
+		blit_cache_.clear();
 	}
 
-	std::map<int, std::pair<std::vector<tile_corner>, std::vector<tile_corner>>> vertices_ot;
+	typedef std::pair<std::vector<tile_corner>, std::vector<tile_corner>> ChunkVertices;
+	std::map<int, std::map<std::pair<int,int>, ChunkVertices>> vertices_ot;
 
 	for(int n = 0; n != tiles_.size(); ++n) {
 		if(!editor_ && (tiles_[n].x <= boundaries().x() - TileSize || tiles_[n].y <= boundaries().y() - TileSize || tiles_[n].x >= boundaries().x2() || tiles_[n].y >= boundaries().y2())) {
@@ -1975,11 +2117,21 @@ void Level::prepare_tiles_for_drawing()
 			continue;
 		}
 
-		auto blit_cache_info_ptr = blit_cache_[tiles_[n].zorder];
-
 		tiles_[n].draw_disabled = false;
 
-		const int npoints = LevelObject::calculateTileCorners(tiles_[n].object->isOpaque() ? &vertices_ot[tiles_[n].zorder].first : &vertices_ot[tiles_[n].zorder].second, tiles_[n]);
+		const std::pair<int,int> key = tile_chunk_key(tiles_[n]);
+		if(key.first < row1 || key.first > row2 || key.second < col1 || key.second > col2) {
+			continue;
+		}
+
+		std::shared_ptr<LayerBlitInfo>& blit_cache_info_ptr = blit_cache_[tiles_[n].zorder][key];
+		if(blit_cache_info_ptr == nullptr) {
+			blit_cache_info_ptr = std::make_shared<LayerBlitInfo>();
+			blit_cache_info_ptr->setTexture(tiles_[n].object->texture());
+		}
+
+		ChunkVertices& vertices = vertices_ot[tiles_[n].zorder][key];
+		const int npoints = LevelObject::calculateTileCorners(tiles_[n].object->isOpaque() ? &vertices.first : &vertices.second, tiles_[n]);
 		if(npoints > 0) {
 			if(*tiles_[n].object->texture() != *blit_cache_info_ptr->getTexture()) {
 				ASSERT_LOG(false, "Multiple tile textures per level per zorder are unsupported. level: '" 
@@ -1989,9 +2141,11 @@ void Level::prepare_tiles_for_drawing()
 		}
 	}
 
-	for(auto& v_ot : vertices_ot) {
-		auto blit_cache_info_ptr = blit_cache_[v_ot.first];
-		blit_cache_info_ptr->setVertices(&v_ot.second.first, &v_ot.second.second);
+	for(auto& layer : vertices_ot) {
+		LayerChunkMap& chunks = blit_cache_[layer.first];
+		for(auto& v_ot : layer.second) {
+			chunks[v_ot.first]->setVertices(&v_ot.second.first, &v_ot.second.second);
+		}
 	}
 
 	for(int n = 1; n < static_cast<int>(solid_color_rects_.size()); ++n) {
@@ -2808,6 +2962,7 @@ void Level::do_processing()
 	}
 
 	solid_chars_.clear();
+	solid_chars_index_.invalidate();
 }
 
 void Level::erase_char(EntityPtr c)
@@ -2825,6 +2980,7 @@ void Level::erase_char(EntityPtr c)
 	}
 
 	solid_chars_.clear();
+	solid_chars_index_.invalidate();
 }
 
 bool Level::isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<point>& points, const SurfaceInfo** surf_info) const
@@ -2985,32 +3141,52 @@ bool Level::solid(const Entity& e, const std::vector<point>& points, const Surfa
 
 bool Level::solid(int xbegin, int ybegin, int w, int h, const SurfaceInfo** info) const
 {
+	return isSolidInRect(solid_, xbegin, ybegin, w, h, info);
+}
+
+bool Level::isSolidInRect(const LevelSolidMap& map, int xbegin, int ybegin, int w, int h, const SurfaceInfo** surf_info) const
+{
+	if(w <= 0 || h <= 0) {
+		return false;
+	}
+
 	const int xend = xbegin + w;
 	const int yend = ybegin + h;
+	const int tx_begin = tile_floor(xbegin);
+	const int tx_end = tile_floor(xend - 1);
+	const int ty_begin = tile_floor(ybegin);
+	const int ty_end = tile_floor(yend - 1);
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
-			}
+	//pixels are still visited in row order, so the surface info reported
+	//is that of the same pixel a pixel by pixel scan would find first.
+	for(int ty = ty_begin; ty <= ty_end; ++ty) {
+		bool any_tiles = false;
+		for(int tx = tx_begin; tx <= tx_end && !any_tiles; ++tx) {
+			any_tiles = map.find(tile_pos(tx, ty)) != nullptr;
 		}
-	}
 
-	return false;
-}
+		if(!any_tiles) {
+			continue;
+		}
 
-bool Level::solid(const rect& r, const SurfaceInfo** info) const
-{
-	//TODO: consider optimizing this function.
-	const int ybegin = r.y();
-	const int yend = r.y2();
-	const int xbegin = r.x();
-	const int xend = r.x2();
+		const int y1 = std::max(ybegin - ty*TileSize, 0);
+		const int y2 = std::min(yend - ty*TileSize, TileSize);
+		for(int y = y1; y < y2; ++y) {
+			for(int tx = tx_begin; tx <= tx_end; ++tx) {
+				const TileSolidInfo* info = map.find(tile_pos(tx, ty));
+				if(info == nullptr) {
+					continue;
+				}
 
-	for(int y = ybegin; y != yend; ++y) {
-		for(int x = xbegin; x != xend; ++x) {
-			if(solid(x, y, info)) {
-				return true;
+				const int x1 = std::max(xbegin - tx*TileSize, 0);
+				const int x2 = std::min(xend - tx*TileSize, TileSize);
+				if(info->anySolidInRow(y, x1, x2)) {
+					if(surf_info) {
+						*surf_info = &info->info;
+					}
+
+					return true;
+				}
 			}
 		}
 	}
@@ -3018,6 +3194,11 @@ bool Level::solid(const rect& r, const SurfaceInfo** info) const
 	return false;
 }
 
+bool Level::solid(const rect& r, const SurfaceInfo** info) const
+{
+	return isSolidInRect(solid_, r.x(), r.y(), r.w(), r.h(), info);
+}
+
 bool Level::may_be_solid_in_rect(const rect& r) const
 {
 	int x = r.x();
@@ -3078,7 +3259,8 @@ void Level::add_tile(const LevelTile& t)
 	tiles_.insert(itor, t);
 	add_tile_solid(t);
 	layers_.insert(t.zorder);
-	prepare_tiles_for_drawing();
+	const rect area(t.x, t.y, 1, 1);
+	prepare_tiles_for_drawing(&area);
 }
 
 bool Level::add_tile_rect(int zorder, int x1, int y1, int x2, int y2, const std::string& str)
@@ -3282,11 +3464,26 @@ struct tile_on_point {
 
 bool Level::remove_tiles_at(int x, int y)
 {
-	const auto nitems = tiles_.size();
-	tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), tile_on_point(x,y)), tiles_.end());
-	const bool result = nitems != tiles_.size();
-	prepare_tiles_for_drawing();
-	return result;
+	//the area covering the positions of the tiles removed.
+	int x1 = x, y1 = y, x2 = x, y2 = y;
+	bool found = false;
+	const tile_on_point on_point(x, y);
+	for(const LevelTile& t : tiles_) {
+		if(on_point(t)) {
+			x1 = std::min(x1, t.x);
+			y1 = std::min(y1, t.y);
+			found = true;
+		}
+	}
+
+	if(!found) {
+		return false;
+	}
+
+	tiles_.erase(std::remove_if(tiles_.begin(), tiles_.end(), on_point), tiles_.end());
+	const rect area = rect::from_coordinates(x1, y1, x2, y2);
+	prepare_tiles_for_drawing(&area);
+	return true;
 }
 
 std::vector<point> Level::get_solid_contiguous_region(int xpos, int ypos) const
@@ -3356,6 +3553,7 @@ void Level::remove_character(EntityPtr e)
 	}
 	chars_.erase(std::remove(chars_.begin(), chars_.end(), e), chars_.end());
 	solid_chars_.erase(std::remove(solid_chars_.begin(), solid_chars_.end(), e), solid_chars_.end());
+	solid_chars_index_.invalidate();
 	active_chars_.erase(std::remove(active_chars_.begin(), active_chars_.end(), e), active_chars_.end());
 	new_chars_.erase(std::remove(new_chars_.begin(), new_chars_.end(), e), new_chars_.end());
 }
@@ -3618,6 +3816,7 @@ void Level::add_character(EntityPtr p)
 
 	if(solid_chars_.empty() == false && p->solid()) {
 		solid_chars_.push_back(p);
+		solid_chars_index_.add(p);
 	}
 
 	if(p->isHuman()) {
@@ -3774,6 +3973,8 @@ DEFINE_FIELD(local_player, "null|custom_obj")
 	return variant(obj.player_.get());
 DEFINE_FIELD(num_active, "int")
 	return variant(static_cast<int>(obj.active_chars_.size()));
+DEFINE_FIELD(solid_index_stats, "{hits: int, misses: int, candidates: int, skipped: int}")
+	return obj.solid_chars_index_.getStats();
 DEFINE_FIELD(active_chars, "[custom_obj]")
 	std::vector<variant> v;
 	for(const EntityPtr& e : obj.active_chars_) {
@@ -4247,6 +4448,7 @@ void Level::getAllLabels(std::vector<std::string>& labels) const
 const std::vector<EntityPtr>& Level::get_solid_chars() const
 {
 	if(solid_chars_.empty()) {
+		solid_chars_index_.invalidate();
 		for(const EntityPtr& e : chars_) {
 			if(e->solid() || e->platform()) {
 				solid_chars_.push_back(e);
@@ -4257,6 +4459,11 @@ const std::vector<EntityPtr>& Level::get_solid_chars() const
 	return solid_chars_;
 }
 
+void Level::get_solid_chars_in_rect(const rect& area, std::vector<EntityPtr>& result) const
+{
+	solid_chars_index_.getEntitiesInRect(get_solid_chars(), area, result);
+}
+
 bool Level::can_interact(const rect& body) const
 {
 	for(const portal& p : portals_) {
@@ -4404,6 +4611,7 @@ void Level::restore_from_backup(backup_snapshot& snapshot)
 	active_chars_.clear();
 
 	solid_chars_.clear();
+	solid_chars_index_.invalidate();
 
 	chars_by_label_.clear();
 	for(const EntityPtr& e : chars_) {
@@ -4956,6 +5164,7 @@ void Level::surrenderReferences(GarbageCollector* gc)
 	for(EntityPtr& e : solid_chars_) {
 		gc->surrenderPtr(&e, "solid_chars");
 	}
+	solid_chars_index_.surrenderReferences(gc);
 	for(EntityPtr& e : chars_immune_from_time_freeze_) {
 		gc->surrenderPtr(&e, "chars_immune");
 	}
@@ -5061,6 +5270,14 @@ BENCHMARK(level_solid)
 	}
 }
 
+BENCHMARK(level_solid_rect)
+{
+	static Level* lvl = new Level("stairway-to-heaven.cfg");
+	BENCHMARK_LOOP {
+		lvl->solid(rect(rng::generate()%1000, rng::generate()%1000, 64, 64));
+	}
+}
+
 BENCHMARK(load_nene)
 {
 	BENCHMARK_LOOP {
@@ -50,6 +50,8 @@
 #include "level_object.hpp"
 #include "level_solid_map.hpp"
 #include "random.hpp"
+#include "solid_entity_index.hpp"
+#include "spatial_grid.hpp"
 #include "speech_dialog.hpp"
 #include "tile_map.hpp"
 #include "variant.hpp"
@@ -109,6 +111,11 @@ public:
 	std::string package() const;
 
 	variant write() const;
+
+	//turns a document made by write() into the contents of a save file.
+	//It is written in binary if --binary_level_saves is set.
+	static std::string writeSaveDocument(const variant& doc);
+
 	void draw(int x, int y, int w, int h) const;
 	void drawLater(int x, int y, int w, int h) const;
 	void draw_status() const;
@@ -231,6 +238,10 @@ public:
 	//a function to start rebuilding tiles in a background thread.
 	void start_rebuild_tiles_in_background(const std::vector<int>& layers);
 
+	//like start_rebuild_tiles_in_background(), but only the tiles which
+	//could be affected by changes to the given area are rebuilt.
+	void start_rebuild_tiles_rect_in_background(const std::vector<int>& layers, const rect& area);
+
 	//a function which, if rebuilding tiles has been completed, will update
 	//with the new tiles. Returns true iff there is no longer a tile build going on.
 	bool complete_rebuild_tiles_in_background();
@@ -292,9 +303,17 @@ public:
 	const std::vector<EntityPtr>& get_active_chars() const { return active_chars_; }
 	const std::vector<EntityPtr>& get_chars() const { return chars_; }
 	const std::vector<EntityPtr>& get_solid_chars() const;
-	void swap_chars(std::vector<EntityPtr>& v) { chars_.swap(v); solid_chars_.clear(); }
+	void swap_chars(std::vector<EntityPtr>& v) { chars_.swap(v); solid_chars_.clear(); solid_chars_index_.invalidate(); }
+
+	//gets the solid characters whose solid or platform rect intersects
+	//area, in the same order as get_solid_chars().
+	void get_solid_chars_in_rect(const rect& area, std::vector<EntityPtr>& result) const;
 	int num_active_chars() const { return static_cast<int>(active_chars_.size()); }
 
+	//broadphase used by detect_user_collisions(), kept between cycles so
+	//only objects which moved to different cells need to be updated.
+	SpatialGrid<const Entity*>& user_collision_grid() { return user_collision_grid_; }
+
 	//function which, given the rect of the player's body will return true iff
 	//the player can currently "interact" with a portal or object. i.e. if
 	//pressing up will talk to someone or enter a door etc.
@@ -450,7 +469,10 @@ private:
 	void read_compiled_tiles(variant node, std::vector<LevelTile>::iterator& out);
 
 	void complete_tiles_refresh();
-	void prepare_tiles_for_drawing();
+
+	//builds what is needed to draw the tiles. If given an area, only the
+	//vertices of the chunks of tile layers overlapping it are rebuilt.
+	void prepare_tiles_for_drawing(const rect* changed_area=nullptr);
 
 	void do_processing();
 
@@ -462,6 +484,8 @@ private:
 	void draw_layer_solid(int layer, int x, int y, int w, int h) const;
 
 	void rebuild_tiles_rect(const rect& r);
+	void queue_tile_rebuild(const std::vector<int>& layers, const rect* area);
+	void complete_tiles_refresh_rect(const rect& r);
 	void add_tile_solid(const LevelTile& t);
 	void add_solid_rect(int x1, int y1, int x2, int y2, int friction, int traction, int damage, const std::string& info);
 	void add_solid(int x, int y, int friction, int traction, int damage, const std::string& info);
@@ -496,6 +520,7 @@ private:
 	LevelSolidMap standable_base_;
 
 	bool isSolid(const LevelSolidMap& map, int x, int y, const SurfaceInfo** surf_info) const;
+	bool isSolidInRect(const LevelSolidMap& map, int xbegin, int ybegin, int w, int h, const SurfaceInfo** surf_info) const;
 	bool isSolid(const LevelSolidMap& map, const Entity& e, const std::vector<point>& points, const SurfaceInfo** surf_info) const;
 
 	void setSolid(LevelSolidMap& map, int x, int y, int friction, int traction, int damage, const std::string& info, bool solid=true);
@@ -544,6 +569,9 @@ private:
 	mutable std::vector<EntityPtr> active_chars_;
 	std::vector<EntityPtr> new_chars_;
 	mutable std::vector<EntityPtr> solid_chars_;
+	mutable SolidEntityIndex solid_chars_index_;
+
+	SpatialGrid<const Entity*> user_collision_grid_;
 
 	std::vector<EntityPtr> chars_immune_from_time_freeze_;
 
@@ -691,7 +719,10 @@ private:
 
 	LevelPtr suspended_level_;
 
-	mutable std::map<int, std::shared_ptr<LayerBlitInfo>> blit_cache_;
+	//the chunks of each tile layer, keyed by zorder and then by the
+	//chunk's row and column, so each layer is drawn top to bottom.
+	typedef std::map<std::pair<int,int>, std::shared_ptr<LayerBlitInfo>> LayerChunkMap;
+	mutable std::map<int, LayerChunkMap> blit_cache_;
 
 	mutable KRE::RenderTargetPtr rt_, backup_rt_;
 	bool have_render_to_texture_;
@@ -75,6 +75,7 @@
 #include "theme_imgui.hpp"
 #include "user_voxel_object.hpp"
 #include "utils.hpp"
+#include "variant_allocation_profiler.hpp"
 #include "variant_utils.hpp"
 #include "globals.h"
 
@@ -117,6 +118,8 @@ namespace
 
 	PREF_BOOL(editor_pause, false, "If true, the editor auto pauses when started");
 	PREF_INT(time_quota_async_work_items, 10, "Number of milliseconds allowed each frame for asynchronous/background work items to run");
+	PREF_INT(garbage_collection_reap_quota_us, 2000, "Number of microseconds allowed each frame for destroying objects found by the FFL garbage collector");
+	PREF_INT(level_prefetch_quota_us, 2000, "Number of microseconds allowed each frame for loading the object types of nearby levels ahead of time");
 
 	PREF_BOOL(allow_debug_console_clicking, true, "Allow clicking on objects in the debug console to select them");
 	PREF_BOOL(reload_modified_objects, false, "Reload object definitions when their file is modified on disk");
@@ -776,6 +779,7 @@ LevelRunner::LevelRunner(LevelPtr& lvl, std::string& level_cfg, std::string& ori
 	current_process_ = 0;
 	next_process_ = 0;
 	current_events_ = 0;
+	last_draw_calls_ = 0;
 
 	nskip_draw_ = 0;
 
@@ -853,6 +857,9 @@ bool LevelRunner::play_level()
 {
 	const current_level_runner_scope current_level_runner_setter(this);
 
+	//play_cycle() reaps garbage a little each frame.
+	const GarbageCollectionIncrementalReapScope reap_scope;
+
 	sound::stop_looped_sounds(nullptr);
 
 	lvl_->setAsCurrentLevel();
@@ -918,6 +925,8 @@ void process_tbs_matchmaking_server();
 bool LevelRunner::play_cycle()
 {
 	formula_profiler::pump();
+	variant_allocation_profiler::pump();
+	reapGarbageCollection(g_garbage_collection_reap_quota_us);
 
 	const int start_cycle_time = profile::get_tick_time();
 
@@ -935,6 +944,7 @@ bool LevelRunner::play_cycle()
 	}
 
 	background_task_pool::pump();
+	pump_level_prefetch(g_level_prefetch_quota_us);
 
 	performance_data current_perf(current_max_,current_fps_,50,0,0,0,0,0,CustomObject::events_handled_per_second,"");
 
@@ -1746,6 +1756,7 @@ bool LevelRunner::play_cycle()
 
 	const int start_draw = profile::get_tick_time();
 	if(!skip_odd_frame && (start_draw < desired_end_time || nskip_draw_ >= g_max_frame_skips)) {
+		KRE::DisplayDevice::resetDrawCallCount();
 		formula_profiler::Instrument instrument("DRAW");
 		bool should_draw = true;
 
@@ -1879,6 +1890,7 @@ bool LevelRunner::play_cycle()
 #endif
 
 		performance_data perf(current_max_,current_fps_, current_cycles_, current_delay_, current_draw_, current_process_, current_flip_, cycle, current_events_, profiling_summary_);
+		perf.draw_calls = last_draw_calls_;
 	
 		if(!is_skipping_game() && preferences::show_fps()) {
 			draw_fps(*lvl_, perf);
@@ -1888,6 +1900,10 @@ bool LevelRunner::play_cycle()
 		next_draw_ += draw_time;
 		current_perf.draw = draw_time;
 
+		//the overlay is drawn before the frame is finished, so it shows the previous frame's total.
+		last_draw_calls_ = KRE::DisplayDevice::getDrawCallCount();
+		current_perf.draw_calls = last_draw_calls_;
+
 		const int start_flip = profile::get_tick_time();
 		if(!is_skipping_game()) {
 			KRE::WindowManager::getMainWindow()->swap();
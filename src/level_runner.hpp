@@ -102,7 +102,7 @@ private:
 
 	int current_max_, next_max_, current_fps_, next_fps_, current_cycles_, next_cycles_, current_delay_, next_delay_,
 	    current_draw_, next_draw_, current_process_, next_process_,
-		current_flip_, next_flip_, current_events_;
+		current_flip_, next_flip_, current_events_, last_draw_calls_;
 	std::string profiling_summary_;
 	int nskip_draw_;
 
@@ -27,6 +27,25 @@
 
 #include "level_solid_map.hpp"
 #include "preferences.hpp"
+#include "random.hpp"
+#include "unit_test.hpp"
+
+bool TileSolidInfo::anySolidInRow(int y, int x1, int x2) const
+{
+	if(x1 >= x2) {
+		return false;
+	}
+
+	if(all_solid) {
+		return true;
+	}
+
+	//find_next() skips over a whole block of the bitmap at a time, rather
+	//than testing each pixel.
+	const size_t begin = y*TileSize + x1;
+	const size_t found = begin == 0 ? bitmap.find_first() : bitmap.find_next(begin - 1);
+	return found < static_cast<size_t>(y*TileSize + x2);
+}
 
 namespace 
 {
@@ -243,3 +262,29 @@ void LevelSolidMap::merge(const LevelSolidMap& map, int xoffset, int yoffset)
 		}
 	}
 }
+
+UNIT_TEST(tile_solid_info_any_solid_in_row)
+{
+	TileSolidInfo info;
+	CHECK_EQ(info.anySolidInRow(0, 0, TileSize), false);
+
+	for(int n = 0; n != TileSize; ++n) {
+		info.bitmap.set(rng::generate()%(TileSize*TileSize));
+	}
+
+	for(int y = 0; y != TileSize; ++y) {
+		for(int x1 = 0; x1 <= TileSize; ++x1) {
+			for(int x2 = x1; x2 <= TileSize; ++x2) {
+				bool expected = false;
+				for(int x = x1; x != x2; ++x) {
+					expected = expected || info.bitmap.test(y*TileSize + x);
+				}
+				CHECK_EQ(info.anySolidInRow(y, x1, x2), expected);
+			}
+		}
+	}
+
+	info.all_solid = true;
+	CHECK_EQ(info.anySolidInRow(1, 2, 3), true);
+	CHECK_EQ(info.anySolidInRow(1, 2, 2), false);
+}
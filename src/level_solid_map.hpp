@@ -55,6 +55,9 @@ struct TileSolidInfo
 	tile_bitmap bitmap;
 	SurfaceInfo info;
 	bool all_solid;
+
+	//true if any pixel in [x1, x2) on row y of the tile is solid.
+	bool anySolidInRow(int y, int x1, int x2) const;
 };
 
 class LevelSolidMap 
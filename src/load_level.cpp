@@ -21,247 +21,408 @@
 	   distribution.
 */
 
-//use non-threaded loading unless/until we can fix threaded loading.
-
-#if 0
-#include <assert.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "asserts.hpp"
-#include "concurrent_cache.hpp"
+#include "background_task_pool.hpp"
+#include "custom_object_type.hpp"
 #include "filesystem.hpp"
-#include "foreach.hpp"
+#include "formula_garbage_collector.hpp"
 #include "json_parser.hpp"
-#include "level.hpp"
 #include "load_level.hpp"
 #include "module.hpp"
-#include "package.hpp"
 #include "preferences.hpp"
-#include "preprocessor.hpp"
-#include "string_utils.hpp"
-#include "texture.hpp"
+#include "profile_timer.hpp"
 #include "thread.hpp"
 #include "variant.hpp"
 
-namespace {
-typedef concurrent_cache<std::string, variant> level_wml_map;
-level_wml_map& wml_cache() {
-	static level_wml_map instance;
-	return instance;
-}
-
-std::map<std::string, threading::thread*>& wml_threads()
+//Levels are prefetched in stages. Workers on the background task pool
+//read and parse the level, then read and parse the files of the object
+//types it uses. Parsed documents are handed to the main thread in the
+//task's on_complete handler and wait in json::set_prefetched_document()
+//until they're used.
+//
+//Documents the preprocessor acts on are left for the main thread, since
+//its directives may run FFL, which isn't thread safe. So is instantiating
+//the object types, which compiles their FFL and loads their textures.
+//pump_level_prefetch() does that from the prefetched documents one type
+//per frame, within a time budget.
+
+namespace 
 {
-	static std::map<std::string, threading::thread*> instance;
-	return instance;
-}
+	PREF_BOOL(level_prefetch, true, "Read and parse the levels next to the current one in the background so that moving to them doesn't stall");
 
-class wml_loader {
-	std::string lvl_;
-public:
-	wml_loader(const std::string& lvl) : lvl_(lvl)
-	{}
-	void operator()() {
-		static const std::string global_path = preferences::load_compiled() ? "data/compiled/level/" : preferences::level_path();
-
-		std::string filename;
-
-		std::vector<std::string> components = util::split(lvl_, '/');
-		if(components.size() == 1) {
-			filename = global_path + lvl_;
-		} else if(components.size() == 2) {
-			filename = std::string(preferences::user_data_path()) + "/packages/" + components.front() + "/" + components.back();
-		} else {
-			ASSERT_LOG(false, "UNRECOGNIZED LEVEL PATH FORMAT: " << lvl_);
+	//most levels we keep prefetched at once. The oldest is dropped first.
+	const int MaxPrefetchedLevels = 8;
+
+	//files read and parsed by a background task.
+	struct DocumentJob
+	{
+		DocumentJob() : done(false)
+		{}
+
+		//paths as given to json::parse_from_file() and the files to read.
+		std::vector<std::string> paths, files;
+
+		//the documents, and whether each could be parsed by the worker.
+		std::vector<json::PrefetchedDocument> docs;
+		std::vector<bool> parsed;
+
+		//set by run() when it's finished, for stop_job() to wait on.
+		bool done;
+		threading::mutex done_mutex;
+		threading::condition done_cond;
+
+		void run() {
+			std::vector<json::PrefetchedDocument> result(files.size());
+			std::vector<bool> result_parsed(files.size(), false);
+			for(size_t n = 0; n != files.size(); ++n) {
+				std::string contents;
+				try {
+					contents = sys::read_file(files[n]);
+				} catch(...) {
+					//it will be read again when it's used.
+					continue;
+				}
+
+				result_parsed[n] = json::parse_in_worker(paths[n], contents, json::JSON_PARSE_OPTIONS::USE_PREPROCESSOR, &result[n]);
+			}
+
+			docs.swap(result);
+			parsed.swap(result_parsed);
+
+			threading::lock lck(done_mutex);
+			done = true;
+			done_cond.notify_all();
 		}
 
-		try {
-			variant node(json::parse_from_file(filename));
-			wml_cache().put(lvl_, node);
-		} catch(json::parse_error& e) {
-			ASSERT_LOG(false, "ERROR PARSING LEVEL WML FOR '" << filename << "': " << e.error_message());
-		}catch(...) {
-			std::cerr << "FAILED TO LOAD " << filename << "\n";
-			ASSERT_LOG(false, "FAILED TO LOAD");
+		void wait() {
+			threading::lock lck(done_mutex);
+			while(!done) {
+				done_cond.wait(done_mutex);
+			}
 		}
-	}
-};
-}
+	};
 
-void clear_level_wml()
-{
-	wml_cache().clear();
-}
+	typedef std::shared_ptr<DocumentJob> DocumentJobPtr;
 
-namespace {
-bool is_save_file(const std::string& fname)
-{
-	static const std::string SaveFiles[] = {"save.cfg", "save2.cfg", "save3.cfg", "save4.cfg"};
-	return std::count(SaveFiles, SaveFiles + sizeof(SaveFiles)/sizeof(SaveFiles[0]), fname) != 0;
-}
-}
+	struct PrefetchedLevel
+	{
+		PrefetchedLevel() : task_id(-1), level_read(false), load_objects(false), objects_found(false)
+		{}
 
-void preload_level_wml(const std::string& lvl)
-{
-	if(is_save_file(lvl) || lvl == "autosave.cfg") {
-		return;
-	}
+		std::string name;
 
-	if(wml_cache().count(lvl)) {
-		return;
+		//the job currently in progress, and the paths whose documents have
+		//been handed to the parser but may not have been used yet.
+		int task_id;
+		DocumentJobPtr job;
+		std::vector<std::string> pending_paths;
+
+		//the level's document, if it could be parsed by a worker.
+		variant doc;
+		bool level_read;
+
+		bool load_objects, objects_found;
+
+		//object types still to be instantiated.
+		std::vector<std::string> object_types;
+	};
+
+	typedef std::shared_ptr<PrefetchedLevel> PrefetchedLevelPtr;
+
+	std::vector<PrefetchedLevelPtr> g_prefetched_levels;
+
+	//paths prefetched for levels which have since been loaded. They're
+	//used while the level is built, and whatever is left is discarded
+	//on the next pump_level_prefetch().
+	std::vector<std::string> g_loaded_level_paths;
+
+	//how far instantiating object types has gone over the per frame
+	//budget. No more are instantiated until it has been paid back.
+	int g_object_type_overrun_us = 0;
+
+	PrefetchedLevelPtr find_prefetched_level(const std::string& lvl)
+	{
+		for(const PrefetchedLevelPtr& p : g_prefetched_levels) {
+			if(p->name == lvl) {
+				return p;
+			}
+		}
+
+		return PrefetchedLevelPtr();
 	}
 
-	wml_cache().put(lvl, variant());
-#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
-	wml_threads()[lvl] = new threading::thread("load-"+lvl, wml_loader(lvl));
-#else
-	wml_threads()[lvl] = new threading::thread(wml_loader(lvl));
-#endif
-}
+	void discard_paths(std::vector<std::string>& paths)
+	{
+		for(const std::string& path : paths) {
+			json::discard_prefetched_document(path);
+		}
 
-variant load_level_wml(const std::string& lvl)
-{
-	if(lvl == "tmp_state.cfg") {
-		//special state for debugging.
-		return json::parse_from_file("./tmp_state.cfg");
+		paths.clear();
 	}
 
-	if(is_save_file(lvl) || lvl == "autosave.cfg") {
-		std::string filename;
-		if(is_save_file(lvl)) {
-			filename = std::string(preferences::user_data_path()) + "/" + lvl;
-		} else {
-			filename = preferences::auto_save_file_path();
+	//called on the main thread once the job's worker is done with it.
+	void finish_job(PrefetchedLevel& p)
+	{
+		for(size_t n = 0; n != p.job->paths.size(); ++n) {
+			if(!p.job->parsed[n]) {
+				continue;
+			}
+
+			json::set_prefetched_document(p.job->paths[n], p.job->docs[n]);
+			p.pending_paths.push_back(p.job->paths[n]);
 		}
 
-		return json::parse_from_file(filename);
+		if(!p.level_read) {
+			p.level_read = true;
+			if(p.job->parsed.empty() == false && p.job->parsed.front()) {
+				p.doc = p.job->docs.front().doc;
+			}
+		}
+
+		//the variants were made on the worker, but from here on only the
+		//main thread holds them.
+		p.job->docs.clear();
+
+		p.task_id = -1;
+		p.job.reset();
+		GarbageCollectible::decrementWorkerThreads();
 	}
 
-	if(wml_cache().count(lvl)) {
-		std::map<std::string, threading::thread*>::iterator t = wml_threads().find(lvl);
-		if(t != wml_threads().end()) {
-			delete t->second;
-			wml_threads().erase(t);
+	void start_job(const PrefetchedLevelPtr& p, const DocumentJobPtr& job)
+	{
+		p->job = job;
+		std::weak_ptr<PrefetchedLevel> weak_level(p);
+
+		//workers create collectible objects while parsing.
+		GarbageCollectible::incrementWorkerThreads();
+		p->task_id = background_task_pool::submit(
+		  [job]() { job->run(); },
+		  [weak_level]() {
+			PrefetchedLevelPtr level = weak_level.lock();
+			if(level) {
+				finish_job(*level);
+			}
+		  },
+		  background_task_pool::TASK_PRIORITY::PREFETCH);
+	}
+
+	//makes sure no job is in progress for the level. If keep_results is
+	//true a job which has already started is waited for and its documents
+	//are used; otherwise they're thrown away.
+	void stop_job(PrefetchedLevel& p, bool keep_results)
+	{
+		if(p.task_id == -1) {
+			return;
 		}
 
-		return wml_cache().get(lvl);
+		if(background_task_pool::cancel(p.task_id)) {
+			p.task_id = -1;
+			p.job.reset();
+			p.level_read = true;
+			GarbageCollectible::decrementWorkerThreads();
+			return;
+		}
+
+		//it's already running. Its on_complete won't be called now it
+		//has been cancelled, so wait for it and finish it here.
+		p.job->wait();
+
+		if(!keep_results) {
+			std::fill(p.job->parsed.begin(), p.job->parsed.end(), false);
+		}
+
+		finish_job(p);
 	}
 
-	wml_loader loader(lvl);
-	loader();
-	return load_level_wml_nowait(lvl);
-}
+	void drop_prefetched_level(const PrefetchedLevelPtr& p)
+	{
+		stop_job(*p, false);
+		discard_paths(p->pending_paths);
+		g_prefetched_levels.erase(std::remove(g_prefetched_levels.begin(), g_prefetched_levels.end(), p), g_prefetched_levels.end());
+	}
 
-variant load_level_wml_nowait(const std::string& lvl)
-{
-	return wml_cache().get(lvl);
-}
+	void prefetch_level(const std::string& lvl, bool load_objects)
+	{
+		if(!g_level_prefetch) {
+			return;
+		}
 
-namespace {
-typedef std::map<std::string, std::pair<threading::thread*, level*> > level_map;
-level_map levels_loading;
+		PrefetchedLevelPtr p = find_prefetched_level(lvl);
+		if(p) {
+			p->load_objects = p->load_objects || load_objects;
+			return;
+		}
 
-threading::mutex& levels_loading_mutex() {
-	static threading::mutex m;
-	return m; 
-}
+		//saved games aren't in the level paths, and aren't prefetched.
+		const std::string* path = find_level_path(lvl);
+		if(path == nullptr) {
+			return;
+		}
+
+		while(static_cast<int>(g_prefetched_levels.size()) >= MaxPrefetchedLevels) {
+			drop_prefetched_level(g_prefetched_levels.front());
+		}
+
+		p = std::make_shared<PrefetchedLevel>();
+		p->name = lvl;
+		p->load_objects = load_objects;
+		g_prefetched_levels.push_back(p);
+
+		DocumentJobPtr job = std::make_shared<DocumentJob>();
+		job->paths.push_back(*path);
+		job->files.push_back(module::map_file(*path));
+		start_job(p, job);
+	}
+
+	//starts reading and parsing the files of the object types the level
+	//uses which aren't loaded yet.
+	void find_object_types(const PrefetchedLevelPtr& p)
+	{
+		DocumentJobPtr job = std::make_shared<DocumentJob>();
+		for(variant obj : p->doc["character"].as_list_optional()) {
+			if(!obj.is_map() || !obj["type"].is_string()) {
+				continue;
+			}
+
+			const std::string& type = obj["type"].as_string();
+			if(CustomObjectType::isLoaded(type) || std::count(p->object_types.begin(), p->object_types.end(), type)) {
+				continue;
+			}
+
+			p->object_types.push_back(type);
+
+			const std::string base_type(type.begin(), std::find(type.begin(), type.end(), '.'));
+			const std::string* path = CustomObjectType::getObjectPath(base_type + ".cfg");
+			if(path != nullptr && std::count(job->paths.begin(), job->paths.end(), *path) == 0) {
+				job->paths.push_back(*path);
+				job->files.push_back(module::map_file(*path));
+			}
+		}
 
-class level_loader {
-	std::string lvl_;
-public:
-	level_loader(const std::string& lvl) : lvl_(lvl)
-	{}
-	void operator()() {
-		level* lvl = NULL;
-		try {
-			lvl = new level(lvl_);
-		} catch(const graphics::texture::worker_thread_error&) {
-			//we can't load the level in here, we must do it in the main thread.
-			std::cerr << "LOAD LEVEL FAILURE: " << lvl << " MUST LOAD IN "
-			             "MAIN THREAD\n";
+		if(job->paths.empty() == false) {
+			start_job(p, job);
 		}
-		threading::lock lck(levels_loading_mutex());
-		levels_loading[lvl_].second = lvl;
 	}
-};
 
+	//does the next step of prefetching the level on the main thread.
+	void advance_prefetch(const PrefetchedLevelPtr& p)
+	{
+		if(p->task_id != -1 || !p->level_read) {
+			return;
+		}
+
+		if(p->load_objects && !p->objects_found && p->doc.is_map()) {
+			p->objects_found = true;
+			find_object_types(p);
+		}
+	}
+
+	//instantiates the next of the level's object types, once their files
+	//have been parsed. Returns false if there was nothing to do.
+	bool load_next_object_type(const PrefetchedLevelPtr& p)
+	{
+		if(p->task_id != -1 || !p->objects_found) {
+			return false;
+		}
+
+		while(p->object_types.empty() == false) {
+			const std::string type = p->object_types.back();
+			p->object_types.pop_back();
+			if(CustomObjectType::isLoaded(type)) {
+				continue;
+			}
+
+			try {
+				assert_recover_scope recover_scope;
+				CustomObjectType::get(type);
+			} catch(validation_failure_exception& e) {
+				LOG_WARN("Could not prefetch object " << type << " for level " << p->name << ": " << e.msg);
+			}
+
+			return true;
+		}
+
+		return false;
+	}
 }
 
 load_level_manager::load_level_manager()
-{}
+{
+}
 
 load_level_manager::~load_level_manager()
 {
-	for(level_map::iterator i = levels_loading.begin(); i != levels_loading.end(); ++i) {
-		i->second.first->join();
-		delete i->second.first;
-		delete i->second.second;
+	clear_level_wml();
+}
+
+void clear_level_wml()
+{
+	while(g_prefetched_levels.empty() == false) {
+		drop_prefetched_level(g_prefetched_levels.back());
 	}
 
-	levels_loading.clear();
+	discard_paths(g_loaded_level_paths);
+}
+
+void preload_level_wml(const std::string& lvl)
+{
+	prefetch_level(lvl, false);
 }
 
 void preload_level(const std::string& lvl)
 {
-	//--TODO: Currently multi-threaded pre-loading causes weird crashes.
-	//--      need to fix this!!
-	assert(!lvl.empty());
-	threading::lock lck(levels_loading_mutex());
-	if(levels_loading.count(lvl) == 0) {
-#if defined(__ANDROID__) && SDL_VERSION_ATLEAST(1, 3, 0)
-		levels_loading[lvl].first = new threading::thread("load"+lvl,level_loader(lvl));
-#else
-		levels_loading[lvl].first = new threading::thread(level_loader(lvl));
-#endif
-	}
+	prefetch_level(lvl, true);
 }
 
-ffl::IntrusivePtr<level> load_level(const std::string& lvl)
+variant load_level_wml(const std::string& lvl)
 {
-	std::cerr << "START LOAD LEVEL\n";
-	level_map::iterator itor;
-	{
-		threading::lock lck(levels_loading_mutex());
-		itor = levels_loading.find(lvl);
-		if(itor == levels_loading.end()) {
-			ffl::IntrusivePtr<level> res(new level(lvl));
-			res->finish_loading();
-			fprintf(stderr, "LOADED LEVEL: %p\n", res);
-			return res;
-		}
+	PrefetchedLevelPtr p = find_prefetched_level(lvl);
+	if(p) {
+		//a job in progress is waited for, since the level would have to
+		//parse the same files anyway.
+		stop_job(*p, true);
+
+		discard_paths(g_loaded_level_paths);
+		g_loaded_level_paths.swap(p->pending_paths);
+		g_prefetched_levels.erase(std::remove(g_prefetched_levels.begin(), g_prefetched_levels.end(), p), g_prefetched_levels.end());
 	}
 
-	itor->second.first->join();
-	delete itor->second.first;
-	ffl::IntrusivePtr<level> res;
-	res.reset(itor->second.second);
-	if(res.get() == NULL) {
-		res.reset(new level(lvl));
-	}
-	res->finish_loading();
-	levels_loading.erase(itor);
-	std::cerr << "FINISH LOAD LEVEL\n";
-	return res;
-}
-
-namespace {
-bool hidden_file(const std::string& filename) {
-	return !filename.empty() && filename[0] == '.';
-}
+	//uses the prefetched document, unless the file has changed since.
+	return load_level_wml_nowait(lvl);
 }
 
-std::vector<std::string> get_known_levels()
+void pump_level_prefetch(int max_time_us)
 {
-	std::vector<std::string> files;
-	module::get_files_in_dir(preferences::level_path(), &files);
-	files.erase(std::remove_if(files.begin(), files.end(), hidden_file), files.end());
+	profile::timer timer;
+
+	discard_paths(g_loaded_level_paths);
 
-	foreach(const std::string& pkg, package::all_packages()) {
-		std::vector<std::string> v = package::package_levels(pkg);
-		files.insert(files.end(), v.begin(), v.end());
+	//copied since starting jobs may drop levels.
+	const std::vector<PrefetchedLevelPtr> levels = g_prefetched_levels;
+	for(const PrefetchedLevelPtr& p : levels) {
+		advance_prefetch(p);
 	}
 
-	std::sort(files.begin(), files.end());
-	
-	return files;
+	//a type can't be split, so one which takes longer than the budget
+	//holds back the next ones for as many frames as it went over by.
+	if(g_object_type_overrun_us > 0) {
+		g_object_type_overrun_us = std::max(0, g_object_type_overrun_us - max_time_us);
+		return;
+	}
+
+	if(timer.get_time() >= max_time_us) {
+		return;
+	}
+
+	for(const PrefetchedLevelPtr& p : levels) {
+		if(load_next_object_type(p)) {
+			g_object_type_overrun_us = std::max(0, static_cast<int>(timer.get_time()) - max_time_us);
+			return;
+		}
+	}
 }
-#endif
@@ -37,12 +37,24 @@ void load_level_paths();
 void reload_level_paths();
 const std::string& get_level_path(const std::string& name);
 
+//like get_level_path() but returns nullptr if there is no such level.
+const std::string* find_level_path(const std::string& name);
+
 void clear_level_wml();
 void preload_level_wml(const std::string& lvl);
 variant load_level_wml(const std::string& lvl);
 variant load_level_wml_nowait(const std::string& lvl);
 
+//starts warming a level: its document and the files of the object types
+//it uses are read and parsed on background threads, and the types are
+//then loaded by pump_level_prefetch(), so that a later load_level()
+//doesn't have to wait for them.
 void preload_level(const std::string& lvl);
 ffl::IntrusivePtr<Level> load_level(const std::string& lvl);
 
+//does the main thread part of preloading levels. Should be called once a
+//frame; loads at most one object type, and none once max_time_us has been
+//used.
+void pump_level_prefetch(int max_time_us);
+
 std::vector<std::string> get_known_levels();
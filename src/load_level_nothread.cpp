@@ -52,28 +52,22 @@ void load_level_paths()
 }
 
 const std::string& get_level_path(const std::string& name) 
+{
+	const std::string* path = find_level_path(name);
+	ASSERT_LOG(path != nullptr, "FILE NOT FOUND: " << name);
+	return *path;
+}
+
+const std::string* find_level_path(const std::string& name)
 {
 	if(get_level_paths().empty()) {
 		load_level_paths();
 	}
 	std::map<std::string, std::string>::const_iterator itor = module::find(get_level_paths(), name);
 	if(itor == get_level_paths().end()) {
-		ASSERT_LOG(false, "FILE NOT FOUND: " << name);
+		return nullptr;
 	}
-	return itor->second;
-}
-
-void clear_level_wml()
-{
-}
-
-void preload_level_wml(const std::string& lvl)
-{
-}
-
-variant load_level_wml(const std::string& lvl)
-{
-	return load_level_wml_nowait(lvl);
+	return &itor->second;
 }
 
 variant load_level_wml_nowait(const std::string& lvl)
@@ -91,18 +85,6 @@ variant load_level_wml_nowait(const std::string& lvl)
 	}
 }
 
-load_level_manager::load_level_manager()
-{
-}
-
-load_level_manager::~load_level_manager()
-{
-}
-
-void preload_level(const std::string& lvl)
-{
-}
-
 ffl::IntrusivePtr<Level> load_level(const std::string& lvl)
 {
 	ffl::IntrusivePtr<Level> res(new Level(lvl));
@@ -53,6 +53,7 @@
 #include "controls.hpp"
 #include "custom_object.hpp"
 #include "custom_object_functions.hpp"
+#include "custom_object_type.hpp"
 #include "draw_scene.hpp"
 #include "editor.hpp"
 #include "difficulty.hpp"
@@ -236,6 +237,9 @@ namespace
 			"                                 when it loses focus\n" <<
 			"      --tests                  runs the game's unit tests and exits\n" <<
 			"      --tests=\"foo,bar,baz\"  runs the named unit tests and exits\n" <<
+			"      --preload-all-objects    loads every object type at startup, parsing\n"
+			"                                 them in the background, and logs how long\n"
+			"                                 each took to compile\n"
 			"      --no-tests               skips the execution of unit tests on startup\n"
 			"      --utility=NAME           runs the specified UTILITY( NAME ) code block,\n" <<
 			"                                 such as compile_levels or compile_objects,\n" <<
@@ -476,6 +480,7 @@ int main(int argcount, char* argvec[])
 	std::string level_cfg = "titlescreen.cfg";
 	bool unit_tests_only = false, skip_tests = false;
 	bool run_benchmarks = false;
+	bool preload_all_objects = false;
 	std::vector<std::string> benchmarks_list;
 	std::string utility_program;
 	std::vector<std::string> util_args;
@@ -633,6 +638,8 @@ int main(int argcount, char* argvec[])
 		} else if(arg_name == "--benchmarks") {
 			run_benchmarks = true;
 			benchmarks_list = util::split(arg_value);
+		} else if(arg == "--preload-all-objects") {
+			preload_all_objects = true;
 		} else if(arg == "--no-tests") {
 			skip_tests = true;
 		} else if(arg == "--tests" || arg_name == "--tests") {
@@ -1132,6 +1139,10 @@ int main(int argcount, char* argvec[])
 
 		game_logic::FormulaObject::loadAllClasses();
 
+		if(preload_all_objects) {
+			CustomObjectType::preloadAllObjects(true);
+		}
+
 	} catch(const json::ParseError& e) {
 		LOG_ERROR("ERROR PARSING: " << e.errorMessage());
 		return 0;
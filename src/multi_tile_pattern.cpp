@@ -29,6 +29,7 @@
 #include "multi_tile_pattern.hpp"
 #include "tile_map.hpp"
 #include "string_utils.hpp"
+#include "thread.hpp"
 #include "variant_utils.hpp"
 
 namespace 
@@ -38,6 +39,17 @@ namespace
 	//test equality of regexes.
 	std::map<std::string, const boost::regex*> regex_pool;
 
+	//pool ids are issued while tile maps are built, which may be on a
+	//background thread, and looked up by their matchers.
+	std::map<const boost::regex*, int> regex_pool_ids;
+	std::vector<const boost::regex*> regexes_by_pool_id;
+
+	threading::mutex& regex_pool_ids_mutex()
+	{
+		static threading::mutex* m = new threading::mutex;
+		return *m;
+	}
+
 	std::deque<MultiTilePattern>& patterns()
 	{
 		static std::deque<MultiTilePattern> instance;
@@ -67,6 +79,27 @@ const boost::regex& get_regex_from_pool(const std::string& key)
 	return *re;
 }
 
+int get_regex_pool_id(const boost::regex* re)
+{
+	threading::lock lck(regex_pool_ids_mutex());
+	auto itor = regex_pool_ids.find(re);
+	if(itor != regex_pool_ids.end()) {
+		return itor->second;
+	}
+
+	const int id = static_cast<int>(regexes_by_pool_id.size());
+	regexes_by_pool_id.push_back(re);
+	regex_pool_ids[re] = id;
+	return id;
+}
+
+const boost::regex* get_regex_by_pool_id(int id)
+{
+	threading::lock lck(regex_pool_ids_mutex());
+	ASSERT_LOG(id >= 0 && id < static_cast<int>(regexes_by_pool_id.size()), "Unknown regex pool id: " << id);
+	return regexes_by_pool_id[id];
+}
+
 const std::deque<MultiTilePattern>& MultiTilePattern::getAll()
 {
 	return patterns();
@@ -284,6 +317,7 @@ MultiTilePattern::MultiTilePattern(variant node, const std::string& tile_id)
 
 		TileInfo info;
 		info.re = &get_regex_from_pool(cell.regex);
+		info.re_id = get_regex_pool_id(info.re);
 
 		for(const std::string& m : cell.map_to) {
 			TileEntry entry;
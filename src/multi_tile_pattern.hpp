@@ -36,6 +36,12 @@
 
 const boost::regex& get_regex_from_pool(const std::string& key);
 
+//every regex handed out by the pool can also be given a small id, so that
+//sets of regexes can be kept as bitsets. An inverted regex ('!' prefix)
+//has an id of its own. Both functions are safe to call from any thread.
+int get_regex_pool_id(const boost::regex* re);
+const boost::regex* get_regex_by_pool_id(int id);
+
 class MultiTilePattern
 {
 public:
@@ -53,6 +59,7 @@ public:
 
 	struct TileInfo {
 		const boost::regex* re;
+		int re_id;
 		std::vector<TileEntry> tiles;
 	};
 
@@ -0,0 +1,174 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <map>
+
+#include "entity.hpp"
+#include "formula_garbage_collector.hpp"
+#include "solid_entity_index.hpp"
+
+namespace
+{
+	//the union of the entity's solid and platform rects.
+	rect get_indexed_rect(const Entity& e)
+	{
+		const rect& solid = e.solidRect();
+		const rect platform = e.platformRect();
+		if(solid.w() <= 0 || solid.h() <= 0) {
+			return platform;
+		}
+
+		if(platform.w() <= 0 || platform.h() <= 0) {
+			return solid;
+		}
+
+		const int x1 = std::min(solid.x(), platform.x());
+		const int y1 = std::min(solid.y(), platform.y());
+		const int x2 = std::max(solid.x2(), platform.x2());
+		const int y2 = std::max(solid.y2(), platform.y2());
+		return rect(x1, y1, x2 - x1, y2 - y1);
+	}
+}
+
+SolidEntityIndex::SolidEntityIndex()
+  : valid_(false), hits_(0), misses_(0), candidates_(0), skipped_(0)
+{
+}
+
+SolidEntityIndex::SolidEntityIndex(const SolidEntityIndex& o)
+  : valid_(false), hits_(0), misses_(0), candidates_(0), skipped_(0)
+{
+}
+
+SolidEntityIndex& SolidEntityIndex::operator=(const SolidEntityIndex& o)
+{
+	invalidate();
+	return *this;
+}
+
+SolidEntityIndex::~SolidEntityIndex()
+{
+	invalidate();
+}
+
+void SolidEntityIndex::invalidate()
+{
+	for(const EntityPtr& e : linked_) {
+		if(e && e->spatial_index_link_.index == this) {
+			e->spatial_index_link_.index = nullptr;
+			e->spatial_index_link_.moved = false;
+		}
+	}
+
+	linked_.clear();
+	moved_.clear();
+	valid_ = false;
+}
+
+void SolidEntityIndex::add(const EntityPtr& e)
+{
+	if(!valid_) {
+		return;
+	}
+
+	link(e, static_cast<int>(linked_.size()));
+}
+
+void SolidEntityIndex::link(const EntityPtr& e, int tag)
+{
+	e->spatial_index_link_.index = this;
+	e->spatial_index_link_.moved = false;
+	linked_.push_back(e);
+	grid_.update(e.get(), get_indexed_rect(*e), tag);
+}
+
+void SolidEntityIndex::rebuild(const std::vector<EntityPtr>& chars)
+{
+	invalidate();
+
+	//the grid is kept between rebuilds, so objects which didn't change
+	//cells since the last rebuild are cheap to re-add.
+	grid_.beginUpdate();
+	linked_.reserve(chars.size());
+	for(const EntityPtr& e : chars) {
+		link(e, static_cast<int>(linked_.size()));
+	}
+	grid_.endUpdate();
+
+	valid_ = true;
+}
+
+void SolidEntityIndex::entityMoved(Entity* e)
+{
+	moved_.push_back(e);
+}
+
+void SolidEntityIndex::flushMoved()
+{
+	for(Entity* e : moved_) {
+		e->spatial_index_link_.moved = false;
+		grid_.move(e, get_indexed_rect(*e));
+	}
+
+	moved_.clear();
+}
+
+void SolidEntityIndex::getEntitiesInRect(const std::vector<EntityPtr>& chars, const rect& area, std::vector<EntityPtr>& result)
+{
+	if(!valid_ || chars.size() != linked_.size()) {
+		rebuild(chars);
+		++misses_;
+	} else {
+		flushMoved();
+		++hits_;
+	}
+
+	query_buf_.clear();
+	grid_.getIntersecting(area, query_buf_);
+	std::sort(query_buf_.begin(), query_buf_.end());
+
+	candidates_ += static_cast<int>(query_buf_.size());
+	skipped_ += static_cast<int>(chars.size() - query_buf_.size());
+
+	for(int index : query_buf_) {
+		result.push_back(chars[index]);
+	}
+}
+
+void SolidEntityIndex::surrenderReferences(GarbageCollector* collector)
+{
+	for(EntityPtr& e : linked_) {
+		collector->surrenderPtr(&e, "solid_entity_index");
+	}
+}
+
+variant SolidEntityIndex::getStats() const
+{
+	std::map<variant, variant> m;
+	m[variant("hits")] = variant(hits_);
+	m[variant("misses")] = variant(misses_);
+	m[variant("candidates")] = variant(candidates_);
+	m[variant("skipped")] = variant(skipped_);
+	return variant(&m);
+}
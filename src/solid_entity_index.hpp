@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "entity_fwd.hpp"
+#include "geometry.hpp"
+#include "spatial_grid.hpp"
+#include "variant.hpp"
+
+class GarbageCollector;
+
+//Index of a level's solid and platform objects by the area they cover,
+//so collision queries only need to look at objects near the area being
+//probed. Linked entities report every change to their solid or platform
+//rect, so the index stays exact while objects move during a cycle.
+//
+//The index mirrors the list of solid characters the level passes to
+//getEntitiesInRect(). Whenever that list is rebuilt the level must call
+//invalidate(), and the index will be rebuilt on the next query.
+class SolidEntityIndex
+{
+public:
+	SolidEntityIndex();
+
+	//copies start out empty; entities can only be linked to one index.
+	SolidEntityIndex(const SolidEntityIndex& o);
+	SolidEntityIndex& operator=(const SolidEntityIndex& o);
+	~SolidEntityIndex();
+
+	void invalidate();
+
+	//called when e is appended to the level's solid characters.
+	void add(const EntityPtr& e);
+
+	//gets the entities in chars whose solid or platform rect intersects
+	//area, in the order they appear in chars.
+	void getEntitiesInRect(const std::vector<EntityPtr>& chars, const rect& area, std::vector<EntityPtr>& result);
+
+	//called by entities whenever their solid or platform rect changes.
+	void entityMoved(Entity* e);
+
+	void surrenderReferences(GarbageCollector* collector);
+
+	//hits are queries answered from the index; misses are queries which
+	//had to rebuild it first.
+	variant getStats() const;
+
+private:
+	void rebuild(const std::vector<EntityPtr>& chars);
+	void flushMoved();
+	void link(const EntityPtr& e, int tag);
+
+	bool valid_;
+	std::vector<EntityPtr> linked_;
+	std::vector<Entity*> moved_;
+	SpatialGrid<const Entity*> grid_;
+	std::vector<int> query_buf_;
+
+	int hits_, misses_;
+	int candidates_, skipped_;
+};
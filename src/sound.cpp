@@ -23,11 +23,18 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <iostream>
 #include <map>
 #include <cmath>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "SDL_mixer.h"
 #include "SDL_loadso.h"
 
@@ -52,6 +59,7 @@
 
 PREF_INT(mixer_looped_sounds_fade_time_ms, 100, "Number of milliseconds looped sounds should fade for");
 PREF_INT(audio_cache_size_mb, 30, "Audio data cache size in megabytes");
+PREF_INT(audio_stream_min_seconds, 10, "Ogg sound effects at least this many seconds long are streamed rather than cached. 0 disables streaming");
 
 PREF_BOOL(debug_visualize_audio, false, "Show a graph of audio data");
 
@@ -469,14 +477,180 @@ namespace sound
 	ffl::IntrusivePtr<MusicPlayer> g_music_queue;
 
 
+	//A long sound effect decoded a piece at a time rather than all at once.
+	//The music thread decodes into a ring of stereo frames and the mixing
+	//thread plays them. Each side only advances its own counter, so neither
+	//needs a lock.
+	class SoundStream
+	{
+	public:
+		SoundStream(const std::string& fname, int nframes, int start_frame)
+		  : fname_(fname), nframes_(nframes), start_frame_(start_frame), opened_(false), nchannels_(0), bit_stream_(0),
+		    buf_(BufferFrames*2), read_count_(0), write_count_(0), eof_(false), looped_(false), loop_point_(0), loop_from_(0)
+		{}
+
+		~SoundStream()
+		{
+			if(opened_) {
+				vorbis().ov_clear(&file_);
+			}
+		}
+
+		int nframes() const { return nframes_; }
+
+		//May be called from any thread. Takes effect the next time the
+		//decoder reaches the loop end.
+		void setLoop(bool looped, int loop_point, int loop_from)
+		{
+			loop_point_.store(loop_point);
+			loop_from_.store(loop_from);
+			looped_.store(looped);
+		}
+
+		//Mixing thread: points *data at up to max_frames decoded stereo frames
+		//which are contiguous in the ring and returns how many there are.
+		int peek(const short** data, int max_frames) const
+		{
+			const unsigned read = read_count_.load(std::memory_order_relaxed);
+			const unsigned navail = write_count_.load(std::memory_order_acquire) - read;
+			const unsigned index = read % BufferFrames;
+			*data = &buf_[index*2];
+			return static_cast<int>(std::min<unsigned>(std::min<unsigned>(navail, BufferFrames - index), static_cast<unsigned>(max_frames)));
+		}
+
+		//Mixing thread: releases frames returned by peek() back to the decoder.
+		void consume(int nframes)
+		{
+			read_count_.store(read_count_.load(std::memory_order_relaxed) + nframes, std::memory_order_release);
+		}
+
+		//True once the decoder has reached the end and every frame has been played.
+		bool finished() const
+		{
+			return eof_.load(std::memory_order_acquire) && read_count_.load(std::memory_order_acquire) == write_count_.load(std::memory_order_acquire);
+		}
+
+		//Music thread: decodes until the ring is full or the file ends.
+		void decode()
+		{
+			if(eof_.load(std::memory_order_relaxed)) {
+				return;
+			}
+
+			if(!opened_) {
+				if(vorbis().ov_fopen(fname_.c_str(), &file_) != 0) {
+					LOG_ERROR("Could not open streamed sound: " << fname_);
+					eof_.store(true, std::memory_order_release);
+					return;
+				}
+
+				opened_ = true;
+				nchannels_ = vorbis().ov_info(&file_, -1)->channels;
+				if(start_frame_ > 0) {
+					vorbis().ov_time_seek(&file_, start_frame_/SampleRateDouble);
+				}
+			}
+
+			unsigned write = write_count_.load(std::memory_order_relaxed);
+
+			//Seeks since we last got data, to avoid spinning on an empty loop region.
+			int nseeks = 0;
+
+			for(;;) {
+				const unsigned nspace = BufferFrames - (write - read_count_.load(std::memory_order_acquire));
+				if(nspace == 0) {
+					break;
+				}
+
+				const unsigned index = write % BufferFrames;
+				int nwant = static_cast<int>(std::min<unsigned>(nspace, BufferFrames - index));
+
+				const bool looped = looped_.load();
+				const int loop_from = loop_from_.load();
+				if(looped && loop_from > 0 && loop_from < nframes_) {
+					const int cur = static_cast<int>(vorbis().ov_time_tell(&file_)*SampleRate + 0.5);
+					if(cur >= loop_from) {
+						if(++nseeks > 1 || vorbis().ov_time_seek(&file_, loop_point_.load()/SampleRateDouble) != 0) {
+							eof_.store(true, std::memory_order_release);
+							break;
+						}
+						continue;
+					}
+
+					nwant = std::min(nwant, loop_from - cur);
+				}
+
+				short decoded[4096];
+				const int nbytes_wanted = std::min<int>(sizeof(decoded), nwant*nchannels_*sizeof(short));
+				const long nbytes = vorbis().ov_read(&file_, reinterpret_cast<char*>(decoded), nbytes_wanted, 0, 2, 1, &bit_stream_);
+				if(nbytes <= 0) {
+					//End of the file, or a decoding error which we treat the same way.
+					if(looped && nbytes == 0 && ++nseeks <= 1 && vorbis().ov_time_seek(&file_, loop_point_.load()/SampleRateDouble) == 0) {
+						continue;
+					}
+
+					eof_.store(true, std::memory_order_release);
+					break;
+				}
+
+				nseeks = 0;
+
+				const int ngot = static_cast<int>(nbytes/(nchannels_*sizeof(short)));
+				short* out = &buf_[index*2];
+				if(nchannels_ == 2) {
+					memcpy(out, decoded, ngot*2*sizeof(short));
+				} else {
+					for(int n = 0; n != ngot; ++n) {
+						out[n*2] = out[n*2+1] = decoded[n];
+					}
+				}
+
+				write += ngot;
+				write_count_.store(write, std::memory_order_release);
+			}
+		}
+
+	private:
+		enum { BufferFrames = 32768 };
+
+		std::string fname_;
+		int nframes_, start_frame_;
+
+		//Only used by the music thread.
+		OggVorbis_File file_;
+		bool opened_;
+		int nchannels_;
+		int bit_stream_;
+
+		std::vector<short> buf_;
+		std::atomic<unsigned> read_count_, write_count_;
+		std::atomic<bool> eof_;
+
+		std::atomic<bool> looped_;
+		std::atomic<int> loop_point_, loop_from_;
+	};
+
+	//Streams the music thread keeps decoded. Expired entries are dropped
+	//by the music thread. Access controlled by g_sound_streams_mutex.
+	std::vector<std::weak_ptr<SoundStream>> g_sound_streams;
+	threading::mutex g_sound_streams_mutex;
+
+	void register_sound_stream(const std::shared_ptr<SoundStream>& stream)
+	{
+		threading::lock lck(g_sound_streams_mutex);
+		g_sound_streams.push_back(stream);
+	}
+
 	//Ring buffer which music is mixed into by the music thread. The mixer thread consumes
 	//this for the mix.
-	//Access to g_music_buf_read and g_music_buf_nsamples is controlled by g_music_thread_mutex.
-	//g_music_buf_write is only used by the music thread so doesn't need to be synchronized.
+	//g_music_buf_read is only written by the mixer and g_music_buf_write is only used by
+	//the music thread. g_music_buf_nsamples is the hand-off between them: the mixer moves
+	//the read pointer before releasing samples and the music thread reads the count
+	//before the read pointer, so neither needs a lock.
 	float g_music_buf[8192];
-	float* g_music_buf_read = g_music_buf;
+	std::atomic<float*> g_music_buf_read(g_music_buf);
 	float* g_music_buf_write = g_music_buf;
-	int g_music_buf_nsamples = 0;
+	std::atomic<int> g_music_buf_nsamples(0);
 
 	//The music thread. The purpose of this thread is to fill the music ring buffer with music
 	//mixed from the g_music_players music tracks.
@@ -500,12 +674,11 @@ namespace sound
 						players.push_back(p.get());
 					}
 				}
-
-				buf_read = g_music_buf_read;
-
-				nspace_available = sizeof(g_music_buf)/sizeof(*g_music_buf) - g_music_buf_nsamples;
 			}
 
+			nspace_available = sizeof(g_music_buf)/sizeof(*g_music_buf) - g_music_buf_nsamples.load(std::memory_order_acquire);
+			buf_read = g_music_buf_read.load(std::memory_order_acquire);
+
 			float* end_music_buf = g_music_buf + sizeof(g_music_buf)/sizeof(*g_music_buf);
 
 			int nwrite = 0;
@@ -537,11 +710,29 @@ namespace sound
 				}
 			}
 
+			g_music_buf_nsamples.fetch_add(nwrite, std::memory_order_release);
+
+			//Keep streamed sound effects decoded ahead of the mixer.
+			std::vector<std::shared_ptr<SoundStream>> streams;
 			{
-				threading::lock lck(g_music_thread_mutex);
-				g_music_buf_nsamples += nwrite;
+				threading::lock lck(g_sound_streams_mutex);
+				for(auto itor = g_sound_streams.begin(); itor != g_sound_streams.end(); ) {
+					std::shared_ptr<SoundStream> stream = itor->lock();
+					if(stream) {
+						streams.push_back(stream);
+						++itor;
+					} else {
+						itor = g_sound_streams.erase(itor);
+					}
+				}
 			}
 
+			for(const std::shared_ptr<SoundStream>& stream : streams) {
+				stream->decode();
+			}
+
+			streams.clear();
+
 			SDL_Delay(20);
 		}
 	}
@@ -708,6 +899,13 @@ namespace sound
 	size_t g_wave_cache_size;
 	threading::mutex g_wave_cache_mutex;
 
+	//Statistics on how well the wave cache is doing, reported by get_memory_usage_info().
+	std::atomic<int> g_wave_cache_hits(0), g_wave_cache_misses(0), g_wave_cache_evictions(0);
+
+	//Sound effects which are too long to cache and are instead streamed,
+	//mapped to their length in frames. Access controlled by g_wave_cache_mutex.
+	std::map<std::string, int> g_streamed_waves;
+
 	bool get_cached_wave(const std::string& fname, std::shared_ptr<WaveData>* ptr)
 	{
 		threading::lock lck(g_wave_cache_mutex);
@@ -727,6 +925,48 @@ namespace sound
 		}
 	}
 
+	bool get_streamed_wave(const std::string& fname, int* nframes)
+	{
+		threading::lock lck(g_wave_cache_mutex);
+		auto itor = g_streamed_waves.find(fname);
+		if(itor == g_streamed_waves.end()) {
+			return false;
+		}
+
+		*nframes = itor->second;
+		return true;
+	}
+
+	//Checks whether an ogg file is long enough to be streamed, and if so
+	//records it in g_streamed_waves. Streams aren't resampled, so only
+	//files already at our sample rate qualify.
+	bool register_if_streamed(const std::string& fname)
+	{
+		if(g_audio_stream_min_seconds <= 0) {
+			return false;
+		}
+
+		OggVorbis_File file;
+		if(vorbis().ov_fopen(fname.c_str(), &file) != 0) {
+			return false;
+		}
+
+		const vorbis_info* info = vorbis().ov_info(&file, -1);
+		const ogg_int64_t nframes = vorbis().ov_pcm_total(&file, -1);
+		const bool streamed = info != nullptr && info->rate == SampleRate && (info->channels == 1 || info->channels == 2) && nframes >= static_cast<ogg_int64_t>(g_audio_stream_min_seconds)*SampleRate && nframes <= INT_MAX;
+		vorbis().ov_clear(&file);
+
+		if(!streamed) {
+			return false;
+		}
+
+		LOG_INFO("Streaming long sound: " << fname << " (" << (nframes/SampleRate) << "s)");
+
+		threading::lock lck(g_wave_cache_mutex);
+		g_streamed_waves[fname] = static_cast<int>(nframes);
+		return true;
+	}
+
 
 	bool g_muted;
 
@@ -754,6 +994,10 @@ namespace sound
 		std::vector<char> ogg_buf;
 
 		if(fname.size() > 4 && std::equal(fname.end()-4,fname.end(), ".ogg")) {
+			if(register_if_streamed(fname)) {
+				return;
+			}
+
 			bool res = loadVorbis(fname.c_str(), res_spec, ogg_buf);
 			ASSERT_LOG(res, "Could not load ogg: " << fname);
 			ASSERT_LOG(ogg_buf.size() > 0, "No ogg data: " << fname);
@@ -835,6 +1079,7 @@ namespace sound
 				}
 
 				g_wave_cache_size -= g_wave_cache_lru.back()->memoryUsage();
+				++g_wave_cache_evictions;
 
 				{
 					threading::lock lck(g_files_loading_mutex);
@@ -885,9 +1130,151 @@ namespace sound
 		}
 	}
 
+	//Queues an already mapped file for the loader thread. Returns false if
+	//it's already loaded or loading.
+	bool queue_wave_load(const std::string& file)
+	{
+		{
+			threading::lock lck(g_files_loading_mutex);
+			if(g_files_loading.count(file)) {
+				return false;
+			}
+
+			g_files_loading.insert(file);
+		}
+
+		threading::lock lck(g_loader_thread_mutex);
+		g_loader_thread_queue.push_back(file);
+		g_loader_thread_cond.notify_one();
+		return true;
+	}
+
 	std::shared_ptr<threading::thread> g_loader_thread;
 	std::shared_ptr<threading::thread> g_music_thread;
 
+	//Mixing kernels used by the audio callback. Each adds into 'output',
+	//which holds interleaved stereo floats. The SSE2 paths handle whole
+	//vectors and leave the remainder to the scalar loop.
+
+	//output[n] += input[n]*volume for n in [0,nfloats).
+	void mix_scaled(float* output, const float* input, int nfloats, float volume)
+	{
+		int n = 0;
+#if defined(__SSE2__)
+		const __m128 vol = _mm_set1_ps(volume);
+		for(; n + 4 <= nfloats; n += 4) {
+			const __m128 in = _mm_loadu_ps(input + n);
+			const __m128 out = _mm_loadu_ps(output + n);
+			_mm_storeu_ps(output + n, _mm_add_ps(out, _mm_mul_ps(in, vol)));
+		}
+#endif
+		for(; n < nfloats; ++n) {
+			output[n] += input[n]*volume;
+		}
+	}
+
+	//Mixes nframes of interleaved stereo 16-bit samples, scaling the left
+	//and right channels separately.
+	void mix_s16_stereo(float* output, const short* input, int nframes, float left, float right)
+	{
+		left /= SHRT_MAX;
+		right /= SHRT_MAX;
+
+		int n = 0;
+#if defined(__SSE2__)
+		const __m128 vol = _mm_setr_ps(left, right, left, right);
+		for(; n + 4 <= nframes; n += 4) {
+			const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + n*2));
+			//widen to 32 bits, using the arithmetic shift to sign extend.
+			const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+			const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+
+			float* out = output + n*2;
+			_mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_cvtepi32_ps(lo), vol)));
+			_mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(_mm_cvtepi32_ps(hi), vol)));
+		}
+#endif
+		for(; n < nframes; ++n) {
+			output[n*2] += input[n*2]*left;
+			output[n*2+1] += input[n*2+1]*right;
+		}
+	}
+
+	//Mixes nframes of mono 16-bit samples into both channels.
+	void mix_s16_mono(float* output, const short* input, int nframes, float left, float right)
+	{
+		left /= SHRT_MAX;
+		right /= SHRT_MAX;
+
+		int n = 0;
+#if defined(__SSE2__)
+		const __m128 vol = _mm_setr_ps(left, right, left, right);
+		for(; n + 4 <= nframes; n += 4) {
+			const __m128i in = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + n));
+			//duplicate each sample into both channels then widen to 32 bits.
+			const __m128i pairs = _mm_unpacklo_epi16(in, in);
+			const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(pairs, pairs), 16);
+			const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(pairs, pairs), 16);
+
+			float* out = output + n*2;
+			_mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_cvtepi32_ps(lo), vol)));
+			_mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(_mm_cvtepi32_ps(hi), vol)));
+		}
+#endif
+		for(; n < nframes; ++n) {
+			output[n*2] += input[n]*left;
+			output[n*2+1] += input[n]*right;
+		}
+	}
+
+	//Fixed capacity queue with one thread pushing and one thread popping.
+	//Neither side takes a lock, so the audio callback never has to wait
+	//for the game thread.
+	template<typename T, int Capacity>
+	class SingleProducerQueue
+	{
+	public:
+		SingleProducerQueue() : head_(0), tail_(0)
+		{}
+
+		//Called only from the producing thread. Returns false if the queue is full.
+		bool push(const T& value)
+		{
+			const int tail = tail_.load(std::memory_order_relaxed);
+			const int next = (tail + 1) % Capacity;
+			if(next == head_.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			items_[tail] = value;
+			tail_.store(next, std::memory_order_release);
+			return true;
+		}
+
+		//Called only from the consuming thread. Returns false if the queue is empty.
+		bool pop(T* value)
+		{
+			const int head = head_.load(std::memory_order_relaxed);
+			if(head == tail_.load(std::memory_order_acquire)) {
+				return false;
+			}
+
+			*value = items_[head];
+			head_.store((head + 1) % Capacity, std::memory_order_release);
+			return true;
+		}
+
+		//Called only from the producing thread; the consumer can only make
+		//more room, so a false result stays valid.
+		bool full() const
+		{
+			return (tail_.load(std::memory_order_relaxed) + 1) % Capacity == head_.load(std::memory_order_acquire);
+		}
+	private:
+		T items_[Capacity];
+		std::atomic<int> head_, tail_;
+	};
+
 	class SoundSource : public game_logic::FormulaCallable
 	{
 	public:
@@ -957,6 +1344,7 @@ namespace sound
 		void setPeakGain(float peakGainDB);
 		void setBiquad(BiquadFilterType type, float Fc, float Q, float peakGain);
 		float process(int nchannel, float in);
+		void processStereo(const float* in, float* out, int nframes);
 		
 	protected:
 		void calcBiquad(void);
@@ -975,6 +1363,36 @@ namespace sound
 		return out;
 	}
 
+	//Filters nframes of interleaved stereo input, adding the result to out.
+	//The recursion is serial in time, so instead of vectorizing this keeps
+	//the coefficients and delay line for both channels in locals.
+	void Biquad::processStereo(const float* in, float* out, int nframes) {
+		const float c0 = a0, c1 = a1, c2 = a2, d1 = b1, d2 = b2;
+		float lz1 = z1_[0], lz2 = z2_[0];
+		float rz1 = z1_[1], rz2 = z2_[1];
+
+		for(int n = 0; n < nframes; ++n) {
+			const float left = in[n*2];
+			const float right = in[n*2+1];
+
+			const float left_out = left * c0 + lz1;
+			lz1 = left * c1 + lz2 - d1 * left_out;
+			lz2 = left * c2 - d2 * left_out;
+
+			const float right_out = right * c0 + rz1;
+			rz1 = right * c1 + rz2 - d1 * right_out;
+			rz2 = right * c2 - d2 * right_out;
+
+			out[n*2] += left_out;
+			out[n*2+1] += right_out;
+		}
+
+		z1_[0] = lz1;
+		z2_[0] = lz2;
+		z1_[1] = rz1;
+		z2_[1] = rz2;
+	}
+
 	Biquad::Biquad(BiquadFilterType t, variant node) {
 		setBiquad(t, node["fc"].as_double(4000.0)/SampleRate, node["q"].as_double(0.707), node["peak_gain"].as_double(1.0));
 		for(int n = 0; n != NumChannels; ++n) {
@@ -1118,28 +1536,29 @@ namespace sound
 		BiQuadSoundEffectFilter(BiquadFilterType t, variant node) : SoundEffectFilter(node), filter_(t, node)
 		{}
 
+		//clones are made on the game thread, so don't copy the mixer's buffer.
+		BiQuadSoundEffectFilter(const BiQuadSoundEffectFilter& o) : SoundEffectFilter(o), filter_(o.filter_)
+		{}
+
 		void MixData(float* output, int nsamples) override
 		{
-			threading::lock lck(mutex_);
-
-			std::vector<float> input;
-			input.resize(nsamples*NumChannels);
-			GetData(&input[0], nsamples);
+			if(nsamples <= 0) {
+				return;
+			}
 
-			const float* in = &input[0];
+			//sources mix into their output, so the scratch buffer starts silent.
+			input_.assign(nsamples*NumChannels, 0.0f);
+			GetData(&input_[0], nsamples);
 
-			for(int n = 0; n < nsamples; ++n) {
-				float left = filter_.process(0, *in++);
-				float right = filter_.process(1, *in++);
-				*output++ += left;
-				*output++ += right;
-			}
+			filter_.processStereo(&input_[0], output, nsamples);
 		}
 
 		SoundEffectFilter* clone() const override { return new BiQuadSoundEffectFilter(*this); }
 	private:
-		threading::mutex mutex_;
 		Biquad filter_;
+
+		//Only used by the mixing thread; kept to avoid allocating every callback.
+		std::vector<float> input_;
 		DECLARE_CALLABLE(BiQuadSoundEffectFilter);
 	};
 
@@ -1152,23 +1571,32 @@ namespace sound
 		explicit SpeedSoundEffectFilter(variant options) : SoundEffectFilter(options), speed_(options["speed"].as_float(1.0f))
 		{}
 
+		SpeedSoundEffectFilter(const SpeedSoundEffectFilter& o) : SoundEffectFilter(o), speed_(o.speed_.load())
+		{}
+
 		void MixData(float* output, int nsamples) override
 		{
-			threading::lock lck(mutex_);
-			int source_nsamples = int(nsamples*speed_);
+			const float speed = speed_;
+			int source_nsamples = int(nsamples*speed);
 
 			if(source_nsamples <= 0) {
 				return;
 			}
 
-			std::vector<float> buf;
-			buf.resize(source_nsamples*NumChannels);
-			GetData(&buf[0], source_nsamples);
+			buf_.assign(source_nsamples*NumChannels, 0.0f);
+			GetData(&buf_[0], source_nsamples);
+
+			//point is never negative, so truncation is floor(). When point is a
+			//whole number the ratio is zero, so using a+1 for the upper sample
+			//matches ceil().
+			const float* buf = &buf_[0];
+			const int last = source_nsamples - 1;
 			for(int n = 0; n != nsamples; ++n) {
-				const float point = n*speed_;
-				const int a = util::clamp<int>(static_cast<int>(floor(point)), 0, source_nsamples - 1);
-				const int b = util::clamp<int>(static_cast<int>(ceil(point)), 0, source_nsamples - 1);
-				const float ratio = n*speed_ - floor(point);
+				const float point = n*speed;
+				const int whole = static_cast<int>(point);
+				const int a = std::min<int>(whole, last);
+				const int b = std::min<int>(whole + 1, last);
+				const float ratio = point - whole;
 
 				output[n*2] += util::mix<float>(buf[a*2], buf[b*2], ratio);
 				output[n*2+1] += util::mix<float>(buf[a*2+1], buf[b*2+1], ratio);
@@ -1177,36 +1605,39 @@ namespace sound
 
 		SoundEffectFilter* clone() const override { return new SpeedSoundEffectFilter(*this); }
 	private:
-		threading::mutex mutex_;
-		float speed_;
+		//set by the game thread while the mixer reads it.
+		std::atomic<float> speed_;
+
+		//Only used by the mixing thread; kept to avoid allocating every callback.
+		std::vector<float> buf_;
 		DECLARE_CALLABLE(SpeedSoundEffectFilter);
 	};
 
 	BEGIN_DEFINE_CALLABLE(SpeedSoundEffectFilter, SoundEffectFilter)
 	DEFINE_FIELD(speed, "decimal")
-		return variant(obj.speed_);
+		return variant(obj.speed_.load());
 	DEFINE_SET_FIELD
-		threading::lock lck(obj.mutex_);
 		obj.speed_ = value.as_float();
 	END_DEFINE_CALLABLE(SpeedSoundEffectFilter)
 
 	class BinauralDelaySoundEffectFilter : public SoundEffectFilter
 	{
 	public:
-		explicit BinauralDelaySoundEffectFilter(variant options) : SoundEffectFilter(options), delay_(options["delay"].as_float())
+		explicit BinauralDelaySoundEffectFilter(variant options) : SoundEffectFilter(options), delay_(options["delay"].as_float()), buffered_(false)
+		{}
+
+		//clones are made on the game thread, so don't copy the mixer's buffer.
+		BinauralDelaySoundEffectFilter(const BinauralDelaySoundEffectFilter& o) : SoundEffectFilter(o), delay_(o.delay_), buffered_(false)
 		{}
 
 		SoundEffectFilter* clone() const override { return new BinauralDelaySoundEffectFilter(*this); }
 
 		bool finished() const override {
-			threading::lock lck(mutex_);
-			return buf_.empty() && SoundEffectFilter::finished();
+			return !buffered_ && SoundEffectFilter::finished();
 		}
 
 		void MixData(float* output, int nsamples) override
 		{
-			threading::lock lck(mutex_);
-
 			std::vector<float> buffer;
 			buffer.resize(nsamples*NumChannels);
 			GetData(&buffer[0], nsamples);
@@ -1265,11 +1696,16 @@ namespace sound
 					buf_.erase(buf_.begin(), buf_.begin() + ncopy);
 				}
 			}
+
+			buffered_ = !buf_.empty();
 		}
 	private:
-		threading::mutex mutex_;
 		float delay_;
+
+		//buf_ is only used by the mixer; buffered_ tells the game thread
+		//whether it still holds delayed samples.
 		std::vector<float> buf_;
+		std::atomic<bool> buffered_;
 		DECLARE_CALLABLE(BinauralDelaySoundEffectFilter);
 	};
 
@@ -1278,15 +1714,45 @@ namespace sound
 		return variant(obj.delay_);
 	END_DEFINE_CALLABLE(BinauralDelaySoundEffectFilter)
 
+	class PlayingSound;
+
+	//A change sent from the game thread to the mixer. Which of the arguments
+	//are used depends on the type.
+	struct MixerCommand {
+		enum TYPE { ADD_SOUND, REMOVE_SOUND, SET_VOLUME, SET_PANNING, SET_LOOP, STOP, SET_SOURCE, SET_FILTERS };
+		TYPE type;
+		PlayingSound* sound;
+
+		//SET_VOLUME: volume and seconds to reach it; SET_PANNING: left and
+		//right; STOP: fade time.
+		float value[2];
+
+		//SET_LOOP
+		bool looped;
+		int loop_point, loop_from;
+
+		//SET_SOURCE: the wave data or stream to mix; both are null while loading.
+		const WaveData* data;
+		SoundStream* stream;
+
+		//SET_FILTERS: the end of the filter chain, which the mixer pulls from.
+		SoundSource* first_filter;
+
+		//Numbers commands in the order they're sent, so the game thread knows
+		//when the mixer has run them.
+		unsigned int seq;
+	};
+
 	class RawPlayingSound : public SoundSource
 	{
 	public:
-		RawPlayingSound(const std::string& fname, float volume, float fade_in) : fname_(fname), pos_(0), volume_(volume), volume_target_(0.0), volume_target_time_(-1.0), fade_in_(fade_in), looped_(false), loop_point_(0), loop_from_(0), fade_out_(-1.0f), fade_out_current_(0.0f), left_pan_(1.0f), right_pan_(1.0f)
+		RawPlayingSound(const std::string& fname, float volume, float fade_in) : fname_(fname), pos_(0), volume_(volume), faded_out_(false), fade_out_(-1.0f), looped_(false), loop_point_(0), loop_from_(0), left_pan_(1.0f), right_pan_(1.0f), waited_for_load_(false)
 		{
 			init();
+			initMixerState(fade_in);
 		}
 
-		RawPlayingSound(const std::string& fname, variant options) : fname_(fname), pos_(int(options["pos"].as_double(0.0)*SampleRate)), volume_(options["volume"].as_float(1.0f)), volume_target_(0.0), volume_target_time_(-1.0), fade_in_(options["fade_in"].as_float(0.0f)), looped_(options["loop"].as_bool(false)), loop_point_(int(options["loop_point"].as_float(0.0f)*SampleRate)), loop_from_(int(options["loop_from"].as_float(0.0f)*SampleRate)), fade_out_(-1.0f), fade_out_current_(0.0f), left_pan_(1.0f), right_pan_(1.0f)
+		RawPlayingSound(const std::string& fname, variant options) : fname_(fname), pos_(int(options["pos"].as_double(0.0)*SampleRate)), volume_(options["volume"].as_float(1.0f)), faded_out_(false), fade_out_(-1.0f), looped_(options["loop"].as_bool(false)), loop_point_(int(options["loop_point"].as_float(0.0f)*SampleRate)), loop_from_(int(options["loop_from"].as_float(0.0f)*SampleRate)), left_pan_(1.0f), right_pan_(1.0f), waited_for_load_(false)
 		{
 			variant panning = options["pan"];
 			if(panning.is_list()) {
@@ -1295,18 +1761,28 @@ namespace sound
 			}
 
 			init();
+			initMixerState(options["fade_in"].as_float(0.0f));
+		}
+
+		//Plays wave data which is already in memory, bypassing the cache.
+		RawPlayingSound(std::shared_ptr<WaveData> data, float volume) : fname_(data->fname), data_(data), pos_(0), volume_(volume), faded_out_(false), fade_out_(-1.0f), looped_(false), loop_point_(0), loop_from_(0), left_pan_(1.0f), right_pan_(1.0f), waited_for_load_(false)
+		{
+			initMixerState(0.0f);
 		}
 
 		virtual ~RawPlayingSound() {}
 
-		void setLooped(bool value) { looped_ = value; }
+		//The setters below only change what the game thread sees. Once the
+		//sound has been handed to the mixer, the owning PlayingSound sends a
+		//MixerCommand so the mixer picks up the change.
+		void setLooped(bool value) { looped_ = value; updateStreamLoop(); }
 		bool looped() const { return looped_; }
 
 		int loopPoint() const { return loop_point_; }
-		void setLoopPoint(int value) { loop_point_ = value; }
+		void setLoopPoint(int value) { loop_point_ = value; updateStreamLoop(); }
 
 		int loopFrom() const { return loop_from_; }
-		void setLoopFrom(int value) { loop_from_ = value; }
+		void setLoopFrom(int value) { loop_from_ = value; updateStreamLoop(); }
 
 		float leftPan() const { return left_pan_; }
 		float rightPan() const { return right_pan_; }
@@ -1319,20 +1795,42 @@ namespace sound
 
 		bool loaded() const
 		{
-			return data_.get() != nullptr;
+			return data_.get() != nullptr || stream_.get() != nullptr;
 		}
 
-		void init()
+		//Looks for the sound's data. Returns true if this call found it.
+		bool init()
 		{
-			if(data_) {
-				return;
+			if(data_ || stream_) {
+				return false;
 			}
-			bool res = get_cached_wave(map_filename(fname_), &data_);
+			const std::string file = map_filename(fname_);
+			bool res = get_cached_wave(file, &data_);
 			if(res) {
 				ASSERT_LOG(data_.get() != nullptr, "Could not load wave: " << fname_);
-			} else {
-				preload(fname_);
+
+				//finding a load we waited on isn't a hit; the miss was
+				//already counted when it was queued.
+				if(!waited_for_load_) {
+					++g_wave_cache_hits;
+				}
+				return true;
 			}
+
+			int nframes = 0;
+			if(get_streamed_wave(file, &nframes)) {
+				stream_.reset(new SoundStream(file, nframes, std::max(0, pos_.load())));
+				updateStreamLoop();
+				register_sound_stream(stream_);
+				return true;
+			}
+
+			waited_for_load_ = true;
+			if(queue_wave_load(file)) {
+				++g_wave_cache_misses;
+			}
+
+			return false;
 		}
 
 		const std::string& fname() const { return fname_; }
@@ -1343,61 +1841,103 @@ namespace sound
 
 			fname_ = f;
 			data_.reset();
+			stream_.reset();
+			waited_for_load_ = false;
 			init();
 		}
 
 		void stopPlaying(float fade_time) {
 			fade_out_ = fade_time;
-			fade_out_current_ = 0.0f;
 		}
 
 		//Once finished(), the game thread may remove this from the list of playing sounds.
-		bool finished() const override 
+		bool finished() const override
 		{
-			return (data_.get() != nullptr && !looped_ && pos_ >= int(data_->nsamples())) || (fade_out_ >= 0.0f && fade_out_current_ >= fade_out_);
+			return (data_.get() != nullptr && !looped_ && pos_ >= int(data_->nsamples())) || (stream_.get() != nullptr && stream_->finished()) || (fade_out_ >= 0.0f && (fade_out_ <= 0.0f || faded_out_));
 		}
 
-		void setVolume(float volume, float nseconds=0.0)
+		float getVolume() const
 		{
-			if(nseconds <= 0.0) {
-				volume_ = volume;
-				volume_target_time_ = -1.0;
-			} else {
-				volume_target_ = volume;
-				volume_target_time_ = nseconds;
+			return volume_;
+		}
+
+		//Applies a command sent by the game thread. Called from the mixing
+		//thread, or from the game thread when there's no mixer running.
+		void applyCommand(const MixerCommand& cmd)
+		{
+			switch(cmd.type) {
+			case MixerCommand::SET_VOLUME:
+				if(cmd.value[1] <= 0.0f) {
+					volume_ = cmd.value[0];
+					mix_.volume_target_time = -1.0f;
+				} else {
+					mix_.volume_target = cmd.value[0];
+					mix_.volume_target_time = cmd.value[1];
+				}
+				break;
+			case MixerCommand::SET_PANNING:
+				mix_.left_pan = cmd.value[0];
+				mix_.right_pan = cmd.value[1];
+				break;
+			case MixerCommand::SET_LOOP:
+				mix_.looped = cmd.looped;
+				mix_.loop_point = cmd.loop_point;
+				mix_.loop_from = cmd.loop_from;
+				break;
+			case MixerCommand::STOP:
+				mix_.fade_out = cmd.value[0];
+				mix_.fade_out_current = 0.0f;
+				updateFadedOut();
+				break;
+			case MixerCommand::SET_SOURCE:
+				mix_.data = cmd.data;
+				mix_.stream = cmd.stream;
+				break;
+			default:
+				break;
 			}
 		}
 
-		float getVolume() const
+		//Whether the mixer has data to play. Only called from the mixing thread.
+		bool mixerLoaded() const
 		{
-			return volume_;
+			return mix_.data != nullptr || mix_.stream != nullptr;
 		}
 
-		//Mix data into the output buffer. Can be safely called from the mixing thread.
+		//Mix data into the output buffer. Called from the mixing thread; only
+		//touches state the mixer owns, so it never waits on the game thread.
 		virtual void MixData(float* output, int nsamples) override
 		{
-			if(!data_ || nsamples <= 0 || (!looped_ && pos_ >= int(data_->nsamples())) || (fade_out_ >= 0.0f && fade_out_current_ >= fade_out_)) {
+			if(mix_.stream) {
+				mixStream(output, nsamples);
+				return;
+			}
+
+			const WaveData* data = mix_.data;
+			if(!data || nsamples <= 0 || (!mix_.looped && pos_ >= int(data->nsamples())) || (mix_.fade_out >= 0.0f && mix_.fade_out_current >= mix_.fade_out)) {
 				return;
 			}
 			int pos = pos_;
-			pos_ += nsamples;
-			std::shared_ptr<WaveData> data = data_;
+			int new_pos = pos + nsamples;
 
-			float fade_out = fade_out_;
-			float fade_out_current = fade_out_current_;
+			float fade_out = mix_.fade_out;
+			float fade_out_current = mix_.fade_out_current;
 
-			int endpoint = !looped_ || loop_from_ <= 0 || loop_from_ > static_cast<int>(data_->nsamples()) ? data_->nsamples() : loop_from_;
+			int endpoint = !mix_.looped || mix_.loop_from <= 0 || mix_.loop_from > static_cast<int>(data->nsamples()) ? data->nsamples() : mix_.loop_from;
 
-			if(fade_out_ >= 0.0f) {
-				fade_out_current_ += float(std::min<int>(nsamples, endpoint - pos))/float(SampleRate);
+			if(mix_.fade_out >= 0.0f) {
+				mix_.fade_out_current += float(std::min<int>(nsamples, endpoint - pos))/float(SampleRate);
+				updateFadedOut();
 			}
 
-			if(looped_ && pos_ >= endpoint) {
-				pos_ = loop_point_;
-				fade_in_ = 0.0f;
+			if(mix_.looped && new_pos >= endpoint) {
+				new_pos = mix_.loop_point;
+				mix_.fade_in = 0.0f;
 			}
 
-			float looped = looped_;
+			pos_ = new_pos;
+
+			const bool looped = mix_.looped;
 
 			if(pos < 0) {
 				nsamples += pos;
@@ -1415,96 +1955,216 @@ namespace sound
 				nsamples = navail;
 			}
 
-			const short* p = &data->buffer[pos*data->nchannels];
+			mixFrames(output, &data->buffer[pos*data->nchannels], data->nchannels, pos, nsamples, fade_out, fade_out_current);
+			output += nsamples*2;
+
+			if(looped && nmissed > 0 && endpoint > 0) {
+				MixData(output, nmissed);
+			}
+		}
+
+		//Position in frames. Streams count every frame played, so this wraps
+		//it back into the loop.
+		int pos() const
+		{
+			const int pos = pos_;
+			if(stream_ && looped_) {
+				const int end = loop_from_ > 0 && loop_from_ < stream_->nframes() ? loop_from_ : stream_->nframes();
+				if(pos >= end && end > loop_point_) {
+					return loop_point_ + (pos - end) % (end - loop_point_);
+				}
+			}
+			return pos;
+		}
+
+		//Length in frames, or -1 if not loaded yet.
+		int length() const
+		{
+			if(data_) {
+				return static_cast<int>(data_->nsamples());
+			} else if(stream_) {
+				return stream_->nframes();
+			}
+			return -1;
+		}
+
+		std::shared_ptr<WaveData> data() const { return data_; }
+		std::shared_ptr<SoundStream> stream() const { return stream_; }
+
+	private:
+		//Copies the game thread's settings to the mixer's. Only used while
+		//constructing, before the mixer can see the sound.
+		void initMixerState(float fade_in)
+		{
+			mix_.data = data_.get();
+			mix_.stream = stream_.get();
+			mix_.fade_in = fade_in;
+			mix_.looped = looped_;
+			mix_.loop_point = loop_point_;
+			mix_.loop_from = loop_from_;
+			mix_.left_pan = left_pan_;
+			mix_.right_pan = right_pan_;
+		}
+
+		void updateFadedOut()
+		{
+			faded_out_ = mix_.fade_out >= 0.0f && mix_.fade_out_current >= mix_.fade_out;
+		}
 
+		//Mixes nsamples frames of p, which starts at frame pos of the sound,
+		//into output.
+		void mixFrames(float* output, const short* p, int nchannels, int pos, int nsamples, float fade_out, float fade_out_current)
+		{
+			const float fade_in = mix_.fade_in;
+			const float left_pan = mix_.left_pan, right_pan = mix_.right_pan;
 			float volume = volume_ * g_sfx_volume;
 
-			if(pos < fade_in_*SampleRate || fade_out >= 0.0f) {
+			if(pos < fade_in*SampleRate || fade_out >= 0.0f) {
 				for(int n = 0; n != nsamples; ++n) {
-					*output++ += (float(*p)/SHRT_MAX) * volume * std::min<float>(1.0f, ((pos+n*2) / (SampleRate*fade_in_))) * (1.0f - (fade_out_current + (n*0.5f)/SampleRate)/fade_out);
-					if(data->nchannels > 1) {
+					*output++ += (float(*p)/SHRT_MAX) * volume * std::min<float>(1.0f, ((pos+n*2) / (SampleRate*fade_in))) * (1.0f - (fade_out_current + (n*0.5f)/SampleRate)/fade_out);
+					if(nchannels > 1) {
 						++p;
 					}
-					*output++ += (float(*p)/SHRT_MAX) * volume * std::min<float>(1.0f, ((pos+n*2) / (SampleRate*fade_in_))) * (1.0f - (fade_out_current + (n*0.5f)/SampleRate)/fade_out);
+					*output++ += (float(*p)/SHRT_MAX) * volume * std::min<float>(1.0f, ((pos+n*2) / (SampleRate*fade_in))) * (1.0f - (fade_out_current + (n*0.5f)/SampleRate)/fade_out);
 					++p;
 				}
-			} else if(volume_target_time_ > 0.0f) {
+			} else if(mix_.volume_target_time > 0.0f) {
 				const float begin_volume = volume;
 				float ntime = nsamples/44100.0f;
-				if(ntime > volume_target_time_) {
-					ntime = volume_target_time_;
+				if(ntime > mix_.volume_target_time) {
+					ntime = mix_.volume_target_time;
 				}
 
-				float ratio = ntime/volume_target_time_;
+				float ratio = ntime/mix_.volume_target_time;
 
-				float end_volume = (1.0-ratio)*begin_volume + volume_target_*ratio*g_sfx_volume;
+				float end_volume = (1.0-ratio)*begin_volume + mix_.volume_target*ratio*g_sfx_volume;
 
 				for(int n = 0; n != nsamples; ++n) {
 					float r = float(n)/float(nsamples);
 					float volume = (begin_volume*(1.0-r) + end_volume*r);
-					*output++ += (float(*p)/SHRT_MAX) * volume * left_pan_;
-					if(data->nchannels > 1) {
+					*output++ += (float(*p)/SHRT_MAX) * volume * left_pan;
+					if(nchannels > 1) {
 						++p;
 					}
-					*output++ += (float(*p++)/SHRT_MAX) * volume * right_pan_;
+					*output++ += (float(*p++)/SHRT_MAX) * volume * right_pan;
 				}
 
-				volume_target_time_ -= ntime;
-				volume_ = (1.0-ratio)*volume_ + volume_target_*ratio;
-				if(volume_target_time_ <= 0.001) {
-					volume_target_time_ = 0.0f;
-					volume_ = volume_target_;
-				}
-			} else if(left_pan_ != 1.0f || right_pan_ != 1.0f) {
-				for(int n = 0; n != nsamples; ++n) {
-					*output++ += (float(*p)/SHRT_MAX) * volume * left_pan_;
-					if(data->nchannels > 1) {
-						++p;
-					}
-					*output++ += (float(*p++)/SHRT_MAX) * volume * right_pan_;
-				}
-			} else if(data->nchannels == 1) {
-				for(int n = 0; n != nsamples; ++n) {
-					*output++ += (float(*p)/SHRT_MAX) * volume;
-					*output++ += (float(*p)/SHRT_MAX) * volume;
-					++p;
+				mix_.volume_target_time -= ntime;
+				if(mix_.volume_target_time <= 0.001) {
+					mix_.volume_target_time = 0.0f;
+					volume_ = mix_.volume_target;
+				} else {
+					volume_ = (1.0-ratio)*volume_ + mix_.volume_target*ratio;
 				}
+			} else if(nchannels == 1) {
+				mix_s16_mono(output, p, nsamples, volume * left_pan, volume * right_pan);
 			} else {
-				for(int n = 0; n != nsamples*2; ++n) {
-					*output++ += (float(*p++)/SHRT_MAX) * volume;
-				}
+				mix_s16_stereo(output, p, nsamples, volume * left_pan, volume * right_pan);
 			}
+		}
 
-			if(looped && nmissed > 0 && endpoint > 0) {
-				MixData(output, nmissed);
+		//Mixes from the stream, leaving silence if the decoder has fallen behind.
+		void mixStream(float* output, int nsamples)
+		{
+			SoundStream* stream = mix_.stream;
+			if(nsamples <= 0 || stream->finished() || (mix_.fade_out >= 0.0f && mix_.fade_out_current >= mix_.fade_out)) {
+				return;
 			}
-		}
 
-		int pos() const { return pos_; }
+			const float fade_out = mix_.fade_out;
+			const float fade_out_current = mix_.fade_out_current;
 
-		std::shared_ptr<WaveData> data() const { return data_; }
+			int nmixed = 0;
+			while(nmixed < nsamples) {
+				const short* p = nullptr;
+				const int n = stream->peek(&p, nsamples - nmixed);
+				if(n <= 0) {
+					break;
+				}
 
-	private:
+				mixFrames(output + nmixed*2, p, 2, pos_, n, fade_out, fade_out_current + float(nmixed)/float(SampleRate));
+				stream->consume(n);
+				pos_ += n;
+				nmixed += n;
+			}
+
+			if(mix_.fade_out >= 0.0f) {
+				mix_.fade_out_current += float(nsamples)/float(SampleRate);
+				updateFadedOut();
+			}
+		}
+
+		void updateStreamLoop()
+		{
+			if(stream_) {
+				stream_->setLoop(looped_, loop_point_, loop_from_);
+			}
+		}
 
+		//State owned by the game thread.
 		std::string fname_;
 
 		std::shared_ptr<WaveData> data_;
 
-		int pos_;
+		//Set instead of data_ for sounds too long to cache.
+		std::shared_ptr<SoundStream> stream_;
 
-		float volume_, volume_target_, volume_target_time_, fade_in_;
+		//Written by the mixer and read by the game thread.
+		std::atomic<int> pos_;
+		std::atomic<float> volume_;
+		std::atomic<bool> faded_out_;
 
-		float fade_out_, fade_out_current_;
+		//fade time given to stopPlaying(), or negative if still playing.
+		float fade_out_;
 
 		bool looped_;
 		int loop_point_, loop_from_;
 
 		float left_pan_, right_pan_;
+
+		//true once init() has missed the cache, so finding the data later
+		//isn't counted as a hit.
+		bool waited_for_load_;
+
+		//State owned by the mixer. The game thread changes it by sending
+		//MixerCommands, which the mixer applies before mixing.
+		struct MixerState {
+			MixerState() : data(nullptr), stream(nullptr), volume_target(0.0f), volume_target_time(-1.0f), fade_in(0.0f), fade_out(-1.0f), fade_out_current(0.0f), looped(false), loop_point(0), loop_from(0), left_pan(1.0f), right_pan(1.0f)
+			{}
+
+			const WaveData* data;
+			SoundStream* stream;
+
+			float volume_target, volume_target_time, fade_in;
+
+			float fade_out, fade_out_current;
+
+			bool looped;
+			int loop_point, loop_from;
+
+			float left_pan, right_pan;
+		};
+
+		MixerState mix_;
+	};
+
+	//What a command may still be in use by the mixer: the sound itself, and
+	//anything the command replaced. Released once the mixer has run the command.
+	struct MixerKeepAlive {
+		unsigned int seq;
+		ffl::IntrusivePtr<SoundSource> sound;
+		std::vector<ffl::IntrusivePtr<SoundEffectFilter> > filters;
+		std::shared_ptr<WaveData> data;
+		std::shared_ptr<SoundStream> stream;
 	};
 
+	void SendMixerCommand(MixerCommand cmd, MixerKeepAlive keep);
+
 	//Representation of a sound currently playing. A new instance will be created every time
 	//a sound effect starts playing, so is reasonably lightweight.
 	//Instances are created by the game thread but accessed from the mixing thread.
+	//Once created, changes made by the game thread reach the mixer as MixerCommands
+	//rather than by sharing state, so mixing never takes a lock.
 	//
 	//If the underlying data isn't available when this object is created it will wait, polling
 	//every frame to see if the cache has been populated every frame, and then play as soon
@@ -1515,6 +2175,7 @@ namespace sound
 		PlayingSound(const std::string& fname, const void* obj, float volume, float fade_in) : obj_(obj), source_(new RawPlayingSound(fname, volume, fade_in))
 		{
 			first_filter_ = source_;
+			mix_first_filter_ = first_filter_.get();
 		}
 
 		PlayingSound(const std::string& fname, const void* obj, variant options) : obj_(obj), source_(new RawPlayingSound(fname, options)), userdata_(options["userdata"])
@@ -1530,72 +2191,106 @@ namespace sound
 					filters.push_back(ffl::IntrusivePtr<SoundEffectFilter>(p));
 				}
 
-				setFilters(filters);
+				buildFilters(filters);
 			}
+
+			mix_first_filter_ = first_filter_.get();
 		}
 
 		virtual ~PlayingSound() {}
 
 		void setFilename(const std::string& f) {
-			threading::lock lck(mutex_);
+			if(source_->fname() == f) {
+				return;
+			}
+
+			MixerKeepAlive keep;
+			keep.data = source_->data();
+			keep.stream = source_->stream();
 			source_->setFilename(f);
+			sendSource(keep);
 		}
 
 		void setObj(const void* obj) { obj_ = obj; }
 
-		void setLooped(bool value) { source_->setLooped(value); }
+		void setLooped(bool value) {
+			source_->setLooped(value);
+			sendLoop();
+		}
 		bool looped() const { return source_->looped(); }
 
 		int loopPoint() const { return source_->loopPoint(); }
 		void setLoopPoint(int value) {
-			threading::lock lck(mutex_);
 			source_->setLoopPoint(value);
+			sendLoop();
 		}
 
 		int loopFrom() const { return source_->loopFrom(); }
 		void setLoopFrom(int value) {
-			threading::lock lck(mutex_);
 			source_->setLoopFrom(value);
+			sendLoop();
 		}
 
 		float leftPan() const { return source_->leftPan(); }
 		float rightPan() const { return source_->rightPan(); }
 		void setPanning(float left, float right)
 		{
-			threading::lock lck(mutex_);
 			source_->setPanning(left, right);
+
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::SET_PANNING;
+			cmd.value[0] = left;
+			cmd.value[1] = right;
+			send(cmd, MixerKeepAlive());
 		}
 
 		void init()
 		{
-			threading::lock lck(mutex_);
-			source_->init();
+			if(source_->init()) {
+				sendSource(MixerKeepAlive());
+			}
 		}
 
 		void stopPlaying(float fade_time) {
-			threading::lock lck(mutex_);
 			source_->stopPlaying(fade_time);
+
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::STOP;
+			cmd.value[0] = fade_time;
+			send(cmd, MixerKeepAlive());
 		}
 
 		//Once finished(), the game thread may remove this from the list of playing sounds.
 		bool finished() const override
 		{
-			threading::lock lck(mutex_);
 			return first_filter_->finished();
 		}
 
 		void setVolume(float volume, float nseconds=0.0)
 		{
-			threading::lock lck(mutex_);
-			source_->setVolume(volume, nseconds);
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::SET_VOLUME;
+			cmd.value[0] = volume;
+			cmd.value[1] = nseconds;
+			send(cmd, MixerKeepAlive());
+		}
+
+		//Applies a command sent by the game thread; see RawPlayingSound::applyCommand().
+		void applyCommand(const MixerCommand& cmd)
+		{
+			if(cmd.type == MixerCommand::SET_FILTERS) {
+				mix_first_filter_ = cmd.first_filter;
+			} else {
+				source_->applyCommand(cmd);
+			}
 		}
 
-		//Mix data into the output buffer. Can be safely called from the mixing thread.
+		//Mix data into the output buffer. Called from the mixing thread; only
+		//touches state the mixer owns, so it takes no locks.
 		virtual void MixData(float* output, int nsamples) override
 		{
-			threading::lock lck(mutex_);
-			if(source_->loaded()) {
-				first_filter_->MixData(output, nsamples);
+			if(source_->mixerLoaded()) {
+				mix_first_filter_->MixData(output, nsamples);
 			}
 		}
 
@@ -1607,7 +2302,52 @@ namespace sound
 		}
 
 		void setFilters(std::vector<ffl::IntrusivePtr<SoundEffectFilter> > filters) {
-			threading::lock lck(mutex_);
+			//the mixer may still be pulling from the old chain.
+			MixerKeepAlive keep;
+			keep.filters.swap(filters_);
+
+			buildFilters(filters);
+
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::SET_FILTERS;
+			cmd.first_filter = first_filter_.get();
+			send(cmd, keep);
+		}
+
+		ffl::IntrusivePtr<RawPlayingSound> src() const { return source_; }
+
+	private:
+		DECLARE_CALLABLE(PlayingSound);
+
+		void send(MixerCommand cmd, MixerKeepAlive keep)
+		{
+			cmd.sound = this;
+			keep.sound.reset(this);
+			SendMixerCommand(cmd, keep);
+		}
+
+		void sendLoop()
+		{
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::SET_LOOP;
+			cmd.looped = source_->looped();
+			cmd.loop_point = source_->loopPoint();
+			cmd.loop_from = source_->loopFrom();
+			send(cmd, MixerKeepAlive());
+		}
+
+		void sendSource(MixerKeepAlive keep)
+		{
+			MixerCommand cmd = MixerCommand();
+			cmd.type = MixerCommand::SET_SOURCE;
+			cmd.data = source_->data().get();
+			cmd.stream = source_->stream().get();
+			send(cmd, keep);
+		}
+
+		//Clones filters into filters_ and chains them onto the source.
+		void buildFilters(const std::vector<ffl::IntrusivePtr<SoundEffectFilter> >& filters)
+		{
 			filters_.clear();
 			for(auto f : filters) {
 				filters_.push_back(ffl::IntrusivePtr<SoundEffectFilter>(f->clone()));
@@ -1627,28 +2367,131 @@ namespace sound
 			}
 		}
 
-		ffl::IntrusivePtr<RawPlayingSound> src() const { return source_; }
-
-	private:
-		DECLARE_CALLABLE(PlayingSound);
-
-		threading::mutex mutex_;
-
 		const void* obj_;
 
+		//Set on construction and never changed, so both threads may use it.
 		ffl::IntrusivePtr<RawPlayingSound> source_;
 
+		//The filter chain as the game thread last set it.
 		ffl::IntrusivePtr<SoundSource> first_filter_;
 
 		std::vector<ffl::IntrusivePtr<SoundEffectFilter> > filters_;
 
+		//The filter chain being mixed. Only used by the mixer once published.
+		SoundSource* mix_first_filter_;
+
 		variant userdata_;
 	};
 
-	//List of currently playing sounds. Only the game thread can modify this,
-	//the mixing thread will read it.
+	//List of currently playing sounds. Only accessed from the game thread, which
+	//holds a reference to every sound the mixer may be using.
 	std::vector<ffl::IntrusivePtr<PlayingSound> > g_playing_sounds;
-	threading::mutex g_playing_sounds_mutex;
+
+	//Commands from the game thread to the mixer.
+	const int MixerQueueSize = 1024;
+	SingleProducerQueue<MixerCommand, MixerQueueSize> g_mixer_commands;
+
+	//Commands that didn't fit in g_mixer_commands, sent on a later frame.
+	//Only accessed from the game thread.
+	std::vector<MixerCommand> g_mixer_commands_overflow;
+
+	//The seq of the last command sent, and of the last command the mixer ran.
+	unsigned int g_mixer_commands_sent = 0;
+	std::atomic<unsigned int> g_mixer_commands_done(0);
+
+	//What sent commands keep alive, oldest first. Only accessed from the game thread.
+	std::vector<MixerKeepAlive> g_mixer_pending;
+
+	//The sounds being mixed. Only accessed from the mixing thread.
+	std::vector<SoundSource*> g_mixer_voices;
+
+	void SendMixerCommand(MixerCommand cmd, MixerKeepAlive keep)
+	{
+		if(!ok()) {
+			//nothing is mixing, so changes to a sound can be applied here.
+			if(cmd.type != MixerCommand::ADD_SOUND && cmd.type != MixerCommand::REMOVE_SOUND) {
+				cmd.sound->applyCommand(cmd);
+			}
+			return;
+		}
+
+		cmd.seq = keep.seq = ++g_mixer_commands_sent;
+		g_mixer_pending.push_back(keep);
+
+		if(g_mixer_commands_overflow.empty() == false || !g_mixer_commands.push(cmd)) {
+			g_mixer_commands_overflow.push_back(cmd);
+		}
+	}
+
+	//Called from the game thread to start mixing a sound.
+	void StartPlayingSound(const ffl::IntrusivePtr<PlayingSound>& s)
+	{
+		g_playing_sounds.push_back(s);
+
+		MixerCommand cmd = MixerCommand();
+		cmd.type = MixerCommand::ADD_SOUND;
+		cmd.sound = s.get();
+
+		MixerKeepAlive keep;
+		keep.sound = s;
+		SendMixerCommand(cmd, keep);
+	}
+
+	//Called from the game thread to stop mixing a sound.
+	void StopMixingSound(const ffl::IntrusivePtr<PlayingSound>& s)
+	{
+		MixerCommand cmd = MixerCommand();
+		cmd.type = MixerCommand::REMOVE_SOUND;
+		cmd.sound = s.get();
+
+		MixerKeepAlive keep;
+		keep.sound = s;
+		SendMixerCommand(cmd, keep);
+	}
+
+	//Called from the mixing thread before each mix to pick up new commands.
+	void ProcessMixerCommands()
+	{
+		MixerCommand cmd;
+		while(g_mixer_commands.pop(&cmd)) {
+			if(cmd.type == MixerCommand::ADD_SOUND || cmd.type == MixerCommand::REMOVE_SOUND) {
+				auto itor = std::find(g_mixer_voices.begin(), g_mixer_voices.end(), static_cast<SoundSource*>(cmd.sound));
+				if(cmd.type == MixerCommand::ADD_SOUND) {
+					if(itor == g_mixer_voices.end()) {
+						g_mixer_voices.push_back(cmd.sound);
+					}
+				} else if(itor != g_mixer_voices.end()) {
+					g_mixer_voices.erase(itor);
+				}
+			} else {
+				cmd.sound->applyCommand(cmd);
+			}
+
+			g_mixer_commands_done.store(cmd.seq, std::memory_order_release);
+		}
+	}
+
+	//Called from the game thread to release what the mixer has finished with.
+	void ReleaseMixerPending()
+	{
+		const unsigned int done = g_mixer_commands_done.load(std::memory_order_acquire);
+
+		//compared as a difference so the count may wrap.
+		size_t nreleased = 0;
+		while(nreleased != g_mixer_pending.size() && static_cast<int>(g_mixer_pending[nreleased].seq - done) <= 0) {
+			++nreleased;
+		}
+
+		g_mixer_pending.erase(g_mixer_pending.begin(), g_mixer_pending.begin() + nreleased);
+	}
+
+	//Mixes every voice into buf, which holds nsamples stereo samples.
+	void MixVoices(const std::vector<SoundSource*>& voices, float* buf, int nsamples)
+	{
+		for(SoundSource* s : voices) {
+			s->MixData(buf, nsamples);
+		}
+	}
 
 	BEGIN_DEFINE_CALLABLE(PlayingSound, SoundSource)
 	DEFINE_FIELD(filename, "string")
@@ -1660,15 +2503,14 @@ namespace sound
 	DEFINE_FIELD(pos, "decimal")
 		return variant(obj.src()->pos()/SampleRateDouble);
 	DEFINE_FIELD(duration, "decimal|null")
-		if(obj.src()->data()) {
-			return variant(obj.src()->data()->nsamples()/SampleRateDouble);
+		if(obj.src()->length() >= 0) {
+			return variant(obj.src()->length()/SampleRateDouble);
 		}
 
 		return variant();
 	DEFINE_FIELD(loop, "bool")
 		return variant::from_bool(obj.looped());
 	DEFINE_SET_FIELD
-		threading::lock lck(obj.mutex_);
 		obj.setLooped(value.as_bool());
 
 	DEFINE_FIELD(loop_point, "decimal|null")
@@ -1691,7 +2533,6 @@ namespace sound
 			return variant(float(obj.loopFrom()) / float(SampleRate));
 		}
 	DEFINE_SET_FIELD
-		threading::lock lck(obj.mutex_);
 		if(value.is_null()) {
 			obj.setLoopFrom(0);
 		} else {
@@ -1717,7 +2558,6 @@ namespace sound
 		return variant(&v);
 
 	DEFINE_SET_FIELD
-		threading::lock lck(obj.mutex_);
 		std::vector<decimal> d = value.as_list_decimal();
 		ASSERT_LOG(d.size() == 2, "Incorrect pan arg");
 		obj.setPanning(d[0].as_float32(), d[1].as_float32());
@@ -1744,11 +2584,10 @@ namespace sound
 	BEGIN_DEFINE_FN(play, "()->commands")
 		ffl::IntrusivePtr<PlayingSound> ptr(const_cast<PlayingSound*>(&obj));
 		return variant(new game_logic::FnCommandCallable("sound::play", [=]() {
-			threading::lock lck(g_playing_sounds_mutex);
 			if(std::find(g_playing_sounds.begin(), g_playing_sounds.end(), ptr) != g_playing_sounds.end()) {
 				return;
 			} else {
-				g_playing_sounds.push_back(ptr);
+				StartPlayingSound(ptr);
 			}
 		}));
 	END_DEFINE_FN
@@ -1780,39 +2619,28 @@ namespace sound
 			++g_audio_callback_done_fade_out;
 		}
 
-		float sfx_volume = g_sfx_volume;
-
 		float* buf = reinterpret_cast<float*>(stream);
 		const int nsamples = len / sizeof(float);
 
+		//Pick up sounds started or stopped by the game thread.
+		ProcessMixerCommands();
+
 		//Set the buffer to zeroes so we can start mixing.
-		for(int n = 0; n < nsamples; ++n) {
-			buf[n] = 0.0f;
-		}
+		std::fill(buf, buf + nsamples, 0.0f);
 
 		if(g_muted || g_audio_callback_done_fade_out > 1) {
 			return;
 		}
 
 		//Mix all the sound effects.
-		{
-			threading::lock lck(g_playing_sounds_mutex);
-			for(const ffl::IntrusivePtr<PlayingSound>& s : g_playing_sounds) {
-				s->MixData(buf, nsamples/2);
-			}
-		}
+		MixVoices(g_mixer_voices, buf, nsamples/2);
 
 		//Now mix the music from the music ring buffer.
 		const float music_volume = g_engine_music_volume*g_user_music_volume;
 
-		float*	music_read = nullptr;
-		int music_nsamples = 0;
 		float* end_music_buf = g_music_buf + sizeof(g_music_buf)/sizeof(*g_music_buf);
-		{
-			threading::lock lck(g_music_thread_mutex);
-			music_read = g_music_buf_read;
-			music_nsamples = g_music_buf_nsamples;
-		}
+		int music_nsamples = g_music_buf_nsamples.load(std::memory_order_acquire);
+		float* music_read = g_music_buf_read.load(std::memory_order_relaxed);
 
 		int music_starting_samples = music_nsamples;
 
@@ -1821,27 +2649,24 @@ namespace sound
 
 		float* music_write_buf = buf;
 
-		for(int n = 0; n < nmix; ++n) {
-			*music_write_buf++ += *music_read++ * music_volume;
-		}
+		mix_scaled(music_write_buf, music_read, nmix, music_volume);
+		music_write_buf += nmix;
+		music_read += nmix;
 
 		music_nsamples -= nmix;
 
 		if(music_read == end_music_buf) {
 			music_read = g_music_buf;
 			nmix = std::min<int>(music_nsamples, nsamples - nmix);
-			for(int n = 0; n < nmix; ++n) {
-				*music_write_buf++ += *music_read++ * music_volume;
-			}
+			mix_scaled(music_write_buf, music_read, nmix, music_volume);
+			music_write_buf += nmix;
+			music_read += nmix;
 
 			music_nsamples -= nmix;
 		}
 
-		{
-			threading::lock lck(g_music_thread_mutex);
-			g_music_buf_read = music_read;
-			g_music_buf_nsamples -= music_starting_samples - music_nsamples;
-		}
+		g_music_buf_read.store(music_read, std::memory_order_release);
+		g_music_buf_nsamples.fetch_sub(music_starting_samples - music_nsamples, std::memory_order_release);
 
 		if(g_audio_callback_fade_out) {
 			float* buf = reinterpret_cast<float*>(stream);
@@ -1899,6 +2724,9 @@ Manager::Manager()
 	spec.callback = AudioCallback;
 	spec.userdata = nullptr;
 
+	//so adding voices in the callback doesn't normally allocate.
+	g_mixer_voices.reserve(256);
+
 	g_audio_device = SDL_OpenAudioDevice(nullptr, 0, &spec, nullptr, 0);
 	SDL_PauseAudioDevice(g_audio_device, 0);
 
@@ -1944,6 +2772,15 @@ Manager::~Manager()
 
 		SDL_CloseAudioDevice(g_audio_device);
 		g_audio_device = 0;
+
+		//the mixer has stopped, so nothing it was using needs to be kept alive.
+		MixerCommand cmd;
+		while(g_mixer_commands.pop(&cmd)) {
+		}
+
+		g_mixer_voices.clear();
+		g_mixer_commands_overflow.clear();
+		g_mixer_pending.clear();
 	}
 }
 
@@ -1974,13 +2811,26 @@ void mute(bool flag)
 //The game thread, called every frame.
 void process()
 {
+	//Send any mixer commands which didn't fit in the queue earlier.
+	{
+		size_t nsent = 0;
+		while(nsent != g_mixer_commands_overflow.size() && g_mixer_commands.push(g_mixer_commands_overflow[nsent])) {
+			++nsent;
+		}
+
+		g_mixer_commands_overflow.erase(g_mixer_commands_overflow.begin(), g_mixer_commands_overflow.begin() + nsent);
+	}
+
+	//Release sounds, filters and data the mixer has stopped using.
+	ReleaseMixerPending();
+
 	//Go through the playing sounds list and remove any that are finished.
 	{
-		threading::lock lck(g_playing_sounds_mutex);
 		for(ffl::IntrusivePtr<PlayingSound>& s : g_playing_sounds) {
 			s->init();
 
 			if(s->finished()) {
+				StopMixingSound(s);
 				s.reset();
 			}
 		}
@@ -2022,20 +2872,7 @@ void process()
 //preload a sound effect in the cache.
 void preload(const std::string& fname)
 {
-	std::string file = map_filename(fname);
-
-	{
-		threading::lock lck(g_files_loading_mutex);
-		if(g_files_loading.count(file)) {
-			return;
-		}
-
-		g_files_loading.insert(file);
-	}
-
-	threading::lock lck(g_loader_thread_mutex);
-	g_loader_thread_queue.push_back(file);
-	g_loader_thread_cond.notify_one();
+	queue_wave_load(map_filename(fname));
 }
 
 void change_volume(const void* object, float volume, float nseconds)
@@ -2112,8 +2949,7 @@ void play(const std::string& file, const void* object, float volume, float fade_
 	ffl::IntrusivePtr<PlayingSound> s(new PlayingSound(file, object, volume, fade_in_time));
 	s->setPanning(g_pan_left, g_pan_right);
 
-	threading::lock lck(g_playing_sounds_mutex);
-	g_playing_sounds.push_back(s);
+	StartPlayingSound(s);
 }
 
 
@@ -2153,8 +2989,7 @@ int play_looped(const std::string& file, const void* object, float volume, float
 	s->setLooped(true);
 	s->setPanning(g_pan_left, g_pan_right);
 
-	threading::lock lck(g_playing_sounds_mutex);
-	g_playing_sounds.push_back(s);
+	StartPlayingSound(s);
 	return -1;
 }
 
@@ -2225,10 +3060,10 @@ BEGIN_DEFINE_CALLABLE_NOBASE(AudioEngine)
 			threading::lock lck(g_wave_cache_mutex);
 			threading::lock lck2(g_files_loading_mutex);
 			s << "Cached sounds: " << g_wave_cache_lru.size() << "/" << g_wave_cache.size() << " entries, " << (g_wave_cache_size/(1024*1024)) << "/" << g_audio_cache_size_mb << "MB; files loaded: " << g_files_loading.size() << "\n";
+			s << "Cache hits: " << g_wave_cache_hits.load() << ", misses: " << g_wave_cache_misses.load() << ", evictions: " << g_wave_cache_evictions.load() << "; " << g_streamed_waves.size() << " long sounds streamed\n";
 		}
 
 		{
-			threading::lock lck(g_playing_sounds_mutex);
 			s << g_playing_sounds.size() << " sounds playing\n";
 
 			for(auto p : g_playing_sounds) {
@@ -2236,8 +3071,8 @@ BEGIN_DEFINE_CALLABLE_NOBASE(AudioEngine)
 				if(p->src()->looped()) {
 					s << " (looped)";
 				}
-				if(p->src()->data()) {
-					s << " " << p->src()->pos() << "/" << p->src()->data()->nsamples();
+				if(p->src()->length() >= 0) {
+					s << " " << p->src()->pos() << "/" << p->src()->length();
 				}
 
 				s << "\n";
@@ -2290,8 +3125,6 @@ BEGIN_DEFINE_CALLABLE_NOBASE(AudioEngine)
 	DEFINE_FIELD(current_sounds, "[builtin playing_sound]")
 		std::vector<variant> res;
 
-		threading::lock lck(g_playing_sounds_mutex);
-
 		for(auto p : g_playing_sounds) {
 			res.push_back(variant(p.get()));
 		}
@@ -2351,6 +3184,17 @@ MemoryUsageInfo get_memory_usage_info()
 	info.cache_usage = g_wave_cache_size;
 	info.max_cache_usage = g_audio_cache_size_mb*1024*1024;
 	info.nsounds_cached = static_cast<int>(g_wave_cache_lru.size());
+	info.cache_hits = g_wave_cache_hits.load();
+	info.cache_misses = g_wave_cache_misses.load();
+	info.cache_evictions = g_wave_cache_evictions.load();
+
+	threading::lock lck2(g_sound_streams_mutex);
+	info.nsounds_streaming = 0;
+	for(const std::weak_ptr<SoundStream>& stream : g_sound_streams) {
+		if(!stream.expired()) {
+			++info.nsounds_streaming;
+		}
+	}
 	return info;
 }
 
@@ -2392,3 +3236,99 @@ COMMAND_LINE_UTILITY(validate_waves)
 		}
 	}
 }
+
+UNIT_TEST(sound_mix_kernels)
+{
+	//an odd length so the scalar tail after the vector loop is used too.
+	const int nframes = 37;
+	std::vector<short> stereo(nframes*2), mono(nframes);
+	std::vector<float> music(nframes*2);
+	for(int n = 0; n != nframes*2; ++n) {
+		stereo[n] = static_cast<short>((n*7919)%65536 - 32768);
+		music[n] = n*0.01f - 0.3f;
+	}
+
+	for(int n = 0; n != nframes; ++n) {
+		mono[n] = stereo[n*2+1];
+	}
+
+	const float left = 0.25f, right = 0.75f;
+
+	std::vector<float> out(nframes*2, 0.5f);
+	sound::mix_s16_stereo(&out[0], &stereo[0], nframes, left, right);
+	for(int n = 0; n != nframes; ++n) {
+		CHECK(std::abs(out[n*2] - (0.5f + stereo[n*2]*left/SHRT_MAX)) < 1e-5f, "left sample " << n);
+		CHECK(std::abs(out[n*2+1] - (0.5f + stereo[n*2+1]*right/SHRT_MAX)) < 1e-5f, "right sample " << n);
+	}
+
+	out.assign(nframes*2, 0.5f);
+	sound::mix_s16_mono(&out[0], &mono[0], nframes, left, right);
+	for(int n = 0; n != nframes; ++n) {
+		CHECK(std::abs(out[n*2] - (0.5f + mono[n]*left/SHRT_MAX)) < 1e-5f, "left sample " << n);
+		CHECK(std::abs(out[n*2+1] - (0.5f + mono[n]*right/SHRT_MAX)) < 1e-5f, "right sample " << n);
+	}
+
+	out.assign(nframes*2, 0.5f);
+	sound::mix_scaled(&out[0], &music[0], nframes*2 - 1, 0.5f);
+	for(int n = 0; n != nframes*2 - 1; ++n) {
+		CHECK(std::abs(out[n] - (0.5f + music[n]*0.5f)) < 1e-5f, "sample " << n);
+	}
+
+	CHECK_EQ(out.back(), 0.5f);
+}
+
+UNIT_TEST(sound_mixer_queue)
+{
+	sound::SingleProducerQueue<int, 4> q;
+	int value = 0;
+	CHECK(!q.pop(&value), "empty queue popped a value");
+
+	//one slot is kept free to tell a full queue from an empty one.
+	CHECK(q.push(1) && q.push(2) && q.push(3), "queue filled early");
+	CHECK(q.full(), "queue should be full");
+	CHECK(!q.push(4), "pushed to a full queue");
+
+	for(int n = 1; n <= 3; ++n) {
+		CHECK(q.pop(&value), "queue emptied early");
+		CHECK_EQ(value, n);
+	}
+
+	CHECK(!q.pop(&value), "empty queue popped a value");
+
+	//wrap around the end of the storage several times.
+	for(int n = 0; n != 10; ++n) {
+		CHECK(q.push(n), "push failed");
+		CHECK(q.pop(&value), "pop failed");
+		CHECK_EQ(value, n);
+	}
+}
+
+//Mixes looped sound effect voices the way the audio callback does, without
+//needing an audio device.
+BENCHMARK_ARG(sound_mix_voices, int nvoices)
+{
+	std::vector<short> samples(sound::SampleRate*sound::NumChannels);
+	for(size_t n = 0; n != samples.size(); ++n) {
+		samples[n] = static_cast<short>(rand()%65536 - 32768);
+	}
+
+	std::shared_ptr<sound::WaveData> data(new sound::WaveData("benchmark", &samples, sound::NumChannels));
+
+	std::vector<ffl::IntrusivePtr<sound::RawPlayingSound>> sounds;
+	std::vector<sound::SoundSource*> voices;
+	for(int n = 0; n != nvoices; ++n) {
+		sounds.emplace_back(new sound::RawPlayingSound(data, 0.5f));
+		sounds.back()->setLooped(true);
+		sounds.back()->setPanning(1.0f, (n%4)*0.25f);
+		voices.push_back(sounds.back().get());
+	}
+
+	std::vector<float> buf(sound::BUFFER_NUM_SAMPLES*sound::NumChannels);
+	BENCHMARK_LOOP {
+		std::fill(buf.begin(), buf.end(), 0.0f);
+		sound::MixVoices(voices, &buf[0], sound::BUFFER_NUM_SAMPLES);
+	}
+}
+
+BENCHMARK_ARG_CALL(sound_mix_voices, voices_8, 8);
+BENCHMARK_ARG_CALL(sound_mix_voices, voices_64, 64);
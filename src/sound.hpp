@@ -101,6 +101,10 @@ namespace sound
 		int nsounds_cached;
 		int cache_usage;
 		int max_cache_usage;
+		int cache_hits;
+		int cache_misses;
+		int cache_evictions;
+		int nsounds_streaming;
 	};
 
 	MemoryUsageInfo get_memory_usage_info();
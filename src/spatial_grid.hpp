@@ -0,0 +1,308 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "geometry.hpp"
+
+//A uniform grid over world space which buckets items by the cells their
+//bounding rect covers. It is designed to be kept around between frames:
+//callers bracket a pass with beginUpdate()/endUpdate() and call update()
+//for every live item. Items whose cells haven't changed cost a lookup only,
+//and items that weren't updated during the pass are dropped at endUpdate().
+//
+//The grid never dereferences the items it stores, so it is safe to key it
+//on raw pointers to objects which may be destroyed between passes.
+template<typename T>
+class SpatialGrid
+{
+public:
+	explicit SpatialGrid(int cell_size=128, int max_cells_per_item=64)
+	  : cell_size_(cell_size), max_cells_per_item_(max_cells_per_item),
+	    generation_(0), cell_moves_(0)
+	{}
+
+	//The grid is a cache; copies start out empty, since the cell lists
+	//point into the item table of the grid they belong to.
+	SpatialGrid(const SpatialGrid& g)
+	  : cell_size_(g.cell_size_), max_cells_per_item_(g.max_cells_per_item_),
+	    generation_(0), cell_moves_(0)
+	{}
+
+	SpatialGrid& operator=(const SpatialGrid& g) {
+		if(&g != this) {
+			clear();
+			cell_size_ = g.cell_size_;
+			max_cells_per_item_ = g.max_cells_per_item_;
+		}
+		return *this;
+	}
+
+	void beginUpdate() { ++generation_; }
+
+	//inserts the item, or moves it if it is already present. The tag is
+	//an arbitrary caller-supplied value reported back by the queries.
+	void update(const T& item, const rect& area, int tag=0) {
+		Entry& e = entries_[item];
+		e.area = area;
+		e.tag = tag;
+		e.generation = generation_;
+
+		int x1, y1, x2, y2;
+		getCellRange(area, &x1, &y1, &x2, &y2);
+		const bool oversized = static_cast<int64_t>(x2 - x1 + 1)*(y2 - y1 + 1) > max_cells_per_item_;
+		if(e.linked && oversized == e.oversized && (oversized ||
+		   (x1 == e.x1 && y1 == e.y1 && x2 == e.x2 && y2 == e.y2))) {
+			return;
+		}
+
+		if(e.linked) {
+			unlink(e);
+		}
+
+		e.x1 = x1;
+		e.y1 = y1;
+		e.x2 = x2;
+		e.y2 = y2;
+		e.oversized = oversized;
+		link(e);
+		++cell_moves_;
+	}
+
+	//moves an item which is already present, keeping its tag. Returns
+	//false if the item isn't in the grid.
+	bool move(const T& item, const rect& area) {
+		auto itor = entries_.find(item);
+		if(itor == entries_.end()) {
+			return false;
+		}
+
+		update(item, area, itor->second.tag);
+		return true;
+	}
+
+	void erase(const T& item) {
+		auto itor = entries_.find(item);
+		if(itor != entries_.end()) {
+			unlink(itor->second);
+			entries_.erase(itor);
+		}
+	}
+
+	//removes all items which weren't updated since beginUpdate().
+	void endUpdate() {
+		for(auto itor = entries_.begin(); itor != entries_.end(); ) {
+			if(itor->second.generation != generation_) {
+				unlink(itor->second);
+				itor = entries_.erase(itor);
+			} else {
+				++itor;
+			}
+		}
+	}
+
+	void clear() {
+		entries_.clear();
+		cells_.clear();
+		oversized_.clear();
+	}
+
+	size_t size() const { return entries_.size(); }
+
+	//number of times an item was moved between cells. Useful to confirm
+	//that the grid is being maintained incrementally.
+	int cellMoves() const { return cell_moves_; }
+
+	//gets the tags of all pairs of items whose areas intersect. Each pair
+	//is reported exactly once, with the lower tag first.
+	void getIntersectingPairs(std::vector<std::pair<int,int> >& result) const {
+		for(const auto& cell : cells_) {
+			const int cx = cellX(cell.first);
+			const int cy = cellY(cell.first);
+			const std::vector<const Entry*>& items = cell.second;
+			for(int i = 0; i < static_cast<int>(items.size()); ++i) {
+				const Entry& a = *items[i];
+				for(int j = i+1; j < static_cast<int>(items.size()); ++j) {
+					const Entry& b = *items[j];
+
+					//a pair sharing several cells is only reported from the
+					//top-left cell they share.
+					if(std::max(a.x1, b.x1) != cx || std::max(a.y1, b.y1) != cy) {
+						continue;
+					}
+
+					addPairIfIntersecting(a, b, result);
+				}
+			}
+		}
+
+		for(int i = 0; i < static_cast<int>(oversized_.size()); ++i) {
+			const Entry& a = *oversized_[i];
+			for(const auto& item : entries_) {
+				const Entry& b = item.second;
+				if(&a == &b || (b.oversized && std::find(oversized_.begin(), oversized_.begin() + i, &b) != oversized_.begin() + i)) {
+					//either ourselves or a pair of oversized items we
+					//already reported.
+					continue;
+				}
+
+				addPairIfIntersecting(a, b, result);
+			}
+		}
+	}
+
+	//gets the tags of all items whose areas intersect the given rect.
+	void getIntersecting(const rect& area, std::vector<int>& result) const {
+		int x1, y1, x2, y2;
+		getCellRange(area, &x1, &y1, &x2, &y2);
+		if(static_cast<int64_t>(x2 - x1 + 1)*(y2 - y1 + 1) > static_cast<int64_t>(cells_.size())) {
+			//cheaper to look at everything than to probe every cell.
+			for(const auto& item : entries_) {
+				if(rects_intersect(item.second.area, area)) {
+					result.push_back(item.second.tag);
+				}
+			}
+			return;
+		}
+
+		for(int y = y1; y <= y2; ++y) {
+			for(int x = x1; x <= x2; ++x) {
+				auto itor = cells_.find(cellKey(x, y));
+				if(itor == cells_.end()) {
+					continue;
+				}
+
+				for(const Entry* e : itor->second) {
+					//only report the item from the first cell it shares
+					//with the query area.
+					if(std::max(e->x1, x1) == x && std::max(e->y1, y1) == y && rects_intersect(e->area, area)) {
+						result.push_back(e->tag);
+					}
+				}
+			}
+		}
+
+		for(const Entry* e : oversized_) {
+			if(rects_intersect(e->area, area)) {
+				result.push_back(e->tag);
+			}
+		}
+	}
+
+private:
+	struct Entry {
+		Entry() : tag(0), generation(0), x1(0), y1(0), x2(-1), y2(-1), linked(false), oversized(false)
+		{}
+		rect area;
+		int tag;
+		unsigned int generation;
+		int x1, y1, x2, y2;
+		bool linked, oversized;
+	};
+
+	static int floorDiv(int a, int b) {
+		return a >= 0 ? a/b : -((-a + b - 1)/b);
+	}
+
+	static uint64_t cellKey(int x, int y) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+	}
+
+	static int cellX(uint64_t key) { return static_cast<int32_t>(static_cast<uint32_t>(key >> 32)); }
+	static int cellY(uint64_t key) { return static_cast<int32_t>(static_cast<uint32_t>(key)); }
+
+	void getCellRange(const rect& area, int* x1, int* y1, int* x2, int* y2) const {
+		*x1 = floorDiv(area.x(), cell_size_);
+		*y1 = floorDiv(area.y(), cell_size_);
+		*x2 = floorDiv(std::max(area.x(), area.x2() - 1), cell_size_);
+		*y2 = floorDiv(std::max(area.y(), area.y2() - 1), cell_size_);
+	}
+
+	static void addPairIfIntersecting(const Entry& a, const Entry& b, std::vector<std::pair<int,int> >& result) {
+		if(rects_intersect(a.area, b.area)) {
+			result.push_back(std::pair<int,int>(std::min(a.tag, b.tag), std::max(a.tag, b.tag)));
+		}
+	}
+
+	void link(Entry& e) {
+		if(e.oversized) {
+			oversized_.push_back(&e);
+		} else {
+			for(int y = e.y1; y <= e.y2; ++y) {
+				for(int x = e.x1; x <= e.x2; ++x) {
+					cells_[cellKey(x, y)].push_back(&e);
+				}
+			}
+		}
+
+		e.linked = true;
+	}
+
+	void unlink(Entry& e) {
+		if(!e.linked) {
+			return;
+		}
+
+		if(e.oversized) {
+			oversized_.erase(std::find(oversized_.begin(), oversized_.end(), &e));
+		} else {
+			for(int y = e.y1; y <= e.y2; ++y) {
+				for(int x = e.x1; x <= e.x2; ++x) {
+					auto itor = cells_.find(cellKey(x, y));
+					if(itor == cells_.end()) {
+						continue;
+					}
+
+					std::vector<const Entry*>& items = itor->second;
+					auto i = std::find(items.begin(), items.end(), &e);
+					if(i != items.end()) {
+						*i = items.back();
+						items.pop_back();
+					}
+
+					if(items.empty()) {
+						cells_.erase(itor);
+					}
+				}
+			}
+		}
+
+		e.linked = false;
+	}
+
+	int cell_size_;
+	int max_cells_per_item_;
+	unsigned int generation_;
+	int cell_moves_;
+
+	//unordered_map never moves its elements, so cells can point into it.
+	std::unordered_map<T, Entry> entries_;
+	std::unordered_map<uint64_t, std::vector<const Entry*> > cells_;
+	std::vector<const Entry*> oversized_;
+};
@@ -45,6 +45,7 @@
 #include "tbs_web_server.hpp"
 #include "string_utils.hpp"
 #include "unit_test.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -89,6 +90,12 @@ namespace tbs
 
 			}
 
+			//optional: games may declare which players see an identical
+			//transformed state, so it only has to be built once for them.
+			if(obj_->queryValue("transform_group").is_null() == false) {
+				DEFINE_INTERFACE_FN(transform_group, "(int)->any");
+			}
+
 		}
 
 		variant create(variant msg) { std::vector<variant> v; v.push_back(msg); return create_fn_(v); }
@@ -103,13 +110,16 @@ namespace tbs
 
 		variant process() { if(process_fn_.is_null() == false) { std::vector<variant> v; return process_fn_(v); } return variant(); }
 
+		bool has_transform_group() const { return transform_group_fn_.is_null() == false; }
+		variant transform_group(int nplayer) { std::vector<variant> v; v.push_back(variant(nplayer)); return transform_group_fn_(v); }
+
 		ffl::IntrusivePtr<game_logic::FormulaObject>& object() { return obj_; }
 
 	private:
 		ffl::IntrusivePtr<game_logic::FormulaObject> obj_;
 
 		variant create_fn_, restart_fn_, add_bot_fn_, message_fn_, player_disconnected_fn_, transform_fn_, get_state_fn_, restore_state_fn_, player_waiting_on_fn_;
-		variant process_fn_;
+		variant process_fn_, transform_group_fn_;
 	};
 
 	extern std::string global_debug_str;
@@ -174,6 +184,7 @@ namespace tbs
 	    game_id_(generate_game_id()),
 	    started_(false), state_(STATE_SETUP), state_id_(0), cycle_(0), tick_rate_(50),
 		backup_callable_(nullptr),
+		sharing_transformed_states_(false),
 		started_waiting_for_player_at_(-1),
 		start_timestamp_(static_cast<int>(time(nullptr)))
 	{
@@ -200,12 +211,8 @@ namespace tbs
 			variant delta = doc["delta"];
 			ASSERT_LOG(delta.is_map(), "Delta not found");
 
-			variant clone = FormulaObject::deepClone(variant(state_ptr.get()));
-			FormulaObject* obj = clone.try_convert<FormulaObject>();
-			ASSERT_LOG(obj, "Could not clone");
-
-			obj->applyDiff(delta);
-			state_ptr.reset(obj);
+			//the replayed state is private to us, so patch it in place.
+			state_ptr->applyDiff(delta);
 		}
 	}
 
@@ -343,15 +350,50 @@ namespace tbs
 			send_delta = true;
 		}
 
-		variant msg = FormulaObject::deepClone(variant(game_type_->get_state()));
-		variant cmd = game_type_->transform(msg, nplayer < 0 ? 0 : nplayer);
-		const_cast<game*>(this)->executeCommand(cmd);
+		//while broadcasting, recipients in the same transform group share
+		//one transformed state, and one delta per state they last received.
+		shared_state* shared = nullptr;
+		variant group;
+		if(sharing_transformed_states_ && game_type_->has_transform_group()) {
+			group = game_type_->transform_group(nplayer < 0 ? 0 : nplayer);
+			if(group.is_null() == false) {
+				shared = &shared_states_[group];
+			}
+		}
 
-		variant state_doc = msg;
+		variant state_doc;
+		if(shared) {
+			state_doc = shared->doc;
+		}
+
+		if(state_doc.is_null()) {
+			variant msg = FormulaObject::deepClone(variant(game_type_->get_state()));
+			variant cmd = game_type_->transform(msg, nplayer < 0 ? 0 : nplayer);
+			const_cast<game*>(this)->executeCommand(cmd);
+
+			state_doc = msg;
+			if(shared) {
+				shared->doc = state_doc;
+			}
+		}
 
 		if(send_delta) {
-			result.add("delta", FormulaObject::generateDiff(players_[nplayer].state_sent, state_doc));
-			result.add("delta_basis", players_[nplayer].state_id_sent);
+			const player& p = players_[nplayer];
+			variant delta;
+			std::pair<int, variant> basis(p.state_id_sent, p.state_group_sent);
+			if(shared && p.state_group_sent.is_null() == false) {
+				delta = shared->deltas[basis];
+			}
+
+			if(delta.is_null()) {
+				delta = FormulaObject::generateDiff(p.state_sent, state_doc);
+				if(shared && p.state_group_sent.is_null() == false) {
+					shared->deltas[basis] = delta;
+				}
+			}
+
+			result.add("delta", delta);
+			result.add("delta_basis", p.state_id_sent);
 		} else {
 			result.add("state", state_doc);
 		}
@@ -359,6 +401,7 @@ namespace tbs
 		if(nplayer >= 0 && nplayer < static_cast<int>(players_.size())) {
 			players_[nplayer].state_id_sent = state_id_;
 			players_[nplayer].state_sent = state_doc;
+			players_[nplayer].state_group_sent = group;
 		}
 
 		std::string log_str;
@@ -525,12 +568,8 @@ namespace {
 			variant delta = doc["delta"];
 			ASSERT_LOG(delta.is_map(), "Delta not found");
 
-			variant clone = FormulaObject::deepClone(variant(state_ptr.get()));
-			FormulaObject* obj = clone.try_convert<FormulaObject>();
-			ASSERT_LOG(obj, "Could not clone");
-
-			obj->applyDiff(delta);
-			state_ptr.reset(obj);
+			//the replayed state is private to us, so patch it in place.
+			state_ptr->applyDiff(delta);
 
 			if(doc["state_id"].as_int() >= state_id || i == static_cast<int>(replay_.size())-1) {
 				variant cmd = game_type_->restore_state(variant(state_ptr.get()));
@@ -602,7 +641,7 @@ namespace {
 		queue_message(result.build(), nplayer);
 	}
 
-	game::player::player() : side(-1), is_human(true), confirmed_state_id(-1), state_id_sent(-1), allow_deltas(false)
+	game::player::player() : side(-1), is_human(true), confirmed_state_id(-1), state_id_sent(-1), allow_deltas(false), allow_binary(false)
 	{
 	}
 
@@ -698,17 +737,32 @@ namespace {
 		}
 	}
 
+	game::sharing_transformed_states_scope::sharing_transformed_states_scope(game* g) : game_(g)
+	{
+		game_->sharing_transformed_states_ = true;
+	}
+
+	game::sharing_transformed_states_scope::~sharing_transformed_states_scope()
+	{
+		game_->sharing_transformed_states_ = false;
+		game_->shared_states_.clear();
+	}
+
 	void game::send_game_state(int nplayer, int processing_ms)
 	{
 		LOG_DEBUG("SEND GAME STATE: " << nplayer);
 		if(nplayer == -1) {
-			for(int n = 0; n != players().size(); ++n) {
-				send_game_state(n, processing_ms);
-			}
+			{
+				const sharing_transformed_states_scope sharing_scope(this);
+
+				for(int n = 0; n != players().size(); ++n) {
+					send_game_state(n, processing_ms);
+				}
 
-			//Send to observers.
-			queue_message(write(-1));
-			outgoing_messages_.back().recipients.push_back(-1);
+				//Send to observers.
+				queue_message(write(-1));
+				outgoing_messages_.back().recipients.push_back(-1);
+			}
 
 			current_message_ = "";
 		} else if(nplayer >= 0 && static_cast<unsigned>(nplayer) < players().size()) {
@@ -719,7 +773,7 @@ namespace {
 				return;
 			}
 
-			queue_message(write(nplayer, processing_ms), nplayer);
+			queue_message(variant_binary::write_document(write(nplayer, processing_ms), players_[nplayer].allow_binary), nplayer);
 
 
 			if(g_tbs_server_local && players_[nplayer].confirmed_state_id != -1) {
@@ -946,6 +1000,10 @@ namespace {
 					players_[nplayer].allow_deltas = msg["allow_deltas"].as_bool();
 				}
 
+				if(nplayer >= 0 && nplayer < static_cast<int>(players_.size()) && msg.has_key("allow_binary")) {
+					players_[nplayer].allow_binary = msg["allow_binary"].as_bool();
+				}
+
 				const variant state_id = msg["state_id"];
 				if(state_id.as_int() != state_id_ && nplayer >= 0) {
 					if(!g_tbs_server_local || players_[nplayer].confirmed_state_id == -1) {
@@ -26,6 +26,7 @@
 #include <boost/scoped_ptr.hpp>
 #include "intrusive_ptr.hpp"
 #include <deque>
+#include <map>
 #include <set>
 
 #include "db_client.hpp"
@@ -92,8 +93,15 @@ namespace tbs
 
 			mutable variant state_sent;
 			mutable int state_id_sent;
+
+			//the transform group state_sent was built for, or null.
+			mutable variant state_group_sent;
 			bool allow_deltas;
 
+			//if set, game states are sent to this player encoded with
+			//variant_binary rather than as FSON.
+			bool allow_binary;
+
 		};
 
 		int get_player_index(const std::string& nick) const;
@@ -179,6 +187,26 @@ namespace tbs
 
 		std::vector<std::string> observers_;
 
+		//transformed states shared between recipients of one broadcast,
+		//keyed by the game's transform_group().
+		struct shared_state {
+			variant doc;
+
+			//deltas keyed by the state id and group the recipient had.
+			std::map<std::pair<int, variant>, variant> deltas;
+		};
+
+		bool sharing_transformed_states_;
+		mutable std::map<variant, shared_state> shared_states_;
+
+		//shares transformed states for one broadcast, and stops sharing
+		//and drops the shared states however the broadcast ends.
+		struct sharing_transformed_states_scope {
+			explicit sharing_transformed_states_scope(game* g);
+			~sharing_transformed_states_scope();
+			game* game_;
+		};
+
 		variant player_waiting_on_;
 		int started_waiting_for_player_at_;
 
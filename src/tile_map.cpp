@@ -25,14 +25,17 @@
 #include <cmath>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <sstream>
 #include <set>
+#include <unordered_map>
 
 #include "asserts.hpp"
 #include "formatter.hpp"
 #include "formula.hpp"
 #include "formula_callable.hpp"
 #include "formula_function.hpp"
+#include "formula_garbage_collector.hpp"
 #include "json_parser.hpp"
 #include "level_object.hpp"
 #include "level_solid_map.hpp"
@@ -44,11 +47,13 @@
 #include "string_utils.hpp"
 #include "thread.hpp"
 #include "tile_map.hpp"
+#include "unit_test.hpp"
 #include "variant_utils.hpp"
 
 namespace 
 {
 	PREF_INT(tile_pattern_search_border, 1, "How many extra tiles to search for patterns");
+	PREF_BOOL(tile_pattern_validate, false, "Cross-check compiled tile pattern matches against boost::regex");
 
 	const std::map<std::string, int>& str_to_zorder() {
 		static std::map<std::string, int>* instance = nullptr;
@@ -118,25 +123,71 @@ int get_named_zorder(const std::string& key, int default_value)
 
 namespace 
 {
-	typedef std::map<const boost::regex*, bool> regex_match_map;
-	std::map<boost::array<char, 4>, regex_match_map> re_matches;
-
-	bool match_regex(boost::array<char, 4> str, const boost::regex* re) 
+	bool regex_match_uncached(const boost::array<char, 4>& str, const boost::regex* re) 
 	{
 		if(reinterpret_cast<intptr_t>(re)&1) {
 			//the low bit in the re pointer is set, meaning this is an inverted
 			//match.
-			return !match_regex(str, reinterpret_cast<const boost::regex*>(reinterpret_cast<intptr_t>(re)-1));
+			return !regex_match_uncached(str, reinterpret_cast<const boost::regex*>(reinterpret_cast<intptr_t>(re)-1));
+		}
+
+		return boost::regex_match(str.data(), str.data() + strlen(str.data()), *re);
+	}
+
+	void set_bit(std::vector<uint64_t>& bits, int n)
+	{
+		const size_t word = static_cast<size_t>(n) >> 6;
+		if(word >= bits.size()) {
+			bits.resize(word+1);
+		}
+
+		bits[word] |= uint64_t(1) << (n&63);
+	}
+
+	bool test_bit(const std::vector<uint64_t>& bits, int n)
+	{
+		const size_t word = static_cast<size_t>(n) >> 6;
+		return word < bits.size() && ((bits[word] >> (n&63))&1) != 0;
+	}
+
+	//Every tile string ever matched, compiled down to bitsets indexed by
+	//regex pool id. Tile strings come from a small vocabulary, so each
+	//(string, regex) pair only ever goes through boost::regex once.
+	struct CompiledTileString 
+	{
+		//bits for regexes we have tried, and the subset which matched.
+		std::vector<uint64_t> evaluated, matched;
+	};
+
+	std::unordered_map<uint32_t, CompiledTileString> compiled_tile_strings;
+
+	threading::mutex& compiled_tile_strings_mutex()
+	{
+		static threading::mutex* m = new threading::mutex;
+		return *m;
+	}
+
+	uint32_t tile_string_key(const boost::array<char, 4>& str)
+	{
+		uint32_t key;
+		memcpy(&key, str.data(), sizeof(key));
+		return key;
+	}
+
+	//the caller must hold compiled_tile_strings_mutex().
+	bool match_regex(const boost::array<char, 4>& str, int re_id) 
+	{
+		CompiledTileString& c = compiled_tile_strings[tile_string_key(str)];
+		if(test_bit(c.evaluated, re_id)) {
+			return test_bit(c.matched, re_id);
 		}
 
-		std::map<const boost::regex*, bool>& m = re_matches[str];
-		std::map<const boost::regex*, bool>::const_iterator i = m.find(re);
-		if(i != m.end()) {
-			return i->second;
+		const bool match = regex_match_uncached(str, get_regex_by_pool_id(re_id));
+		set_bit(c.evaluated, re_id);
+		if(match) {
+			set_bit(c.matched, re_id);
 		}
 
-		const bool match = boost::regex_match(str.data(), str.data() + strlen(str.data()), *re);
-		m[re] = match;
 		return match;
 	}
 
@@ -187,6 +238,7 @@ struct TilePattern
 		}
 
 		current_tile_pattern = &get_regex_from_pool(patterns[main_tile].empty() ? "^$" : patterns[main_tile]);
+		current_tile_id = get_regex_pool_id(current_tile_pattern);
 
 		for(std::vector<std::string>::size_type n = 0; n != patterns.size(); ++n) {
 			if(n == main_tile) {
@@ -215,14 +267,16 @@ struct TilePattern
 
 	std::string tile_id;
 	const boost::regex* current_tile_pattern;
+	int current_tile_id;
 
 	struct SurroundingTile {
 		SurroundingTile(int x, int y, const std::string& s)
-		  : xoffset(x), yoffset(y), pattern(&get_regex_from_pool(s))
+		  : xoffset(x), yoffset(y), pattern(&get_regex_from_pool(s)), pattern_id(get_regex_pool_id(pattern))
 		{}
 		int xoffset;
 		int yoffset;
 		const boost::regex* pattern;
+		int pattern_id;
 	};
 
 	std::vector<SurroundingTile> surrounding_tiles;
@@ -430,7 +484,7 @@ TileMap::TileMap() : xpos_(0), ypos_(0), x_speed_(100), y_speed_(100), zorder_(0
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
+	pattern_index_.back().setMatches(get_regex_pool_id(&get_regex_from_pool("")));
 }
 
 TileMap::TileMap(variant node)
@@ -460,7 +514,7 @@ TileMap::TileMap(variant node)
 
 	//make an entry for the empty string.
 	pattern_index_.push_back(PatternIndexEntry());
-	pattern_index_.back().matching_patterns.push_back(&get_regex_from_pool(""));
+	pattern_index_.back().setMatches(get_regex_pool_id(&get_regex_from_pool("")));
 
 	{
 	const std::string& tiles_str = node["tiles"].as_string();
@@ -544,28 +598,32 @@ TileMap::~TileMap()
 
 void TileMap::buildPatterns()
 {
-	std::vector<const boost::regex*> all_regexes;
+	std::vector<int> all_regexes;
 
 	patterns_version_ = current_patterns_version;
 	const unsigned begin_time = profile::get_tick_time();
 	patterns_.clear();
+	multi_patterns_.clear();
+
+	threading::lock lck(compiled_tile_strings_mutex());
+
 	for(const TilePattern& p : patterns) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
+		std::vector<int> re;
+		std::vector<int> accepted_re;
 		if(!p.current_tile_pattern->empty()) {
-			re.push_back(p.current_tile_pattern);
+			re.push_back(p.current_tile_id);
 		}
 		
 		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
-			re.push_back(t.pattern);
+			re.push_back(t.pattern_id);
 		}
 
 		int matches = 0;
 		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
+			for(int& regex : re) {
+				if(regex != -1 && match_regex(e.str, regex)) {
 					accepted_re.push_back(regex);
-					regex = nullptr;
+					regex = -1;
 					++matches;
 					if(matches == re.size()) {
 						break;
@@ -585,22 +643,22 @@ void TileMap::buildPatterns()
 	}
 
 	for(const MultiTilePattern& p : MultiTilePattern::getAll()) {
-		std::vector<const boost::regex*> re;
-		std::vector<const boost::regex*> accepted_re;
+		std::vector<int> re;
+		std::vector<int> accepted_re;
 
 		re.reserve(p.width()*p.height());
 		for(int x = 0; x < p.width(); ++x) {
 			for(int y = 0; y < p.height(); ++y) {
-				re.push_back(p.getTileAt(x, y).re);
+				re.push_back(p.getTileAt(x, y).re_id);
 			}
 		}
 
 		int matches = 0;
 		for(PatternIndexEntry& e : pattern_index_) {
-			for(const boost::regex*& regex : re) {
-				if(regex && match_regex(e.str, regex)) {
+			for(int& regex : re) {
+				if(regex != -1 && match_regex(e.str, regex)) {
 					accepted_re.push_back(regex);
-					regex = nullptr;
+					regex = -1;
 					++matches;
 					if(matches == re.size()) {
 						break;
@@ -625,9 +683,9 @@ void TileMap::buildPatterns()
 	for(PatternIndexEntry& e : pattern_index_) {
 		e.matching_patterns.clear();
 
-		for(const boost::regex* re : all_regexes) {
+		for(int re : all_regexes) {
 			if(match_regex(e.str, re)) {
-				e.matching_patterns.push_back(re);
+				e.setMatches(re);
 			}
 		}
 	}
@@ -736,6 +794,21 @@ const char* TileMap::getTile(int y, int x) const
 	return pattern_index_[map_[y][x]].str.data();
 }
 
+void TileMap::PatternIndexEntry::setMatches(int re_id)
+{
+	set_bit(matching_patterns, re_id);
+}
+
+bool TileMap::entryMatches(const PatternIndexEntry& e, int re_id) const
+{
+	const bool result = e.matches(re_id);
+	if(g_tile_pattern_validate) {
+		ASSERT_LOG(result == regex_match_uncached(e.str, get_regex_by_pool_id(re_id)), "Compiled tile pattern match disagrees with boost::regex for tile '" << e.str.data() << "' and regex " << re_id << ": " << result);
+	}
+
+	return result;
+}
+
 const TileMap::PatternIndexEntry& TileMap::getTileEntry(int y, int x) const
 {
 	if(x < 0 || y < 0 
@@ -869,7 +942,7 @@ void TileMap::applyMatchingMultiPattern(int& x, int y,
 		const int ypos = pattern.tryOrder()[n].loc.y;
 
 		const PatternIndexEntry& entry = getTileEntry(y + ypos, x + xpos);
-		if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), pattern.getTileAt(xpos, ypos).re) == entry.matching_patterns.end()) {
+		if(!entryMatches(entry, pattern.getTileAt(xpos, ypos).re_id)) {
 			//the regex doesn't match
 			match = false;
 
@@ -1034,6 +1107,22 @@ void TileMap::buildTiles(std::vector<LevelTile>* tiles, const rect* r) const
 	LOG_DEBUG("done build tiles: " << ntiles << " " << (profile::get_tick_time() - begin_time));
 }
 
+int TileMap::getPatternRadius() const
+{
+	int radius = 1;
+	for(const TilePattern* p : getPatterns()) {
+		for(const TilePattern::SurroundingTile& t : p->surrounding_tiles) {
+			radius = std::max(radius, std::max(std::abs(t.xoffset), std::abs(t.yoffset)));
+		}
+	}
+
+	for(const MultiTilePattern* p : multi_patterns_) {
+		radius = std::max(radius, std::max(p->width(), p->height()));
+	}
+
+	return radius;
+}
+
 const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& cache, bool* face_right) const
 {
 
@@ -1047,10 +1136,8 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 
 	const int xpos = xpos_ + x*TileSize;
 
-	ffl::IntrusivePtr<FilterCallable> callable_ptr(new FilterCallable(*this, x, y));
-	FilterCallable& callable = *callable_ptr;
-
 	const char* current_tile = getTile(y,x);
+	const PatternIndexEntry& current_entry = getTileEntry(y,x);
 
 	//we build a cache of all of the patterns which have some chance of
 	//matching the current tile.
@@ -1058,7 +1145,7 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 	if(itor == cache.cache.end()) {
 		itor = cache.cache.insert(std::pair<const char*,std::vector<const TilePattern*> >(current_tile, std::vector<const TilePattern*>())).first;
 		for(const TilePattern* p : getPatterns()) {
-			if(!p->current_tile_pattern->empty() && !boost::regex_match(current_tile, current_tile + strlen(current_tile), *p->current_tile_pattern)) {
+			if(!p->current_tile_pattern->empty() && !entryMatches(current_entry, p->current_tile_id)) {
 				continue;
 			}
 
@@ -1070,14 +1157,20 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 
 	for(const TilePattern* ptr : matching_patterns) {
 		const TilePattern& p = *ptr;
-		if(p.filter_formula && p.filter_formula->execute(callable).as_bool() == false) {
-			continue;
+		if(p.filter_formula) {
+			//tiles may be built in a worker thread, so keep the garbage
+			//collector out while the filter's callable is alive.
+			std::lock_guard<std::mutex> lock(GarbageCollector::getGlobalMutex());
+			ffl::IntrusivePtr<FilterCallable> callable(new FilterCallable(*this, x, y));
+			if(p.filter_formula->execute(*callable).as_bool() == false) {
+				continue;
+			}
 		}
 
 		bool match = true;
 		for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
 			const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x + t.xoffset);
-			if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
+			if(!entryMatches(entry, t.pattern_id)) {
 				match = false;
 				break;
 			}
@@ -1097,7 +1190,7 @@ const TilePattern* TileMap::getMatchingPattern(int x, int y, TilePatternCache& c
 
 			for(const TilePattern::SurroundingTile& t : p.surrounding_tiles) {
 				const PatternIndexEntry& entry = getTileEntry(y + t.yoffset, x - t.xoffset);
-				if(std::find(entry.matching_patterns.begin(), entry.matching_patterns.end(), t.pattern) == entry.matching_patterns.end()) {
+				if(!entryMatches(entry, t.pattern_id)) {
 					match = false;
 					break;
 				}
@@ -1192,3 +1285,27 @@ int TileMap::getPatternIndexEntry(const tile_string& str) {
 	buildPatterns();
 	return index;
 }
+
+UNIT_TEST(tile_pattern_compiled_matches)
+{
+	const char* regexes[] = { "", "^$", "blk", "!blk", "b.k", "(abc|blk)", "[a-c]+", "!.*" };
+	const char* tiles[] = { "", "blk", "bak", "abc", "x" };
+
+	threading::lock lck(compiled_tile_strings_mutex());
+	for(const char* tile : tiles) {
+		boost::array<char, 4> str;
+		str.fill(0);
+		strncpy(str.data(), tile, 3);
+
+		for(const char* key : regexes) {
+			const boost::regex* re = &get_regex_from_pool(key);
+			const int id = get_regex_pool_id(re);
+			CHECK_EQ(get_regex_by_pool_id(id), re);
+
+			//the second lookup is answered from the compiled bitsets.
+			const bool expected = regex_match_uncached(str, re);
+			CHECK_EQ(match_regex(str, id), expected);
+			CHECK_EQ(match_regex(str, id), expected);
+		}
+	}
+}
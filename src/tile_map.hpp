@@ -26,8 +26,10 @@
 #include <boost/array.hpp>
 #include <boost/regex.hpp>
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "geometry.hpp"
 
@@ -64,6 +66,10 @@ public:
 
 	variant write() const;
 	void buildTiles(std::vector<LevelTile>* tiles, const rect* r=nullptr) const;
+
+	//the furthest distance, in tiles, a change to a single tile can have an
+	//effect on which tiles are built around it.
+	int getPatternRadius() const;
 	bool setTile(int xpos, int ypos, const std::string& str);
 	int zorder() const { return zorder_; }
 	int getXSpeed() const { return x_speed_; }
@@ -109,11 +115,25 @@ private:
 	{
 		PatternIndexEntry() { for(int n = 0; n != str.size(); ++n) { str[n] = 0; } }
 		tile_string str;
-		mutable std::vector<const boost::regex*> matching_patterns;
+
+		//a bitset, indexed by regex pool id, of the regexes in use by
+		//this map's patterns which match str.
+		std::vector<uint64_t> matching_patterns;
+
+		bool matches(int re_id) const {
+			const size_t word = static_cast<size_t>(re_id) >> 6;
+			return word < matching_patterns.size() && ((matching_patterns[word] >> (re_id&63))&1) != 0;
+		}
+
+		void setMatches(int re_id);
 	};
 
 	const PatternIndexEntry& getTileEntry(int y, int x) const;
 
+	//tests an entry against a regex pool id, cross-checking the result
+	//against boost::regex if tile_pattern_validate is on.
+	bool entryMatches(const PatternIndexEntry& e, int re_id) const;
+
 	std::vector<PatternIndexEntry> pattern_index_;
 
 	int getPatternIndexEntry(const tile_string& str);
@@ -213,6 +213,7 @@ UTILITY(compile_objects)
 		}
 	}
 
+	CustomObjectType::preloadAllObjects();
 	std::vector<ConstCustomObjectTypePtr> types = CustomObjectType::getAll();
 	for(ConstCustomObjectTypePtr type : types) {
 		const std::string* path = CustomObjectType::getObjectPath(type->id() + ".cfg");
@@ -46,7 +46,7 @@ void write_autosave()
 		node.add_attr(variant("music"), variant(sound::current_music()));
 	}
 	
-	sys::write_file(preferences::auto_save_file_path(), node.write_json());
+	sys::write_file(preferences::auto_save_file_path(), Level::writeSaveDocument(node));
 	sys::write_file(std::string(preferences::auto_save_file_path()) + ".stat", "1");
 }
 
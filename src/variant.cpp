@@ -21,7 +21,10 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <functional>
 #include <set>
 #include <stdlib.h>
 #include <stdio.h>
@@ -100,11 +103,48 @@ int variant::get_enum_index(const std::string& enum_id) {
 namespace {
 std::set<variant*> callable_variants_loading, delayed_variants_loading;
 
+//source of list and map generations. Every in-place mutation takes a
+//fresh value, so two containers can only share a non-zero generation by
+//being copies of each other.
+std::atomic<unsigned long long> g_container_generation(0);
+
+unsigned long long next_container_generation()
+{
+	return ++g_container_generation;
+}
+
 std::vector<CallStackEntry> call_stack;
 
 variant last_failed_query_map, last_failed_query_key;
 variant last_query_map;
 variant UnfoundInMapNullVariant;
+
+THREAD_LOCAL bool g_worker_thread = false;
+
+void set_last_query_map(const variant& m)
+{
+	if(!g_worker_thread) {
+		last_query_map = m;
+	}
+}
+
+void set_last_failed_query(const variant& m, const variant& key)
+{
+	if(!g_worker_thread) {
+		last_failed_query_map = m;
+		last_failed_query_key = key;
+	}
+}
+}
+
+VariantWorkerThreadScope::VariantWorkerThreadScope() : previous_(g_worker_thread)
+{
+	g_worker_thread = true;
+}
+
+VariantWorkerThreadScope::~VariantWorkerThreadScope()
+{
+	g_worker_thread = previous_;
 }
 
 void init_call_stack(int min_size)
@@ -198,6 +238,10 @@ std::string output_formula_error_info();
 namespace {
 void generate_error(std::string message)
 {
+	if(g_worker_thread) {
+		ASSERT_LOG(false, "ERROR: " << message << "\ntype error");
+	}
+
 	if(call_stack.empty() == false && call_stack.back().expression) {
 		message += "\n" + call_stack.back().expression->debugPinpointLocation();
 	}
@@ -231,12 +275,12 @@ struct variant_uuid : public GarbageCollectible {
 struct variant_list : public GarbageCollectible {
 
 	variant_list() : begin(elements.begin()), end(elements.end()),
-	                 storage(nullptr)
+	                 storage(nullptr), generation(0)
 	{}
 
 	variant_list(const variant_list& o) :
 	   elements(o.begin, o.end), begin(elements.begin()), end(elements.end()),
-	   storage(nullptr)
+	   storage(nullptr), generation(o.generation)
 	{}
 
 	const variant_list& operator=(const variant_list& o) {
@@ -244,6 +288,7 @@ struct variant_list : public GarbageCollectible {
 		begin = elements.begin();
 		end = elements.end();
 		storage = nullptr;
+		generation = o.generation;
 		return *this;
 	}
 
@@ -300,6 +345,9 @@ struct variant_list : public GarbageCollectible {
 	std::vector<variant> elements;
 	ffl::IntrusivePtr<variant_list> storage;
 	std::vector<variant>::iterator begin, end;
+
+	//see variant::container_generation().
+	unsigned long long generation;
 };
 
 struct variant_string {
@@ -331,15 +379,60 @@ struct variant_map : public GarbageCollectible {
 	variant::debug_info info;
 	ffl::IntrusivePtr<const game_logic::FormulaExpression> expression;
 
-	variant_map() : GarbageCollectible(), modcount(0)
+	variant_map() : GarbageCollectible(), modcount(0), generation(0), key_index_(nullptr), lookups_since_change_(0)
 	{
 	}
-	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0)
+	variant_map(const variant_map& o) : GarbageCollectible(o), expression(o.expression), elements(o.elements), modcount(0), generation(o.generation), key_index_(nullptr), lookups_since_change_(0)
 	{
 	}
 
 	~variant_map()
 	{
+		delete key_index_.load();
+	}
+
+	//finds the value stored under a string key without having to construct
+	//a variant for the key. Small maps are scanned directly. Larger maps
+	//which are searched repeatedly get an open addressing index over their
+	//string keys, which is dropped by keysChanged(). Returns false if the
+	//map isn't indexed yet, in which case the caller must search elements.
+	bool findString(const std::string& key, const variant** result) const {
+		*result = nullptr;
+		if(elements.size() <= MaxScannedElements) {
+			for(const std::pair<const variant,variant>& p : elements) {
+				if(p.first.is_string() && p.first.as_string() == key) {
+					*result = &p.second;
+					break;
+				}
+			}
+
+			return true;
+		}
+
+		const KeyIndex* index = key_index_.load(std::memory_order_acquire);
+		if(index == nullptr) {
+			if(++lookups_since_change_ < static_cast<int>(elements.size()/4)) {
+				return false;
+			}
+
+			index = buildIndex();
+		}
+
+		const size_t hash = std::hash<std::string>()(key);
+		for(size_t n = hash&index->mask; index->slots[n].second != nullptr; n = (n+1)&index->mask) {
+			if(index->slots[n].first == hash && index->slots[n].second->first.as_string() == key) {
+				*result = &index->slots[n].second->second;
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	//must be called whenever a key is added to or removed from elements.
+	void keysChanged() {
+		delete key_index_.exchange(nullptr);
+		lookups_since_change_ = 0;
 	}
 
 	void surrenderReferences(GarbageCollector* collector) override {
@@ -377,7 +470,55 @@ struct variant_map : public GarbageCollectible {
 
 	std::map<variant,variant> elements;
 	int modcount;
+
+	//see variant::container_generation().
+	unsigned long long generation;
 private:
+	static const size_t MaxScannedElements = 8;
+
+	struct KeyIndex {
+		//pairs of the key's hash and its element, or nullptr for empty slots.
+		std::vector<std::pair<size_t, const std::pair<const variant,variant>*> > slots;
+		size_t mask;
+	};
+
+	const KeyIndex* buildIndex() const {
+		KeyIndex* index = new KeyIndex;
+		size_t nslots = 16;
+		while(nslots < elements.size()*2) {
+			nslots *= 2;
+		}
+
+		index->slots.resize(nslots);
+		index->mask = nslots - 1;
+		for(const std::pair<const variant,variant>& p : elements) {
+			if(p.first.is_string() == false) {
+				continue;
+			}
+
+			const size_t hash = std::hash<std::string>()(p.first.as_string());
+			size_t n = hash&index->mask;
+			while(index->slots[n].second != nullptr) {
+				n = (n+1)&index->mask;
+			}
+
+			index->slots[n] = std::make_pair(hash, &p);
+		}
+
+		//another thread may have built the index at the same time as us,
+		//in which case we use theirs.
+		KeyIndex* expected = nullptr;
+		if(key_index_.compare_exchange_strong(expected, index, std::memory_order_acq_rel)) {
+			return index;
+		}
+
+		delete index;
+		return expected;
+	}
+
+	mutable std::atomic<KeyIndex*> key_index_;
+	mutable std::atomic<int> lookups_since_change_;
+
 	void operator=(const variant_map&);
 };
 
@@ -679,6 +820,7 @@ variant variant::create_delayed(game_logic::ConstFormulaPtr f, game_logic::Const
 	variant v;
 	v.type_ = VARIANT_TYPE_DELAYED;
 	v.delayed_ = new variant_delayed;
+	recordVariantAllocation();
 	v.delayed_->fn = f;
 	v.delayed_->callable = callable;
 
@@ -704,6 +846,7 @@ variant variant::create_function_overload(const std::vector<variant>& fn)
 	variant result;
 	result.type_ = VARIANT_TYPE_MULTI_FUNCTION;
 	result.multi_fn_ = new variant_multi_fn;
+	recordVariantAllocation();
 	result.multi_fn_->add_reference();
 	result.multi_fn_->functions = fn;
 	return result;
@@ -727,6 +870,7 @@ variant::variant(std::vector<variant>* array)
 	assert(array);
 	if(array->empty() == false) {
 		list_ = new variant_list;
+		recordVariantAllocation();
 		list_->add_reference();
 		list_->elements.swap(*array);
 		list_->begin = list_->elements.begin();
@@ -746,6 +890,7 @@ variant::variant(const char* s)
 		return;
 	}
 	string_ = new variant_string(std::string(s));
+	recordVariantAllocation();
 	increment_refcount();
 
 	registerGlobalVariant(this);
@@ -755,6 +900,7 @@ variant::variant(const std::string& str)
 	: type_(VARIANT_TYPE_STRING)
 {
 	string_ = new variant_string(str);
+	recordVariantAllocation();
 	increment_refcount();
 
 	registerGlobalVariant(this);
@@ -784,6 +930,7 @@ variant::variant(std::map<variant,variant>* map)
 	
 	assert(map);
 	map_ = new variant_map;
+	recordVariantAllocation();
 	map_->add_reference();
 	map_->elements.swap(*map);
 
@@ -794,6 +941,7 @@ variant::variant(const variant& formula_var, const game_logic::FormulaCallable&
 	: type_(VARIANT_TYPE_GENERIC_FUNCTION)
 {
 	generic_fn_ = new variant_generic_fn;
+	recordVariantAllocation();
 	generic_fn_->add_reference();
 	generic_fn_->fn = formula_var;
 	generic_fn_->callable = &callable;
@@ -813,6 +961,7 @@ variant::variant(const game_logic::ConstFormulaPtr& formula, const game_logic::F
   : type_(VARIANT_TYPE_FUNCTION)
 {
 	fn_ = new variant_fn;
+	recordVariantAllocation();
 	fn_->add_reference();
 	fn_->fn = formula;
 	fn_->callable = &callable;
@@ -835,6 +984,7 @@ variant variant::change_function_callable(const game_logic::FormulaCallable& cal
 	variant res;
 	res.type_ = VARIANT_TYPE_FUNCTION;
 	res.fn_ = new variant_fn(*fn_);
+	recordVariantAllocation();
 	res.fn_->add_reference();
 	res.fn_->callable = &callable;
 	return res;
@@ -849,6 +999,7 @@ variant::variant(std::function<variant(const game_logic::FormulaCallable&)> buil
   : type_(VARIANT_TYPE_FUNCTION)
 {
 	fn_ = new variant_fn;
+	recordVariantAllocation();
 	fn_->add_reference();
 	fn_->builtin_fn = builtin_fn;
 	fn_->base_slot = 0;
@@ -866,6 +1017,7 @@ variant::variant(game_logic::ConstFormulaPtr fml, const std::vector<std::string>
   : type_(VARIANT_TYPE_FUNCTION)
 {
 	fn_ = new variant_fn;
+	recordVariantAllocation();
 	fn_->type->arg_names = args;
 	fn_->base_slot = base_slot;
 	fn_->fn = fml;
@@ -896,6 +1048,7 @@ const variant& variant::operator=(const variant& v)
 		type_ = v.type_;
 		value_ = v.value_;
 		if (type_ > VARIANT_TYPE_DECIMAL) {
+			recordVariantCopy();
 			increment_refcount();
 		}
 	}
@@ -926,16 +1079,27 @@ const variant& variant::operator[](const variant& v) const
 
 	if(type_ == VARIANT_TYPE_MAP) {
 		assert(map_);
+		const variant* result = nullptr;
+		if(v.is_string() && map_->findString(v.as_string(), &result)) {
+			if(result == nullptr) {
+				set_last_failed_query(*this, v);
+
+				return UnfoundInMapNullVariant;
+			}
+
+			set_last_query_map(*this);
+			return *result;
+		}
+
 		std::map<variant,variant>::const_iterator i = map_->elements.find(v);
 		if (i == map_->elements.end())
 		{
-			last_failed_query_map = *this;
-			last_failed_query_key = v;
+			set_last_failed_query(*this, v);
 
 			return UnfoundInMapNullVariant;
 		}
 
-		last_query_map = *this;
+		set_last_query_map(*this);
 		return i->second;
 	} else if(type_ == VARIANT_TYPE_LIST) {
 		return operator[](v.as_int());
@@ -952,6 +1116,18 @@ const variant& variant::operator[](const variant& v) const
 
 const variant& variant::operator[](const std::string& key) const
 {
+	const variant* result = nullptr;
+	if(type_ == VARIANT_TYPE_MAP && map_->findString(key, &result)) {
+		if(result == nullptr) {
+			set_last_failed_query(*this, variant(key));
+
+			return UnfoundInMapNullVariant;
+		}
+
+		set_last_query_map(*this);
+		return *result;
+	}
+
 	return (*this)[variant(key)];
 }
 
@@ -961,6 +1137,11 @@ bool variant::has_key(const variant& key) const
 		return false;
 	}
 
+	const variant* result = nullptr;
+	if(key.is_string() && map_->findString(key.as_string(), &result)) {
+		return result != nullptr && result->is_null() == false;
+	}
+
 	std::map<variant,variant>::const_iterator i = map_->elements.find(key);
 	if(i != map_->elements.end() && i->second.is_null() == false) {
 		return true;
@@ -971,6 +1152,11 @@ bool variant::has_key(const variant& key) const
 
 bool variant::has_key(const std::string& key) const
 {
+	const variant* result = nullptr;
+	if(type_ == VARIANT_TYPE_MAP && map_->findString(key, &result)) {
+		return result != nullptr && result->is_null() == false;
+	}
+
 	return has_key(variant(key));
 }
 
@@ -1049,6 +1235,7 @@ variant variant::get_list_slice(int begin, int end) const
 	}
 
 	result.list_ = new variant_list;
+	recordVariantAllocation();
 	result.list_->add_reference();
 	result.list_->begin = list_->begin + begin;
 	result.list_->end = list_->begin + end;
@@ -1554,17 +1741,20 @@ bool variant::is_unmodified_single_reference() const
 
 variant variant::add_attr(variant key, variant value)
 {
-	last_query_map = variant();
+	set_last_query_map(variant());
 
 	if(is_map()) {
 		if(map_->refcount() > 1) {
 			map_->dec_reference();
 			map_ = new variant_map(*map_);
+			recordVariantAllocation();
 			map_->add_reference();
 		}
 
 		make_unique();
 		map_->elements[key] = value;
+		map_->keysChanged();
+		map_->generation = next_container_generation();
 		return *this;
 	} else {
 		return variant();
@@ -1573,17 +1763,20 @@ variant variant::add_attr(variant key, variant value)
 
 variant variant::remove_attr(variant key)
 {
-	last_query_map = variant();
+	set_last_query_map(variant());
 
 	if(is_map()) {
 		if(map_->refcount() > 1) {
 			map_->dec_reference();
 			map_ = new variant_map(*map_);
+			recordVariantAllocation();
 			map_->add_reference();
 		}
 
 		make_unique();
 		map_->elements.erase(key);
+		map_->keysChanged();
+		map_->generation = next_container_generation();
 		return *this;
 	} else {
 		return variant();
@@ -1594,7 +1787,9 @@ void variant::add_attr_mutation(variant key, variant value)
 {
 	if(is_map()) {
 		map_->elements[key] = value;
+		map_->keysChanged();
 		map_->modcount++;
+		map_->generation = next_container_generation();
 	}
 }
 
@@ -1602,7 +1797,9 @@ void variant::remove_attr_mutation(variant key)
 {
 	if(is_map()) {
 		map_->elements.erase(key);
+		map_->keysChanged();
 		map_->modcount++;
+		map_->generation = next_container_generation();
 	}
 }
 
@@ -1612,6 +1809,7 @@ variant* variant::get_attr_mutable(variant key)
 		std::map<variant,variant>::iterator i = map_->elements.find(key);
 		if(i != map_->elements.end()) {
 			map_->modcount++;
+			map_->generation = next_container_generation();
 			return &i->second;
 		}
 	}
@@ -1623,6 +1821,11 @@ variant* variant::get_index_mutable(int index)
 {
 	if(is_list()) {
 		if(index >= 0 && static_cast<unsigned>(index) < num_elements()) {
+			//the element may live in storage shared with other lists.
+			list_->generation = next_container_generation();
+			if(list_->storage) {
+				list_->storage->generation = list_->generation;
+			}
 			return &list_->begin[index];
 		}
 	}
@@ -1630,10 +1833,81 @@ variant* variant::get_index_mutable(int index)
 	return nullptr;
 }
 
+unsigned long long variant::container_generation() const
+{
+	if(is_map()) {
+		return map_->generation;
+	} else if(is_list() && list_ != nullptr) {
+		if(list_->storage) {
+			return std::max(list_->generation, list_->storage->generation);
+		}
+		return list_->generation;
+	}
+
+	return 0;
+}
+
+void variant::copy_container_generation(const variant& o)
+{
+	if(is_map()) {
+		map_->generation = o.container_generation();
+	} else if(is_list() && list_ != nullptr) {
+		list_->generation = o.container_generation();
+	}
+}
+
+variant variant::deep_copy_document() const
+{
+	variant result;
+	switch(type_) {
+	case VARIANT_TYPE_STRING:
+		result = variant(string_->str);
+		result.string_->translated_from = string_->translated_from;
+		break;
+	case VARIANT_TYPE_LIST: {
+		std::vector<variant> items;
+		if(list_ != nullptr) {
+			items.reserve(list_->size());
+			for(auto i = list_->begin; i != list_->end; ++i) {
+				items.push_back(i->deep_copy_document());
+			}
+		}
+
+		result = variant(&items);
+		break;
+	}
+	case VARIANT_TYPE_MAP: {
+		std::map<variant,variant> items;
+		for(const std::pair<const variant,variant>& p : map_->elements) {
+			items.insert(items.end(), std::pair<variant,variant>(p.first.deep_copy_document(), p.second.deep_copy_document()));
+		}
+
+		result = variant(&items);
+		break;
+	}
+	case VARIANT_TYPE_NULL:
+	case VARIANT_TYPE_INT:
+	case VARIANT_TYPE_ENUM:
+	case VARIANT_TYPE_BOOL:
+	case VARIANT_TYPE_DECIMAL:
+		return *this;
+	default:
+		ASSERT_LOG(false, "Cannot copy a " << variant_type_to_string(type_) << " in a document");
+	}
+
+	const debug_info* info = get_debug_info();
+	if(info) {
+		result.setDebugInfo(*info);
+	}
+
+	return result;
+}
+
 void variant::weaken()
 {
 	if(type_ == VARIANT_TYPE_CALLABLE) {
 		variant_weak* weak = new variant_weak;
+		recordVariantAllocation();
 		weak->refcount++;
 		weak->ptr = ffl::weak_ptr<game_logic::FormulaCallable>(mutable_callable_);
 
@@ -1658,6 +1932,7 @@ variant variant::bind_closure(const game_logic::FormulaCallable* callable)
 	variant result;
 	result.type_ = VARIANT_TYPE_FUNCTION;
 	result.fn_ = new variant_fn(*fn_);
+	recordVariantAllocation();
 	result.fn_->add_reference();
 	result.fn_->callable.reset(callable);
 	return result;
@@ -1673,6 +1948,7 @@ variant variant::bind_args(const std::vector<variant>& args)
 	variant result;
 	result.type_ = VARIANT_TYPE_FUNCTION;
 	result.fn_ = new variant_fn(*fn_);
+	recordVariantAllocation();
 	result.fn_->add_reference();
 	result.fn_->bound_args.insert(result.fn_->bound_args.end(), args.begin(), args.end());
 
@@ -1814,6 +2090,15 @@ const std::string& variant::as_string() const
 	return string_->str;
 }
 
+const std::string* variant::get_translated_from() const
+{
+	if(type_ != VARIANT_TYPE_STRING || string_->translated_from.empty()) {
+		return nullptr;
+	}
+
+	return &string_->translated_from;
+}
+
 boost::uuids::uuid variant::as_callable_loading() const
 {
 	must_be(VARIANT_TYPE_CALLABLE_LOADING);
@@ -2210,35 +2495,38 @@ bool variant::operator>(const variant& v) const
 
 void variant::throw_type_error(variant::TYPE t) const
 {
-	if(this == &UnfoundInMapNullVariant) {
-		const debug_info* info = last_failed_query_map.get_debug_info();
-		if(info) {
-			generate_error(formatter() << "In object at " << *info->filename << " " << info->line << " (column " << info->column << ") did not find attribute " << last_failed_query_key << " which was expected to be a " << variant_type_to_string(t));
-		} else if(last_failed_query_map.get_source_expression()) {
-			generate_error(formatter() << "Map object generated in FFL was expected to have key '" << last_failed_query_key << "' of type " << variant_type_to_string(t) << " but this key wasn't found. The map was generated by this expression:\n" << last_failed_query_map.get_source_expression()->debugPinpointLocation());
+	//a worker thread's queries aren't recorded.
+	if(!g_worker_thread) {
+		if(this == &UnfoundInMapNullVariant) {
+			const debug_info* info = last_failed_query_map.get_debug_info();
+			if(info) {
+				generate_error(formatter() << "In object at " << *info->filename << " " << info->line << " (column " << info->column << ") did not find attribute " << last_failed_query_key << " which was expected to be a " << variant_type_to_string(t));
+			} else if(last_failed_query_map.get_source_expression()) {
+				generate_error(formatter() << "Map object generated in FFL was expected to have key '" << last_failed_query_key << "' of type " << variant_type_to_string(t) << " but this key wasn't found. The map was generated by this expression:\n" << last_failed_query_map.get_source_expression()->debugPinpointLocation());
+			}
 		}
-	}
 
-	if(last_query_map.is_map() && last_query_map.get_debug_info()) {
-		for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
-			if(this == &i->second) {
-				const debug_info* info = i->first.get_debug_info();
-				if(info == nullptr) {
-					info = last_query_map.get_debug_info();
-				}
-				generate_error(formatter() << "In object at " << *info->filename << " " << info->line << " (column " << info->column << ") attribute for " << i->first << " was " << *this << ", which is a " << variant_type_to_string(type_) << ", must be a " << variant_type_to_string(t));
+		if(last_query_map.is_map() && last_query_map.get_debug_info()) {
+			for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
+				if(this == &i->second) {
+					const debug_info* info = i->first.get_debug_info();
+					if(info == nullptr) {
+						info = last_query_map.get_debug_info();
+					}
+					generate_error(formatter() << "In object at " << *info->filename << " " << info->line << " (column " << info->column << ") attribute for " << i->first << " was " << *this << ", which is a " << variant_type_to_string(type_) << ", must be a " << variant_type_to_string(t));
 				
-			}
-		}
-	} else if(last_query_map.is_map() && last_query_map.get_source_expression()) {
-		for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
-			if(this == &i->second) {
-				std::ostringstream expression;
-				if(last_failed_query_map.get_source_expression()) {
-					expression << " The map was generated by this expression:\n" << last_failed_query_map.get_source_expression()->debugPinpointLocation();
 				}
+			}
+		} else if(last_query_map.is_map() && last_query_map.get_source_expression()) {
+			for(std::map<variant,variant>::const_iterator i = last_query_map.map_->elements.begin(); i != last_query_map.map_->elements.end(); ++i) {
+				if(this == &i->second) {
+					std::ostringstream expression;
+					if(last_failed_query_map.get_source_expression()) {
+						expression << " The map was generated by this expression:\n" << last_failed_query_map.get_source_expression()->debugPinpointLocation();
+					}
 
-				generate_error(formatter() << "Map object generated in FFL was expected to have key '" << last_failed_query_key << "' of type " << variant_type_to_string(t) << " but this key was of type " << variant_type_to_string(i->second.type_) << " instead." << expression.str());
+					generate_error(formatter() << "Map object generated in FFL was expected to have key '" << last_failed_query_key << "' of type " << variant_type_to_string(t) << " but this key was of type " << variant_type_to_string(i->second.type_) << " instead." << expression.str());
+				}
 			}
 		}
 	}
@@ -2420,6 +2708,7 @@ void variant::make_unique()
 
 		list_->dec_reference();
 		list_ = new variant_list(*list_);
+		recordVariantAllocation();
 		list_->add_reference();
 		for(variant& v : list_->elements) {
 			v.make_unique();
@@ -2429,6 +2718,7 @@ void variant::make_unique()
 	case VARIANT_TYPE_STRING:
 		string_->refcount--;
 		string_ = new variant_string(*string_);
+		recordVariantAllocation();
 		string_->refcount = 1;
 		break;
 	case VARIANT_TYPE_MAP: {
@@ -2444,6 +2734,7 @@ void variant::make_unique()
 		map_->dec_reference();
 
 		variant_map* vm = new variant_map;
+		recordVariantAllocation();
 		vm->add_reference();
 		vm->info = map_->info;
 		vm->elements.swap(m);
@@ -3012,3 +3303,188 @@ BENCHMARK(variant_assign)
 		}
 	}
 }
+
+UNIT_TEST(variant_map_string_lookup)
+{
+	for(int size : {4, 100}) {
+		std::map<variant,variant> m;
+		for(int n = 0; n != size; ++n) {
+			m[variant(formatter() << "key" << n)] = variant(n);
+			m[variant(n)] = variant(-n);
+		}
+
+		variant v(&m);
+
+		//enough lookups that large maps get indexed part way through.
+		for(int pass = 0; pass != 2; ++pass) {
+			for(int n = 0; n != size; ++n) {
+				const std::string key = formatter() << "key" << n;
+				CHECK_EQ(v[key], variant(n));
+				CHECK_EQ(v[variant(key)], variant(n));
+				CHECK_EQ(v[variant(n)], variant(-n));
+				CHECK(v.has_key(key), "has_key failed: " << key);
+			}
+
+			CHECK(v.has_key("missing") == false, "found missing key");
+			CHECK(v["missing"].is_null(), "found missing key");
+		}
+
+		v.add_attr_mutation(variant("added"), variant(7));
+		v.remove_attr_mutation(variant("key0"));
+		for(int n = 0; n != size; ++n) {
+			CHECK_EQ(v["added"], variant(7));
+			CHECK(v.has_key("key0") == false, "found removed key");
+		}
+	}
+}
+
+namespace {
+std::map<variant,variant> benchmark_map(int size)
+{
+	std::map<variant,variant> m;
+	for(int n = 0; n != size; ++n) {
+		m[variant(formatter() << "attribute_" << n)] = variant(n);
+	}
+
+	return m;
+}
+
+//keeps a benchmark's result from being optimized away.
+volatile int g_benchmark_sink;
+
+void benchmark_sink(int value)
+{
+	g_benchmark_sink = value;
+}
+
+std::vector<std::string> benchmark_keys(int size)
+{
+	std::vector<std::string> keys;
+	for(int n = 0; n != size; ++n) {
+		keys.push_back(formatter() << "attribute_" << n);
+	}
+
+	return keys;
+}
+}
+
+BENCHMARK_ARG(variant_map_string_lookup, int size)
+{
+	std::map<variant,variant> m = benchmark_map(size);
+	variant v(&m);
+	const std::vector<std::string> keys = benchmark_keys(size);
+	BENCHMARK_LOOP {
+		for(const std::string& key : keys) {
+			v[key];
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_string_lookup, small, 6);
+BENCHMARK_ARG_CALL(variant_map_string_lookup, medium, 40);
+BENCHMARK_ARG_CALL(variant_map_string_lookup, large, 1000);
+
+//the same lookups done directly on a std::map, as they were before
+//variant maps could find string keys without building a variant.
+BENCHMARK_ARG(std_map_string_lookup, int size)
+{
+	const std::map<variant,variant> m = benchmark_map(size);
+	const std::vector<std::string> keys = benchmark_keys(size);
+	BENCHMARK_LOOP {
+		for(const std::string& key : keys) {
+			m.find(variant(key));
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(std_map_string_lookup, std_small, 6);
+BENCHMARK_ARG_CALL(std_map_string_lookup, std_medium, 40);
+BENCHMARK_ARG_CALL(std_map_string_lookup, std_large, 1000);
+
+//the key index is only built once a map has been searched repeatedly, so
+//building a map and reading a key from it should cost the same as the
+//std::map it wraps.
+BENCHMARK_ARG(variant_map_construct, int size)
+{
+	const std::map<variant,variant> source = benchmark_map(size);
+	std::vector<variant> keys;
+	for(const auto& p : source) {
+		keys.push_back(p.first);
+	}
+
+	BENCHMARK_LOOP {
+		std::map<variant,variant> m;
+		for(int n = 0; n != size; ++n) {
+			m[keys[n]] = variant(n);
+		}
+
+		variant v(&m);
+		benchmark_sink(v["attribute_0"].as_int());
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_construct, construct_small, 6);
+BENCHMARK_ARG_CALL(variant_map_construct, construct_medium, 40);
+BENCHMARK_ARG_CALL(variant_map_construct, construct_large, 1000);
+
+BENCHMARK_ARG(std_map_construct, int size)
+{
+	const std::map<variant,variant> source = benchmark_map(size);
+	std::vector<variant> keys;
+	for(const auto& p : source) {
+		keys.push_back(p.first);
+	}
+
+	BENCHMARK_LOOP {
+		std::map<variant,variant> m;
+		for(int n = 0; n != size; ++n) {
+			m[keys[n]] = variant(n);
+		}
+
+		benchmark_sink(m.find(variant("attribute_0"))->second.as_int());
+	}
+}
+
+BENCHMARK_ARG_CALL(std_map_construct, std_construct_small, 6);
+BENCHMARK_ARG_CALL(std_map_construct, std_construct_medium, 40);
+BENCHMARK_ARG_CALL(std_map_construct, std_construct_large, 1000);
+
+//as_map() iterates the elements in key order, whether or not the map
+//has been indexed.
+BENCHMARK_ARG(variant_map_iterate, int size)
+{
+	std::map<variant,variant> m = benchmark_map(size);
+	const variant v(&m);
+	//searching every key once is enough to build the index.
+	for(const std::string& key : benchmark_keys(size)) {
+		v[key];
+	}
+
+	BENCHMARK_LOOP {
+		int sum = 0;
+		for(const auto& p : v.as_map()) {
+			sum += p.second.as_int();
+		}
+		benchmark_sink(sum);
+	}
+}
+
+BENCHMARK_ARG_CALL(variant_map_iterate, iterate_small, 6);
+BENCHMARK_ARG_CALL(variant_map_iterate, iterate_medium, 40);
+BENCHMARK_ARG_CALL(variant_map_iterate, iterate_large, 1000);
+
+BENCHMARK_ARG(std_map_iterate, int size)
+{
+	const std::map<variant,variant> m = benchmark_map(size);
+	BENCHMARK_LOOP {
+		int sum = 0;
+		for(const auto& p : m) {
+			sum += p.second.as_int();
+		}
+		benchmark_sink(sum);
+	}
+}
+
+BENCHMARK_ARG_CALL(std_map_iterate, std_iterate_small, 6);
+BENCHMARK_ARG_CALL(std_map_iterate, std_iterate_medium, 40);
+BENCHMARK_ARG_CALL(std_map_iterate, std_iterate_large, 1000);
@@ -78,6 +78,17 @@ struct CallStackManager
 class variant;
 void swap_variants_loading(std::set<variant*>& v);
 
+//marks the current thread as a worker thread while it exists. The maps a
+//worker queries aren't recorded for error messages, and its errors don't
+//refer to the FFL call stack, since both belong to the main thread.
+class VariantWorkerThreadScope
+{
+	bool previous_;
+public:
+	VariantWorkerThreadScope();
+	~VariantWorkerThreadScope();
+};
+
 struct variant_list;
 struct variant_string;
 struct variant_map;
@@ -117,6 +128,16 @@ inline void registerGlobalVariant(variant* v) {}
 inline void unregisterGlobalVariant(variant* v) {}
 #endif
 
+//hooks for variant_allocation_profiler, which counts copies of reference
+//counted variants and heap allocations made for variants.
+#ifdef VARIANT_ALLOCATION_PROFILER
+void recordVariantCopy();
+void recordVariantAllocation();
+#else
+inline void recordVariantCopy() {}
+inline void recordVariantAllocation() {}
+#endif
+
 typedef ffl::IntrusivePtr<VariantFunctionTypeInfo> VariantFunctionTypeInfoPtr;
 
 class variant 
@@ -172,11 +193,14 @@ public:
 		type_ = v.type_;
 		value_ = v.value_;
 		if (type_ > VARIANT_TYPE_DECIMAL) {
+			recordVariantCopy();
 			increment_refcount();
 		}
 	}
 
-	variant(variant&& v) {
+	//moves never throw, so that std::vector<variant> moves its elements
+	//rather than copying them when it grows.
+	variant(variant&& v) noexcept {
 		registerGlobalVariant(this);
 		type_ = v.type_;
 		value_ = v.value_;
@@ -189,7 +213,7 @@ public:
 		}
 	}
 
-	const variant& operator=(variant&& v)
+	const variant& operator=(variant&& v) noexcept
 	{
 		if(&v != this) {
 			if (type_ > VARIANT_TYPE_DECIMAL) {
@@ -325,6 +349,19 @@ public:
 	variant *get_attr_mutable(variant key);
 	variant *get_index_mutable(int index);
 
+	//lists and maps carry a generation which changes whenever they are
+	//mutated in place. A copy given the generation of its source with
+	//copy_container_generation() has the same contents for as long as
+	//the two generations still match.
+	unsigned long long container_generation() const;
+	void copy_container_generation(const variant& o);
+
+	//copies a document made of lists, maps and strings without touching
+	//the reference counts of the original, so several threads may copy
+	//the same document at once. Other values which are reference counted,
+	//such as objects and functions, can't be copied this way.
+	variant deep_copy_document() const;
+
 	const void* get_addr() const { return list_; }
 
 	//weaken returns a weak reference to the variant if it's some kind
@@ -355,6 +392,10 @@ public:
 	std::string as_string_default(const char* default_value=nullptr) const;
 	const std::string& as_string() const;
 
+	//if this is a string made by create_translated_string(), returns the
+	//original untranslated string. Otherwise returns nullptr.
+	const std::string* get_translated_from() const;
+
 	bool is_callable() const { return type_ == VARIANT_TYPE_CALLABLE; }
 	const game_logic::FormulaCallable* as_callable() const {
 		must_be(VARIANT_TYPE_CALLABLE); return callable_; }
@@ -0,0 +1,209 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "SDL.h"
+
+#include "asserts.hpp"
+#include "formatter.hpp"
+#include "formula.hpp"
+#include "formula_function.hpp"
+#include "preferences.hpp"
+#include "unit_test.hpp"
+#include "variant.hpp"
+#include "variant_allocation_profiler.hpp"
+
+PREF_BOOL(variant_allocation_profile, false, "Log which FFL call sites copy and allocate the most variants. Requires a build with VARIANT_ALLOCATION_PROFILER defined");
+PREF_INT(variant_allocation_profile_interval, 300, "Number of frames between variant allocation profile reports");
+
+namespace variant_allocation_profiler
+{
+	namespace
+	{
+		struct SiteCounts
+		{
+			SiteCounts() : copies(0), allocations(0)
+			{}
+
+			//keeps the expression alive so that it can be described in
+			//the report.
+			game_logic::ConstExpressionPtr expression;
+			uint64_t copies, allocations;
+		};
+
+		bool g_enabled = false;
+		SDL_threadID g_profiled_thread;
+		int g_nframes = 0;
+
+		std::unordered_map<const game_logic::FormulaExpression*, SiteCounts>& site_counts()
+		{
+			static std::unordered_map<const game_logic::FormulaExpression*, SiteCounts>* counts = new std::unordered_map<const game_logic::FormulaExpression*, SiteCounts>;
+			return *counts;
+		}
+
+		SiteCounts* current_site()
+		{
+			if(!g_enabled || SDL_ThreadID() != g_profiled_thread) {
+				return nullptr;
+			}
+
+			const std::vector<CallStackEntry>& call_stack = get_expression_call_stack();
+			const game_logic::FormulaExpression* expression = call_stack.empty() ? nullptr : call_stack.back().expression;
+			SiteCounts& counts = site_counts()[expression];
+			if(expression && !counts.expression) {
+				counts.expression.reset(expression);
+			}
+
+			return &counts;
+		}
+
+		std::string describe_site(const game_logic::FormulaExpression* expression)
+		{
+			if(expression == nullptr) {
+				return "(outside FFL)";
+			}
+
+			std::string code = expression->str();
+			std::replace(code.begin(), code.end(), '\n', ' ');
+			if(code.size() > 60) {
+				code.resize(57);
+				code += "...";
+			}
+
+			const variant::debug_info* info = expression->hasDebugInfo() ? expression->getParentFormula().get_debug_info() : nullptr;
+			if(info == nullptr || info->filename == nullptr) {
+				return code;
+			}
+
+			game_logic::PinpointedLoc loc;
+			expression->debugPinpointLocation(&loc);
+			return formatter() << *info->filename << ":" << loc.begin_line << ": " << code;
+		}
+	}
+
+	void set_enabled(bool enabled)
+	{
+#ifdef VARIANT_ALLOCATION_PROFILER
+		if(enabled && !g_enabled) {
+			site_counts().clear();
+			g_nframes = 0;
+			g_profiled_thread = SDL_ThreadID();
+		}
+
+		g_enabled = enabled;
+#else
+		if(enabled) {
+			LOG_WARN("Variant allocation profiling needs a build with VARIANT_ALLOCATION_PROFILER defined");
+		}
+#endif
+	}
+
+	bool is_enabled()
+	{
+		return g_enabled;
+	}
+
+	void pump()
+	{
+		if(g_variant_allocation_profile != g_enabled) {
+			set_enabled(g_variant_allocation_profile);
+			if(!g_enabled) {
+				//don't warn every frame in builds without the profiler.
+				g_variant_allocation_profile = false;
+			}
+		}
+
+		if(!g_enabled) {
+			return;
+		}
+
+		++g_nframes;
+		if(g_variant_allocation_profile_interval > 0 && g_nframes%g_variant_allocation_profile_interval == 0) {
+			LOG_INFO(get_report());
+		}
+	}
+
+	std::string get_report(int max_sites)
+	{
+		std::vector<std::pair<const game_logic::FormulaExpression*, const SiteCounts*> > sites;
+		uint64_t total_copies = 0, total_allocations = 0;
+		for(const auto& p : site_counts()) {
+			sites.push_back(std::make_pair(p.first, &p.second));
+			total_copies += p.second.copies;
+			total_allocations += p.second.allocations;
+		}
+
+		std::sort(sites.begin(), sites.end(), [](const std::pair<const game_logic::FormulaExpression*, const SiteCounts*>& a, const std::pair<const game_logic::FormulaExpression*, const SiteCounts*>& b) {
+			return a.second->copies + a.second->allocations > b.second->copies + b.second->allocations;
+		});
+
+		const double nframes = std::max(g_nframes, 1);
+
+		std::ostringstream s;
+		s << "VARIANT ALLOCATION PROFILE over " << g_nframes << " frames: " << (total_copies/nframes) << " copies, " << (total_allocations/nframes) << " allocations per frame\n";
+		s << "copies/frame allocs/frame call site\n";
+		for(int n = 0; n < static_cast<int>(sites.size()) && n < max_sites; ++n) {
+			s << (sites[n].second->copies/nframes) << " " << (sites[n].second->allocations/nframes) << " " << describe_site(sites[n].first) << "\n";
+		}
+
+		return s.str();
+	}
+}
+
+#ifdef VARIANT_ALLOCATION_PROFILER
+void recordVariantCopy()
+{
+	if(variant_allocation_profiler::SiteCounts* counts = variant_allocation_profiler::current_site()) {
+		++counts->copies;
+	}
+}
+
+void recordVariantAllocation()
+{
+	if(variant_allocation_profiler::SiteCounts* counts = variant_allocation_profiler::current_site()) {
+		++counts->allocations;
+	}
+}
+
+UNIT_TEST(variant_allocation_profiler)
+{
+	variant_allocation_profiler::set_enabled(true);
+
+	std::vector<variant> items;
+	items.push_back(variant("a"));
+	std::vector<variant> copy = items;
+	variant list(&copy);
+
+	variant_allocation_profiler::set_enabled(false);
+
+	const variant_allocation_profiler::SiteCounts& counts = variant_allocation_profiler::site_counts()[nullptr];
+	CHECK_EQ(counts.copies, 1u);
+	CHECK_EQ(counts.allocations, 2u);
+}
+#endif
@@ -0,0 +1,50 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <string>
+
+//Counts copies of reference counted variants and heap allocations made for
+//variants, and attributes them to the FFL expression which was executing
+//at the time. Counting adds a branch to every variant copy, so it is only
+//compiled in when building with VARIANT_ALLOCATION_PROFILER defined.
+//Otherwise these functions do nothing.
+//
+//Only the main thread is profiled.
+namespace variant_allocation_profiler
+{
+	//starting profiling discards counts from any earlier run.
+	void set_enabled(bool enabled);
+	bool is_enabled();
+
+	//should be called once per frame. While the variant_allocation_profile
+	//preference is set this starts profiling and logs a report every few
+	//seconds.
+	void pump();
+
+	//returns a table of the call sites making the most copies, with
+	//counts averaged over the frames profiled so far.
+	std::string get_report(int max_sites=20);
+}
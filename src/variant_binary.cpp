@@ -0,0 +1,670 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "asserts.hpp"
+#include "decimal.hpp"
+#include "unit_test.hpp"
+#include "uuid.hpp"
+#include "variant_binary.hpp"
+#include "wml_formula_callable.hpp"
+
+namespace variant_binary
+{
+	namespace
+	{
+		const char Magic[] = { 'F', 'B', 'V' };
+
+		//bump whenever the format changes in an incompatible way.
+		const unsigned char FormatVersion = 1;
+
+		const int HeaderSize = sizeof(Magic) + 2;
+
+		//strings up to this length are interned, so later occurrences are
+		//written as a reference to the first one.
+		const size_t MaxInternedString = 128;
+
+		//guards against stack overflow when reading malformed documents.
+		const int MaxDepth = 1024;
+
+		enum TAG {
+			TAG_NULL,
+			TAG_FALSE,
+			TAG_TRUE,
+			TAG_INT,
+			TAG_DECIMAL,
+			TAG_STRING,
+			TAG_STRING_INTERN,
+			TAG_STRING_REF,
+			TAG_TRANSLATED_STRING,
+			TAG_ENUM,
+			TAG_LIST,
+			TAG_MAP,
+			TAG_OBJECT,
+			TAG_OBJECT_REF,
+		};
+
+		const int UuidSize = 16;
+
+		class Writer
+		{
+		public:
+			Writer(std::string* out, unsigned int flags) : out_(out), flags_(flags)
+			{}
+
+			bool write(const variant& v) {
+				switch(v.type()) {
+				case variant::VARIANT_TYPE_NULL:
+					writeTag(TAG_NULL);
+					return true;
+				case variant::VARIANT_TYPE_BOOL:
+					writeTag(v.as_bool() ? TAG_TRUE : TAG_FALSE);
+					return true;
+				case variant::VARIANT_TYPE_INT:
+					writeTag(TAG_INT);
+					writeSigned(v.as_int());
+					return true;
+				case variant::VARIANT_TYPE_DECIMAL: {
+					writeTag(TAG_DECIMAL);
+					const uint64_t value = static_cast<uint64_t>(v.as_decimal().value());
+					for(int n = 0; n != 8; ++n) {
+						out_->push_back(static_cast<char>((value >> (n*8))&0xFF));
+					}
+					return true;
+				}
+				case variant::VARIANT_TYPE_STRING: {
+					const std::string* translated_from = v.get_translated_from();
+					if(translated_from) {
+						//store the original, so it's translated for the
+						//locale in use when the document is read.
+						writeTag(TAG_TRANSLATED_STRING);
+						writeString(*translated_from);
+					} else {
+						writeString(v.as_string());
+					}
+					writeDebugInfo(v);
+					return true;
+				}
+				case variant::VARIANT_TYPE_ENUM:
+					writeTag(TAG_ENUM);
+					writeString(v.as_enum());
+					return true;
+				case variant::VARIANT_TYPE_LIST: {
+					writeTag(TAG_LIST);
+					writeVarint(v.num_elements());
+					for(int n = 0; n != v.num_elements(); ++n) {
+						if(!write(v[n])) {
+							return false;
+						}
+					}
+					writeDebugInfo(v);
+					return true;
+				}
+				case variant::VARIANT_TYPE_MAP: {
+					writeTag(TAG_MAP);
+					const std::map<variant,variant>& m = v.as_map();
+					writeVarint(m.size());
+					for(const variant_pair& p : m) {
+						if(!write(p.first) || !write(p.second)) {
+							return false;
+						}
+					}
+					writeDebugInfo(v);
+					return true;
+				}
+				case variant::VARIANT_TYPE_CALLABLE: {
+					if(flags_&REJECT_OBJECTS) {
+						return false;
+					}
+
+					const game_logic::WmlSerializableFormulaCallable* obj = v.try_convert<game_logic::WmlSerializableFormulaCallable>();
+					if(obj == nullptr) {
+						return false;
+					}
+
+					writeObject(obj->uuid());
+					return true;
+				}
+				case variant::VARIANT_TYPE_CALLABLE_LOADING:
+					if(flags_&REJECT_OBJECTS) {
+						return false;
+					}
+
+					writeObject(v.as_callable_loading());
+					return true;
+				default:
+					return false;
+				}
+			}
+
+		private:
+			//objects are written by uuid the first time they're seen and by
+			//index after that, so shared references stay shared.
+			void writeObject(const boost::uuids::uuid& id) {
+				auto itor = objects_.find(id);
+				if(itor != objects_.end()) {
+					writeTag(TAG_OBJECT_REF);
+					writeVarint(itor->second);
+					return;
+				}
+
+				const int index = static_cast<int>(objects_.size());
+				objects_[id] = index;
+				writeTag(TAG_OBJECT);
+				out_->append(reinterpret_cast<const char*>(id.begin()), UuidSize);
+			}
+
+			void writeTag(TAG tag) {
+				out_->push_back(static_cast<char>(tag));
+			}
+
+			void writeVarint(uint64_t n) {
+				while(n >= 0x80) {
+					out_->push_back(static_cast<char>((n&0x7F)|0x80));
+					n >>= 7;
+				}
+				out_->push_back(static_cast<char>(n));
+			}
+
+			void writeSigned(int64_t n) {
+				writeVarint((static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63));
+			}
+
+			void writeRawString(const std::string& s) {
+				writeVarint(s.size());
+				out_->append(s);
+			}
+
+			void writeString(const std::string& s) {
+				if(s.size() > MaxInternedString) {
+					writeTag(TAG_STRING);
+					writeRawString(s);
+					return;
+				}
+
+				auto itor = strings_.find(s);
+				if(itor != strings_.end()) {
+					writeTag(TAG_STRING_REF);
+					writeVarint(itor->second);
+					return;
+				}
+
+				const int index = static_cast<int>(strings_.size());
+				strings_[s] = index;
+				writeTag(TAG_STRING_INTERN);
+				writeRawString(s);
+			}
+
+			void writeDebugInfo(const variant& v) {
+				if((flags_&WRITE_DEBUG_INFO) == 0) {
+					return;
+				}
+
+				const variant::debug_info* info = v.get_debug_info();
+				if(info == nullptr) {
+					writeVarint(0);
+					return;
+				}
+
+				//filenames are written in full the first time they are used
+				//and referred to by index afterwards.
+				auto itor = filenames_.find(*info->filename);
+				if(itor != filenames_.end()) {
+					writeVarint(itor->second + 1);
+				} else {
+					const int index = static_cast<int>(filenames_.size());
+					filenames_[*info->filename] = index;
+					writeVarint(index + 1);
+					writeRawString(*info->filename);
+				}
+
+				writeSigned(info->line);
+				writeSigned(info->column);
+				writeSigned(info->end_line);
+				writeSigned(info->end_column);
+			}
+
+			std::string* out_;
+			unsigned int flags_;
+			std::unordered_map<std::string, int> strings_;
+			std::unordered_map<std::string, int> filenames_;
+			std::map<boost::uuids::uuid, int> objects_;
+		};
+
+		struct ReadError {};
+
+		class Reader
+		{
+		public:
+			Reader(const char* data, const char* end, bool debug_info, const FilenameInterner& filenames)
+			  : data_(data), end_(end), debug_info_(debug_info), filename_interner_(filenames)
+			{}
+
+			variant read(int depth=0) {
+				if(depth > MaxDepth) {
+					throw ReadError();
+				}
+
+				switch(readByte()) {
+				case TAG_NULL:
+					return variant();
+				case TAG_FALSE:
+					return variant::from_bool(false);
+				case TAG_TRUE:
+					return variant::from_bool(true);
+				case TAG_INT:
+					return variant(static_cast<int>(readSigned()));
+				case TAG_DECIMAL: {
+					uint64_t value = 0;
+					for(int n = 0; n != 8; ++n) {
+						value |= static_cast<uint64_t>(readByte()) << (n*8);
+					}
+					return variant(decimal::from_raw_value(static_cast<int64_t>(value)));
+				}
+				case TAG_STRING:
+				case TAG_STRING_INTERN:
+				case TAG_STRING_REF: {
+					--data_;
+					variant v(readString());
+					readDebugInfo(&v);
+					return v;
+				}
+				case TAG_TRANSLATED_STRING: {
+					variant v = variant::create_translated_string(readString());
+					readDebugInfo(&v);
+					return v;
+				}
+				case TAG_ENUM:
+					return variant::create_enum(readString());
+				case TAG_LIST: {
+					const uint64_t size = readSize();
+					std::vector<variant> items;
+					items.reserve(size);
+					for(uint64_t n = 0; n != size; ++n) {
+						items.push_back(read(depth+1));
+					}
+
+					variant v(&items);
+					readDebugInfo(&v);
+					return v;
+				}
+				case TAG_MAP: {
+					const uint64_t size = readSize();
+					std::map<variant, variant> m;
+					for(uint64_t n = 0; n != size; ++n) {
+						variant key = read(depth+1);
+						if(key.is_bool() || key.type() == variant::VARIANT_TYPE_CALLABLE_LOADING) {
+							throw ReadError();
+						}
+
+						variant value = read(depth+1);
+
+						//keys were written in order, so this is amortized
+						//constant time.
+						m.insert(m.end(), variant_pair(key, value));
+					}
+
+					variant v(&m);
+					readDebugInfo(&v);
+					return v;
+				}
+				case TAG_OBJECT: {
+					if(end_ - data_ < UuidSize) {
+						throw ReadError();
+					}
+
+					boost::uuids::uuid id;
+					std::copy(data_, data_ + UuidSize, reinterpret_cast<char*>(id.begin()));
+					data_ += UuidSize;
+					objects_.push_back(id);
+					return variant::create_variant_under_construction(id);
+				}
+				case TAG_OBJECT_REF: {
+					const uint64_t index = readVarint();
+					if(index >= objects_.size()) {
+						throw ReadError();
+					}
+
+					return variant::create_variant_under_construction(objects_[index]);
+				}
+				default:
+					throw ReadError();
+				}
+			}
+
+			bool atEnd() const { return data_ == end_; }
+
+		private:
+			unsigned char readByte() {
+				if(data_ == end_) {
+					throw ReadError();
+				}
+
+				return static_cast<unsigned char>(*data_++);
+			}
+
+			uint64_t readVarint() {
+				uint64_t result = 0;
+				for(int shift = 0; shift < 64; shift += 7) {
+					const unsigned char c = readByte();
+					result |= static_cast<uint64_t>(c&0x7F) << shift;
+					if((c&0x80) == 0) {
+						return result;
+					}
+				}
+
+				throw ReadError();
+			}
+
+			int64_t readSigned() {
+				const uint64_t n = readVarint();
+				return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n&1);
+			}
+
+			//reads a count of items, each of which takes at least one byte.
+			uint64_t readSize() {
+				const uint64_t size = readVarint();
+				if(size > static_cast<uint64_t>(end_ - data_)) {
+					throw ReadError();
+				}
+
+				return size;
+			}
+
+			std::string readRawString() {
+				const uint64_t size = readSize();
+				std::string result(data_, data_ + size);
+				data_ += size;
+				return result;
+			}
+
+			std::string readString() {
+				switch(readByte()) {
+				case TAG_STRING:
+					return readRawString();
+				case TAG_STRING_INTERN:
+					strings_.push_back(readRawString());
+					return strings_.back();
+				case TAG_STRING_REF: {
+					const uint64_t index = readVarint();
+					if(index >= strings_.size()) {
+						throw ReadError();
+					}
+					return strings_[index];
+				}
+				default:
+					throw ReadError();
+				}
+			}
+
+			void readDebugInfo(variant* v) {
+				if(!debug_info_) {
+					return;
+				}
+
+				const uint64_t file = readVarint();
+				if(file == 0) {
+					return;
+				}
+
+				if(file == filenames_.size() + 1) {
+					const std::string fname = readRawString();
+					filenames_.push_back(filename_interner_ ? filename_interner_(fname) : nullptr);
+				} else if(file > filenames_.size()) {
+					throw ReadError();
+				}
+
+				variant::debug_info info;
+				info.filename = filenames_[file-1];
+				info.line = static_cast<int>(readSigned());
+				info.column = static_cast<int>(readSigned());
+				info.end_line = static_cast<int>(readSigned());
+				info.end_column = static_cast<int>(readSigned());
+
+				if(info.filename) {
+					v->setDebugInfo(info);
+				}
+			}
+
+			const char* data_;
+			const char* end_;
+			bool debug_info_;
+			const FilenameInterner& filename_interner_;
+			std::vector<std::string> strings_;
+			std::vector<const std::string*> filenames_;
+			std::vector<boost::uuids::uuid> objects_;
+		};
+	}
+
+	bool write(const variant& v, std::string* out, unsigned int flags)
+	{
+		const size_t start = out->size();
+		out->append(Magic, Magic + sizeof(Magic));
+		out->push_back(static_cast<char>(FormatVersion));
+		//only flags which change the encoding go in the header.
+		out->push_back(static_cast<char>(flags&WRITE_DEBUG_INFO));
+
+		Writer writer(out, flags);
+		if(!writer.write(v)) {
+			out->resize(start);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool read(const char* data, size_t size, variant* result, FilenameInterner filenames)
+	{
+		if(!is_binary_document(data, size) || static_cast<unsigned char>(data[sizeof(Magic)]) != FormatVersion) {
+			return false;
+		}
+
+		const unsigned int flags = static_cast<unsigned char>(data[sizeof(Magic)+1]);
+
+		try {
+			Reader reader(data + HeaderSize, data + size, (flags&WRITE_DEBUG_INFO) != 0, filenames);
+			variant v = reader.read();
+			if(!reader.atEnd()) {
+				return false;
+			}
+
+			*result = v;
+			return true;
+		} catch(ReadError&) {
+			return false;
+		}
+	}
+
+	bool is_binary_document(const char* data, size_t size)
+	{
+		return size >= static_cast<size_t>(HeaderSize) && std::equal(Magic, Magic + sizeof(Magic), data);
+	}
+
+	std::string write_document(const variant& v, bool binary)
+	{
+		std::string result;
+		if(binary && write(v, &result)) {
+			return result;
+		}
+
+		return v.write_json();
+	}
+}
+
+UNIT_TEST(variant_binary_round_trip)
+{
+	std::vector<variant> items;
+	items.push_back(variant());
+	items.push_back(variant::from_bool(true));
+	items.push_back(variant::from_bool(false));
+	items.push_back(variant(0));
+	items.push_back(variant(-1));
+	items.push_back(variant(2147483647));
+	items.push_back(variant(-2147483647 - 1));
+	items.push_back(variant(decimal::from_raw_value(-1234567)));
+	items.push_back(variant(""));
+	items.push_back(variant(std::string(1000, 'x')));
+
+	std::vector<variant> inner;
+	inner.push_back(variant("a"));
+	std::vector<variant> empty;
+	inner.push_back(variant(&empty));
+
+	std::map<variant, variant> m;
+	m[variant("a")] = variant(1);
+	m[variant("b")] = variant("a");
+	m[variant(5)] = variant(&inner);
+	const variant map_value(&m);
+	items.push_back(map_value);
+	items.push_back(map_value);
+
+	const variant doc(&items);
+
+	std::string data;
+	CHECK(variant_binary::write(doc, &data), "Could not write document");
+
+	variant result;
+	CHECK(variant_binary::read(data.c_str(), data.size(), &result), "Could not read document");
+	CHECK_EQ(result, doc);
+
+	//a truncated document must be rejected rather than read.
+	for(size_t n = 0; n < data.size(); ++n) {
+		CHECK(!variant_binary::read(data.c_str(), n, &result), "Read truncated document");
+	}
+}
+
+UNIT_TEST(variant_binary_debug_info)
+{
+	static const std::string fname = "test.cfg";
+
+	variant str("abc");
+	variant::debug_info info;
+	info.filename = &fname;
+	info.line = 3;
+	info.column = 7;
+	info.end_line = 3;
+	info.end_column = 10;
+	str.setDebugInfo(info);
+
+	std::vector<variant> items;
+	items.push_back(str);
+	variant doc(&items);
+
+	std::string data;
+	CHECK(variant_binary::write(doc, &data, variant_binary::WRITE_DEBUG_INFO), "Could not write document");
+
+	variant result;
+	CHECK(variant_binary::read(data.c_str(), data.size(), &result, [](const std::string& s) { return &fname; }), "Could not read document");
+	CHECK_EQ(result, doc);
+	CHECK(result[0].get_debug_info() != nullptr, "Debug info was lost");
+	CHECK_EQ(result[0].get_debug_info()->line, 3);
+	CHECK_EQ(result[0].get_debug_info()->end_column, 10);
+}
+
+namespace
+{
+	variant generate_random_variant(int depth)
+	{
+		static const char* Strings[] = { "", "a", "b", "type", "x", "y", "@eval", "a much longer string which will still be interned" };
+		const int nstrings = sizeof(Strings)/sizeof(*Strings);
+
+		switch(rand()%(depth > 4 ? 6 : 8)) {
+		case 0: return variant();
+		case 1: return variant::from_bool(rand()%2 != 0);
+		case 2: return variant(rand() - RAND_MAX/2);
+		case 3: return variant(decimal::from_raw_value(static_cast<int64_t>(rand() - RAND_MAX/2)*rand()));
+		case 4: return variant(Strings[rand()%nstrings]);
+		case 5: return variant(std::string(rand()%300, static_cast<char>('a' + rand()%26)));
+		case 6: {
+			std::vector<variant> items;
+			const int nitems = rand()%6;
+			for(int n = 0; n != nitems; ++n) {
+				items.push_back(generate_random_variant(depth+1));
+			}
+			return variant(&items);
+		}
+		default: {
+			std::map<variant, variant> m;
+			const int nitems = rand()%6;
+			for(int n = 0; n != nitems; ++n) {
+				variant key = rand()%2 ? variant(Strings[rand()%nstrings]) : variant(rand()%10);
+				m[key] = generate_random_variant(depth+1);
+			}
+			return variant(&m);
+		}
+		}
+	}
+}
+
+UNIT_TEST(variant_binary_fuzz)
+{
+	srand(0);
+	for(int i = 0; i != 200; ++i) {
+		const variant doc = generate_random_variant(0);
+
+		std::string data;
+		CHECK(variant_binary::write(doc, &data), "Could not write document: " << doc.write_json());
+
+		variant result;
+		CHECK(variant_binary::read(data.c_str(), data.size(), &result), "Could not read document: " << doc.write_json());
+		CHECK_EQ(result, doc);
+
+		//corrupt documents must be rejected or read as something, but
+		//never crash.
+		for(int n = 0; n != 10; ++n) {
+			std::string corrupt = data;
+			corrupt[rand()%corrupt.size()] = static_cast<char>(rand()%256);
+			variant_binary::read(corrupt.c_str(), corrupt.size(), &result);
+		}
+	}
+}
+
+UNIT_TEST(variant_binary_object_references)
+{
+	const boost::uuids::uuid a = generate_uuid(), b = generate_uuid();
+
+	std::vector<variant> items;
+	items.push_back(variant::create_variant_under_construction(a));
+	items.push_back(variant::create_variant_under_construction(b));
+	items.push_back(variant::create_variant_under_construction(a));
+	const variant doc(&items);
+
+	std::string data;
+	CHECK(variant_binary::write(doc, &data), "Could not write document");
+
+	variant result;
+	CHECK(variant_binary::read(data.c_str(), data.size(), &result), "Could not read document");
+	CHECK_EQ(result.num_elements(), 3);
+	CHECK(result[0].type() == variant::VARIANT_TYPE_CALLABLE_LOADING, "Object reference not read back");
+	CHECK(result[0].as_callable_loading() == a, "Wrong object referenced");
+	CHECK(result[1].as_callable_loading() == b, "Wrong object referenced");
+	CHECK(result[2].as_callable_loading() == a, "Shared object reference not preserved");
+
+	data.clear();
+	CHECK(!variant_binary::write(doc, &data, variant_binary::REJECT_OBJECTS), "Object references written with REJECT_OBJECTS");
+	CHECK(data.empty(), "Rejected document left output behind");
+}
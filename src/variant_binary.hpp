@@ -0,0 +1,74 @@
+/*
+	Copyright (C) 2003-2014 by David White <davewx7@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "variant.hpp"
+
+//A compact binary encoding for variant documents which is much cheaper to
+//decode than JSON. Short strings are interned so that repeated map keys are
+//only stored once, integers are stored as varints and decimals are stored
+//as their raw fixed point values, so they round-trip exactly.
+//
+//Serializable objects are written as references, by uuid the first time an
+//object is seen and by index after that. Like deserialize() in FSON, a
+//reference reads back as an object under construction which is resolved
+//by a wmlFormulaCallableReadScope, so the objects themselves must be
+//written separately, e.g. by game_logic::serialize_doc_with_objects().
+namespace variant_binary
+{
+	enum WRITE_FLAGS {
+		//store the debug info (filename and location) of strings, lists
+		//and maps along with them.
+		WRITE_DEBUG_INFO = 1,
+
+		//fail instead of writing object references, for documents which
+		//must be complete in themselves, such as cache entries.
+		REJECT_OBJECTS = 2,
+	};
+
+	//encodes v and appends it to out. Returns false if v contains
+	//something that can't be encoded, such as a function, a callable
+	//which isn't serializable or, with REJECT_OBJECTS, any object.
+	bool write(const variant& v, std::string* out, unsigned int flags=0);
+
+	//maps filenames found in debug info to strings which will live as long
+	//as the decoded document. Debug info is dropped if none is given.
+	typedef std::function<const std::string*(const std::string&)> FilenameInterner;
+
+	//decodes a document created by write(). Returns false if the data is
+	//malformed or was written by an incompatible version of the encoder.
+	bool read(const char* data, size_t size, variant* result, FilenameInterner filenames=FilenameInterner());
+
+	//returns true if data looks like the start of a document created by write().
+	bool is_binary_document(const char* data, size_t size);
+
+	//writes v in binary if binary is true and v can be encoded, and as
+	//FSON otherwise. Readers that accept binary documents detect them with
+	//is_binary_document().
+	std::string write_document(const variant& v, bool binary);
+}
@@ -30,6 +30,7 @@
 #include "asserts.hpp"
 #include "formula_object.hpp"
 #include "json_parser.hpp"
+#include "variant_binary.hpp"
 #include "variant_utils.hpp"
 #include "wml_formula_callable.hpp"
 
@@ -267,6 +268,9 @@ namespace game_logic
 
 				if(fname) {
 					v = json::parse_from_file(msg);
+				} else if(variant_binary::is_binary_document(msg.c_str(), msg.size())) {
+					const bool valid = variant_binary::read(msg.c_str(), msg.size(), &v);
+					ASSERT_LOG(valid, "ERROR PROCESSING BINARY DOCUMENT OF SIZE " << msg.size());
 				} else {
 					try {
 						v = json::parse(msg, json::JSON_PARSE_OPTIONS::NO_PREPROCESSOR);
@@ -280,7 +284,14 @@ namespace game_logic
 				}
 	
 				if(v.is_map() && v.has_key(variant("serialized_objects"))) {
-					for(variant& obj_node : v["serialized_objects"]["character"].as_list()) {
+					for(variant obj_node : v["serialized_objects"]["character"].as_list()) {
+						if(obj_node.is_map()) {
+							//documents that weren't run through the
+							//preprocessor, such as binary ones, have the
+							//objects as maps.
+							WmlSerializableFormulaCallable::deserializeObj(obj_node, &obj_node);
+						}
+
 						game_logic::WmlSerializableFormulaCallablePtr obj = obj_node.try_convert<game_logic::WmlSerializableFormulaCallable>();
 						ASSERT_LOG(obj.get() != nullptr, "ILLEGAL OBJECT FOUND IN SERIALIZATION");
 
@@ -157,6 +157,7 @@ namespace css
 			{
 				return "." + class_name_;
 			}
+			const std::string& getClassName() const { return class_name_; }
 			std::array<int,3> calculateSpecificity() override {
 				std::array<int,3> specificity;
 				for(int n = 0; n != 3; ++n) {
@@ -182,6 +183,7 @@ namespace css
 			{
 				return "#" + id_;
 			}
+			const std::string& getId() const { return id_; }
 			std::array<int,3> calculateSpecificity() override {
 				std::array<int,3> specificity;
 				for(int n = 0; n != 3; ++n) {
@@ -638,6 +640,17 @@ namespace css
 		return false;
 	}
 
+	void SimpleSelector::getRequiredKeys(std::string* id, std::vector<std::string>* classes) const
+	{
+		for(auto& f : filters_) {
+			if(f->id() == FilterId::ID) {
+				*id = static_cast<const IdSelector*>(f.get())->getId();
+			} else if(f->id() == FilterId::CLASS) {
+				classes->emplace_back(static_cast<const ClassSelector*>(f.get())->getClassName());
+			}
+		}
+	}
+
 	void SimpleSelector::setElementId(xhtml::ElementId id) 
 	{ 
 		element_ = id; 
@@ -108,6 +108,9 @@ namespace css
 		void addFilter(FilterSelectorPtr f);
 		void setElementId(xhtml::ElementId id);
 		xhtml::ElementId getElementId() const { return element_; }
+		// The id and class names an element needs in order to match,
+		// used for indexing rules. id is left alone if there is no id.
+		void getRequiredKeys(std::string* id, std::vector<std::string>* classes) const;
 		std::string toString() const;
 		const Specificity& getSpecificity() const { return specificity_; }
 	private:
@@ -125,6 +128,7 @@ namespace css
 		static std::vector<SelectorPtr> parseTokens(const std::vector<TokenPtr>& tokens);
 		bool match(xhtml::NodePtr element) const;
 		void addSimpleSelector(SimpleSelectorPtr s) { selector_chain_.emplace_back(s); }
+		const std::vector<SimpleSelectorPtr>& getSelectorChain() const { return selector_chain_; }
 		std::string toString() const;
 		void calculateSpecificity();
 		const Specificity& getSpecificity() const { return specificity_; }
@@ -21,23 +21,187 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+
+#include "asserts.hpp"
+#include "css_parser.hpp"
 #include "css_stylesheet.hpp"
+#include "unit_test.hpp"
+#include "xhtml_element.hpp"
 #include "xhtml_node.hpp"
+#include "xhtml_parser.hpp"
 
 namespace css
 {
+	namespace
+	{
+		void split_class_names(const std::string& value, std::vector<std::string>* class_names)
+		{
+			class_names->clear();
+			boost::split(*class_names, value, boost::is_any_of(" \n\r\t\f"), boost::token_compress_on);
+		}
+
+		// Adds the hashes for everything an element must have to match s.
+		void add_required_hashes(const SimpleSelectorPtr& s, std::vector<unsigned>* hashes)
+		{
+			if(s->getElementId() != xhtml::ElementId::ANY) {
+				hashes->emplace_back(AncestorFilter::hashTag(s->getElementId()));
+			}
+			std::string id;
+			std::vector<std::string> classes;
+			s->getRequiredKeys(&id, &classes);
+			if(!id.empty()) {
+				hashes->emplace_back(AncestorFilter::hashId(id));
+			}
+			for(auto& cn : classes) {
+				hashes->emplace_back(AncestorFilter::hashClass(cn));
+			}
+		}
+	}
+
+	// AncestorFilter functions
+	AncestorFilter::AncestorFilter()
+		: counts_(1 << FilterBits, 0),
+		  hashes_(),
+		  stack_()
+	{
+	}
+
+	void AncestorFilter::pushElement(const xhtml::NodePtr& n)
+	{
+		stack_.emplace_back(static_cast<int>(hashes_.size()));
+		if(n->id() != xhtml::NodeId::ELEMENT) {
+			return;
+		}
+
+		hashes_.emplace_back(hashTag(static_cast<const xhtml::Element*>(n.get())->getElementId()));
+		auto id_attr = n->getAttribute("id");
+		if(id_attr != nullptr) {
+			hashes_.emplace_back(hashId(id_attr->getValue()));
+		}
+		auto class_attr = n->getAttribute("class");
+		if(class_attr != nullptr) {
+			std::vector<std::string> class_names;
+			split_class_names(class_attr->getValue(), &class_names);
+			for(auto& cn : class_names) {
+				if(!cn.empty()) {
+					hashes_.emplace_back(hashClass(cn));
+				}
+			}
+		}
+
+		const unsigned mask = (1 << FilterBits) - 1;
+		for(auto it = hashes_.begin() + stack_.back(); it != hashes_.end(); ++it) {
+			++counts_[*it & mask];
+			++counts_[(*it >> FilterBits) & mask];
+		}
+	}
+
+	void AncestorFilter::popElement()
+	{
+		ASSERT_LOG(!stack_.empty(), "popElement() called on an empty AncestorFilter");
+		const unsigned mask = (1 << FilterBits) - 1;
+		for(auto it = hashes_.begin() + stack_.back(); it != hashes_.end(); ++it) {
+			--counts_[*it & mask];
+			--counts_[(*it >> FilterBits) & mask];
+		}
+		hashes_.resize(stack_.back());
+		stack_.pop_back();
+	}
+
+	bool AncestorFilter::mayContain(unsigned hash) const
+	{
+		const unsigned mask = (1 << FilterBits) - 1;
+		return counts_[hash & mask] != 0 && counts_[(hash >> FilterBits) & mask] != 0;
+	}
+
+	unsigned AncestorFilter::hashTag(xhtml::ElementId tag)
+	{
+		return (static_cast<unsigned>(tag) + 1) * 2654435761U;
+	}
+
+	unsigned AncestorFilter::hashId(const std::string& id)
+	{
+		return static_cast<unsigned>(std::hash<std::string>()(id)) ^ 0x5bd1e995U;
+	}
+
+	unsigned AncestorFilter::hashClass(const std::string& class_name)
+	{
+		return static_cast<unsigned>(std::hash<std::string>()(class_name)) ^ 0x9e3779b9U;
+	}
+
 	// StyleSheet functions
 	StyleSheet::StyleSheet()
-		: rules_()
+		: rules_(),
+		  id_rules_(),
+		  class_rules_(),
+		  tag_rules_(),
+		  universal_rules_(),
+		  matches_(),
+		  class_names_()
 	{
 	}
 
 	void StyleSheet::addRule(const CssRulePtr& rule)
 	{
 		rules_.emplace_back(rule);
+		for(int n = 0; n != static_cast<int>(rule->selectors.size()); ++n) {
+			indexSelector(static_cast<int>(rules_.size()) - 1, n);
+		}
 		//std::stable_sort(rules_.begin(), rules_.end(), sort_fn);
 	}
 
+	void StyleSheet::indexSelector(int rule_index, int selector_index)
+	{
+		IndexedSelector is;
+		is.rule_index = rule_index;
+		is.selector_index = selector_index;
+
+		const auto& chain = rules_[rule_index]->selectors[selector_index]->getSelectorChain();
+		if(chain.empty()) {
+			universal_rules_.emplace_back(is);
+			return;
+		}
+
+		// Walk the chain the same way Selector::match() does, keeping track of
+		// whether the simple selector is being matched against an ancestor of
+		// the element (rather than the element or a sibling of it).
+		bool ancestor = false;
+		for(auto it = chain.rbegin(); it != chain.rend(); ) {
+			auto simple = *it++;
+			if(ancestor) {
+				add_required_hashes(simple, &is.ancestor_hashes);
+			}
+			switch(simple->getCombinator()) {
+				case Combinator::DESCENDENT:
+					if(it != chain.rend()) {
+						add_required_hashes(*it++, &is.ancestor_hashes);
+					}
+					ancestor = true;
+					break;
+				case Combinator::CHILD:		ancestor = true; break;
+				case Combinator::SIBLING:	ancestor = false; break;
+				case Combinator::NONE:
+				default: break;
+			}
+		}
+
+		// Bucket on the most selective part of the rightmost simple selector.
+		std::string id;
+		std::vector<std::string> classes;
+		chain.back()->getRequiredKeys(&id, &classes);
+		if(!id.empty()) {
+			id_rules_[id].emplace_back(is);
+		} else if(!classes.empty()) {
+			class_rules_[classes.front()].emplace_back(is);
+		} else if(chain.back()->getElementId() != xhtml::ElementId::ANY) {
+			tag_rules_[chain.back()->getElementId()].emplace_back(is);
+		} else {
+			universal_rules_.emplace_back(is);
+		}
+	}
+
 	std::string StyleSheet::toString() const
 	{
 		std::ostringstream ss;
@@ -53,19 +217,192 @@ namespace css
 		return ss.str();
 	}
 
-	void StyleSheet::applyRulesToElement(xhtml::NodePtr n)
+	void StyleSheet::findMatches(const xhtml::NodePtr& n, const AncestorFilter* filter)
+	{
+		matches_.clear();
+		auto add_candidates = [this, filter](const IndexedSelectorList& list) {
+			for(auto& is : list) {
+				if(filter != nullptr && !filter->empty()) {
+					bool rejected = false;
+					for(auto h : is.ancestor_hashes) {
+						if(!filter->mayContain(h)) {
+							rejected = true;
+							break;
+						}
+					}
+					if(rejected) {
+						continue;
+					}
+				}
+				matches_.emplace_back(&is);
+			}
+		};
+
+		auto id_attr = n->getAttribute("id");
+		if(id_attr != nullptr) {
+			auto it = id_rules_.find(id_attr->getValue());
+			if(it != id_rules_.end()) {
+				add_candidates(it->second);
+			}
+		}
+		auto class_attr = n->getAttribute("class");
+		if(class_attr != nullptr && !class_rules_.empty()) {
+			split_class_names(class_attr->getValue(), &class_names_);
+			for(auto& cn : class_names_) {
+				auto it = class_rules_.find(cn);
+				if(it != class_rules_.end()) {
+					add_candidates(it->second);
+				}
+			}
+		}
+		auto it = tag_rules_.find(static_cast<const xhtml::Element*>(n.get())->getElementId());
+		if(it != tag_rules_.end()) {
+			add_candidates(it->second);
+		}
+		add_candidates(universal_rules_);
+
+		// Put candidates back into stylesheet order, since that decides which
+		// declaration wins between selectors of the same specificity.
+		std::sort(matches_.begin(), matches_.end(), [](const IndexedSelector* lhs, const IndexedSelector* rhs) {
+			return lhs->rule_index == rhs->rule_index 
+				? lhs->selector_index < rhs->selector_index 
+				: lhs->rule_index < rhs->rule_index;
+		});
+		matches_.erase(std::unique(matches_.begin(), matches_.end()), matches_.end());
+
+		// Only the first selector of a rule that matches is used.
+		int last_rule = -1;
+		auto out = matches_.begin();
+		for(auto is : matches_) {
+			if(is->rule_index != last_rule && rules_[is->rule_index]->selectors[is->selector_index]->match(n)) {
+				last_rule = is->rule_index;
+				*out++ = is;
+			}
+		}
+		matches_.erase(out, matches_.end());
+	}
+
+	std::vector<std::pair<CssRulePtr, SelectorPtr>> StyleSheet::getMatches(xhtml::NodePtr n, const AncestorFilter* filter)
+	{
+		std::vector<std::pair<CssRulePtr, SelectorPtr>> res;
+		if(n->id() == xhtml::NodeId::ELEMENT) {
+			findMatches(n, filter);
+			for(auto is : matches_) {
+				res.emplace_back(rules_[is->rule_index], rules_[is->rule_index]->selectors[is->selector_index]);
+			}
+		}
+		return res;
+	}
+
+	void StyleSheet::applyRulesToElement(xhtml::NodePtr n, const AncestorFilter* filter)
 	{
 		if(n->id() == xhtml::NodeId::ELEMENT) {
 			n->clearProperties();
-			for(auto& r : rules_) {
+			findMatches(n, filter);
+			for(auto is : matches_) {
+				auto& r = rules_[is->rule_index];
+				//LOG_INFO("merge for node: " << n->toString() << ", selector: " << s->toString() << ", spec: " << s->getSpecificity()[0] << "," << s->getSpecificity()[1] << "," << s->getSpecificity()[2]);
+				n->mergeProperties(r->selectors[is->selector_index]->getSpecificity(), r->declaractions);
+			}
+		}
+	}
+}
+
+namespace
+{
+	// Styles every element under n the way Document::processStyleRules() does.
+	void style_tree(const css::StyleSheetPtr& ss, css::AncestorFilter& filter, const xhtml::NodePtr& n)
+	{
+		ss->applyRulesToElement(n, &filter);
+		filter.pushElement(n);
+		for(auto& child : n->getChildren()) {
+			style_tree(ss, filter, child);
+		}
+		filter.popElement();
+	}
+
+	std::string generate_stylesheet(int nrules)
+	{
+		std::ostringstream ss;
+		for(int n = 0; n != nrules; ++n) {
+			switch(n % 5) {
+				case 0: ss << ".c" << n << " { color: red; }\n"; break;
+				case 1: ss << "div .c" << n << " span { color: blue; }\n"; break;
+				case 2: ss << "#id" << n << " { margin-left: 1px; }\n"; break;
+				case 3: ss << "p.c" << n << " > em { color: green; }\n"; break;
+				case 4: ss << "ul li.c" << n << ", div + p { padding-top: 2px; }\n"; break;
+			}
+		}
+		ss << "p { color: black; }\n";
+		ss << "* { margin-top: 0px; }\n";
+		return ss.str();
+	}
+
+	std::string generate_document(int depth, int breadth, int nclasses, int* counter)
+	{
+		std::ostringstream ss;
+		for(int n = 0; n != breadth; ++n) {
+			const int id = (*counter)++;
+			static const char* const tags[] = { "div", "p", "span", "em", "ul", "li" };
+			const char* tag = tags[id % 6];
+			ss << "<" << tag << " id=\"id" << (id % (nclasses*2)) << "\" class=\"c" << (id % nclasses) << " c" << ((id*7) % nclasses) << "\">";
+			if(depth > 0) {
+				ss << generate_document(depth - 1, breadth, nclasses, counter);
+			} else {
+				ss << "text";
+			}
+			ss << "</" << tag << ">";
+		}
+		return ss.str();
+	}
+}
+
+UNIT_TEST(css_stylesheet_indexed_matches)
+{
+	auto ss = std::make_shared<css::StyleSheet>();
+	css::Parser::parse(ss, generate_stylesheet(50));
+	int counter = 0;
+	auto frag = xhtml::parse_from_string("<div>" + generate_document(3, 4, 50, &counter) + "</div>", nullptr);
+
+	// The indexed and filtered lookup should pick exactly the selectors that
+	// trying every rule in turn does.
+	css::AncestorFilter filter;
+	int nmatches = 0;
+	std::function<void(const xhtml::NodePtr&)> check = [&](const xhtml::NodePtr& n) {
+		if(n->id() == xhtml::NodeId::ELEMENT) {
+			std::vector<std::pair<css::CssRulePtr, css::SelectorPtr>> expected;
+			for(auto& r : ss->getRules()) {
 				for(auto& s : r->selectors) {
 					if(s->match(n)) {
-						//LOG_INFO("merge for node: " << n->toString() << ", selector: " << s->toString() << ", spec: " << s->getSpecificity()[0] << "," << s->getSpecificity()[1] << "," << s->getSpecificity()[2]);
-						n->mergeProperties(s->getSpecificity(), r->declaractions);
+						expected.emplace_back(r, s);
 						break;
 					}
-				}				
+				}
 			}
+			auto matches = ss->getMatches(n, &filter);
+			CHECK_EQ(matches.size(), expected.size());
+			CHECK_EQ(matches == expected, true);
+			nmatches += static_cast<int>(matches.size());
+		}
+		filter.pushElement(n);
+		for(auto& child : n->getChildren()) {
+			check(child);
 		}
+		filter.popElement();
+	};
+	check(frag);
+	CHECK_EQ(filter.empty(), true);
+	CHECK_GT(nmatches, 0);
+}
+
+BENCHMARK(css_style_large_document)
+{
+	auto ss = std::make_shared<css::StyleSheet>();
+	css::Parser::parse(ss, generate_stylesheet(1000));
+	int counter = 0;
+	auto frag = xhtml::parse_from_string("<div>" + generate_document(4, 6, 400, &counter) + "</div>", nullptr);
+	css::AncestorFilter filter;
+	BENCHMARK_LOOP {
+		style_tree(ss, filter, frag);
 	}
 }
@@ -23,6 +23,9 @@
 
 #pragma once
 
+#include <map>
+#include <unordered_map>
+
 #include "xhtml_fwd.hpp"
 #include "css_selector.hpp"
 #include "css_properties.hpp"
@@ -36,6 +39,30 @@ namespace css
 	};
 	typedef std::shared_ptr<CssRule> CssRulePtr;
 
+	// Counting bloom filter over the tags, ids and classes of the elements
+	// currently on the path from the root to the node being styled. Used
+	// to throw out selectors needing an ancestor that definitely isn't
+	// there without walking up the tree. Elements must be popped in the
+	// reverse order they were pushed.
+	class AncestorFilter
+	{
+	public:
+		AncestorFilter();
+		void pushElement(const xhtml::NodePtr& n);
+		void popElement();
+		bool mayContain(unsigned hash) const;
+		bool empty() const { return stack_.empty(); }
+
+		static unsigned hashTag(xhtml::ElementId tag);
+		static unsigned hashId(const std::string& id);
+		static unsigned hashClass(const std::string& class_name);
+	private:
+		enum { FilterBits = 12 };
+		std::vector<uint16_t> counts_;
+		std::vector<unsigned> hashes_;
+		std::vector<int> stack_;
+	};
+
 	class StyleSheet
 	{
 	public:
@@ -44,9 +71,33 @@ namespace css
 		std::string toString() const;
 
 		const std::vector<CssRulePtr>& getRules() const { return rules_; }
-		void applyRulesToElement(xhtml::NodePtr n);
+		// filter, if given, should hold the ancestors of n.
+		void applyRulesToElement(xhtml::NodePtr n, const AncestorFilter* filter=nullptr);
+		// Gets the selectors which match n in the order they are merged,
+		// with at most one per rule.
+		std::vector<std::pair<CssRulePtr, SelectorPtr>> getMatches(xhtml::NodePtr n, const AncestorFilter* filter=nullptr);
 	private:
+		// Rules are indexed by the rightmost simple selector of each of their
+		// selectors, so only those that could possibly match an element's
+		// id, classes or tag are ever tried against it.
+		struct IndexedSelector
+		{
+			int rule_index;
+			int selector_index;
+			std::vector<unsigned> ancestor_hashes;
+		};
+		typedef std::vector<IndexedSelector> IndexedSelectorList;
+		void indexSelector(int rule_index, int selector_index);
+		// Leaves the selectors which match n in matches_, in stylesheet order.
+		void findMatches(const xhtml::NodePtr& n, const AncestorFilter* filter);
+
 		std::vector<CssRulePtr> rules_;
+		std::unordered_map<std::string, IndexedSelectorList> id_rules_;
+		std::unordered_map<std::string, IndexedSelectorList> class_rules_;
+		std::map<xhtml::ElementId, IndexedSelectorList> tag_rules_;
+		IndexedSelectorList universal_rules_;
+		std::vector<const IndexedSelector*> matches_;
+		std::vector<std::string> class_names_;
 	};
 	typedef std::shared_ptr<StyleSheet> StyleSheetPtr;
 }
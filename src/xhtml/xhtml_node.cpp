@@ -121,7 +121,11 @@ namespace xhtml
 		  script_handler_(nullptr),
 		  active_handlers_(),
 		  mouse_entered_(false),
-		  style_node_()
+		  style_node_(),
+		  style_dirty_(true),
+		  descendants_dirty_(true),
+		  inline_style_(),
+		  inline_style_properties_()
 	{
 		active_handlers_.resize(static_cast<int>(EventHandlerId::MAX_EVENT_HANDLERS));
 	}
@@ -172,6 +176,7 @@ namespace xhtml
 			children_.emplace_back(child);
 			child->setParent(shared_from_this());
 		}
+		invalidateStyle();
 	}
 
 	void Node::removeChild(NodePtr child)
@@ -191,6 +196,7 @@ namespace xhtml
 				}
 			}			
 			child->left_ = child->right_ = std::weak_ptr<Node>();
+			invalidateStyle();
 		} else {
 			ASSERT_LOG(false, "Tried to remove child node which doesn't belong to us.");
 		}
@@ -200,11 +206,62 @@ namespace xhtml
 	{
 		a->setParent(shared_from_this());
 		attributes_[a->getName()] = a;
+		invalidateStyle();
 	}
 
 	void Node::setAttribute(const std::string& name, const std::string& value)
 	{
 		attributes_[name] = Attribute::create(name, value, getOwnerDoc());
+		invalidateStyle();
+	}
+
+	void Node::invalidateStyle()
+	{
+		style_dirty_ = true;
+
+		// '+' selectors can match on the element to the left, skipping
+		// over any text nodes in between.
+		auto right = getRight();
+		while(right != nullptr && right->id() != NodeId::ELEMENT) {
+			right = right->getRight();
+		}
+		if(right != nullptr) {
+			right->style_dirty_ = true;
+		}
+
+		for(auto parent = getParent(); parent != nullptr && !parent->descendants_dirty_; parent = parent->getParent()) {
+			parent->descendants_dirty_ = true;
+		}
+
+		auto owner = getOwnerDoc();
+		if(owner != nullptr) {
+			owner->triggerLayout();
+		}
+	}
+
+	void Node::restyleComplete()
+	{
+		if(!style_dirty_ && !descendants_dirty_) {
+			return;
+		}
+		style_dirty_ = descendants_dirty_ = false;
+		for(auto& c : children_) {
+			c->restyleComplete();
+		}
+	}
+
+	void Node::mergeInlineStyle()
+	{
+		auto attr = getAttribute("style");
+		if(attr == nullptr) {
+			return;
+		}
+		if(attr->getValue() != inline_style_) {
+			inline_style_ = attr->getValue();
+			inline_style_properties_ = css::Parser::parseDeclarationList(inline_style_);
+		}
+		css::Specificity specificity = {9999, 9999, 9999};
+		mergeProperties(specificity, inline_style_properties_);
 	}
 
 	bool Node::preOrderTraversal(std::function<bool(NodePtr)> fn) 
@@ -438,12 +495,14 @@ namespace xhtml
 			if((active_pclass_ & css::PseudoClass::FOCUS) != css::PseudoClass::FOCUS) {
 				active_pclass_ = active_pclass_ | css::PseudoClass::FOCUS;
 				getOwnerDoc()->setActiveElement(shared_from_this());
+				invalidateStyle();
 				*trigger = true;
 			}
 			return true;
 		} else if((active_pclass_ & css::PseudoClass::FOCUS) == css::PseudoClass::FOCUS) {
 			active_pclass_ = active_pclass_ & ~css::PseudoClass::FOCUS;
 			getOwnerDoc()->setActiveElement(nullptr);
+			invalidateStyle();
 			*trigger = true;
 		}
 
@@ -530,11 +589,13 @@ namespace xhtml
 		if(mouse_entered_) {
 			if((active_pclass_ & css::PseudoClass::HOVER) != css::PseudoClass::HOVER) {
 				active_pclass_ = active_pclass_ | css::PseudoClass::HOVER;
+				invalidateStyle();
 				*trigger = true;
 			}
 			return true;
 		} else if(mouse_left && (active_pclass_ & css::PseudoClass::HOVER) == css::PseudoClass::HOVER) {
 			active_pclass_ = active_pclass_ & ~css::PseudoClass::HOVER;
+			invalidateStyle();
 			*trigger = true;
 		}
 		return true;
@@ -726,6 +787,9 @@ namespace xhtml
 		  trigger_rebuild_(false),
 		  layout_x_(0),
 		  layout_y_(0),
+		  layout_(),
+		  layout_width_(-1),
+		  layout_height_(-1),
 		  active_element_(),
 		  event_listeners_()
 	{
@@ -762,39 +826,40 @@ namespace xhtml
 			return true;
 		});
 		
+		// new rules may match anything.
+		invalidateStyle();
+		triggerLayout();
 		processStyleRules();
 	}
 
 	void Document::processStyleRules()
 	{
+		// Only nodes marked dirty, and their descendants, are re-matched,
+		// everything else keeps the properties from the last time around.
+		// The filter tracks the ancestors of the node being styled, so it has
+		// to see every node on the way down, dirty or not.
 		auto& ss = style_sheet_;
-		preOrderTraversal([&ss](NodePtr n) {
-			ss->applyRulesToElement(n);
-			return true;
-		});
-
-		// Parse and apply specific element style rules from attributes here.
-		preOrderTraversal([](NodePtr n) {
-			if(n->id() == NodeId::ELEMENT) {
-				// XXX: we should cache this and only re-parse if it changes.
-				auto attr = n->getAttribute("style");
-				if(attr) {
-					auto plist = css::Parser::parseDeclarationList(attr->getValue());
-					css::Specificity specificity = {9999, 9999, 9999};
-					n->mergeProperties(specificity, plist);
-				}
+		css::AncestorFilter filter;
+		std::function<void(const NodePtr&, bool)> apply_rules = [&ss, &filter, &apply_rules](const NodePtr& n, bool force) {
+			force |= n->needsRestyle();
+			if(!force && !n->hasDirtyDescendants()) {
+				return;
 			}
-			return true;
-		});
-		
-		static bool marked_transtions = false;
-		if(!marked_transtions) {
-			//marked_transtions = true;
-			preOrderTraversal([](NodePtr n) {
+			if(force) {
+				ss->applyRulesToElement(n, &filter);
+				// Parse and apply specific element style rules from attributes here.
+				if(n->id() == NodeId::ELEMENT) {
+					n->mergeInlineStyle();
+				}
 				n->markTransitions();
-				return true;
-			});
-		}
+			}
+			filter.pushElement(n);
+			for(auto& child : n->getChildren()) {
+				apply_rules(child, force);
+			}
+			filter.popElement();
+		};
+		apply_rules(shared_from_this(), false);
 	}
 
 	void Document::enableDebug(int flags)
@@ -824,7 +889,13 @@ namespace xhtml
 			
 			clearEventListeners();
 
-			// XXX should we should have a re-process styles flag here.
+			// computed values may depend on the viewport size.
+			if(w != layout_width_ || h != layout_height_) {
+				layout_width_ = w;
+				layout_height_ = h;
+				invalidateStyle();
+			}
+
 			{
 #if defined(ENABLE_PROFILING)
 				profile::manager pman("apply styles");
@@ -842,17 +913,25 @@ namespace xhtml
 				} else {
 					style_tree->updateStyles();
 				}
+				restyleComplete();
 			}
 
 			{
 #if defined(ENABLE_PROFILING)
 				profile::manager pman("layout");
 #endif
+				// Layout always runs from the root. The LayoutEngine carries
+				// float and line state from box to box, so laying out just a
+				// dirty subtree would need that state saved per containing block.
 				layout = Box::createLayout(style_tree, w, h);
 			}
 
+			layout_ = layout;
 			triggerRender();
 			trigger_layout_ = false;
+		} else if(needsRender()) {
+			// only paint properties changed, so re-use the last layout.
+			layout = layout_;
 		}
 
 		if(needsRender() && layout != nullptr) {
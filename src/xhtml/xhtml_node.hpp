@@ -179,6 +179,17 @@ namespace xhtml
 
 		void clearProperties() { properties_.clear(); }
 		void inheritProperties();
+		// Merges the properties from the style attribute, which is only
+		// re-parsed when the attribute changes.
+		void mergeInlineStyle();
+
+		// Style invalidation. A dirty node, and everything below it, has
+		// its selectors re-matched and its styles recomputed on the next
+		// layout. Nodes start out dirty.
+		void invalidateStyle();
+		bool needsRestyle() const { return style_dirty_; }
+		bool hasDirtyDescendants() const { return descendants_dirty_; }
+		void restyleComplete();
 		
 		// for elements
 		const rect& getDimensions() { return dimensions_; }
@@ -239,6 +250,12 @@ namespace xhtml
 
 		// back reference to the tree node holding computer values for us.
 		WeakStyleNodePtr style_node_;
+
+		bool style_dirty_;
+		bool descendants_dirty_;
+
+		std::string inline_style_;
+		css::PropertyList inline_style_properties_;
 	};
 
 	class Document : public Node
@@ -289,6 +306,12 @@ namespace xhtml
 		int layout_x_;
 		int layout_y_;
 
+		// the last layout, kept so changes which only need a re-render
+		// don't have to lay the document out again.
+		RootBoxPtr layout_;
+		int layout_width_;
+		int layout_height_;
+
 		WeakNodePtr active_element_;
 		std::set<EventListenerPtr> event_listeners_;
 	};
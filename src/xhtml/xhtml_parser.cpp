@@ -160,3 +160,44 @@ UNIT_TEST(xhtml_node_tests)
 	frag->normalize();
 	LOG_DEBUG("children in fragment (after normalize): " << frag->getChildren().size());
 }
+
+UNIT_TEST(xhtml_style_invalidation)
+{
+	auto frag = xhtml::parse_from_string("<div><em>a</em><p>b</p><span>c</span></div>", nullptr);
+	auto div = frag->getChildren().front();
+	CHECK_EQ(div->getChildren().size(), 3);
+	auto em = div->getChildren()[0];
+	auto p = div->getChildren()[1];
+	auto span = div->getChildren()[2];
+
+	frag->restyleComplete();
+	CHECK_EQ(em->needsRestyle(), false);
+	CHECK_EQ(div->hasDirtyDescendants(), false);
+
+	em->setAttribute("class", "selected");
+	CHECK_EQ(em->needsRestyle(), true);
+	// p can be matched by "em + p".
+	CHECK_EQ(p->needsRestyle(), true);
+	CHECK_EQ(span->needsRestyle(), false);
+	CHECK_EQ(div->needsRestyle(), false);
+	CHECK_EQ(div->hasDirtyDescendants(), true);
+	CHECK_EQ(frag->hasDirtyDescendants(), true);
+
+	frag->restyleComplete();
+	CHECK_EQ(em->needsRestyle(), false);
+	CHECK_EQ(p->needsRestyle(), false);
+	CHECK_EQ(frag->hasDirtyDescendants(), false);
+
+	// "a + b" still matches with whitespace between the elements.
+	frag = xhtml::parse_from_string("<div><a/></div>", nullptr);
+	div = frag->getChildren().front();
+	div->addChild(xhtml::Text::create(" \n "));
+	div->addChild(xhtml::parse_from_string("<b/>", nullptr));
+	CHECK_EQ(div->getChildren().size(), 3);
+	auto a = div->getChildren()[0];
+	auto b = div->getChildren()[2];
+
+	frag->restyleComplete();
+	a->setAttribute("class", "selected");
+	CHECK_EQ(b->needsRestyle(), true);
+}
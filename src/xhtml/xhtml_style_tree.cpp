@@ -143,21 +143,31 @@ namespace xhtml
 		return true;
 	}
 
-	void StyleNode::updateStyles()
+	void StyleNode::updateStyles(bool force)
 	{
 		std::unique_ptr<RenderContext::Manager> rcm;
 		auto node = node_.lock();
 		if(node != nullptr) {
+			// computed values are inherited, so everything below a dirty
+			// node is recomputed too.
+			force |= node->needsRestyle();
+			if(!force && !node->hasDirtyDescendants()) {
+				return;
+			}
 			bool is_element = node->id() == NodeId::ELEMENT;
 			bool is_text = node->id() == NodeId::TEXT;
 			if(is_element || is_text) {
+				// clean ancestors still need to be on the context stack for
+				// their dirty descendants to inherit from.
 				rcm.reset(new RenderContext::Manager(node->getProperties()));
-				processStyles(false);
+				if(force) {
+					processStyles(false);
+				}
 			}
 		}
 
 		for(auto& child : getChildren()) {
-			child->updateStyles();
+			child->updateStyles(force);
 		}
 	}
 
@@ -149,7 +149,9 @@ namespace xhtml
 		// set properties. may trigger re-layout
 		void setPropertyFromString(css::Property p, const std::string& value);
 
-		void updateStyles();
+		// recomputes styles for nodes which have been invalidated, or for
+		// everything if force is set.
+		void updateStyles(bool force=false);
 		void inheritProperties(const StyleNodePtr& new_styles);
 	private:
 		void processStyles(bool created);